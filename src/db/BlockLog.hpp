@@ -0,0 +1,552 @@
+#ifndef CTRADING__DB__BLOCKLOG__HPP
+#define CTRADING__DB__BLOCKLOG__HPP
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <functional>
+
+#include "exceptions/Exception.hpp"
+#include "./Codec.hpp"
+
+
+// records are grouped in blocks of about 64 KiB, each one compressed on its
+// own and preceded by a header; a record never spans two blocks. Blocks are
+// listed in a sidecar index (path.index), rebuilt from the headers when
+// missing or behind, so that blocks can be decompressed in parallel, or
+// reached by timestamp for records having one (blocks are expected to be in
+// chronological order). A zstd dictionary is kept in path.dictionary.
+
+
+#pragma pack(push, 1)
+
+struct BlockLogBlockHeader {
+    uint32_t magic;
+    uint32_t raw_size;
+    uint32_t compressed_size;
+    uint32_t records_count;
+    double first_timestamp;
+    CodecType codec;
+};
+
+struct BlockLogBlock {
+    double first_timestamp;
+    uint64_t offset;
+    uint32_t records_count;
+    uint32_t raw_size;
+    uint32_t compressed_size;
+    CodecType codec;
+};
+
+#pragma pack(pop)
+
+// first written by GzipLog, hence its value
+static const uint32_t block_log_magic = 0x424c5a47; // "GZLB"
+
+
+// timestamp of records that have one
+template <typename T>
+inline auto block_log_timestamp(const T& item, int) -> decltype((double) item.timestamp) {
+    return item.timestamp;
+}
+template <typename T>
+inline const double block_log_timestamp(const T& item, long) {
+    return NAN;
+}
+
+
+// whether the file starts with a block; false for missing and empty files
+inline const bool block_log_is_block_file(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+    uint32_t magic = 0;
+    const bool result = fread(&magic, sizeof(magic), 1, file) == 1 && magic == block_log_magic;
+    fclose(file);
+    return result;
+}
+
+inline const bool block_log_is_empty_file(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        return true;
+    }
+    fseek(file, 0, SEEK_END);
+    const bool result = ftell(file) == 0;
+    fclose(file);
+    return result;
+}
+
+
+// complete blocks of a log, from its index and then its headers; when
+// repairing, what follows the last complete block is dropped, and the index
+// completed
+inline std::vector<BlockLogBlock> block_log_load_blocks(const std::string& path, const bool repair) {
+    std::vector<BlockLogBlock> blocks;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        if (repair && truncate((path + ".index").c_str(), 0) != 0 && errno != ENOENT) {
+            throw FileException("BlockLog could not truncate index", path + ".index", strerror(errno));
+        }
+        return blocks;
+    }
+    fseek(file, 0, SEEK_END);
+    const uint64_t file_size = ftell(file);
+    uint64_t size = 0;
+    FILE* index_file = fopen((path + ".index").c_str(), "rb");
+    if (index_file) {
+        BlockLogBlock block;
+        while (fread(&block, sizeof(block), 1, index_file) == 1 && block.offset == size && size + sizeof(BlockLogBlockHeader) + block.compressed_size <= file_size) {
+            blocks.push_back(block);
+            size += sizeof(BlockLogBlockHeader) + block.compressed_size;
+        }
+        fclose(index_file);
+    }
+    const size_t indexed_count = blocks.size();
+    BlockLogBlockHeader header;
+    fseek(file, size, SEEK_SET);
+    while (fread(&header, sizeof(header), 1, file) == 1 && header.magic == block_log_magic && size + sizeof(header) + header.compressed_size <= file_size) {
+        blocks.push_back({header.first_timestamp, size, header.records_count, header.raw_size, header.compressed_size, header.codec});
+        size += sizeof(header) + header.compressed_size;
+        fseek(file, size, SEEK_SET);
+    }
+    fclose(file);
+    if (repair) {
+        if (truncate(path.c_str(), size) != 0 || truncate((path + ".index").c_str(), indexed_count * sizeof(BlockLogBlock)) != 0 && errno != ENOENT) {
+            throw FileException("BlockLog could not truncate", path, strerror(errno));
+        }
+        if (blocks.size() > indexed_count) {
+            index_file = fopen((path + ".index").c_str(), "ab");
+            if (index_file == NULL || fwrite(&blocks[indexed_count], sizeof(BlockLogBlock), blocks.size() - indexed_count, index_file) != blocks.size() - indexed_count) {
+                throw FileException("BlockLog could not complete index", path + ".index", strerror(errno));
+            }
+            fclose(index_file);
+        }
+    }
+    return blocks;
+}
+
+// empty when there is none
+inline const std::string block_log_load_dictionary(const std::string& path) {
+    std::string dictionary;
+    FILE* file = fopen((path + ".dictionary").c_str(), "rb");
+    if (file == NULL) {
+        return dictionary;
+    }
+    char buffer[65536];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        dictionary.append(buffer, size);
+    }
+    fclose(file);
+    return dictionary;
+}
+
+
+// sealed blocks are compressed and written by a background thread when asked
+// to, so that appending only costs a copy; flush() waits for them
+class BlockLogWriter {
+public:
+
+    inline BlockLogWriter(const std::string& path, const Codec& codec=Codec(CODEC_ZLIB), const size_t block_size=65536, const bool background=true) :
+        _path(path),
+        _codec(codec),
+        _block_size(block_size),
+        _records_count(0),
+        _first_timestamp(NAN),
+        _is_writing(false),
+        _is_stopping(false),
+        _is_failed(false)
+    {
+        if (!block_log_is_empty_file(_path) && !block_log_is_block_file(_path)) {
+            throw FileException("BlockLogWriter cannot append to a file of another format", _path);
+        }
+        if (!_codec.get_dictionary().empty()) {
+            const std::string dictionary = block_log_load_dictionary(_path);
+            if (dictionary.empty() && !block_log_is_empty_file(_path)) {
+                throw FileException("BlockLogWriter cannot add a dictionary to blocks written without one", _path);
+            } else if (dictionary.empty()) {
+                FILE* dictionary_file = fopen((_path + ".dictionary").c_str(), "wb");
+                if (dictionary_file == NULL || fwrite(_codec.get_dictionary().data(), _codec.get_dictionary().size(), 1, dictionary_file) != 1 || fclose(dictionary_file) != 0) {
+                    throw FileException("BlockLogWriter could not write dictionary", _path + ".dictionary", strerror(errno));
+                }
+            } else if (dictionary != _codec.get_dictionary()) {
+                throw FileException("BlockLogWriter cannot change the dictionary of a log", _path);
+            }
+        }
+        const std::vector<BlockLogBlock> blocks = block_log_load_blocks(_path, true);
+        _file = fopen(_path.c_str(), "ab");
+        if (_file == NULL) {
+            throw FileException("Error while open file in append-only mode", _path, strerror(errno));
+        }
+        _index_file = fopen((_path + ".index").c_str(), "ab");
+        if (_index_file == NULL) {
+            throw FileException("Error while open file in append-only mode", _path + ".index", strerror(errno));
+        }
+        _offset = blocks.empty() ? 0 : blocks.back().offset + sizeof(BlockLogBlockHeader) + blocks.back().compressed_size;
+        _buffer.reserve(_block_size);
+        if (background) {
+            _thread = std::thread(&BlockLogWriter::run, this);
+        }
+    }
+    // errors of the last block are lost here; call flush() to get them
+    inline ~BlockLogWriter() {
+        try {
+            flush();
+        } catch (...) {}
+        if (_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _is_stopping = true;
+            }
+            _condition.notify_all();
+            _thread.join();
+        }
+        fclose(_file);
+        fclose(_index_file);
+    }
+
+    template <typename item_t>
+    inline void append(const item_t& item) {
+        if (_records_count == 0) {
+            _first_timestamp = block_log_timestamp(item, 0);
+        }
+        append((const char*) &item, sizeof(item));
+    }
+    inline void append(const char* item) {
+        append(item, strlen(item));
+    }
+    inline void append(const std::string& item) {
+        append(item.data(), item.size());
+    }
+
+    // the current block is written, even if incomplete, as well as the
+    // sealed ones
+    inline void flush() {
+        seal();
+        if (_thread.joinable()) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _written_condition.wait(lock, [this] {
+                return _queue.empty() && !_is_writing;
+            });
+        }
+        check();
+    }
+
+    inline const std::string& get_path() const {
+        return _path;
+    }
+    inline const Codec& get_codec() const {
+        return _codec;
+    }
+
+private:
+
+    struct SealedBlock {
+        std::string raw;
+        uint32_t records_count;
+        double first_timestamp;
+    };
+    // sealed blocks waiting for the background thread
+    static const size_t max_queue_size = 8;
+
+    inline void append(const char* data, const size_t size) {
+        _buffer.append(data, size);
+        ++_records_count;
+        if (_buffer.size() >= _block_size) {
+            seal();
+        }
+    }
+
+    inline void seal() {
+        if (_buffer.empty()) {
+            return;
+        }
+        SealedBlock block = {std::string(), _records_count, _first_timestamp};
+        block.raw.reserve(_block_size);
+        block.raw.swap(_buffer);
+        _records_count = 0;
+        _first_timestamp = NAN;
+        if (!_thread.joinable()) {
+            write(block);
+            return;
+        }
+        check();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _written_condition.wait(lock, [this] {
+                return _queue.size() < max_queue_size;
+            });
+            _queue.push_back(std::move(block));
+        }
+        _condition.notify_one();
+    }
+
+    inline void check() {
+        if (_is_failed) {
+            throw FileException("BlockLogWriter could not write block", _path, _error);
+        }
+    }
+
+    inline void write(const SealedBlock& sealed) {
+        _codec.compress(sealed.raw.data(), sealed.raw.size(), _compressed);
+        const size_t compressed_size = _compressed.size();
+        const BlockLogBlockHeader header = {block_log_magic, (uint32_t) sealed.raw.size(), (uint32_t) compressed_size, sealed.records_count, sealed.first_timestamp, _codec.get_type()};
+        const BlockLogBlock block = {sealed.first_timestamp, _offset, sealed.records_count, (uint32_t) sealed.raw.size(), (uint32_t) compressed_size, _codec.get_type()};
+        if (fwrite(&header, sizeof(header), 1, _file) != 1 || fwrite(_compressed.data(), compressed_size, 1, _file) != 1 || fflush(_file) != 0) {
+            throw FileException("Error while appending to file", _path, strerror(errno));
+        }
+        // the index only lists complete blocks
+        if (fwrite(&block, sizeof(block), 1, _index_file) != 1 || fflush(_index_file) != 0) {
+            throw FileException("Error while appending to file", _path + ".index", strerror(errno));
+        }
+        _offset += sizeof(header) + compressed_size;
+    }
+
+    // blocks are written in the order they were sealed; after a failure,
+    // the following ones are dropped
+    inline void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _condition.wait(lock, [this] {
+                return !_queue.empty() || _is_stopping;
+            });
+            if (_queue.empty()) {
+                return;
+            }
+            SealedBlock block = std::move(_queue.front());
+            _queue.pop_front();
+            _is_writing = true;
+            lock.unlock();
+            if (!_is_failed) {
+                try {
+                    write(block);
+                } catch (const Exception& exception) {
+                    _error = exception.what();
+                    _is_failed = true;
+                } catch (...) {
+                    _error = "unknown error";
+                    _is_failed = true;
+                }
+            }
+            lock.lock();
+            _is_writing = false;
+            _written_condition.notify_all();
+        }
+    }
+
+    const std::string _path;
+    Codec _codec;
+    const size_t _block_size;
+    FILE* _file;
+    FILE* _index_file;
+    uint64_t _offset;
+    // current block
+    std::string _buffer;
+    uint32_t _records_count;
+    double _first_timestamp;
+    std::string _compressed;
+    // background compression
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::condition_variable _written_condition;
+    std::deque<SealedBlock> _queue;
+    bool _is_writing;
+    bool _is_stopping;
+    std::atomic<bool> _is_failed;
+    std::string _error;
+};
+
+
+class BlockLogReader {
+public:
+
+    inline BlockLogReader(const std::string& path) :
+        _path(path),
+        _dictionary(block_log_load_dictionary(path)),
+        _codec(CODEC_NONE, 0, _dictionary),
+        _block_index(0),
+        _position(0)
+    {
+        _file = fopen(_path.c_str(), "rb");
+        if (_file == NULL) {
+            throw FileException("Error while open file in read-only mode", _path, strerror(errno));
+        }
+        _blocks = block_log_load_blocks(_path, false);
+    }
+    inline ~BlockLogReader() {
+        fclose(_file);
+    }
+
+    template <typename T>
+    inline const T next() {
+        T result;
+        next(result);
+        return result;
+    }
+    // number of bytes read, as gzread() does
+    template <typename T>
+    inline int next(T& item) {
+        size_t size = 0;
+        while (size < sizeof(T)) {
+            if (_position == _buffer.size()) {
+                if (_block_index >= _blocks.size()) {
+                    break;
+                }
+                load(_blocks[_block_index++], _buffer);
+                _position = 0;
+            }
+            const size_t chunk = std::min(sizeof(T) - size, _buffer.size() - _position);
+            memcpy((char*) &item + size, &_buffer[_position], chunk);
+            _position += chunk;
+            size += chunk;
+        }
+        return size;
+    }
+
+    // the next record read is the first one at or after the given timestamp
+    template <typename T>
+    inline void seek(const double timestamp) {
+        _block_index = find_block(timestamp);
+        _buffer.clear();
+        _position = 0;
+        while (_block_index < _blocks.size()) {
+            load(_blocks[_block_index++], _buffer);
+            for (_position=0; _position+sizeof(T)<=_buffer.size(); _position+=sizeof(T)) {
+                const T& item = * (const T*) &_buffer[_position];
+                if (block_log_timestamp(item, 0) >= timestamp) {
+                    return;
+                }
+            }
+        }
+    }
+
+    // records of the given period, in order; blocks are decompressed by the
+    // given number of threads
+    template <typename T>
+    inline void read(const double timestamp_begin, const double timestamp_end, std::function<void(const T&)> callback, size_t threads_count=0) {
+        if (threads_count == 0) {
+            threads_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+        size_t begin = find_block(timestamp_begin);
+        size_t end = begin;
+        while (end < _blocks.size() && _blocks[end].first_timestamp <= timestamp_end) {
+            ++end;
+        }
+        const size_t batch_size = 4 * threads_count;
+        std::vector<std::string> buffers(batch_size);
+        while (begin < end) {
+            const size_t count = std::min(batch_size, end - begin);
+            std::atomic<size_t> next(0);
+            // the first failure stops the workers, and is thrown once they
+            // are joined
+            std::atomic<bool> is_failed(false);
+            std::exception_ptr failure;
+            std::mutex failure_mutex;
+            auto decompress = [&] {
+                FILE* file = fopen(_path.c_str(), "rb");
+                try {
+                    if (file == NULL) {
+                        throw FileException("Error while open file in read-only mode", _path, strerror(errno));
+                    }
+                    std::string compressed;
+                    Codec codec(CODEC_NONE, 0, _dictionary);
+                    for (size_t i; !is_failed && (i = next++) < count; ) {
+                        load(_blocks[begin + i], buffers[i], file, compressed, codec);
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(failure_mutex);
+                    if (!is_failed) {
+                        failure = std::current_exception();
+                        is_failed = true;
+                    }
+                }
+                if (file) {
+                    fclose(file);
+                }
+            };
+            std::vector<std::thread> threads;
+            for (size_t t=1; t<std::min(threads_count, count); ++t) {
+                threads.emplace_back(decompress);
+            }
+            decompress();
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+            if (is_failed) {
+                std::rethrow_exception(failure);
+            }
+            for (size_t i=0; i<count; ++i) {
+                for (size_t position=0; position+sizeof(T)<=buffers[i].size(); position+=sizeof(T)) {
+                    const T& item = * (const T*) &buffers[i][position];
+                    const double timestamp = block_log_timestamp(item, 0);
+                    if (timestamp >= timestamp_begin && timestamp <= timestamp_end) {
+                        callback(item);
+                    }
+                }
+            }
+            begin += count;
+        }
+    }
+
+    inline const std::vector<BlockLogBlock>& get_blocks() const {
+        return _blocks;
+    }
+
+private:
+
+    // last block starting before the timestamp
+    inline const size_t find_block(const double timestamp) const {
+        auto it = std::upper_bound(_blocks.begin(), _blocks.end(), timestamp, [](const double timestamp, const BlockLogBlock& block) {
+            return timestamp < block.first_timestamp;
+        });
+        return (it == _blocks.begin()) ? 0 : (it - _blocks.begin() - 1);
+    }
+
+    inline void load(const BlockLogBlock& block, std::string& buffer) {
+        load(block, buffer, _file, _compressed, _codec);
+    }
+    inline void load(const BlockLogBlock& block, std::string& buffer, FILE* file, std::string& compressed, Codec& codec) {
+        compressed.resize(block.compressed_size);
+        if (fseek(file, block.offset + sizeof(BlockLogBlockHeader), SEEK_SET) != 0 || fread(&compressed[0], block.compressed_size, 1, file) != 1) {
+            throw FileException("Error while reading block", _path, block.offset);
+        }
+        codec.uncompress(block.codec, compressed.data(), compressed.size(), block.raw_size, buffer);
+    }
+
+    const std::string _path;
+    const std::string _dictionary;
+    Codec _codec;
+    FILE* _file;
+    std::vector<BlockLogBlock> _blocks;
+    size_t _block_index;
+    // current block
+    std::string _buffer;
+    size_t _position;
+    std::string _compressed;
+};
+
+
+struct BlockLog {
+    typedef BlockLogWriter Writer;
+    typedef BlockLogReader Reader;
+};
+
+
+#endif // CTRADING__DB__BLOCKLOG__HPP
@@ -0,0 +1,258 @@
+#ifndef CTRADING__DB__CODEC__HPP
+#define CTRADING__DB__CODEC__HPP
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <zlib.h>
+
+#ifdef CPPTRADING_LZ4
+#include <lz4.h>
+#endif
+#ifdef CPPTRADING_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include "exceptions/Exception.hpp"
+#include "./TradeCodec.hpp"
+
+
+// how a block of records is compressed; values are stored in files (zlib and
+// the trade codecs were the first ones, hence their values). LZ4 and zstd are
+// only available when compiled with CPPTRADING_LZ4 / CPPTRADING_ZSTD (and
+// linked with -llz4 / -lzstd)
+enum CodecType : uint8_t {
+    CODEC_ZLIB = 0,
+    CODEC_TRADES = 1,
+    CODEC_TRADES_ZLIB = 2,
+    CODEC_NONE = 3,
+    CODEC_LZ4 = 4,
+    CODEC_ZSTD = 5,
+};
+
+
+// compresses with its own type and level (0 for the codec's default), and
+// uncompresses blocks of any type; zstd may use a dictionary. An instance
+// keeps its contexts and buffers, and must not be shared between threads
+class Codec {
+public:
+
+    inline Codec(const CodecType type=CODEC_NONE, const int level=0, const std::string& dictionary="") :
+        _type(type),
+        _level(level),
+        _dictionary(dictionary)
+    {
+        if (!is_available(type)) {
+            throw Exception("Codec was not compiled in", (int) type);
+        }
+    }
+    // contexts are not shared
+    inline Codec(const Codec& other) :
+        Codec(other._type, other._level, other._dictionary) {}
+    inline Codec& operator = (const Codec& other) {
+        _type = other._type;
+        _level = other._level;
+        _dictionary = other._dictionary;
+        release();
+        return *this;
+    }
+    inline ~Codec() {
+        release();
+    }
+
+    static inline const bool is_available(const CodecType type) {
+        switch (type) {
+            case CODEC_NONE:
+            case CODEC_ZLIB:
+            case CODEC_TRADES:
+            case CODEC_TRADES_ZLIB:
+                return true;
+#ifdef CPPTRADING_LZ4
+            case CODEC_LZ4:
+                return true;
+#endif
+#ifdef CPPTRADING_ZSTD
+            case CODEC_ZSTD:
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+    inline const CodecType get_type() const {
+        return _type;
+    }
+    inline const std::string& get_dictionary() const {
+        return _dictionary;
+    }
+
+    inline void compress(const char* data, const size_t size, std::string& output) {
+        switch (_type) {
+            case CODEC_NONE:
+                output.assign(data, size);
+                return;
+            case CODEC_ZLIB:
+                compress_zlib(data, size, output);
+                return;
+            case CODEC_TRADES:
+                TradeCodec::encode(data, size, output);
+                return;
+            case CODEC_TRADES_ZLIB:
+                TradeCodec::encode(data, size, _buffer);
+                compress_zlib(_buffer.data(), _buffer.size(), output);
+                return;
+#ifdef CPPTRADING_LZ4
+            case CODEC_LZ4: {
+                output.resize(LZ4_compressBound(size));
+                const int result = LZ4_compress_fast(data, &output[0], size, output.size(), _level > 0 ? _level : 1);
+                if (result <= 0) {
+                    throw Exception("Codec could not compress with LZ4");
+                }
+                output.resize(result);
+                return;
+            }
+#endif
+#ifdef CPPTRADING_ZSTD
+            case CODEC_ZSTD: {
+                if (_zstd_compression == NULL) {
+                    _zstd_compression = ZSTD_createCCtx();
+                }
+                output.resize(ZSTD_compressBound(size));
+                const size_t result = ZSTD_compress_usingDict(_zstd_compression, &output[0], output.size(), data, size,
+                    _dictionary.data(), _dictionary.size(), _level ? _level : 3);
+                if (ZSTD_isError(result)) {
+                    throw Exception("Codec could not compress with zstd", ZSTD_getErrorName(result));
+                }
+                output.resize(result);
+                return;
+            }
+#endif
+            default:
+                throw Exception("Codec was not compiled in", (int) _type);
+        }
+    }
+
+    // the raw size is known from the block header
+    inline void uncompress(const CodecType type, const char* data, const size_t size, const size_t raw_size, std::string& output) {
+        switch (type) {
+            case CODEC_NONE:
+                output.assign(data, size);
+                break;
+            case CODEC_ZLIB:
+                uncompress_zlib(data, size, raw_size, output);
+                break;
+            case CODEC_TRADES:
+                TradeCodec::decode(data, size, output);
+                break;
+            case CODEC_TRADES_ZLIB:
+                // encoded trades are usually smaller than raw ones
+                uncompress_zlib(data, size, raw_size + 1024, _buffer, true);
+                TradeCodec::decode(_buffer.data(), _buffer.size(), output);
+                break;
+#ifdef CPPTRADING_LZ4
+            case CODEC_LZ4: {
+                output.resize(raw_size);
+                if (LZ4_decompress_safe(data, &output[0], size, raw_size) != (int) raw_size) {
+                    throw Exception("Codec could not uncompress with LZ4");
+                }
+                break;
+            }
+#endif
+#ifdef CPPTRADING_ZSTD
+            case CODEC_ZSTD: {
+                if (_zstd_decompression == NULL) {
+                    _zstd_decompression = ZSTD_createDCtx();
+                }
+                output.resize(raw_size);
+                const size_t result = ZSTD_decompress_usingDict(_zstd_decompression, &output[0], raw_size, data, size,
+                    _dictionary.data(), _dictionary.size());
+                if (ZSTD_isError(result)) {
+                    throw Exception("Codec could not uncompress with zstd", ZSTD_getErrorName(result));
+                }
+                break;
+            }
+#endif
+            default:
+                throw Exception("Codec was not compiled in", (int) type);
+        }
+        if (output.size() != raw_size) {
+            throw Exception("Codec found a block of unexpected size", output.size(), raw_size);
+        }
+    }
+
+#ifdef CPPTRADING_ZSTD
+    // dictionary for zstd, from samples of typical blocks (or records)
+    static inline const std::string train_dictionary(const std::vector<std::string>& samples, const size_t capacity=65536) {
+        std::string concatenated;
+        std::vector<size_t> sizes;
+        for (const std::string& sample : samples) {
+            concatenated += sample;
+            sizes.push_back(sample.size());
+        }
+        std::string dictionary(capacity, 0);
+        const size_t size = ZDICT_trainFromBuffer(&dictionary[0], capacity, concatenated.data(), sizes.data(), sizes.size());
+        if (ZDICT_isError(size)) {
+            throw Exception("Codec could not train dictionary", ZDICT_getErrorName(size));
+        }
+        dictionary.resize(size);
+        return dictionary;
+    }
+#endif
+
+private:
+
+    inline void compress_zlib(const char* data, const size_t size, std::string& output) {
+        uLongf compressed_size = compressBound(size);
+        output.resize(compressed_size);
+        if (::compress2((Bytef*) &output[0], &compressed_size, (const Bytef*) data, size, _level ? _level : Z_DEFAULT_COMPRESSION) != Z_OK) {
+            throw Exception("Codec could not compress with zlib");
+        }
+        output.resize(compressed_size);
+    }
+    // when the size is only a guess, the output grows as needed
+    inline void uncompress_zlib(const char* data, const size_t size, const size_t raw_size, std::string& output, const bool is_guess=false) {
+        output.resize(raw_size);
+        uLongf output_size = raw_size;
+        int result;
+        while ((result = ::uncompress((Bytef*) &output[0], &output_size, (const Bytef*) data, size)) == Z_BUF_ERROR && is_guess) {
+            output.resize(2 * output.size());
+            output_size = output.size();
+        }
+        if (result != Z_OK) {
+            throw Exception("Codec could not uncompress with zlib");
+        }
+        output.resize(output_size);
+    }
+
+    inline void release() {
+#ifdef CPPTRADING_ZSTD
+        if (_zstd_compression) {
+            ZSTD_freeCCtx(_zstd_compression);
+            _zstd_compression = NULL;
+        }
+        if (_zstd_decompression) {
+            ZSTD_freeDCtx(_zstd_decompression);
+            _zstd_decompression = NULL;
+        }
+#endif
+    }
+
+    CodecType _type;
+    int _level;
+    std::string _dictionary;
+    std::string _buffer;
+#ifdef CPPTRADING_ZSTD
+    ZSTD_CCtx* _zstd_compression = NULL;
+    ZSTD_DCtx* _zstd_decompression = NULL;
+#endif
+};
+
+
+#endif // CTRADING__DB__CODEC__HPP
@@ -2,95 +2,110 @@
 #define CTRADING__DB__GZIPLOG__HPP
 
 
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
 #include <string>
+#include <functional>
 
 #include <zlib.h>
-#include <string.h>
 
 #include "../exceptions/Exception.hpp"
+#include "./BlockLog.hpp"
 
 
-class GzipLogWriter {
-public:
+// a block log compressed with zlib by default (see BlockLog.hpp). Files
+// written by the former format (one gzip member per record) can still be
+// read sequentially.
 
-    inline GzipLogWriter(const std::string& path) :
-        _path(path),
-        _file(gzopen(path.c_str(), "ab"))
-    {
-        if (_file == Z_NULL) {
-            throw FileException("Error while open file in append-only mode", _path, strerror(errno));
-        }
-    }
-    inline ~GzipLogWriter() {
-        if (_file) {
-            gzclose(_file);
-        }
-    }
 
-    inline void check(int result) {
-        switch (result) {
-            case Z_ERRNO:
-                throw FileException("Error while appending to file", _path, strerror(errno));
-            case Z_STREAM_ERROR:
-                throw FileException("Error while appending to file", _path, "The stream is invalid, is not open for writing, or is in an invalid state.");
-            case Z_BUF_ERROR:
-                throw FileException("Error while appending to file", _path, "No compression progress is possible");
-            case Z_MEM_ERROR:
-                throw FileException("Error while appending to file", _path, "Insufficient memory available to compress.");
-        }
+inline const bool gzip_log_is_legacy(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        return false;
     }
+    unsigned char magic[2] = {0, 0};
+    const bool is_legacy = fread(magic, 2, 1, file) == 1 && magic[0] == 0x1f && magic[1] == 0x8b;
+    fclose(file);
+    return is_legacy;
+}
 
-    template <typename item_t>
-    inline void append(const item_t& item) {
-        check(gzwrite(_file, &item, sizeof(item)));
-        check(gzflush(_file, Z_FINISH));
-    }
-    inline void append(const char* item) {
-        check(gzputs(_file, item));
-        check(gzflush(_file, Z_FINISH));
-    }
-    inline void append(const std::string& item) {
-        check(gzwrite(_file, item.data(), item.size()));
-        check(gzflush(_file, Z_FINISH));
-    }
+
+class GzipLogWriter : public BlockLogWriter {
+public:
+
+    inline GzipLogWriter(const std::string& path, const size_t block_size=65536, const int level=Z_DEFAULT_COMPRESSION, const CodecType codec=CODEC_ZLIB, const bool background=true) :
+        BlockLogWriter(check(path), Codec(codec, level), block_size, background) {}
 
 private:
-    const std::string _path;
-    gzFile _file;
+
+    static inline const std::string& check(const std::string& path) {
+        if (gzip_log_is_legacy(path)) {
+            throw FileException("GzipLogWriter cannot append to a file of the former format", path);
+        }
+        return path;
+    }
+
 };
 
 
-class GzipLogReader {
+class GzipLogReader : public BlockLogReader {
 public:
 
     inline GzipLogReader(const std::string& path) :
+        BlockLogReader(path),
         _path(path),
-        _file(gzopen(path.c_str(), "rb"))
+        _legacy_file(Z_NULL)
     {
-        if (_file == Z_NULL) {
-            throw FileException("Error while open file in read-only mode", _path, strerror(errno));
+        if (gzip_log_is_legacy(_path)) {
+            _legacy_file = gzopen(path.c_str(), "rb");
+            if (_legacy_file == Z_NULL) {
+                throw FileException("Error while open file in read-only mode", _path, strerror(errno));
+            }
         }
     }
     inline ~GzipLogReader() {
-        if (_file) {
-            gzclose(_file);
+        if (_legacy_file) {
+            gzclose(_legacy_file);
         }
     }
 
     template <typename T>
     inline const T next() {
         T result;
-        gzread(_file, &result, sizeof(T));
+        next(result);
         return result;
     }
+    // number of bytes read, as gzread() does
     template <typename T>
     inline int next(T& item) {
-        return gzread(_file, &item, sizeof(T));
+        if (_legacy_file) {
+            return gzread(_legacy_file, &item, sizeof(T));
+        }
+        return BlockLogReader::next(item);
+    }
+
+    template <typename T>
+    inline void seek(const double timestamp) {
+        if (_legacy_file) {
+            throw FileException("GzipLogReader cannot seek in a file of the former format", _path);
+        }
+        BlockLogReader::seek<T>(timestamp);
+    }
+
+    template <typename T>
+    inline void read(const double timestamp_begin, const double timestamp_end, std::function<void(const T&)> callback, size_t threads_count=0) {
+        if (_legacy_file) {
+            throw FileException("GzipLogReader cannot seek in a file of the former format", _path);
+        }
+        BlockLogReader::read<T>(timestamp_begin, timestamp_end, callback, threads_count);
     }
 
 private:
+
     const std::string _path;
-    gzFile _file;
+    gzFile _legacy_file;
 };
 
 
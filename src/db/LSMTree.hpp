@@ -0,0 +1,871 @@
+#ifndef CTRADING__DB__LSMTREE__HPP
+#define CTRADING__DB__LSMTREE__HPP
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <experimental/filesystem>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include "exceptions/Exception.hpp"
+#include "range/Range.hpp"
+#include "IO/directories.hpp"
+
+
+// storage for records arriving in nearly sorted key order, e.g. by
+// timestamp. Inserts go to a write-ahead log and an in-memory buffer kept
+// sorted; full buffers are written as immutable sorted runs by a background
+// thread, which also merges the runs of a level into one run of the next
+// level once there are `fanout` of them. A run holds its records sorted by
+// key, a sparse index of their keys, and a bloom filter of their ids (for
+// records having one). Ranges read a snapshot of buffers and runs, merged by
+// key; records with equal keys come in the order they were inserted. Failures
+// of the background thread are retried with a growing delay, and thrown by
+// insert() and flush() meanwhile.
+
+
+// id of records that have one
+template <typename T>
+inline auto lsm_tree_id(const T& record, int) -> decltype((uint64_t) record.id) {
+    return record.id;
+}
+template <typename T>
+inline const uint64_t lsm_tree_id(const T& record, long) {
+    return 0;
+}
+
+// splitmix64
+inline const uint64_t lsm_tree_hash(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+
+#pragma pack(push, 1)
+
+template <typename key_t, typename record_t>
+struct LSMTreeEntry {
+    key_t key;
+    record_t record;
+};
+
+// followed by the entries, the keys of every index_interval-th entry, the
+// bloom filter, and (with the bloom filter) the lowest and highest ids of each
+// index_interval entries
+struct LSMTreeRunHeader {
+    uint32_t magic;
+    uint32_t level;
+    uint64_t sequence_min;
+    uint64_t sequence_max;
+    uint64_t count;
+    uint64_t index_interval;
+    uint64_t bloom_size; // in 64 bits words, 0 when records have no id
+    uint64_t id_min;
+    uint64_t id_max;
+};
+
+#pragma pack(pop)
+
+static const uint32_t lsm_tree_run_magic = 0x524d534c; // "LSMR"
+// about 1% of false positives with 10 bits per id
+static const size_t lsm_tree_bloom_bits_per_id = 10;
+static const size_t lsm_tree_bloom_hashes = 7;
+
+
+template <typename key_t, typename record_t>
+class LSMTreeRunWriter {
+public:
+
+    typedef LSMTreeEntry<key_t, record_t> Entry;
+
+    // entries must be appended in order
+    inline LSMTreeRunWriter(const std::string& path, const size_t count, const uint32_t level, const uint64_t sequence_min, const uint64_t sequence_max, const size_t index_interval) :
+        _path(path),
+        _header({lsm_tree_run_magic, level, sequence_min, sequence_max, 0, index_interval, 0, UINT64_MAX, 0})
+    {
+        _file = fopen((_path + ".tmp").c_str(), "wb");
+        if (_file == NULL) {
+            throw FileException("LSMTreeRunWriter could not open file for writing", _path + ".tmp", strerror(errno));
+        }
+        if (fwrite(&_header, sizeof(_header), 1, _file) != 1) {
+            fail();
+        }
+        _bloom.resize((std::max<size_t>(count, 1) * lsm_tree_bloom_bits_per_id + 63) / 64, 0);
+        _index.reserve(count / index_interval + 1);
+        _id_ranges.reserve(2 * (count / index_interval + 1));
+    }
+    inline ~LSMTreeRunWriter() {
+        if (_file != NULL) {
+            fclose(_file);
+            remove((_path + ".tmp").c_str());
+        }
+    }
+
+    inline void append(const Entry& entry) {
+        const uint64_t id = lsm_tree_id(entry.record, 0);
+        if (_header.count % _header.index_interval == 0) {
+            _index.push_back(entry.key);
+            _id_ranges.push_back(id);
+            _id_ranges.push_back(id);
+        } else {
+            _id_ranges[_id_ranges.size() - 2] = std::min(_id_ranges[_id_ranges.size() - 2], id);
+            _id_ranges.back() = std::max(_id_ranges.back(), id);
+        }
+        ++_header.count;
+        _header.id_min = std::min(_header.id_min, id);
+        _header.id_max = std::max(_header.id_max, id);
+        const uint64_t hash = lsm_tree_hash(id);
+        const uint64_t bits = 64 * _bloom.size();
+        for (size_t k=0; k<lsm_tree_bloom_hashes; ++k) {
+            const uint64_t bit = (hash + k * ((hash >> 32) | 1)) % bits;
+            _bloom[bit / 64] |= 1ULL << (bit % 64);
+        }
+        if (fwrite(&entry, sizeof(entry), 1, _file) != 1) {
+            fail();
+        }
+    }
+
+    // the run only appears once complete
+    inline void close() {
+        if (!has_id()) {
+            _bloom.clear();
+            _id_ranges.clear();
+        }
+        _header.bloom_size = _bloom.size();
+        if ((!_index.empty() && fwrite(_index.data(), sizeof(key_t), _index.size(), _file) != _index.size())
+            || (!_bloom.empty() && fwrite(_bloom.data(), sizeof(uint64_t), _bloom.size(), _file) != _bloom.size())
+            || (!_id_ranges.empty() && fwrite(_id_ranges.data(), sizeof(uint64_t), _id_ranges.size(), _file) != _id_ranges.size())
+            || fseek(_file, 0, SEEK_SET) != 0 || fwrite(&_header, sizeof(_header), 1, _file) != 1
+            || fflush(_file) != 0 || fsync(fileno(_file)) != 0) {
+            fail();
+        }
+        fclose(_file);
+        _file = NULL;
+        if (rename((_path + ".tmp").c_str(), _path.c_str()) != 0) {
+            throw FileException("LSMTreeRunWriter could not rename run", _path, strerror(errno));
+        }
+    }
+
+private:
+
+    template <typename T=record_t>
+    static inline auto has_id(int) -> decltype(((T*) NULL)->id, true) {
+        return true;
+    }
+    template <typename T=record_t>
+    static inline const bool has_id(long) {
+        return false;
+    }
+    static inline const bool has_id() {
+        return has_id(0);
+    }
+
+    inline void fail() {
+        throw FileException("LSMTreeRunWriter could not write run", _path + ".tmp", strerror(errno));
+    }
+
+    const std::string _path;
+    LSMTreeRunHeader _header;
+    FILE* _file;
+    std::vector<key_t> _index;
+    std::vector<uint64_t> _bloom;
+    std::vector<uint64_t> _id_ranges;
+};
+
+
+// a run mapped in memory; its file is deleted with it once merged
+template <typename key_t, typename record_t>
+class LSMTreeRun {
+public:
+
+    typedef LSMTreeEntry<key_t, record_t> Entry;
+
+    inline LSMTreeRun(const std::string& path) :
+        _path(path),
+        _is_obsolete(false)
+    {
+        const int fd = open(_path.c_str(), O_RDONLY);
+        struct stat s;
+        if (fd < 0 || fstat(fd, &s) != 0) {
+            throw FileException("LSMTreeRun could not open run", _path, strerror(errno));
+        }
+        _size = s.st_size;
+        _data = (const char*) mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (_data == MAP_FAILED) {
+            throw FileException("LSMTreeRun could not map run", _path, strerror(errno));
+        }
+        _header = (const LSMTreeRunHeader*) _data;
+        if (_size < sizeof(LSMTreeRunHeader) || _header->magic != lsm_tree_run_magic || _header->index_interval == 0
+            || _size != sizeof(LSMTreeRunHeader) + _header->count * sizeof(Entry) + get_index_size() * sizeof(key_t) + (_header->bloom_size + get_id_ranges_size()) * sizeof(uint64_t)) {
+            munmap((void*) _data, _size);
+            throw FileException("LSMTreeRun found an invalid run", _path);
+        }
+        _entries = (const Entry*) (_data + sizeof(LSMTreeRunHeader));
+        _index = (const key_t*) (_entries + _header->count);
+        _bloom = (const uint64_t*) (_index + get_index_size());
+        _id_ranges = _bloom + _header->bloom_size;
+    }
+    inline ~LSMTreeRun() {
+        munmap((void*) _data, _size);
+        if (_is_obsolete) {
+            remove(_path.c_str());
+        }
+    }
+
+    inline const LSMTreeRunHeader& get_header() const {
+        return *_header;
+    }
+    inline const Entry* begin() const {
+        return _entries;
+    }
+    inline const Entry* end() const {
+        return _entries + _header->count;
+    }
+
+    // first entry whose key is not lower (or, when strict, greater) than the
+    // given one, through the sparse index
+    inline const Entry* find(const key_t& key, const bool strict) const {
+        const key_t* index_end = _index + get_index_size();
+        const key_t* it = strict ? std::upper_bound(_index, index_end, key) : std::lower_bound(_index, index_end, key);
+        const size_t block = (it == _index) ? 0 : (it - _index - 1);
+        const Entry* first = _entries + block * _header->index_interval;
+        const Entry* last = std::min(first + _header->index_interval + 1, end());
+        if (strict) {
+            return std::upper_bound(first, last, key, [](const key_t& key, const Entry& entry) { return key < entry.key; });
+        }
+        return std::lower_bound(first, last, key, [](const Entry& entry, const key_t& key) { return entry.key < key; });
+    }
+
+    inline const bool may_contain_id(const uint64_t id) const {
+        if (_header->bloom_size == 0 || id < _header->id_min || id > _header->id_max) {
+            return _header->bloom_size == 0 && _header->count > 0;
+        }
+        const uint64_t hash = lsm_tree_hash(id);
+        const uint64_t bits = 64 * _header->bloom_size;
+        for (size_t k=0; k<lsm_tree_bloom_hashes; ++k) {
+            const uint64_t bit = (hash + k * ((hash >> 32) | 1)) % bits;
+            if (!(_bloom[bit / 64] & (1ULL << (bit % 64)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // ids are only nearly sorted along keys (trades arrive late), so only
+    // the groups of index_interval entries whose id range holds the id are
+    // scanned, rather than the whole run
+    inline void get_by_id(const uint64_t id, std::vector<record_t>& result) const {
+        if (!may_contain_id(id)) {
+            return;
+        }
+        const size_t blocks_count = get_id_ranges_size() ? get_index_size() : 1;
+        for (size_t block=0; block<blocks_count; ++block) {
+            if (get_id_ranges_size() && (id < _id_ranges[2 * block] || id > _id_ranges[2 * block + 1])) {
+                continue;
+            }
+            const Entry* first = get_id_ranges_size() ? (_entries + block * _header->index_interval) : begin();
+            const Entry* last = get_id_ranges_size() ? std::min(first + _header->index_interval, end()) : end();
+            for (const Entry* entry=first; entry!=last; ++entry) {
+                if (lsm_tree_id(entry->record, 0) == id) {
+                    result.push_back(entry->record);
+                }
+            }
+        }
+    }
+
+    inline void mark_obsolete() {
+        _is_obsolete = true;
+    }
+
+private:
+
+    inline const size_t get_index_size() const {
+        return (_header->count + _header->index_interval - 1) / _header->index_interval;
+    }
+    inline const size_t get_id_ranges_size() const {
+        return _header->bloom_size ? 2 * get_index_size() : 0;
+    }
+
+    const std::string _path;
+    const char* _data;
+    size_t _size;
+    const LSMTreeRunHeader* _header;
+    const Entry* _entries;
+    const key_t* _index;
+    const uint64_t* _bloom;
+    const uint64_t* _id_ranges;
+    bool _is_obsolete;
+};
+
+
+// records being buffered, with their write-ahead log
+template <typename key_t, typename record_t>
+struct LSMTreeBuffer {
+    typedef LSMTreeEntry<key_t, record_t> Entry;
+
+    uint64_t sequence;
+    std::vector<Entry> entries;
+    FILE* wal;
+
+    inline ~LSMTreeBuffer() {
+        if (wal != NULL) {
+            fclose(wal);
+        }
+    }
+
+    // nearly sorted keys are mostly appended
+    inline void insert(const Entry& entry) {
+        if (entries.empty() || !(entry.key < entries.back().key)) {
+            entries.push_back(entry);
+        } else {
+            entries.insert(std::upper_bound(entries.begin(), entries.end(), entry.key, [](const key_t& key, const Entry& entry) {
+                return key < entry.key;
+            }), entry);
+        }
+    }
+};
+
+
+template <typename key_t, typename record_t>
+class LSMTreeRangeData : public RangeData<record_t> {
+public:
+
+    typedef LSMTreeEntry<key_t, record_t> Entry;
+    typedef std::pair<const Entry*, const Entry*> Source;
+
+    // sources are ordered from the oldest to the newest, and kept alive by
+    // the snapshot
+    inline LSMTreeRangeData(const std::vector<Source>& sources, const std::shared_ptr<void>& snapshot) :
+        _sources(sources),
+        _snapshot(snapshot) {}
+
+    virtual const bool init(record_t*& value) {
+        value = &_record;
+        return next(value);
+    }
+    virtual const bool next(record_t*& value) {
+        Source* best = NULL;
+        for (Source& source : _sources) {
+            if (source.first != source.second && (best == NULL || source.first->key < best->first->key)) {
+                best = &source;
+            }
+        }
+        if (best == NULL) {
+            return false;
+        }
+        memcpy((void*) &_record, &best->first->record, sizeof(record_t));
+        ++best->first;
+        return true;
+    }
+
+private:
+
+    std::vector<Source> _sources;
+    std::shared_ptr<void> _snapshot;
+    record_t _record;
+};
+
+template <typename key_t, typename record_t>
+class LSMTreeRange : public Range<record_t> {
+public:
+
+    LSMTreeRange(const std::vector<std::pair<const LSMTreeEntry<key_t, record_t>*, const LSMTreeEntry<key_t, record_t>*>>& sources, const std::shared_ptr<void>& snapshot) :
+        Range<record_t>(new LSMTreeRangeData<key_t, record_t>(sources, snapshot)) {}
+
+};
+
+
+template <typename key_t, typename record_t>
+class LSMTree {
+public:
+
+    typedef LSMTreeEntry<key_t, record_t> Entry;
+    typedef LSMTreeRun<key_t, record_t> Run;
+    typedef LSMTreeBuffer<key_t, record_t> Buffer;
+
+    // path is a directory; buffer_size is in records
+    inline LSMTree(const std::string& path, const size_t buffer_size=1<<16, const size_t fanout=4, const size_t index_interval=64) :
+        _path(path),
+        _buffer_size(buffer_size),
+        _fanout(fanout),
+        _index_interval(index_interval),
+        _sequence(0),
+        _is_working(false),
+        _is_stopping(false),
+        _is_failed(false)
+    {
+        make_directory(_path);
+        load();
+        _thread = std::thread(&LSMTree::run, this);
+    }
+    // buffered records stay in their write-ahead logs until reopened
+    inline ~LSMTree() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _is_stopping = true;
+        }
+        _condition.notify_all();
+        _thread.join();
+    }
+
+    inline const std::string& get_path() const {
+        return _path;
+    }
+
+    inline void insert(const key_t& key, const record_t& record) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        check();
+        Entry entry;
+        memcpy((void*) &entry.key, &key, sizeof(key_t));
+        memcpy((void*) &entry.record, &record, sizeof(record_t));
+        if (fwrite(&entry, sizeof(entry), 1, _buffer->wal) != 1 || fflush(_buffer->wal) != 0) {
+            throw FileException("LSMTree could not append to write-ahead log", _path, strerror(errno));
+        }
+        _buffer->insert(entry);
+        if (_buffer->entries.size() >= _buffer_size) {
+            seal();
+            lock.unlock();
+            _condition.notify_all();
+        }
+    }
+
+    // buffered records are written as runs
+    inline void flush() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_buffer->entries.empty()) {
+            seal();
+            _condition.notify_all();
+        }
+        _done_condition.wait(lock, [this] {
+            return _immutables.empty() || _is_failed;
+        });
+        check();
+    }
+    // as well as pending merges
+    inline void compact() {
+        flush();
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done_condition.wait(lock, [this] {
+            return (_immutables.empty() && !_is_working && get_merge_level() < 0) || _is_failed;
+        });
+        check();
+    }
+
+    inline LSMTreeRange<key_t, record_t> get() {
+        return get(NULL, NULL, false);
+    }
+    inline LSMTreeRange<key_t, record_t> get(const key_t& key_target) {
+        return get(&key_target, &key_target, false);
+    }
+    // keys in ]key_begin, key_end], as with UpscaleBTree
+    inline LSMTreeRange<key_t, record_t> get(const key_t& key_begin, const key_t& key_end) {
+        return get(&key_begin, &key_end, !(key_begin == key_end));
+    }
+
+    inline const bool contains(const key_t& searched_key) {
+        return count(searched_key, true);
+    }
+    inline const size_t count(const key_t& searched_key, const bool& stop_at_first=false) {
+        size_t count = 0;
+        for (const record_t& record : get(searched_key)) {
+            if (++count && stop_at_first) {
+                break;
+            }
+        }
+        return count;
+    }
+    inline const size_t count(const key_t& searched_key, const record_t& searched_record, const bool& stop_at_first=false) {
+        size_t count = 0;
+        for (const record_t& record : get(searched_key)) {
+            if (memcmp(&record, &searched_record, sizeof(record_t)) == 0 && ++count && stop_at_first) {
+                break;
+            }
+        }
+        return count;
+    }
+
+    // records with the given id, skipping runs through their bloom filters
+    // and parts of runs through their id ranges; buffers are scanned
+    inline std::vector<record_t> get_by_id(const uint64_t id) {
+        std::vector<record_t> result;
+        std::vector<std::shared_ptr<Run>> runs;
+        std::vector<std::shared_ptr<Buffer>> immutables;
+        std::vector<Entry> buffered;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            runs = _runs;
+            immutables.assign(_immutables.begin(), _immutables.end());
+            for (const Entry& entry : _buffer->entries) {
+                if (lsm_tree_id(entry.record, 0) == id) {
+                    buffered.push_back(entry);
+                }
+            }
+        }
+        for (const std::shared_ptr<Run>& run : runs) {
+            run->get_by_id(id, result);
+        }
+        for (const std::shared_ptr<Buffer>& immutable : immutables) {
+            for (const Entry& entry : immutable->entries) {
+                if (lsm_tree_id(entry.record, 0) == id) {
+                    result.push_back(entry.record);
+                }
+            }
+        }
+        for (const Entry& entry : buffered) {
+            result.push_back(entry.record);
+        }
+        return result;
+    }
+
+    inline const key_t get_extremum_key(const bool is_lowest) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const Entry* result = NULL;
+        auto consider = [&](const Entry* begin, const Entry* end) {
+            if (begin != end) {
+                const Entry* entry = is_lowest ? begin : (end - 1);
+                if (result == NULL || (is_lowest ? (entry->key < result->key) : (result->key < entry->key))) {
+                    result = entry;
+                }
+            }
+        };
+        for (const std::shared_ptr<Run>& run : _runs) {
+            consider(run->begin(), run->end());
+        }
+        for (const std::shared_ptr<Buffer>& immutable : _immutables) {
+            consider(immutable->entries.data(), immutable->entries.data() + immutable->entries.size());
+        }
+        consider(_buffer->entries.data(), _buffer->entries.data() + _buffer->entries.size());
+        if (result == NULL) {
+            throw DBKeyException("LSMTree is empty", _path);
+        }
+        return result->key;
+    }
+    inline const key_t get_lowest_key() {
+        return get_extremum_key(true);
+    }
+    inline const key_t get_highest_key() {
+        return get_extremum_key(false);
+    }
+
+    inline const size_t get_runs_count() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _runs.size();
+    }
+
+private:
+
+    struct Snapshot {
+        std::vector<std::shared_ptr<Run>> runs;
+        std::vector<std::shared_ptr<Buffer>> immutables;
+        std::vector<Entry> buffered;
+    };
+
+    inline LSMTreeRange<key_t, record_t> get(const key_t* key_begin, const key_t* key_end, const bool is_begin_excluded) {
+        std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+        std::vector<std::pair<const Entry*, const Entry*>> sources;
+        auto slice = [&](const Entry* begin, const Entry* end) {
+            if (key_begin) {
+                begin = is_begin_excluded
+                    ? std::upper_bound(begin, end, *key_begin, [](const key_t& key, const Entry& entry) { return key < entry.key; })
+                    : std::lower_bound(begin, end, *key_begin, [](const Entry& entry, const key_t& key) { return entry.key < key; });
+                end = std::upper_bound(begin, end, *key_end, [](const key_t& key, const Entry& entry) { return key < entry.key; });
+            }
+            return std::make_pair(begin, end);
+        };
+        std::lock_guard<std::mutex> lock(_mutex);
+        snapshot->runs = _runs;
+        for (const std::shared_ptr<Run>& run : _runs) {
+            const Entry* begin = key_begin ? run->find(*key_begin, is_begin_excluded) : run->begin();
+            sources.push_back(slice(begin, run->end()));
+        }
+        snapshot->immutables.assign(_immutables.begin(), _immutables.end());
+        for (const std::shared_ptr<Buffer>& immutable : _immutables) {
+            sources.push_back(slice(immutable->entries.data(), immutable->entries.data() + immutable->entries.size()));
+        }
+        // the current buffer keeps changing
+        const std::pair<const Entry*, const Entry*> buffered = slice(_buffer->entries.data(), _buffer->entries.data() + _buffer->entries.size());
+        snapshot->buffered.assign(buffered.first, buffered.second);
+        sources.push_back({snapshot->buffered.data(), snapshot->buffered.data() + snapshot->buffered.size()});
+        return LSMTreeRange<key_t, record_t>(sources, snapshot);
+    }
+
+    inline const std::string get_run_path(const uint32_t level, const uint64_t sequence) const {
+        return _path + "/run-" + std::to_string(level) + '-' + std::to_string(sequence);
+    }
+    inline const std::string get_wal_path(const uint64_t sequence) const {
+        return _path + "/wal-" + std::to_string(sequence);
+    }
+
+    // runs, and buffers from write-ahead logs that were not written as runs
+    inline void load() {
+        std::vector<std::string> run_paths;
+        std::map<uint64_t, std::string> wal_paths;
+        for (auto& p : std::experimental::filesystem::directory_iterator(_path)) {
+            const std::string name = p.path().filename().string();
+            uint32_t level;
+            uint64_t sequence;
+            char end;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+                remove(p.path().c_str());
+            } else if (sscanf(name.c_str(), "run-%u-%lu%c", &level, &sequence, &end) == 2) {
+                run_paths.push_back(p.path().string());
+            } else if (sscanf(name.c_str(), "wal-%lu%c", &sequence, &end) == 1) {
+                wal_paths[sequence] = p.path().string();
+            }
+        }
+        for (const std::string& run_path : run_paths) {
+            _runs.push_back(std::make_shared<Run>(run_path));
+        }
+        // a merge may have been interrupted before its inputs were removed
+        std::vector<std::shared_ptr<Run>> runs;
+        for (const std::shared_ptr<Run>& run : _runs) {
+            const bool is_covered = std::any_of(_runs.begin(), _runs.end(), [&](const std::shared_ptr<Run>& other) {
+                return other != run && other->get_header().level > run->get_header().level
+                    && other->get_header().sequence_min <= run->get_header().sequence_min
+                    && other->get_header().sequence_max >= run->get_header().sequence_max;
+            });
+            if (is_covered) {
+                run->mark_obsolete();
+            } else {
+                runs.push_back(run);
+                _sequence = std::max(_sequence, run->get_header().sequence_max + 1);
+            }
+        }
+        _runs = runs;
+        sort_runs();
+        for (const auto& it : wal_paths) {
+            const uint64_t sequence = it.first;
+            const bool is_written = std::any_of(_runs.begin(), _runs.end(), [&](const std::shared_ptr<Run>& run) {
+                return run->get_header().sequence_min <= sequence && run->get_header().sequence_max >= sequence;
+            });
+            std::shared_ptr<Buffer> buffer(new Buffer{sequence, {}, NULL});
+            FILE* file = is_written ? NULL : fopen(it.second.c_str(), "rb");
+            if (file != NULL) {
+                Entry entry;
+                while (fread(&entry, sizeof(entry), 1, file) == 1) {
+                    buffer->insert(entry);
+                }
+                fclose(file);
+            }
+            if (buffer->entries.empty()) {
+                remove(it.second.c_str());
+            } else {
+                buffer->wal = fopen(it.second.c_str(), "ab");
+                _immutables.push_back(buffer);
+            }
+            _sequence = std::max(_sequence, sequence + 1);
+        }
+        _buffer = make_buffer();
+    }
+
+    inline std::shared_ptr<Buffer> make_buffer() {
+        const uint64_t sequence = _sequence++;
+        std::shared_ptr<Buffer> buffer(new Buffer{sequence, {}, fopen(get_wal_path(sequence).c_str(), "ab")});
+        if (buffer->wal == NULL) {
+            throw FileException("LSMTree could not open write-ahead log", get_wal_path(sequence), strerror(errno));
+        }
+        buffer->entries.reserve(_buffer_size);
+        return buffer;
+    }
+
+    // the lock must be held
+    inline void check() {
+        if (_is_failed) {
+            throw FileException("LSMTree could not write run", _path, _error);
+        }
+    }
+    inline void fail(const std::string& error) {
+        _error = error;
+        _is_failed = true;
+        _done_condition.notify_all();
+    }
+
+    // the lock must be held
+    inline void seal() {
+        _immutables.push_back(_buffer);
+        _buffer = make_buffer();
+    }
+    inline void sort_runs() {
+        std::sort(_runs.begin(), _runs.end(), [](const std::shared_ptr<Run>& a, const std::shared_ptr<Run>& b) {
+            return a->get_header().sequence_min < b->get_header().sequence_min;
+        });
+    }
+    // lowest level with enough runs to be merged, or -1
+    inline const int get_merge_level() const {
+        std::map<uint32_t, size_t> counts;
+        for (const std::shared_ptr<Run>& run : _runs) {
+            if (++counts[run->get_header().level] >= _fanout) {
+                return run->get_header().level;
+            }
+        }
+        return -1;
+    }
+
+    // background work: buffers are written first; when stopping, runs are
+    // not merged any more. Failures are retried after a delay, doubled up to
+    // a second while they go on
+    inline void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::chrono::milliseconds backoff(10);
+        auto wait_backoff = [&] {
+            _condition.wait_for(lock, backoff, [this] {
+                return _is_stopping;
+            });
+            backoff = std::min(2 * backoff, std::chrono::milliseconds(1000));
+        };
+        while (true) {
+            _condition.wait(lock, [this] {
+                return _is_stopping || !_immutables.empty() || get_merge_level() >= 0;
+            });
+            if (!_immutables.empty()) {
+                const std::shared_ptr<Buffer> buffer = _immutables.front();
+                _is_working = true;
+                lock.unlock();
+                std::shared_ptr<Run> run;
+                std::string error;
+                try {
+                    run = write(buffer);
+                } catch (const Exception& exception) {
+                    error = exception.what();
+                } catch (...) {
+                    error = "unknown error";
+                }
+                lock.lock();
+                _is_working = false;
+                if (run) {
+                    _runs.push_back(run);
+                    sort_runs();
+                    _immutables.pop_front();
+                    fclose(buffer->wal);
+                    buffer->wal = NULL;
+                    remove(get_wal_path(buffer->sequence).c_str());
+                    _is_failed = false;
+                    backoff = std::chrono::milliseconds(10);
+                } else if (_is_stopping) {
+                    break;
+                } else {
+                    fail(error);
+                    wait_backoff();
+                }
+                _done_condition.notify_all();
+                continue;
+            }
+            if (_is_stopping) {
+                break;
+            }
+            const int level = get_merge_level();
+            std::vector<std::shared_ptr<Run>> inputs;
+            for (const std::shared_ptr<Run>& run : _runs) {
+                if ((int) run->get_header().level == level && inputs.size() < _fanout) {
+                    inputs.push_back(run);
+                }
+            }
+            _is_working = true;
+            lock.unlock();
+            std::shared_ptr<Run> output;
+            std::string error;
+            try {
+                output = merge(inputs, level + 1);
+            } catch (const Exception& exception) {
+                error = exception.what();
+            } catch (...) {
+                error = "unknown error";
+            }
+            lock.lock();
+            _is_working = false;
+            if (output) {
+                for (const std::shared_ptr<Run>& input : inputs) {
+                    input->mark_obsolete();
+                    _runs.erase(std::find(_runs.begin(), _runs.end(), input));
+                }
+                _runs.push_back(output);
+                sort_runs();
+                _is_failed = false;
+                backoff = std::chrono::milliseconds(10);
+            } else {
+                fail(error);
+                wait_backoff();
+            }
+            _done_condition.notify_all();
+        }
+        _done_condition.notify_all();
+    }
+
+    inline std::shared_ptr<Run> write(const std::shared_ptr<Buffer>& buffer) {
+        const std::string path = get_run_path(0, buffer->sequence);
+        LSMTreeRunWriter<key_t, record_t> writer(path, buffer->entries.size(), 0, buffer->sequence, buffer->sequence, _index_interval);
+        for (const Entry& entry : buffer->entries) {
+            writer.append(entry);
+        }
+        writer.close();
+        return std::make_shared<Run>(path);
+    }
+
+    // inputs are ordered from the oldest; so are entries with equal keys
+    inline std::shared_ptr<Run> merge(const std::vector<std::shared_ptr<Run>>& inputs, const uint32_t level) {
+        size_t count = 0;
+        std::vector<std::pair<const Entry*, const Entry*>> sources;
+        for (const std::shared_ptr<Run>& input : inputs) {
+            count += input->get_header().count;
+            sources.push_back({input->begin(), input->end()});
+        }
+        const std::string path = get_run_path(level, inputs.back()->get_header().sequence_max);
+        LSMTreeRunWriter<key_t, record_t> writer(path, count, level, inputs.front()->get_header().sequence_min, inputs.back()->get_header().sequence_max, _index_interval);
+        while (true) {
+            std::pair<const Entry*, const Entry*>* best = NULL;
+            for (auto& source : sources) {
+                if (source.first != source.second && (best == NULL || source.first->key < best->first->key)) {
+                    best = &source;
+                }
+            }
+            if (best == NULL) {
+                break;
+            }
+            writer.append(*best->first++);
+        }
+        writer.close();
+        return std::make_shared<Run>(path);
+    }
+
+    const std::string _path;
+    const size_t _buffer_size;
+    const size_t _fanout;
+    const size_t _index_interval;
+    uint64_t _sequence;
+    // runs are ordered from the oldest, as are buffers
+    std::vector<std::shared_ptr<Run>> _runs;
+    std::deque<std::shared_ptr<Buffer>> _immutables;
+    std::shared_ptr<Buffer> _buffer;
+    // background work
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::condition_variable _done_condition;
+    bool _is_working;
+    bool _is_stopping;
+    // last failure of the background thread, until it succeeds again
+    bool _is_failed;
+    std::string _error;
+};
+
+
+#endif // CTRADING__DB__LSMTREE__HPP
@@ -0,0 +1,479 @@
+#ifndef CTRADING__DB__ORDERBOOKLOG__HPP
+#define CTRADING__DB__ORDERBOOKLOG__HPP
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include <zlib.h>
+
+#include "exceptions/Exception.hpp"
+#include "IO/directories.hpp"
+#include "models/Order.hpp"
+#include "sources/OrderBook.hpp"
+
+
+// the log is made of three files in a directory:
+// - deltas: every OrderBookEvent, in order; as the timestamps of the orders
+//   themselves are not monotonic, events are dated by the latest of them
+// - snapshots: from time to time, every live order (zlib-compressed), after
+//   a header giving the number of deltas already applied
+// - index: where each snapshot is, by timestamp
+// the book at a given instant is rebuilt from the latest snapshot before it,
+// and the few deltas in between
+
+
+enum OrderBookEventType : uint8_t {
+    ORDER_BOOK_UPDATE = 1,
+    ORDER_BOOK_DELETION = 2,
+};
+
+#pragma pack(push, 1)
+
+struct OrderBookEvent {
+
+    inline void apply(OrderBook& book) const {
+        if (type == ORDER_BOOK_DELETION) {
+            book.puke(order);
+        } else {
+            book.feed(order);
+        }
+    }
+
+    double timestamp;
+    Order order;
+    OrderBookEventType type;
+};
+
+struct OrderBookSnapshotHeader {
+    double timestamp;
+    uint64_t deltas_count;
+    uint32_t orders_count;
+    uint32_t compressed_size;
+};
+
+struct OrderBookIndexEntry {
+    double timestamp;
+    uint64_t snapshot_offset;
+    uint64_t deltas_count;
+};
+
+#pragma pack(pop)
+
+
+class OrderBookLogReader {
+public:
+
+    inline OrderBookLogReader(const std::string& path) :
+        _path(path),
+        _index_size(0) {
+        refresh();
+    }
+
+    // take into account what was appended since
+    inline void refresh() {
+        FILE* file = fopen((_path + "/index").c_str(), "rb");
+        if (file == NULL) {
+            return;
+        }
+        fseek(file, _index_size, SEEK_SET);
+        OrderBookIndexEntry entry;
+        while (fread(&entry, sizeof(entry), 1, file) == 1) {
+            _index.push_back(entry);
+            _index_size += sizeof(entry);
+        }
+        fclose(file);
+    }
+
+    // book as it was at the given instant: one snapshot, and the deltas since
+    inline void load(const double timestamp, OrderBook& book) {
+        book.clear();
+        const OrderBookIndexEntry* entry = find_snapshot(timestamp);
+        uint64_t deltas_count = 0;
+        if (entry) {
+            load_snapshot(*entry, book);
+            deltas_count = entry->deltas_count;
+        }
+        read_deltas(deltas_count, [&](const OrderBookEvent& event) {
+            if (event.timestamp > timestamp) {
+                return false;
+            }
+            event.apply(book);
+            return true;
+        });
+    }
+
+    // step through the events of the given period, with the book they lead to
+    inline void replay(const double timestamp_begin, const double timestamp_end, OrderBook& book, std::function<void(const OrderBookEvent&, const OrderBook&)> callback) {
+        book.clear();
+        const OrderBookIndexEntry* entry = find_snapshot(timestamp_begin);
+        uint64_t deltas_count = 0;
+        if (entry) {
+            load_snapshot(*entry, book);
+            deltas_count = entry->deltas_count;
+        }
+        read_deltas(deltas_count, [&](const OrderBookEvent& event) {
+            if (event.timestamp > timestamp_end) {
+                return false;
+            }
+            event.apply(book);
+            if (event.timestamp >= timestamp_begin) {
+                callback(event, book);
+            }
+            return true;
+        });
+    }
+
+    inline const size_t get_snapshots_count() const {
+        return _index.size();
+    }
+
+private:
+
+    inline const OrderBookIndexEntry* find_snapshot(const double timestamp) const {
+        auto it = std::upper_bound(_index.begin(), _index.end(), timestamp, [](const double timestamp, const OrderBookIndexEntry& entry) {
+            return timestamp < entry.timestamp;
+        });
+        return (it == _index.begin()) ? NULL : &*(it - 1);
+    }
+
+    inline void load_snapshot(const OrderBookIndexEntry& entry, OrderBook& book) {
+        FILE* file = fopen((_path + "/snapshots").c_str(), "rb");
+        if (file == NULL) {
+            throw FileException("OrderBookLogReader could not open snapshots", _path, strerror(errno));
+        }
+        OrderBookSnapshotHeader header;
+        if (fseek(file, entry.snapshot_offset, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, file) != 1) {
+            fclose(file);
+            throw FileException("OrderBookLogReader could not read snapshot header", _path, entry.snapshot_offset);
+        }
+        _compressed.resize(header.compressed_size);
+        if (header.compressed_size && fread(&_compressed[0], header.compressed_size, 1, file) != 1) {
+            fclose(file);
+            throw FileException("OrderBookLogReader could not read snapshot", _path, entry.snapshot_offset);
+        }
+        fclose(file);
+        _orders.resize(header.orders_count);
+        uLongf size = header.orders_count * sizeof(Order);
+        if (size && uncompress((Bytef*) _orders.data(), &size, (const Bytef*) _compressed.data(), _compressed.size()) != Z_OK) {
+            throw FileException("OrderBookLogReader could not uncompress snapshot", _path, entry.snapshot_offset);
+        }
+        for (const Order& order : _orders) {
+            book.feed(order);
+        }
+    }
+
+    // the callback returns false to stop
+    inline void read_deltas(const uint64_t offset, std::function<const bool(const OrderBookEvent&)> callback) {
+        FILE* file = fopen((_path + "/deltas").c_str(), "rb");
+        if (file == NULL) {
+            return;
+        }
+        fseek(file, offset * sizeof(OrderBookEvent), SEEK_SET);
+        _events.resize(4096);
+        size_t count;
+        while ((count = fread(_events.data(), sizeof(OrderBookEvent), _events.size(), file)) != 0) {
+            for (size_t i=0; i<count; ++i) {
+                if (!callback(_events[i])) {
+                    fclose(file);
+                    return;
+                }
+            }
+        }
+        fclose(file);
+    }
+
+    const std::string _path;
+    std::vector<OrderBookIndexEntry> _index;
+    size_t _index_size;
+    // buffers
+    std::string _compressed;
+    std::vector<Order> _orders;
+    std::vector<OrderBookEvent> _events;
+};
+
+
+// snapshots are copied on the feeding thread, then compressed and written by
+// a background thread, along with the deltas before them; flush() waits for it
+class OrderBookLogWriter {
+public:
+
+    // a snapshot is taken every snapshot_interval seconds (of market time), or
+    // every snapshot_events deltas, whichever comes first
+    inline OrderBookLogWriter(const std::string& path, const double snapshot_interval=60., const size_t snapshot_events=10000, const bool background=true) :
+        _path(path),
+        _snapshot_interval(snapshot_interval),
+        _snapshot_events(snapshot_events),
+        _deltas_count(0),
+        _last_snapshot_deltas_count(0),
+        _timestamp(-INFINITY),
+        _last_snapshot_timestamp(-INFINITY),
+        _is_writing(false),
+        _is_stopping(false),
+        _is_failed(false)
+    {
+        make_directory(_path);
+        // drop what an interrupted write may have left, then resume where the
+        // log stopped
+        repair();
+        OrderBookLogReader reader(_path);
+        reader.load(INFINITY, _book);
+        _deltas = open("deltas");
+        _snapshots = open("snapshots");
+        _index = open("index");
+        _deltas_count = ftell(_deltas) / sizeof(OrderBookEvent);
+        _snapshot_offset = ftell(_snapshots);
+        _last_snapshot_deltas_count = _deltas_count;
+        if (_deltas_count) {
+            _timestamp = _last_snapshot_timestamp = _book.get_timestamp();
+        }
+        if (background) {
+            _thread = std::thread(&OrderBookLogWriter::run, this);
+        }
+    }
+
+    inline ~OrderBookLogWriter() {
+        try {
+            flush();
+        } catch (...) {}
+        if (_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _is_stopping = true;
+            }
+            _condition.notify_all();
+            _thread.join();
+        }
+        fclose(_deltas);
+        fclose(_snapshots);
+        fclose(_index);
+    }
+
+    inline void append(const Order& order, const OrderBookEventType type) {
+        _timestamp = std::max(_timestamp, order.timestamp);
+        const OrderBookEvent event = {_timestamp, order, type};
+        if (fwrite(&event, sizeof(event), 1, _deltas) != 1) {
+            throw FileException("OrderBookLogWriter could not write delta", _path, strerror(errno));
+        }
+        ++_deltas_count;
+        event.apply(_book);
+        if (_deltas_count - _last_snapshot_deltas_count >= _snapshot_events || _timestamp - _last_snapshot_timestamp >= _snapshot_interval) {
+            snapshot();
+        }
+    }
+    inline void feed(const Order& order) {
+        append(order, ORDER_BOOK_UPDATE);
+    }
+    inline void puke(const Order& order) {
+        append(order, ORDER_BOOK_DELETION);
+    }
+
+    // deltas are written when a snapshot is, or on flush(), which also waits
+    // for the pending snapshots
+    inline void flush() {
+        if (_thread.joinable()) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _written_condition.wait(lock, [this] {
+                return _queue.empty() && !_is_writing;
+            });
+        }
+        check();
+        if (fflush(_deltas) != 0) {
+            throw FileException("OrderBookLogWriter could not flush deltas", _path, strerror(errno));
+        }
+    }
+
+    inline void snapshot() {
+        check();
+        PendingSnapshot pending = {_timestamp, _deltas_count, std::vector<Order>()};
+        _book.get_orders(pending.orders);
+        _last_snapshot_deltas_count = _deltas_count;
+        _last_snapshot_timestamp = _timestamp;
+        if (!_thread.joinable()) {
+            write(pending);
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _written_condition.wait(lock, [this] {
+                return _queue.size() < max_queue_size;
+            });
+            _queue.push_back(std::move(pending));
+        }
+        _condition.notify_one();
+    }
+
+    inline const OrderBook& get_order_book() const {
+        return _book;
+    }
+
+private:
+
+    struct PendingSnapshot {
+        double timestamp;
+        uint64_t deltas_count;
+        std::vector<Order> orders;
+    };
+    // snapshots waiting for the background thread
+    static const size_t max_queue_size = 4;
+
+    inline FILE* open(const std::string& name) {
+        FILE* file = fopen((_path + "/" + name).c_str(), "ab");
+        if (file == NULL) {
+            throw FileException("OrderBookLogWriter could not open file for writing", _path + "/" + name, strerror(errno));
+        }
+        fseek(file, 0, SEEK_END);
+        return file;
+    }
+
+    inline const uint64_t get_file_size(const std::string& name) {
+        struct stat status;
+        return (stat((_path + "/" + name).c_str(), &status) == 0) ? status.st_size : 0;
+    }
+    inline void truncate(const std::string& name, const uint64_t size) {
+        if (get_file_size(name) != size && ::truncate((_path + "/" + name).c_str(), size) != 0) {
+            throw FileException("OrderBookLogWriter could not truncate file", _path + "/" + name, strerror(errno));
+        }
+    }
+
+    // keep whole deltas, and the index entries pointing to complete snapshots
+    // within them; what follows the last of those snapshots is dropped
+    inline void repair() {
+        const uint64_t deltas_count = get_file_size("deltas") / sizeof(OrderBookEvent);
+        truncate("deltas", deltas_count * sizeof(OrderBookEvent));
+        const uint64_t snapshots_size = get_file_size("snapshots");
+        std::vector<OrderBookIndexEntry> entries(get_file_size("index") / sizeof(OrderBookIndexEntry));
+        uint64_t snapshots_end = 0;
+        size_t entries_count = 0;
+        FILE* index = fopen((_path + "/index").c_str(), "rb");
+        FILE* snapshots = fopen((_path + "/snapshots").c_str(), "rb");
+        if (index && snapshots && !entries.empty()) {
+            entries.resize(fread(entries.data(), sizeof(OrderBookIndexEntry), entries.size(), index));
+            for (const OrderBookIndexEntry& entry : entries) {
+                OrderBookSnapshotHeader header;
+                if (entry.snapshot_offset < snapshots_end || entry.snapshot_offset + sizeof(header) > snapshots_size || entry.deltas_count > deltas_count
+                    || fseek(snapshots, entry.snapshot_offset, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, snapshots) != 1
+                    || entry.snapshot_offset + sizeof(header) + header.compressed_size > snapshots_size) {
+                    break;
+                }
+                snapshots_end = entry.snapshot_offset + sizeof(header) + header.compressed_size;
+                ++entries_count;
+            }
+        }
+        if (index) {
+            fclose(index);
+        }
+        if (snapshots) {
+            fclose(snapshots);
+        }
+        truncate("index", entries_count * sizeof(OrderBookIndexEntry));
+        truncate("snapshots", snapshots_end);
+    }
+
+    inline void check() {
+        if (_is_failed) {
+            throw FileException("OrderBookLogWriter could not write snapshot", _path, _error);
+        }
+    }
+
+    // the deltas a snapshot refers to are flushed before it
+    inline void write(const PendingSnapshot& pending) {
+        if (fflush(_deltas) != 0) {
+            throw FileException("OrderBookLogWriter could not flush deltas", _path, strerror(errno));
+        }
+        uLongf compressed_size = compressBound(pending.orders.size() * sizeof(Order));
+        _compressed.resize(compressed_size);
+        if (compress2((Bytef*) &_compressed[0], &compressed_size, (const Bytef*) pending.orders.data(), pending.orders.size() * sizeof(Order), Z_BEST_SPEED) != Z_OK) {
+            throw FileException("OrderBookLogWriter could not compress snapshot", _path);
+        }
+        const OrderBookIndexEntry entry = {pending.timestamp, _snapshot_offset, pending.deltas_count};
+        const OrderBookSnapshotHeader header = {pending.timestamp, pending.deltas_count, (uint32_t) pending.orders.size(), (uint32_t) compressed_size};
+        if (fwrite(&header, sizeof(header), 1, _snapshots) != 1 || fwrite(_compressed.data(), compressed_size, 1, _snapshots) != 1 || fflush(_snapshots) != 0) {
+            throw FileException("OrderBookLogWriter could not write snapshot", _path, strerror(errno));
+        }
+        // the index only points to complete snapshots
+        if (fwrite(&entry, sizeof(entry), 1, _index) != 1 || fflush(_index) != 0) {
+            throw FileException("OrderBookLogWriter could not write index", _path, strerror(errno));
+        }
+        _snapshot_offset += sizeof(header) + compressed_size;
+    }
+
+    // snapshots are written in the order they were taken; after a failure,
+    // the following ones are dropped
+    inline void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _condition.wait(lock, [this] {
+                return !_queue.empty() || _is_stopping;
+            });
+            if (_queue.empty()) {
+                return;
+            }
+            PendingSnapshot pending = std::move(_queue.front());
+            _queue.pop_front();
+            _is_writing = true;
+            lock.unlock();
+            if (!_is_failed) {
+                try {
+                    write(pending);
+                } catch (const Exception& exception) {
+                    _error = exception.what();
+                    _is_failed = true;
+                } catch (...) {
+                    _error = "unknown error";
+                    _is_failed = true;
+                }
+            }
+            lock.lock();
+            _is_writing = false;
+            _written_condition.notify_all();
+        }
+    }
+
+    const std::string _path;
+    const double _snapshot_interval;
+    const size_t _snapshot_events;
+    OrderBook _book;
+    FILE* _deltas;
+    FILE* _snapshots;
+    FILE* _index;
+    uint64_t _deltas_count;
+    uint64_t _last_snapshot_deltas_count;
+    double _timestamp;
+    double _last_snapshot_timestamp;
+    // background snapshots
+    uint64_t _snapshot_offset;
+    std::string _compressed;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::condition_variable _written_condition;
+    std::deque<PendingSnapshot> _queue;
+    bool _is_writing;
+    bool _is_stopping;
+    std::atomic<bool> _is_failed;
+    std::string _error;
+};
+
+
+struct OrderBookLog {
+    typedef OrderBookLogWriter Writer;
+    typedef OrderBookLogReader Reader;
+};
+
+
+#endif // CTRADING__DB__ORDERBOOKLOG__HPP
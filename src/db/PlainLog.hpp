@@ -9,9 +9,15 @@
 
 #include <experimental/filesystem>
 #include <set>
+#include <memory>
 
 #include "exceptions/Exception.hpp"
 #include "range/Range.hpp"
+#include "./BlockLog.hpp"
+
+
+// records are appended as they are, unless a codec is given: they are then
+// written as compressed blocks (see BlockLog.hpp), which the reader detects
 
 
 class PlainLogReader {
@@ -21,6 +27,10 @@ public:
         _path(basepath),
         _file(NULL)
     {
+        if (block_log_is_block_file(basepath)) {
+            _block_reader.reset(new BlockLogReader(basepath));
+            return;
+        }
         _file = fopen(basepath.c_str(), "rb");
     }
 
@@ -33,6 +43,9 @@ public:
 
     template <typename item_t>
     inline const bool next(item_t& item) {
+        if (_block_reader) {
+            return _block_reader->next(item) == sizeof(item);
+        }
         if (_file == NULL) {
             return false;
         }
@@ -47,9 +60,21 @@ public:
         }
     }
 
+    // compressed records are read through
+    template <typename item_t>
+    inline void skip(const uint64_t count) {
+        if (_block_reader) {
+            item_t item;
+            for (uint64_t i=0; i<count && next(item); ++i);
+        } else if (_file != NULL && fseek(_file, count * sizeof(item_t), SEEK_CUR) != 0) {
+            throw FileException("PlainLogReader could not seek in file", _path, strerror(errno));
+        }
+    }
+
 private:
     const std::string _path;
     FILE* _file;
+    std::unique_ptr<BlockLogReader> _block_reader;
 
 };
 
@@ -99,6 +124,26 @@ public:
         if (_file == NULL) {
             throw FileException("PlainLogWriter could not open file for writing", _path, strerror(errno));
         }
+        if (block_log_is_block_file(_path)) {
+            fclose(_file);
+            throw FileException("PlainLogWriter cannot append raw records to a compressed file", _path);
+        }
+    }
+    inline PlainLogWriter(const std::string& basepath, const Codec& codec, const size_t block_size=65536) :
+        _path(basepath),
+        _file(NULL)
+    {
+        if (codec.get_type() == CODEC_NONE) {
+            if (block_log_is_block_file(_path)) {
+                throw FileException("PlainLogWriter cannot append raw records to a compressed file", _path);
+            }
+            _file = fopen(_path.c_str(), "ab");
+            if (_file == NULL) {
+                throw FileException("PlainLogWriter could not open file for writing", _path, strerror(errno));
+            }
+        } else {
+            _block_writer.reset(new BlockLogWriter(_path, codec, block_size));
+        }
     }
 
     inline ~PlainLogWriter() {
@@ -110,6 +155,10 @@ public:
 
     template <typename item_t>
     inline void append(const item_t& item) {
+        if (_block_writer) {
+            _block_writer->append(item);
+            return;
+        }
         if (fwrite(&item, sizeof(item), 1, _file) != 1) {
             throw FileException("PlainLogWriter could not write to file", _path, strerror(errno));
         }
@@ -118,14 +167,23 @@ public:
         }
     }
 
+    // compressed records are only readable once their block is written
+    inline void flush() {
+        if (_block_writer) {
+            _block_writer->flush();
+        }
+    }
+
     template <typename T>
     inline PlainLogRange<T> get() {
+        flush();
         return PlainLogRange<T>(_path);
     }
 
 private:
     const std::string _path;
     FILE* _file;
+    std::unique_ptr<BlockLogWriter> _block_writer;
 
 };
 
@@ -6,83 +6,257 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 #include <experimental/filesystem>
-#include <set>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <functional>
 
 #include "exceptions/Exception.hpp"
 #include "range/Range.hpp"
+#include "./PlainLog.hpp"
 
 
-class RotatingLogReader {
+// segments are plain logs, compressed or not (see PlainLog.hpp), named after
+// the time they start at. They are listed in a manifest (basepath.manifest)
+// with the bounds of their records' timestamps, so that readers only open
+// the segments overlapping the period they are asked for. The manifest is
+// appended to by writers: a segment is listed with unknown bounds when
+// opened, and again with its bounds when closed; the last entry for a
+// segment wins. Compaction replaces it as a whole (see
+// RotatingLogCompactor.hpp); both hold basepath.lock meanwhile.
+// Segments are rotated by wall clock, or by the records' own timestamps.
+
+
+enum RotatingLogPartitioning {
+    ROTATING_LOG_BY_WALL_CLOCK = 0,
+    ROTATING_LOG_BY_TIMESTAMP = 1,
+};
+
+
+#pragma pack(push, 1)
+
+struct RotatingLogSegment {
+    char suffix[32];
+    // NAN when unknown, e.g. while the segment is written
+    double timestamp_min;
+    double timestamp_max;
+    uint64_t count;
+    uint64_t size;
+
+    inline const bool overlaps(const double timestamp_begin, const double timestamp_end) const {
+        return !(timestamp_max < timestamp_begin) && !(timestamp_min > timestamp_end);
+    }
+};
+
+#pragma pack(pop)
+
+
+// segments by suffix, i.e. in chronological order
+typedef std::map<std::string, RotatingLogSegment> RotatingLogSegments;
+
+
+// serializes changes to the manifest, between threads and processes
+class RotatingLogLock {
 public:
 
-    inline RotatingLogReader(const std::string& basepath) :
-        _basepath(basepath),
-        _file(NULL)
+    inline RotatingLogLock(const std::string& basepath) :
+        _path(basepath + ".lock")
     {
-        std::experimental::filesystem::path b = _basepath;
-        for (auto& p : std::experimental::filesystem::directory_iterator(b.parent_path())) {
-            const std::string filepath = p.path().string();
-            if (filepath.rfind(_basepath, 0) == 0) {
-                _paths.insert(filepath);
-            }
+        _fd = open(_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (_fd < 0 || flock(_fd, LOCK_EX) != 0) {
+            throw FileException("RotatingLogLock could not lock", _path, strerror(errno));
+        }
+    }
+    inline ~RotatingLogLock() {
+        flock(_fd, LOCK_UN);
+        close(_fd);
+    }
+
+private:
+
+    const std::string _path;
+    int _fd;
+
+};
+
+// from the manifest; for logs written before manifests existed, from the
+// directory, with unknown bounds
+inline RotatingLogSegments rotating_log_load_segments(const std::string& basepath) {
+    RotatingLogSegments segments;
+    FILE* file = fopen((basepath + ".manifest").c_str(), "rb");
+    if (file != NULL) {
+        RotatingLogSegment segment;
+        while (fread(&segment, sizeof(segment), 1, file) == 1) {
+            segment.suffix[sizeof(segment.suffix) - 1] = 0;
+            segments[segment.suffix] = segment;
+        }
+        fclose(file);
+        return segments;
+    }
+    std::experimental::filesystem::path b = basepath;
+    if (!std::experimental::filesystem::exists(b.parent_path())) {
+        return segments;
+    }
+    for (auto& p : std::experimental::filesystem::directory_iterator(b.parent_path())) {
+        const std::string filepath = p.path().string();
+        if (filepath.size() <= basepath.size() + 1 || filepath.rfind(basepath + '.', 0) != 0) {
+            continue;
+        }
+        const std::string suffix = filepath.substr(basepath.size() + 1);
+        // segments are named after dates; other files are sidecars
+        if (!isdigit(suffix[0]) || suffix.find('.') != std::string::npos || suffix.size() >= sizeof(RotatingLogSegment::suffix)) {
+            continue;
         }
-        _paths_it = _paths.begin();
+        RotatingLogSegment segment = {{0}, NAN, NAN, 0, 0};
+        strcpy(segment.suffix, suffix.c_str());
+        segments[suffix] = segment;
     }
+    return segments;
+}
 
-    inline ~RotatingLogReader() {
-        close_file();
+
+// replaces the manifest at once; the lock must be held
+inline void rotating_log_save_segments(const std::string& basepath, const RotatingLogSegments& segments) {
+    const std::string path = basepath + ".manifest";
+    FILE* file = fopen((path + ".tmp").c_str(), "wb");
+    if (file == NULL) {
+        throw FileException("RotatingLog could not write manifest", path + ".tmp", strerror(errno));
+    }
+    for (const auto& it : segments) {
+        if (fwrite(&it.second, sizeof(it.second), 1, file) != 1) {
+            fclose(file);
+            throw FileException("RotatingLog could not write manifest", path + ".tmp", strerror(errno));
+        }
     }
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0 || fclose(file) != 0 || rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+        throw FileException("RotatingLog could not replace manifest", path, strerror(errno));
+    }
+}
+
 
-    inline bool close_file() {
-        if (_file != NULL) {
-            fclose(_file);
-            _file = NULL;
+class RotatingLogReader {
+public:
+
+    inline RotatingLogReader(const std::string& basepath, const double timestamp_begin=-INFINITY, const double timestamp_end=INFINITY) :
+        _basepath(basepath),
+        _timestamp_begin(timestamp_begin),
+        _timestamp_end(timestamp_end)
+    {
+        for (const auto& it : rotating_log_load_segments(_basepath)) {
+            if (it.second.overlaps(_timestamp_begin, _timestamp_end)) {
+                _segments.push_back(it.second);
+            }
         }
+        _segments_it = _segments.begin();
+    }
+
+    inline void close_file() {
+        _reader.reset();
     }
+    // segments are only opened when reached
     inline bool rotate_file() {
-        if (_file == NULL) {
-            if (_paths_it == _paths.end()) {
+        if (!_reader) {
+            if (_segments_it == _segments.end()) {
                 return false;
             }
-            _file = fopen((_paths_it++)->c_str(), "rb");
-            if (_file == NULL) {
-                throw FileException("RotatingLogReader could not open file for reading", *_paths_it, strerror(errno));
-            }
+            _reader.reset(new PlainLogReader(_basepath + '.' + (_segments_it++)->suffix));
         }
         return true;
     }
 
+    // records without timestamp are never filtered out
     template <typename item_t>
     inline const bool next(item_t& item) {
-        if (!rotate_file()) {
-            return false;
-        }
-        int read_result;
-        do {
-            read_result = fread(&item, sizeof(item), 1, _file);
-            switch (read_result) {
-                case 1:
+        while (rotate_file()) {
+            while (_reader->next(item)) {
+                const double timestamp = block_log_timestamp(item, 0);
+                if (!(timestamp < _timestamp_begin) && !(timestamp > _timestamp_end)) {
                     return true;
-                case 0:
-                    close_file();
-                    if (!rotate_file()) {
-                        return false;
-                    }
-                    break;
-                default:
-                    throw FileException("RotatingLogReader could not read from file", *_paths_it, read_result, strerror(errno));
+                }
             }
-        } while (read_result == 0);
+            close_file();
+        }
         return false;
     }
 
+    // the ones overlapping the period
+    inline const std::vector<RotatingLogSegment>& get_segments() const {
+        return _segments;
+    }
+
+    // segments are read in parallel, each one by a worker folding the
+    // records of the period into its own result with map; the results are
+    // then merged by reduce, in the order of the segments
+    template <typename T, typename Result>
+    inline Result scan(std::function<void(Result&, const T&)> map, std::function<void(Result&, const Result&)> reduce, const Result& initial=Result(), size_t threads_count=0) {
+        if (threads_count == 0) {
+            threads_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+        std::vector<Result> results(_segments.size(), initial);
+        std::atomic<size_t> next(0);
+        // the first failure stops the workers, and is thrown (e.g. an
+        // exception from map) once they are joined
+        std::atomic<bool> is_failed(false);
+        std::exception_ptr failure;
+        std::mutex failure_mutex;
+        auto work = [&] {
+            try {
+                T item;
+                for (size_t i; !is_failed && (i = next++) < _segments.size(); ) {
+                    PlainLogReader reader(_basepath + '.' + _segments[i].suffix);
+                    while (reader.next(item)) {
+                        const double timestamp = block_log_timestamp(item, 0);
+                        if (!(timestamp < _timestamp_begin) && !(timestamp > _timestamp_end)) {
+                            map(results[i], item);
+                        }
+                    }
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failure_mutex);
+                if (!is_failed) {
+                    failure = std::current_exception();
+                    is_failed = true;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t t=1; t<std::min(threads_count, _segments.size()); ++t) {
+            threads.emplace_back(work);
+        }
+        work();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        if (is_failed) {
+            std::rethrow_exception(failure);
+        }
+        Result result = initial;
+        for (const Result& segment_result : results) {
+            reduce(result, segment_result);
+        }
+        return result;
+    }
+
 private:
+
     const std::string _basepath;
-    std::set<std::string> _paths;
-    std::set<std::string>::iterator _paths_it;
-    FILE* _file;
+    const double _timestamp_begin;
+    const double _timestamp_end;
+    std::vector<RotatingLogSegment> _segments;
+    std::vector<RotatingLogSegment>::iterator _segments_it;
+    std::unique_ptr<PlainLogReader> _reader;
 
 };
 
@@ -91,18 +265,18 @@ template <typename T>
 class RotatingLogRangeData : public RangeData<T> {
 public:
 
-    RotatingLogRangeData(const std::string& basepath) :
-        _reader(basepath)
+    RotatingLogRangeData(const std::string& basepath, const double timestamp_begin, const double timestamp_end) :
+        _reader(basepath, timestamp_begin, timestamp_end)
         {
 
     }
 
     virtual const bool init(T*& value) {
         value = & _value;
-        _reader.next(_value);
+        return _reader.next(_value);
     }
     virtual const bool next(T*& value) {
-        _reader.next(_value);
+        return _reader.next(_value);
     }
 
 private:
@@ -116,8 +290,8 @@ template <typename T>
 class RotatingLogRange : public Range<T> {
 public:
 
-    RotatingLogRange(const std::string& basepath) :
-        Range<T>(new RotatingLogRangeData<T>(basepath)) {}
+    RotatingLogRange(const std::string& basepath, const double timestamp_begin=-INFINITY, const double timestamp_end=INFINITY) :
+        Range<T>(new RotatingLogRangeData<T>(basepath, timestamp_begin, timestamp_end)) {}
 
 };
 
@@ -126,53 +300,122 @@ class RotatingLogWriter {
 public:
 
     inline RotatingLogWriter(const std::string& basepath, const int64_t& interval=86400, const size_t& check_threshold=256) :
+        RotatingLogWriter(basepath, Codec(CODEC_NONE), interval, check_threshold) {}
+    // when partitioning by timestamp, each segment covers an interval of
+    // records' timestamps (or a bit more, with late records), and records
+    // without timestamp go to the current one
+    inline RotatingLogWriter(const std::string& basepath, const Codec& codec, const int64_t& interval=86400, const size_t& check_threshold=256, const size_t block_size=65536, const RotatingLogPartitioning partitioning=ROTATING_LOG_BY_WALL_CLOCK) :
         _basepath(basepath),
+        _codec(codec),
+        _block_size(block_size),
+        _partitioning(partitioning),
         _interval(interval),
         _check_threshold(check_threshold),
         _bytes_written(0),
-        _file(NULL)
+        _partition(0)
     {
-        start();
+        // segments of logs written before manifests existed are listed too
+        {
+            RotatingLogLock lock(_basepath);
+            struct stat s;
+            if (stat((_basepath + ".manifest").c_str(), &s) != 0) {
+                rotating_log_save_segments(_basepath, rotating_log_load_segments(_basepath));
+            }
+        }
+        if (_partitioning == ROTATING_LOG_BY_WALL_CLOCK) {
+            start();
+        }
     }
 
     inline ~RotatingLogWriter() {
-        stop();
+        try {
+            stop();
+        } catch (...) {}
     }
 
     inline void start() {
+        start(time(NULL));
+    }
+    inline void start(const int64_t partition) {
         stop();
-        // format date
         _last_timestamp = time(NULL);
+        _partition = partition;
+        // format date
+        const time_t t = partition;
         struct tm lt;
-        localtime_r(&_last_timestamp, &lt);
+        localtime_r(&t, &lt);
         static const char* suffix_format = "%Y-%m-%dT%H:%M:%S";
         char suffix[32];
         memset(suffix, 0, sizeof(suffix));
         strftime(suffix, sizeof(suffix), suffix_format, &lt);
-        // build path
-        _path = _basepath + '.' + suffix;
-        _file = fopen(_path.c_str(), "ab");
-        if (_file == NULL) {
-            throw FileException("RotatingLogWriter could not open file for writing", _path, strerror(errno));
+        // a listed segment is appended to; a file that is not listed any
+        // more (e.g. compacted) is left alone
+        RotatingLogLock lock(_basepath);
+        const RotatingLogSegments segments = rotating_log_load_segments(_basepath);
+        std::string name = suffix;
+        auto it = segments.find(name);
+        struct stat s;
+        for (size_t i=1; it == segments.end() && stat((_basepath + '.' + name).c_str(), &s) == 0; ++i) {
+            name = std::string(suffix) + '~' + std::to_string(i);
+            it = segments.find(name);
+        }
+        if (it == segments.end()) {
+            _segment = {{0}, NAN, NAN, 0, 0};
+            strcpy(_segment.suffix, name.c_str());
+        } else {
+            _segment = it->second;
         }
+        // listed before being written to
+        _path = _basepath + '.' + name;
+        RotatingLogSegment opened = _segment;
+        opened.timestamp_min = opened.timestamp_max = NAN;
+        write_manifest(opened);
+        _writer.reset(new PlainLogWriter(_path, _codec, _block_size));
     }
     inline void stop() {
-        if (_file != NULL) {
-            fclose(_file);
-            _file = NULL;
+        if (!_writer) {
+            return;
+        }
+        // the segment is closed and listed even if its last block could not
+        // be written, then the error is thrown
+        std::exception_ptr error;
+        try {
+            _writer->flush();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        _writer.reset();
+        struct stat s;
+        _segment.size = (stat(_path.c_str(), &s) == 0) ? s.st_size : 0;
+        RotatingLogLock lock(_basepath);
+        write_manifest(_segment);
+        if (error) {
+            std::rethrow_exception(error);
         }
     }
 
     template <typename item_t>
     inline void append(const item_t& item) {
-        if (fwrite(&item, sizeof(item), 1, _file) != 1) {
-            throw FileException("RotatingLogWriter could not write to file", _path, strerror(errno));
+        const double timestamp = block_log_timestamp(item, 0);
+        if (_partitioning == ROTATING_LOG_BY_TIMESTAMP && !std::isnan(timestamp)) {
+            const int64_t partition = _interval * (int64_t) std::floor(timestamp / _interval);
+            // records a little late for the current segment (from the
+            // previous partition) go to it and widen its bounds, instead of
+            // reopening the former segment for each of them
+            if (!_writer || partition > _partition || partition < _partition - _interval) {
+                start(partition);
+            }
+        } else if (!_writer) {
+            start();
         }
-        if (fflush(_file) != 0) {
-            throw FileException("RotatingLogWriter could not flush to file", _path, strerror(errno));
+        _writer->append(item);
+        ++_segment.count;
+        if (!std::isnan(timestamp)) {
+            _segment.timestamp_min = std::isnan(_segment.timestamp_min) ? timestamp : std::min(_segment.timestamp_min, timestamp);
+            _segment.timestamp_max = std::isnan(_segment.timestamp_max) ? timestamp : std::max(_segment.timestamp_max, timestamp);
         }
         _bytes_written += sizeof(item);
-        if (_bytes_written > _check_threshold)  {
+        if (_partitioning == ROTATING_LOG_BY_WALL_CLOCK && _bytes_written > _check_threshold)  {
             const int64_t current_timestamp = time(NULL);
             if (current_timestamp - _last_timestamp >= _interval) {
                 start();
@@ -181,19 +424,47 @@ public:
         }
     }
 
+    // compressed records are only readable once their block is written
+    inline void flush() {
+        if (_writer) {
+            _writer->flush();
+        }
+    }
+
     template <typename T>
-    inline RotatingLogRange<T> get() {
-        return RotatingLogRange<T>(_basepath);
+    inline RotatingLogRange<T> get(const double timestamp_begin=-INFINITY, const double timestamp_end=INFINITY) {
+        flush();
+        return RotatingLogRange<T>(_basepath, timestamp_begin, timestamp_end);
     }
 
 private:
+
+    // the manifest is reopened, as compaction may have replaced it; the
+    // lock must be held
+    inline void write_manifest(const RotatingLogSegment& segment) {
+        FILE* file = fopen((_basepath + ".manifest").c_str(), "ab");
+        if (file == NULL) {
+            throw FileException("RotatingLogWriter could not open manifest for writing", _basepath + ".manifest", strerror(errno));
+        }
+        const bool is_written = fwrite(&segment, sizeof(segment), 1, file) == 1;
+        if (fclose(file) != 0 || !is_written) {
+            throw FileException("RotatingLogWriter could not write to manifest", _basepath + ".manifest", strerror(errno));
+        }
+    }
+
     const std::string _basepath;
+    const Codec _codec;
+    const size_t _block_size;
+    const RotatingLogPartitioning _partitioning;
     int64_t _interval;
-    size_t _bytes_written;
     size_t _check_threshold;
+    size_t _bytes_written;
     int64_t _last_timestamp;
+    // current segment
+    int64_t _partition;
     std::string _path;
-    FILE* _file;
+    std::unique_ptr<PlainLogWriter> _writer;
+    RotatingLogSegment _segment;
 
 };
 
@@ -0,0 +1,325 @@
+#ifndef CTRADING__DB__ROTATINGLOGCOMPACTOR__HPP
+#define CTRADING__DB__ROTATINGLOGCOMPACTOR__HPP
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "exceptions/Exception.hpp"
+#include "./RotatingLog.hpp"
+
+
+// merges small sealed segments of a rotating log into larger ones, sorted by
+// timestamp and compressed, and drops the oldest segments past a TTL or a
+// total size. Segments being written (whose bounds are unknown) are left
+// alone, and a merge is given up when one of its segments changed meanwhile.
+// The manifest is replaced at once; files that are not listed any more are
+// only deleted after a grace period, so that readers which listed them
+// before can still open them (see basepath.obsolete).
+
+
+#pragma pack(push, 1)
+
+struct RotatingLogObsoleteSegment {
+    char suffix[32];
+    double since;
+};
+
+#pragma pack(pop)
+
+
+struct RotatingLogCompactionMetrics {
+    size_t runs;
+    size_t errors;
+    size_t merged_segments;
+    size_t written_segments;
+    size_t dropped_segments;
+    size_t given_up_merges;
+    size_t deleted_segments;
+    size_t bytes_read;
+    size_t bytes_written;
+};
+
+
+template <typename T>
+class RotatingLogCompactor {
+public:
+
+    // segments smaller than small_size are merged into ones of about
+    // target_size (sizes of their records, so that merged segments keep a
+    // bounded span of time for retention); ttl (in seconds of the records'
+    // timestamps) and max_size (on disk) are ignored when 0
+    inline RotatingLogCompactor(const std::string& basepath, const Codec& codec=Codec(CODEC_ZLIB), const size_t target_size=64<<20, const size_t small_size=16<<20, const double ttl=0., const size_t max_size=0, const double grace_period=60.) :
+        _basepath(basepath),
+        _codec(codec),
+        _target_size(target_size),
+        _small_size(small_size),
+        _ttl(ttl),
+        _max_size(max_size),
+        _grace_period(grace_period),
+        _metrics({0, 0, 0, 0, 0, 0, 0, 0, 0}),
+        _is_stopping(false) {}
+    inline ~RotatingLogCompactor() {
+        stop();
+    }
+
+    // compacts every interval, in the background
+    inline void start(const double interval=60.) {
+        stop();
+        _is_stopping = false;
+        _thread = std::thread([this, interval] {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_condition.wait_for(lock, std::chrono::duration<double>(interval), [this] { return _is_stopping; })) {
+                lock.unlock();
+                try {
+                    compact();
+                } catch (...) {
+                    std::lock_guard<std::mutex> metrics_lock(_metrics_mutex);
+                    ++_metrics.errors;
+                }
+                lock.lock();
+            }
+        });
+    }
+    inline void stop() {
+        if (!_thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _is_stopping = true;
+        }
+        _condition.notify_all();
+        _thread.join();
+    }
+
+    // now is compared with the records' timestamps for the TTL, and with
+    // the wall clock for the grace period
+    inline void compact(const double now=time(NULL)) {
+        RotatingLogCompactionMetrics metrics = {1, 0, 0, 0, 0, 0, 0, 0, 0};
+        // what to do, from a snapshot of the manifest
+        RotatingLogSegments segments;
+        {
+            RotatingLogLock lock(_basepath);
+            segments = rotating_log_load_segments(_basepath);
+        }
+        std::vector<RotatingLogSegment> dropped;
+        size_t total_size = 0;
+        for (auto it=segments.rbegin(); it!=segments.rend(); ++it) {
+            total_size += it->second.size;
+            if (is_sealed(it->second) && (
+                (_ttl > 0. && it->second.timestamp_max < now - _ttl) || (_max_size > 0 && total_size > _max_size)
+            )) {
+                dropped.push_back(it->second);
+            }
+        }
+        std::vector<std::vector<RotatingLogSegment>> groups(1);
+        size_t group_size = 0;
+        for (const auto& it : segments) {
+            const RotatingLogSegment& segment = it.second;
+            const bool is_dropped = std::find_if(dropped.begin(), dropped.end(), [&](const RotatingLogSegment& d) {
+                return strcmp(d.suffix, segment.suffix) == 0;
+            }) != dropped.end();
+            const bool is_compressed = block_log_is_block_file(get_path(segment)) || _codec.get_type() == CODEC_NONE;
+            const size_t size = segment.count * sizeof(T);
+            if (!is_sealed(segment) || is_dropped || (size >= _small_size && is_compressed)) {
+                groups.emplace_back();
+                group_size = 0;
+                continue;
+            }
+            groups.back().push_back(segment);
+            group_size += size;
+            if (group_size >= _target_size) {
+                groups.emplace_back();
+                group_size = 0;
+            }
+        }
+        // merged segments are written without the lock
+        std::vector<std::pair<std::vector<RotatingLogSegment>, RotatingLogSegment>> merges;
+        for (const std::vector<RotatingLogSegment>& group : groups) {
+            if (group.empty() || (group.size() == 1 && (block_log_is_block_file(get_path(group[0])) || _codec.get_type() == CODEC_NONE))) {
+                continue;
+            }
+            merges.push_back({group, merge(group, segments, metrics)});
+            segments[merges.back().second.suffix] = merges.back().second;
+        }
+        // the manifest is replaced, unless segments changed meanwhile
+        RotatingLogLock lock(_basepath);
+        RotatingLogSegments current = rotating_log_load_segments(_basepath);
+        std::vector<RotatingLogObsoleteSegment> obsolete = load_obsolete();
+        auto is_unchanged = [&](const RotatingLogSegment& segment) {
+            auto it = current.find(segment.suffix);
+            return it != current.end() && memcmp(&it->second, &segment, sizeof(segment)) == 0;
+        };
+        auto remove_segment = [&](const RotatingLogSegment& segment) {
+            current.erase(segment.suffix);
+            RotatingLogObsoleteSegment entry = {{0}, now};
+            memcpy(entry.suffix, segment.suffix, sizeof(entry.suffix));
+            obsolete.push_back(entry);
+        };
+        for (const RotatingLogSegment& segment : dropped) {
+            if (is_unchanged(segment)) {
+                remove_segment(segment);
+                ++metrics.dropped_segments;
+            }
+        }
+        for (const auto& merge : merges) {
+            if (std::all_of(merge.first.begin(), merge.first.end(), is_unchanged)) {
+                for (const RotatingLogSegment& segment : merge.first) {
+                    remove_segment(segment);
+                }
+                current[merge.second.suffix] = merge.second;
+                metrics.merged_segments += merge.first.size();
+                ++metrics.written_segments;
+            } else {
+                remove_files(merge.second.suffix);
+                ++metrics.given_up_merges;
+            }
+        }
+        rotating_log_save_segments(_basepath, current);
+        // files are deleted once readers are done with them; a suffix might
+        // have been listed again since
+        std::vector<RotatingLogObsoleteSegment> remaining;
+        for (const RotatingLogObsoleteSegment& entry : obsolete) {
+            if (current.find(entry.suffix) != current.end()) {
+                continue;
+            }
+            if (entry.since > now - _grace_period) {
+                remaining.push_back(entry);
+                continue;
+            }
+            remove_files(entry.suffix);
+            ++metrics.deleted_segments;
+        }
+        save_obsolete(remaining);
+        std::lock_guard<std::mutex> metrics_lock(_metrics_mutex);
+        _metrics.runs += metrics.runs;
+        _metrics.merged_segments += metrics.merged_segments;
+        _metrics.written_segments += metrics.written_segments;
+        _metrics.dropped_segments += metrics.dropped_segments;
+        _metrics.given_up_merges += metrics.given_up_merges;
+        _metrics.deleted_segments += metrics.deleted_segments;
+        _metrics.bytes_read += metrics.bytes_read;
+        _metrics.bytes_written += metrics.bytes_written;
+    }
+
+    inline const RotatingLogCompactionMetrics get_metrics() {
+        std::lock_guard<std::mutex> lock(_metrics_mutex);
+        return _metrics;
+    }
+
+private:
+
+    static inline const bool is_sealed(const RotatingLogSegment& segment) {
+        return !std::isnan(segment.timestamp_min) && !std::isnan(segment.timestamp_max);
+    }
+    inline const std::string get_path(const RotatingLogSegment& segment) const {
+        return _basepath + '.' + segment.suffix;
+    }
+    inline void remove_files(const std::string& suffix) {
+        for (const std::string extension : {"", ".index", ".dictionary"}) {
+            remove((_basepath + '.' + suffix + extension).c_str());
+        }
+    }
+
+    // named after the first segment, e.g. 2018-01-01T00:00:00+2
+    inline const RotatingLogSegment merge(const std::vector<RotatingLogSegment>& group, const RotatingLogSegments& segments, RotatingLogCompactionMetrics& metrics) {
+        std::vector<T> records;
+        size_t count = 0;
+        for (const RotatingLogSegment& segment : group) {
+            count += segment.count;
+        }
+        records.reserve(count);
+        T record;
+        for (const RotatingLogSegment& segment : group) {
+            PlainLogReader reader(get_path(segment));
+            while (reader.next(record)) {
+                records.push_back(record);
+            }
+            metrics.bytes_read += segment.size;
+        }
+        std::stable_sort(records.begin(), records.end(), [](const T& a, const T& b) {
+            return block_log_timestamp(a, 0) < block_log_timestamp(b, 0);
+        });
+        const std::string base = std::string(group[0].suffix).substr(0, std::string(group[0].suffix).find('+'));
+        RotatingLogSegment merged = {{0}, NAN, NAN, records.size(), 0};
+        struct stat s;
+        for (size_t i=1; ; ++i) {
+            const std::string suffix = base + '+' + std::to_string(i);
+            if (segments.find(suffix) == segments.end() && stat((_basepath + '.' + suffix).c_str(), &s) != 0) {
+                strcpy(merged.suffix, suffix.c_str());
+                break;
+            }
+        }
+        {
+            PlainLogWriter writer(get_path(merged), _codec);
+            for (const T& record : records) {
+                writer.append(record);
+                const double timestamp = block_log_timestamp(record, 0);
+                if (!std::isnan(timestamp)) {
+                    merged.timestamp_min = std::isnan(merged.timestamp_min) ? timestamp : std::min(merged.timestamp_min, timestamp);
+                    merged.timestamp_max = std::isnan(merged.timestamp_max) ? timestamp : std::max(merged.timestamp_max, timestamp);
+                }
+            }
+            // a merged segment that could not be fully written is not listed
+            writer.flush();
+        }
+        merged.size = (stat(get_path(merged).c_str(), &s) == 0) ? s.st_size : 0;
+        metrics.bytes_written += merged.size;
+        return merged;
+    }
+
+    inline std::vector<RotatingLogObsoleteSegment> load_obsolete() {
+        std::vector<RotatingLogObsoleteSegment> obsolete;
+        FILE* file = fopen((_basepath + ".obsolete").c_str(), "rb");
+        if (file == NULL) {
+            return obsolete;
+        }
+        RotatingLogObsoleteSegment entry;
+        while (fread(&entry, sizeof(entry), 1, file) == 1) {
+            entry.suffix[sizeof(entry.suffix) - 1] = 0;
+            obsolete.push_back(entry);
+        }
+        fclose(file);
+        return obsolete;
+    }
+    inline void save_obsolete(const std::vector<RotatingLogObsoleteSegment>& obsolete) {
+        const std::string path = _basepath + ".obsolete";
+        FILE* file = fopen((path + ".tmp").c_str(), "wb");
+        if (file == NULL || (!obsolete.empty() && fwrite(obsolete.data(), sizeof(RotatingLogObsoleteSegment), obsolete.size(), file) != obsolete.size())) {
+            throw FileException("RotatingLogCompactor could not write list of obsolete segments", path + ".tmp", strerror(errno));
+        }
+        if (fclose(file) != 0 || rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+            throw FileException("RotatingLogCompactor could not replace list of obsolete segments", path, strerror(errno));
+        }
+    }
+
+    const std::string _basepath;
+    const Codec _codec;
+    const size_t _target_size;
+    const size_t _small_size;
+    const double _ttl;
+    const size_t _max_size;
+    const double _grace_period;
+    RotatingLogCompactionMetrics _metrics;
+    std::mutex _metrics_mutex;
+    // background compaction
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _is_stopping;
+};
+
+
+#endif // CTRADING__DB__ROTATINGLOGCOMPACTOR__HPP
@@ -0,0 +1,414 @@
+#ifndef CTRADING__DB__TRADECODEC__HPP
+#define CTRADING__DB__TRADECODEC__HPP
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "exceptions/Exception.hpp"
+#include "models/Trade.hpp"
+
+
+// columnar encoding of consecutive trades, in the spirit of Gorilla: every
+// field is stored as a column, after the count of trades
+// - integers (ids) are zigzag-encoded deltas, as varints
+// - doubles that are decimals in disguise (prices in cents, timestamps in
+//   milliseconds...) are scaled to integers and stored as deltas (or, for
+//   timestamps, deltas of deltas); other doubles are XORed with the previous
+//   value, as a bit stream of meaningful bits
+// - the type takes two bits
+// each column is decoded in its own loop over a flat array, before trades are
+// assembled, so that the hot loops are branch-light and vectorizable
+
+
+class TradeCodec {
+public:
+
+    // raw is an array of packed trades
+    static inline void encode(const char* raw, const size_t raw_size, std::string& output) {
+        if (raw_size % sizeof(Trade)) {
+            throw Exception("TradeCodec can only encode whole trades", raw_size, sizeof(Trade));
+        }
+        const size_t count = raw_size / sizeof(Trade);
+        const Trade* trades = (const Trade*) raw;
+        output.clear();
+        put(output, (uint32_t) count);
+        std::vector<double> doubles(count);
+        // same order as in the struct
+        encode_integers(trades, count, &Trade::id, output);
+        encode_doubles(trades, count, [](const Trade& trade) { return trade.volume; }, doubles, 1, output);
+        encode_doubles(trades, count, [](const Trade& trade) { return trade.price; }, doubles, 1, output);
+        encode_types(trades, count, output);
+        encode_doubles(trades, count, [](const Trade& trade) { return (double) trade.timestamp; }, doubles, 2, output);
+        encode_integers(trades, count, &Trade::decision_id, output);
+        encode_integers(trades, count, &Trade::buy_order_id, output);
+        encode_integers(trades, count, &Trade::sell_order_id, output);
+    }
+
+    // output is resized to the trades, as packed bytes
+    static inline void decode(const char* data, const size_t size, std::string& output) {
+        Reader reader(data, size);
+        const size_t count = reader.get<uint32_t>();
+        output.resize(count * sizeof(Trade));
+        Trade* trades = (Trade*) &output[0];
+        std::vector<int64_t> integers(count);
+        std::vector<double> doubles(count);
+        decode_integers(reader, trades, count, offsetof(Trade, id), integers);
+        decode_doubles(reader, trades, count, offsetof(Trade, volume), integers, doubles);
+        decode_doubles(reader, trades, count, offsetof(Trade, price), integers, doubles);
+        decode_types(reader, trades, count);
+        decode_doubles(reader, trades, count, offsetof(Trade, timestamp), integers, doubles);
+        decode_integers(reader, trades, count, offsetof(Trade, decision_id), integers);
+        decode_integers(reader, trades, count, offsetof(Trade, buy_order_id), integers);
+        decode_integers(reader, trades, count, offsetof(Trade, sell_order_id), integers);
+    }
+
+private:
+
+    enum ColumnMode : uint8_t {
+        INTEGER_DELTA = 1,
+        DOUBLE_SCALED = 2,
+        DOUBLE_XOR = 3,
+        TYPE_PACKED = 4,
+        TYPE_RAW = 5,
+    };
+
+    // encoding primitives
+
+    template <typename T>
+    static inline void put(std::string& output, const T value) {
+        output.append((const char*) &value, sizeof(T));
+    }
+    static inline void put_varint(std::string& output, uint64_t value) {
+        while (value >= 0x80) {
+            output.push_back((char) (value | 0x80));
+            value >>= 7;
+        }
+        output.push_back((char) value);
+    }
+    static inline const uint64_t zigzag(const int64_t value) {
+        return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+    }
+    static inline const int64_t unzigzag(const uint64_t value) {
+        return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+    }
+
+    class BitWriter {
+    public:
+        inline BitWriter(std::string& output) : _output(output), _buffer(0), _count(0) {}
+        inline void write(const uint64_t value, const int bits) {
+            for (int written=0; written<bits; ) {
+                const int chunk = std::min(bits - written, 64 - _count);
+                const uint64_t part = (value >> (bits - written - chunk)) & (chunk == 64 ? ~0ULL : ((1ULL << chunk) - 1));
+                _buffer = (chunk == 64) ? part : ((_buffer << chunk) | part);
+                _count += chunk;
+                written += chunk;
+                if (_count == 64) {
+                    put(_output, __builtin_bswap64(_buffer));
+                    _buffer = 0;
+                    _count = 0;
+                }
+            }
+        }
+        inline void finish() {
+            if (_count) {
+                const uint64_t value = __builtin_bswap64(_buffer << (64 - _count));
+                _output.append((const char*) &value, (_count + 7) / 8);
+            }
+        }
+    private:
+        std::string& _output;
+        uint64_t _buffer;
+        int _count;
+    };
+
+    class Reader {
+    public:
+        inline Reader(const char* data, const size_t size) : _data((const uint8_t*) data), _end((const uint8_t*) data + size) {}
+        template <typename T>
+        inline const T get() {
+            check(sizeof(T));
+            T value;
+            memcpy(&value, _data, sizeof(T));
+            _data += sizeof(T);
+            return value;
+        }
+        inline const uint64_t get_varint() {
+            uint64_t value = 0;
+            for (int shift=0; ; shift+=7) {
+                check(1);
+                const uint8_t byte = *_data++;
+                value |= (uint64_t) (byte & 0x7f) << shift;
+                if (byte < 0x80) {
+                    return value;
+                }
+            }
+        }
+        inline const uint8_t* skip(const size_t size) {
+            check(size);
+            const uint8_t* data = _data;
+            _data += size;
+            return data;
+        }
+        inline void check(const size_t size) const {
+            if (_data + size > _end) {
+                throw Exception("TradeCodec reached the end of the data");
+            }
+        }
+    private:
+        const uint8_t* _data;
+        const uint8_t* _end;
+    };
+
+    class BitReader {
+    public:
+        inline BitReader(const uint8_t* data, const size_t size) : _data(data), _size(size), _position(0) {}
+        inline const uint64_t read(const int bits) {
+            uint64_t value = 0;
+            for (int i=0; i<bits; ) {
+                const size_t byte = _position >> 3;
+                if (byte >= _size) {
+                    throw Exception("TradeCodec reached the end of the bit stream");
+                }
+                const int offset = _position & 7;
+                const int chunk = std::min(bits - i, 8 - offset);
+                value = (value << chunk) | ((_data[byte] >> (8 - offset - chunk)) & ((1 << chunk) - 1));
+                _position += chunk;
+                i += chunk;
+            }
+            return value;
+        }
+    private:
+        const uint8_t* _data;
+        const size_t _size;
+        size_t _position;
+    };
+
+    // columns are preceded by their mode and size
+    static inline const size_t begin_column(std::string& output, const ColumnMode mode) {
+        output.push_back((char) mode);
+        put(output, (uint32_t) 0);
+        return output.size();
+    }
+    static inline void end_column(std::string& output, const size_t begin) {
+        const uint32_t size = output.size() - begin;
+        memcpy(&output[begin - sizeof(uint32_t)], &size, sizeof(size));
+    }
+
+    static inline void encode_integers(const Trade* trades, const size_t count, uint64_t Trade::*field, std::string& output) {
+        const size_t begin = begin_column(output, INTEGER_DELTA);
+        uint64_t previous = 0;
+        for (size_t i=0; i<count; ++i) {
+            const uint64_t value = trades[i].*field;
+            put_varint(output, zigzag((int64_t) (value - previous)));
+            previous = value;
+        }
+        end_column(output, begin);
+    }
+
+    // order is 1 for deltas, 2 for deltas of deltas
+    template <typename Getter>
+    static inline void encode_doubles(const Trade* trades, const size_t count, Getter getter, std::vector<double>& values, const int order, std::string& output) {
+        for (size_t i=0; i<count; ++i) {
+            values[i] = getter(trades[i]);
+        }
+        const int scale = find_scale(values);
+        if (scale >= 0) {
+            const size_t begin = begin_column(output, DOUBLE_SCALED);
+            output.push_back((char) scale);
+            output.push_back((char) order);
+            const double factor = powers[scale];
+            int64_t previous = 0;
+            int64_t previous_delta = 0;
+            for (size_t i=0; i<count; ++i) {
+                const int64_t value = std::llround(values[i] * factor);
+                const int64_t delta = value - previous;
+                put_varint(output, zigzag(order == 2 ? delta - previous_delta : delta));
+                previous = value;
+                previous_delta = delta;
+            }
+            end_column(output, begin);
+            return;
+        }
+        // as in Gorilla: a bit when equal to the previous value, otherwise
+        // the meaningful bits of the XOR, within the previous window when
+        // they fit in it
+        const size_t begin = begin_column(output, DOUBLE_XOR);
+        BitWriter writer(output);
+        uint64_t previous = 0;
+        int previous_leading = 65;
+        int previous_trailing = 0;
+        for (size_t i=0; i<count; ++i) {
+            uint64_t bits;
+            memcpy(&bits, &values[i], sizeof(bits));
+            const uint64_t x = bits ^ previous;
+            previous = bits;
+            if (x == 0) {
+                writer.write(0, 1);
+                continue;
+            }
+            const int leading = __builtin_clzll(x);
+            const int trailing = __builtin_ctzll(x);
+            if (leading >= previous_leading && trailing >= previous_trailing) {
+                writer.write(2, 2);
+                writer.write(x >> previous_trailing, 64 - previous_leading - previous_trailing);
+            } else {
+                const int meaningful = 64 - leading - trailing;
+                writer.write(3, 2);
+                writer.write(leading, 6);
+                writer.write(meaningful - 1, 6);
+                writer.write(x >> trailing, meaningful);
+                previous_leading = leading;
+                previous_trailing = trailing;
+            }
+        }
+        writer.finish();
+        end_column(output, begin);
+    }
+
+    // smallest power of ten turning every value into an exact integer
+    static inline const int find_scale(const std::vector<double>& values) {
+        for (int scale=0; scale<=9; ++scale) {
+            const double factor = powers[scale];
+            bool is_exact = true;
+            for (const double value : values) {
+                const double scaled = value * factor;
+                if (!(std::abs(scaled) < 9e15)) {
+                    return -1;
+                }
+                const double decoded = (double) std::llround(scaled) / factor;
+                if (memcmp(&decoded, &value, sizeof(double)) != 0) {
+                    is_exact = false;
+                    break;
+                }
+            }
+            if (is_exact) {
+                return scale;
+            }
+        }
+        return -1;
+    }
+
+    static inline void encode_types(const Trade* trades, const size_t count, std::string& output) {
+        for (size_t i=0; i<count; ++i) {
+            if (trades[i].type < -1 || trades[i].type > 2) {
+                const size_t begin = begin_column(output, TYPE_RAW);
+                for (size_t j=0; j<count; ++j) {
+                    put(output, (int32_t) trades[j].type);
+                }
+                end_column(output, begin);
+                return;
+            }
+        }
+        const size_t begin = begin_column(output, TYPE_PACKED);
+        for (size_t i=0; i<count; i+=4) {
+            uint8_t byte = 0;
+            for (size_t j=i; j<count && j<i+4; ++j) {
+                byte |= (uint8_t) (trades[j].type + 1) << (2 * (j - i));
+            }
+            output.push_back((char) byte);
+        }
+        end_column(output, begin);
+    }
+
+    // decoding
+
+    template <typename T>
+    static inline void scatter(Trade* trades, const size_t count, const size_t offset, const T* values) {
+        char* destination = (char*) trades + offset;
+        for (size_t i=0; i<count; ++i, destination+=sizeof(Trade)) {
+            memcpy(destination, &values[i], sizeof(T));
+        }
+    }
+
+    static inline void decode_integers(Reader& reader, Trade* trades, const size_t count, const size_t offset, std::vector<int64_t>& values) {
+        if (reader.get<uint8_t>() != INTEGER_DELTA) {
+            throw Exception("TradeCodec found an unknown integer column");
+        }
+        const uint32_t size = reader.get<uint32_t>();
+        Reader column((const char*) reader.skip(size), size);
+        for (size_t i=0; i<count; ++i) {
+            values[i] = unzigzag(column.get_varint());
+        }
+        prefix_sum(values.data(), count);
+        scatter(trades, count, offset, values.data());
+    }
+
+    static inline void prefix_sum(int64_t* values, const size_t count) {
+        int64_t sum = 0;
+        for (size_t i=0; i<count; ++i) {
+            sum += values[i];
+            values[i] = sum;
+        }
+    }
+
+    static inline void decode_doubles(Reader& reader, Trade* trades, const size_t count, const size_t offset, std::vector<int64_t>& integers, std::vector<double>& values) {
+        const uint8_t mode = reader.get<uint8_t>();
+        const uint32_t size = reader.get<uint32_t>();
+        const uint8_t* data = reader.skip(size);
+        if (mode == DOUBLE_SCALED) {
+            Reader column((const char*) data, size);
+            const int scale = column.get<uint8_t>();
+            const int order = column.get<uint8_t>();
+            if (scale > 9) {
+                throw Exception("TradeCodec found an unknown scale", scale);
+            }
+            for (size_t i=0; i<count; ++i) {
+                integers[i] = unzigzag(column.get_varint());
+            }
+            for (int o=0; o<order; ++o) {
+                prefix_sum(integers.data(), count);
+            }
+            const double factor = powers[scale];
+            for (size_t i=0; i<count; ++i) {
+                values[i] = (double) integers[i] / factor;
+            }
+        } else if (mode == DOUBLE_XOR) {
+            BitReader bits(data, size);
+            uint64_t previous = 0;
+            int leading = 0;
+            int trailing = 0;
+            for (size_t i=0; i<count; ++i) {
+                if (bits.read(1)) {
+                    if (bits.read(1)) {
+                        leading = bits.read(6);
+                        const int meaningful = bits.read(6) + 1;
+                        trailing = 64 - leading - meaningful;
+                    }
+                    previous ^= bits.read(64 - leading - trailing) << trailing;
+                }
+                memcpy(&values[i], &previous, sizeof(double));
+            }
+        } else {
+            throw Exception("TradeCodec found an unknown double column", (int) mode);
+        }
+        scatter(trades, count, offset, values.data());
+    }
+
+    static inline void decode_types(Reader& reader, Trade* trades, const size_t count) {
+        const uint8_t mode = reader.get<uint8_t>();
+        const uint32_t size = reader.get<uint32_t>();
+        const uint8_t* data = reader.skip(size);
+        std::vector<int32_t> types(count);
+        if (mode == TYPE_PACKED && size == (count + 3) / 4) {
+            for (size_t i=0; i<count; ++i) {
+                types[i] = (int32_t) ((data[i >> 2] >> (2 * (i & 3))) & 3) - 1;
+            }
+        } else if (mode == TYPE_RAW && size == count * sizeof(int32_t)) {
+            memcpy(types.data(), data, size);
+        } else {
+            throw Exception("TradeCodec found an unknown type column", (int) mode);
+        }
+        scatter(trades, count, offsetof(Trade, type), types.data());
+    }
+
+    static constexpr double powers[10] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+};
+
+
+#endif // CTRADING__DB__TRADECODEC__HPP
@@ -7,6 +7,14 @@
 #include <unistd.h>
 #include <string>
 #include <exception>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <thread>
 
 #include <ups/upscaledb.h>
 
@@ -31,125 +39,284 @@ protected:
 };
 
 
+// conflicts between transactions, retried with a growing delay
+struct UpscaleDBMetrics {
+    size_t conflicted_calls;
+    size_t conflicts;
+    double backoff_duration;
+};
+
+struct UpscaleDBCounters {
+    std::atomic<size_t> conflicted_calls;
+    std::atomic<size_t> conflicts;
+    std::atomic<uint64_t> backoff_microseconds;
+};
+
+inline UpscaleDBCounters& get_upscaledb_counters() {
+    static UpscaleDBCounters counters = {{0}, {0}, {0}};
+    return counters;
+}
+inline const UpscaleDBMetrics get_upscaledb_metrics() {
+    const UpscaleDBCounters& counters = get_upscaledb_counters();
+    return {counters.conflicted_calls, counters.conflicts, 1e-6 * counters.backoff_microseconds};
+}
+
+// delays double from 1us up to 1ms, and are drawn within their upper half
+// so that conflicting threads do not retry in lockstep
+static const useconds_t upscaledb_backoff_min = 1;
+static const useconds_t upscaledb_backoff_max = 1024;
+
+template <typename Call>
+inline const ups_status_t upscaledb_call(const Call& call) {
+    ups_status_t status = call();
+    if (status != UPS_TXN_CONFLICT) {
+        return status;
+    }
+    UpscaleDBCounters& counters = get_upscaledb_counters();
+    ++counters.conflicted_calls;
+    thread_local std::minstd_rand random(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    useconds_t backoff = upscaledb_backoff_min;
+    do {
+        const useconds_t delay = backoff / 2 + random() % (backoff / 2 + 1);
+        ++counters.conflicts;
+        counters.backoff_microseconds += delay;
+        usleep(delay);
+        backoff = std::min(2 * backoff, upscaledb_backoff_max);
+        status = call();
+    } while (status == UPS_TXN_CONFLICT);
+    return status;
+}
+
+// end of a cursor, or key absent: expected when reading, not worth an exception
+inline const bool upscaledb_is_not_found(const ups_status_t status) {
+    return status == UPS_KEY_NOT_FOUND || status == UPS_INV_PARAMETER || status == UPS_CURSOR_IS_NIL;
+}
+
+
+// evaluates to the status of the call, once there is no conflict
+#define UPS_STATUS_CALL(METHOD, ...) upscaledb_call([&] { return METHOD(__VA_ARGS__); })
+
 #define UPS_SAFE_CALL(METHOD, ...) { \
-    ups_status_t STATUS = UPS_SUCCESS; \
-    while (true) { \
-        STATUS = METHOD(__VA_ARGS__); \
-        if (STATUS == UPS_TXN_CONFLICT) { \
-            usleep(1); \
-        } else { \
-            break; \
-        } \
-    } \
+    const ups_status_t STATUS = UPS_STATUS_CALL(METHOD, __VA_ARGS__); \
     if (STATUS != UPS_SUCCESS) { \
         throw UpscaleDBException(#METHOD, STATUS, __VA_ARGS__); \
     } \
 }
 
 
+// a read transaction, with the cursors opened within it; readers holding it
+// keep seeing the same data, until they take a fresh one from the tree
+class UpscaleBTreeSnapshot {
+public:
+
+    inline UpscaleBTreeSnapshot(ups_env_t* ups_env, ups_db_t* ups_db) :
+        _ups_db(ups_db)
+    {
+        UPS_SAFE_CALL(ups_txn_begin,
+            &_ups_txn,
+            ups_env,
+            "READER",
+            NULL,
+            0
+        )
+    }
+    inline ~UpscaleBTreeSnapshot() {
+        for (ups_cursor_t* ups_cursor : _ups_cursors) {
+            ups_cursor_close(ups_cursor);
+        }
+        ups_txn_abort(_ups_txn, 0);
+    }
+
+    inline ups_txn_t* get_txn() const {
+        return _ups_txn;
+    }
+
+    // cursors are reused by the next readers instead of being closed
+    inline ups_cursor_t* acquire_cursor() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_ups_cursors.empty()) {
+                ups_cursor_t* ups_cursor = _ups_cursors.back();
+                _ups_cursors.pop_back();
+                return ups_cursor;
+            }
+        }
+        ups_cursor_t* ups_cursor;
+        UPS_SAFE_CALL(ups_cursor_create,
+            &ups_cursor,
+            _ups_db,
+            _ups_txn,
+            0 // flags (unused)
+        );
+        return ups_cursor;
+    }
+    inline void release_cursor(ups_cursor_t* ups_cursor) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _ups_cursors.push_back(ups_cursor);
+    }
+
+private:
+
+    ups_db_t* _ups_db;
+    ups_txn_t* _ups_txn;
+    std::mutex _mutex;
+    std::vector<ups_cursor_t*> _ups_cursors;
+};
+
+
+// a cursor taken from a snapshot, given back when destroyed
+class UpscaleBTreeCursor {
+public:
+
+    inline UpscaleBTreeCursor(const std::shared_ptr<UpscaleBTreeSnapshot>& snapshot) :
+        _snapshot(snapshot),
+        _ups_cursor(snapshot->acquire_cursor()) {}
+    inline ~UpscaleBTreeCursor() {
+        release();
+    }
+
+    inline ups_cursor_t* get() const {
+        return _ups_cursor;
+    }
+    inline void release() {
+        if (_ups_cursor) {
+            _snapshot->release_cursor(_ups_cursor);
+            _ups_cursor = NULL;
+        }
+    }
+
+private:
+
+    std::shared_ptr<UpscaleBTreeSnapshot> _snapshot;
+    ups_cursor_t* _ups_cursor;
+};
+
+
+// records are read by batches of prefetch_size, after which the cursor is
+// given back if the range is over
 template <typename key_t, typename record_t>
 class UpscaleBTreeRangeData : public RangeData<record_t> {
 public:
 
-    inline UpscaleBTreeRangeData(ups_db_t* ups_db, ups_txn_t* ups_txn) :
-        _ups_db(ups_db),
-        _ups_txn(ups_txn),
+    inline UpscaleBTreeRangeData(const std::shared_ptr<UpscaleBTreeSnapshot>& snapshot, const size_t prefetch_size) :
+        _snapshot(snapshot),
+        _prefetch_size(std::max<size_t>(prefetch_size, 1)),
         _is_fullrange(true),
         _is_point(false),
         _is_reverse(false),
-        _ups_key({.size=sizeof(key_t), .data=&_key, .flags=UPS_RECORD_USER_ALLOC}),
-        _ups_record({.size=sizeof(record_t), .data=&_record, .flags=UPS_RECORD_USER_ALLOC})
+        _ups_key({.size=sizeof(key_t), .data=&_key, .flags=UPS_RECORD_USER_ALLOC})
         {}
-    inline UpscaleBTreeRangeData(ups_db_t* ups_db, ups_txn_t* ups_txn, const key_t& key_target) :
-        UpscaleBTreeRangeData(ups_db, ups_txn, key_target)
-        {}
-    inline UpscaleBTreeRangeData(ups_db_t* ups_db, ups_txn_t* ups_txn, const key_t& key_begin, const key_t& key_end) :
-        _ups_db(ups_db),
-        _ups_txn(ups_txn),
+    inline UpscaleBTreeRangeData(const std::shared_ptr<UpscaleBTreeSnapshot>& snapshot, const size_t prefetch_size, const key_t& key_begin, const key_t& key_end) :
+        _snapshot(snapshot),
+        _prefetch_size(std::max<size_t>(prefetch_size, 1)),
         _is_fullrange(false),
         _is_point(key_begin == key_end),
         _is_reverse(key_end < key_begin),
         _key(key_begin),
         _key_begin(key_begin),
         _key_end(key_end),
-        _ups_key({.size=sizeof(key_t), .data=&_key, .flags=UPS_RECORD_USER_ALLOC}),
-        _ups_record({.size=sizeof(record_t), .data=&_record, .flags=UPS_RECORD_USER_ALLOC})
+        _ups_key({.size=sizeof(key_t), .data=&_key, .flags=UPS_RECORD_USER_ALLOC})
         {}
 
-    inline ~UpscaleBTreeRangeData() {
-        if (_ups_cursor) {
-            ups_cursor_close(_ups_cursor);
-            _ups_cursor = NULL;
+    virtual const bool init(record_t*& value) {
+        _records.resize(_prefetch_size * sizeof(record_t));
+        _cursor.reset(new UpscaleBTreeCursor(_snapshot));
+        _count = 0;
+        _index = 0;
+        _is_finished = false;
+        const bool is_found = _is_fullrange
+            ? move(UPS_CURSOR_FIRST)
+            : find(_is_point ? UPS_FIND_EQ_MATCH : (_is_reverse ? UPS_FIND_LEQ_MATCH : UPS_FIND_GT_MATCH));
+        if (!is_found || !accept()) {
+            return false;
         }
+        prefetch();
+        value = get_record(0);
+        return true;
     }
-
-    virtual const bool init(record_t*& value) {
-        value = &_record;
-        UPS_SAFE_CALL(ups_cursor_create,
-            &_ups_cursor,
-            _ups_db,
-            _ups_txn, // transaction
-            0 // flags (unused)
-        );
-        try {
-            if (_is_fullrange) {
-                UPS_SAFE_CALL(ups_cursor_move,
-                    _ups_cursor,
-                    &_ups_key,
-                    &_ups_record,
-                    UPS_CURSOR_FIRST
-                );
-            } else {
-                UPS_SAFE_CALL(ups_cursor_find,
-                    _ups_cursor,
-                    &_ups_key,
-                    &_ups_record,
-                    _is_point ? UPS_FIND_EQ_MATCH : (_is_reverse ? UPS_FIND_GEQ_MATCH : UPS_FIND_GT_MATCH)
-                );
+    virtual const bool next(record_t*& value) {
+        if (++_index >= _count) {
+            if (_is_finished) {
+                return false;
             }
-            return true;
-        } catch (const UpscaleDBException& exception) {
-            if (exception.get_status() == UPS_KEY_NOT_FOUND || exception.get_status() == UPS_INV_PARAMETER || exception.get_status() == UPS_CURSOR_IS_NIL) {
+            _count = 0;
+            _index = 0;
+            prefetch();
+            if (_count == 0) {
                 return false;
             }
-            throw exception;
         }
+        value = get_record(_index);
+        return true;
     }
-    virtual const bool next(record_t*& value) {
-        try {
-            UPS_SAFE_CALL(ups_cursor_move,
-                _ups_cursor,
-                &_ups_key,
-                &_ups_record,
-                _is_reverse ? UPS_CURSOR_PREVIOUS : UPS_CURSOR_NEXT
-            );
-        } catch (const UpscaleDBException& exception) {
-            if (exception.get_status() == UPS_KEY_NOT_FOUND || exception.get_status() == UPS_INV_PARAMETER) {
-                return false;
-            } else {
-                throw exception;
-            }
+
+private:
+
+    inline record_t* get_record(const size_t index) {
+        return (record_t*) &_records[index * sizeof(record_t)];
+    }
+    // false when there is nothing more to read
+    inline const bool find(const uint32_t flags) {
+        ups_record_t ups_record = {.size=sizeof(record_t), .data=get_record(_count), .flags=UPS_RECORD_USER_ALLOC};
+        return check("ups_cursor_find", UPS_STATUS_CALL(ups_cursor_find,
+            _cursor->get(),
+            &_ups_key,
+            &ups_record,
+            flags
+        ));
+    }
+    inline const bool move(const uint32_t flags) {
+        ups_record_t ups_record = {.size=sizeof(record_t), .data=get_record(_count), .flags=UPS_RECORD_USER_ALLOC};
+        return check("ups_cursor_move", UPS_STATUS_CALL(ups_cursor_move,
+            _cursor->get(),
+            &_ups_key,
+            &ups_record,
+            flags
+        ));
+    }
+    inline const bool check(const std::string& method, const ups_status_t status) {
+        if (status == UPS_SUCCESS) {
+            return true;
         }
-        if ((!_is_fullrange && (!_is_reverse && _key > _key_end)) || (_is_reverse && _key < _key_end)) {
+        if (upscaledb_is_not_found(status)) {
+            finish();
             return false;
         }
+        throw UpscaleDBException(method, status);
+    }
+    // whether the record just read belongs to the range
+    inline const bool accept() {
+        if (!_is_fullrange && (_is_reverse ? (_key < _key_end) : (_key > _key_end))) {
+            finish();
+            return false;
+        }
+        ++_count;
         return true;
     }
+    inline void finish() {
+        _is_finished = true;
+        _cursor->release();
+    }
+    inline void prefetch() {
+        while (!_is_finished && _count < _prefetch_size && move(_is_reverse ? UPS_CURSOR_PREVIOUS : UPS_CURSOR_NEXT)) {
+            accept();
+        }
+    }
 
-private:
-
+    std::shared_ptr<UpscaleBTreeSnapshot> _snapshot;
+    std::unique_ptr<UpscaleBTreeCursor> _cursor;
+    const size_t _prefetch_size;
     bool _is_reverse;
     bool _is_fullrange;
     bool _is_point;
+    bool _is_finished;
     key_t _key;
-    record_t _record;
-    ups_key_t _ups_key;
-    ups_record_t _ups_record;
-    //
     key_t _key_begin, _key_end;
-    ups_db_t* _ups_db;
-    ups_txn_t* _ups_txn;
-    ups_cursor_t* _ups_cursor;
+    ups_key_t _ups_key;
+    // records are not constructed, as some constructors are costly
+    std::vector<char> _records;
+    size_t _count;
+    size_t _index;
 };
 
 
@@ -157,16 +324,11 @@ template <typename key_t, typename record_t>
 class UpscaleBTreeRange : public Range<record_t> {
 public:
 
-    UpscaleBTreeRange(ups_db_t* ups_db, ups_txn_t* ups_txn) :
-        Range<record_t>(new UpscaleBTreeRangeData<key_t, record_t>(ups_db, ups_txn)) {}
-
-    template <typename key_begin_t, typename key_end_t>
-    UpscaleBTreeRange(ups_db_t* ups_db, ups_txn_t* ups_txn, const key_begin_t& key_target) :
-        Range<record_t>(new UpscaleBTreeRangeData<key_t, record_t>(ups_db, ups_txn, key_target)) {}
+    UpscaleBTreeRange(const std::shared_ptr<UpscaleBTreeSnapshot>& snapshot, const size_t prefetch_size) :
+        Range<record_t>(new UpscaleBTreeRangeData<key_t, record_t>(snapshot, prefetch_size)) {}
 
-    template <typename key_begin_t, typename key_end_t>
-    UpscaleBTreeRange(ups_db_t* ups_db, ups_txn_t* ups_txn, const key_begin_t& key_begin, const key_end_t& key_end) :
-        Range<record_t>(new UpscaleBTreeRangeData<key_t, record_t>(ups_db, ups_txn, key_begin, key_end)) {}
+    UpscaleBTreeRange(const std::shared_ptr<UpscaleBTreeSnapshot>& snapshot, const size_t prefetch_size, const key_t& key_begin, const key_t& key_end) :
+        Range<record_t>(new UpscaleBTreeRangeData<key_t, record_t>(snapshot, prefetch_size, key_begin, key_end)) {}
 };
 
 
@@ -203,11 +365,17 @@ template <typename key_t, typename record_t>
 class UpscaleBTree {
 public:
 
-    UpscaleBTree(const std::string& path, const bool allow_duplicates=true, const size_t cache_size=1<<24, const bool autocommit=false) :
+    // ranges read records by batches of prefetch_size; readers may see a
+    // snapshot lagging behind writes by snapshot_lifetime seconds, which
+    // lets them share its cursors
+    UpscaleBTree(const std::string& path, const bool allow_duplicates=true, const size_t cache_size=1<<24, const bool autocommit=false, const size_t prefetch_size=64, const double snapshot_lifetime=0.) :
         _path(path),
         _allow_duplicates(allow_duplicates),
         _cache_size(cache_size),
-        _autocommit(autocommit)
+        _autocommit(autocommit),
+        _prefetch_size(prefetch_size),
+        _snapshot_lifetime(snapshot_lifetime),
+        _is_snapshot_stale(false)
     {
         // create directory
         make_directory(extract_directory(path));
@@ -217,26 +385,23 @@ public:
             {0, 0},
             {0, 0},
         };
-        try {
-            UPS_SAFE_CALL(ups_env_open,
+        const ups_status_t open_status = UPS_STATUS_CALL(ups_env_open,
+            &_ups_env,
+            _path.c_str(),
+            UPS_AUTO_RECOVERY | UPS_ENABLE_TRANSACTIONS | (_autocommit ? UPS_ENABLE_FSYNC : 0),
+            ups_env_parameters
+        );
+        if (open_status == UPS_FILE_NOT_FOUND) {
+            ups_env_parameters[1] = {UPS_PARAM_PAGE_SIZE, 4096};
+            UPS_SAFE_CALL(ups_env_create,
                 &_ups_env,
                 _path.c_str(),
                 UPS_AUTO_RECOVERY | UPS_ENABLE_TRANSACTIONS | (_autocommit ? UPS_ENABLE_FSYNC : 0),
+                0644,
                 ups_env_parameters
             );
-        } catch (const UpscaleDBException& exception) {
-            if (exception.get_status() == UPS_FILE_NOT_FOUND) {
-                ups_env_parameters[1] = {UPS_PARAM_PAGE_SIZE, 4096};
-                UPS_SAFE_CALL(ups_env_create,
-                    &_ups_env,
-                    _path.c_str(),
-                    UPS_AUTO_RECOVERY | UPS_ENABLE_TRANSACTIONS | (_autocommit ? UPS_ENABLE_FSYNC : 0),
-                    0644,
-                    ups_env_parameters
-                );
-            } else {
-                throw exception;
-            }
+        } else if (open_status != UPS_SUCCESS) {
+            throw UpscaleDBException("ups_env_open", open_status, _path);
         }
         // create database
         ups_parameter_t ups_db_parameters[] = {
@@ -250,40 +415,30 @@ public:
             },
             {0, 0}
         };
-        try {
-            UPS_SAFE_CALL(ups_env_create_db,
+        const ups_status_t create_status = UPS_STATUS_CALL(ups_env_create_db,
+            _ups_env,
+            &_ups_db,
+            1, // name
+            (_allow_duplicates ? UPS_ENABLE_DUPLICATE_KEYS : 0),
+            ups_db_parameters
+        );
+        if (create_status == UPS_DATABASE_ALREADY_EXISTS) {
+            ups_db_parameters[0] = {0, 0};
+            UPS_SAFE_CALL(ups_env_open_db,
                 _ups_env,
                 &_ups_db,
                 1, // name
-                (_allow_duplicates ? UPS_ENABLE_DUPLICATE_KEYS : 0),
+                0, // flags
                 ups_db_parameters
             );
-        } catch (const UpscaleDBException& exception) {
-            if (exception.get_status() == UPS_DATABASE_ALREADY_EXISTS) {
-                ups_db_parameters[0] = {0, 0};
-                UPS_SAFE_CALL(ups_env_open_db,
-                    _ups_env,
-                    &_ups_db,
-                    1, // name
-                    0, // flags
-                    ups_db_parameters
-                );
-            } else {
-                throw exception;
-            }
+        } else if (create_status != UPS_SUCCESS) {
+            throw UpscaleDBException("ups_env_create_db", create_status, _path);
         }
-        // create transaction
-        UPS_SAFE_CALL(ups_txn_begin,
-            &_ups_read_txn,
-            _ups_env,
-            "READER",
-            NULL,
-            0
-        )
     }
 
+    // ranges and snapshots must not outlive the tree
     inline ~UpscaleBTree() {
-        ups_txn_abort(_ups_read_txn, 0);
+        _snapshot.reset();
         ups_env_close(_ups_env, UPS_AUTO_CLEANUP);
         _ups_env = NULL;
     }
@@ -292,6 +447,16 @@ public:
         return _path;
     }
 
+    // taken after a write, readers see it; successive queries on the same
+    // snapshot see the same data
+    inline std::shared_ptr<UpscaleBTreeSnapshot> get_snapshot() {
+        std::lock_guard<std::mutex> lock(_snapshot_mutex);
+        if (!_snapshot || (_is_snapshot_stale && std::chrono::duration<double>(std::chrono::steady_clock::now() - _snapshot_time).count() >= _snapshot_lifetime)) {
+            refresh();
+        }
+        return _snapshot;
+    }
+
     inline void insert(key_t& key, record_t& record) {
         ups_key_t ups_key = {
             .size = sizeof(key_t),
@@ -312,159 +477,127 @@ public:
             NULL,
             0
         )
-        try {
-            UPS_SAFE_CALL(ups_db_insert,
-                _ups_db,
-                NULL, // transaction
-                &ups_key,
-                &ups_record,
-                (_allow_duplicates ? UPS_DUPLICATE : 0) // flags
-            );
-        } catch (const UpscaleDBException& exception) {
-            if (exception.get_status() == UPS_DUPLICATE_KEY) {
+        const ups_status_t status = UPS_STATUS_CALL(ups_db_insert,
+            _ups_db,
+            NULL, // transaction
+            &ups_key,
+            &ups_record,
+            (_allow_duplicates ? UPS_DUPLICATE : 0) // flags
+        );
+        if (status != UPS_SUCCESS) {
+            ups_txn_abort(ups_write_txn, 0);
+            if (status == UPS_DUPLICATE_KEY) {
                 throw DBDuplicateException(key);
-            } else {
-                throw exception;
             }
+            throw UpscaleDBException("ups_db_insert", status, key);
         }
         UPS_SAFE_CALL(ups_txn_commit,
             ups_write_txn,
             0
         )
+        _is_snapshot_stale = true;
     }
 
     inline UpscaleBTreeRange<key_t, record_t> get() {
-        return UpscaleBTreeRange<key_t, record_t>(_ups_db, _ups_read_txn);
+        return get(get_snapshot());
     }
     inline UpscaleBTreeRange<key_t, record_t> get(key_t key_target) {
-        return UpscaleBTreeRange<key_t, record_t>(_ups_db, _ups_read_txn, key_target, key_target);
+        return get(get_snapshot(), key_target);
     }
     inline UpscaleBTreeRange<key_t, record_t> get(key_t key_begin, key_t key_end) {
-        return UpscaleBTreeRange<key_t, record_t>(_ups_db, _ups_read_txn, key_begin, key_end);
+        return get(get_snapshot(), key_begin, key_end);
+    }
+    inline UpscaleBTreeRange<key_t, record_t> get(const std::shared_ptr<UpscaleBTreeSnapshot>& snapshot) {
+        return UpscaleBTreeRange<key_t, record_t>(snapshot, _prefetch_size);
+    }
+    inline UpscaleBTreeRange<key_t, record_t> get(const std::shared_ptr<UpscaleBTreeSnapshot>& snapshot, key_t key_target) {
+        return UpscaleBTreeRange<key_t, record_t>(snapshot, _prefetch_size, key_target, key_target);
+    }
+    inline UpscaleBTreeRange<key_t, record_t> get(const std::shared_ptr<UpscaleBTreeSnapshot>& snapshot, key_t key_begin, key_t key_end) {
+        return UpscaleBTreeRange<key_t, record_t>(snapshot, _prefetch_size, key_begin, key_end);
     }
 
     inline const bool contains(record_t& searched_record) {
         return count(searched_record, true);
     }
     inline const size_t count(const key_t searched_key, const record_t& searched_record, const bool& stop_at_first=false) {
-        // extract key
-        char* searched_record_pointer = (char*) &searched_record;
-        // initialize UPS key & record
-        record_t record;
-        ups_record_t ups_record = {
-            .size = sizeof(record_t),
-            .data = &record,
-            .flags = UPS_RECORD_USER_ALLOC,
-        };
-        char* record_pointer = (char*) &record;
-        key_t key = searched_key;
-        ups_key_t ups_key = {
-            .size = sizeof(key_t),
-            .data = &key,
-            .flags = UPS_RECORD_USER_ALLOC,
-        };
-        // create cursor & start it
-        ups_cursor_t* ups_cursor;
-        UPS_SAFE_CALL(ups_cursor_create,
-            &ups_cursor,
-            _ups_db,
-            _ups_read_txn,
-            0 // flags (unused)
-        );
-        try {
-            UPS_SAFE_CALL(ups_cursor_find,
-                ups_cursor,
-                &ups_key,
-                &ups_record,
-                UPS_FIND_GEQ_MATCH
-            );
-        } catch (const UpscaleDBException& exception) {
-            UPS_SAFE_CALL(ups_cursor_close,
-                ups_cursor
-            );
-            if (exception.get_status() == UPS_KEY_NOT_FOUND || exception.get_status() == UPS_INV_PARAMETER || exception.get_status() == UPS_CURSOR_IS_NIL) {
-                return 0;
-            } else {
-                throw exception;
-            }
-        }
-        // test until record is found... or not
-        size_t count = 0;
-        do {
-            if (key > searched_key) {
-                break;
-            }
-            if (record == searched_record) {
-                ++count;
-                if (stop_at_first) {
-                    break;
-                }
-            }
-            try {
-                UPS_SAFE_CALL(ups_cursor_move,
-                    ups_cursor,
-                    &ups_key,
-                    &ups_record,
-                    UPS_CURSOR_NEXT
-                );
-            } catch (const UpscaleDBException& exception) {
-                if (exception.get_status() == UPS_KEY_NOT_FOUND || exception.get_status() == UPS_INV_PARAMETER) {
-                    break;
-                }
-                UPS_SAFE_CALL(ups_cursor_close,
-                    ups_cursor
-                );
-                throw exception;
-            }
-        } while (true);
-        UPS_SAFE_CALL(ups_cursor_close,
-            ups_cursor
-        );
-        return count;
+        return count(searched_key, &searched_record, stop_at_first);
     }
     inline const bool contains(key_t& searched_key) {
         return count(searched_key, true);
     }
     inline const size_t count(const key_t& searched_key, const bool& stop_at_first=false) {
+        return count(searched_key, NULL, stop_at_first);
+    }
+
+    // number of records, duplicates included
+    inline const uint64_t get_count() {
+        uint64_t count = 0;
+        UPS_SAFE_CALL(ups_db_count,
+            _ups_db,
+            NULL, // transaction
+            0, // flags
+            &count
+        )
+        return count;
+    }
+
+    inline const key_t get_extremum_key(const bool is_lowest) {
+        key_t key;
+        ups_key_t ups_key = {.size=sizeof(key_t), .data=&key, .flags=UPS_RECORD_USER_ALLOC};
+        // only the key is read
+        UpscaleBTreeCursor cursor(get_snapshot());
+        UPS_SAFE_CALL(ups_cursor_move,
+            cursor.get(),
+            &ups_key,
+            NULL,
+            is_lowest ? UPS_CURSOR_FIRST : UPS_CURSOR_LAST
+        );
+        return key;
+    }
+    inline const key_t get_lowest_key() {
+        return get_extremum_key(true);
+    }
+    inline const key_t get_highest_key() {
+        return get_extremum_key(false);
+    }
+
+protected:
+
+    // the lock must be held
+    inline void refresh() {
+        _is_snapshot_stale = false;
+        _snapshot_time = std::chrono::steady_clock::now();
+        _snapshot = std::make_shared<UpscaleBTreeSnapshot>(_ups_env, _ups_db);
+    }
+
+    // records with the given key, and equal to the given record if any
+    inline const size_t count(const key_t& searched_key, const record_t* searched_record, const bool& stop_at_first) {
         // initialize UPS key & record
-        record_t record;
+        char record[sizeof(record_t)];
         ups_record_t ups_record = {
             .size = sizeof(record_t),
-            .data = &record,
+            .data = record,
             .flags = UPS_RECORD_USER_ALLOC,
         };
-        char* record_pointer = (char*) &record;
         key_t key = searched_key;
-        memcpy(&key, &searched_key, sizeof(key_t));
         ups_key_t ups_key = {
             .size = sizeof(key_t),
             .data = &key,
             .flags = UPS_RECORD_USER_ALLOC,
         };
-        // create cursor & start it
-        ups_cursor_t* ups_cursor;
-        UPS_SAFE_CALL(ups_cursor_create,
-            &ups_cursor,
-            _ups_db,
-            _ups_read_txn,
-            0 // flags (unused)
+        // take a cursor & start it
+        UpscaleBTreeCursor cursor(get_snapshot());
+        ups_status_t status = UPS_STATUS_CALL(ups_cursor_find,
+            cursor.get(),
+            &ups_key,
+            &ups_record,
+            UPS_FIND_GEQ_MATCH
         );
-        try {
-            UPS_SAFE_CALL(ups_cursor_find,
-                ups_cursor,
-                &ups_key,
-                &ups_record,
-                UPS_FIND_GEQ_MATCH
-            );
-        } catch (const UpscaleDBException& exception) {
-            UPS_SAFE_CALL(ups_cursor_close,
-                ups_cursor
-            );
-            if (exception.get_status() == UPS_KEY_NOT_FOUND || exception.get_status() == UPS_INV_PARAMETER || exception.get_status() == UPS_CURSOR_IS_NIL) {
-                return 0;
-            } else {
-                throw exception;
-            }
+        if (upscaledb_is_not_found(status)) {
+            return 0;
+        } else if (status != UPS_SUCCESS) {
+            throw UpscaleDBException("ups_cursor_find", status);
         }
         // test until record is found... or not
         size_t count = 0;
@@ -472,76 +605,42 @@ public:
             if (key > searched_key) {
                 break;
             }
-            if (key == searched_key) {
+            if (key == searched_key && (searched_record == NULL || memcmp(record, searched_record, sizeof(record_t)) == 0)) {
                 ++count;
                 if (stop_at_first) {
                     break;
                 }
             }
-            try {
-                UPS_SAFE_CALL(ups_cursor_move,
-                    ups_cursor,
-                    &ups_key,
-                    &ups_record,
-                    UPS_CURSOR_NEXT
-                );
-            } catch (const UpscaleDBException& exception) {
-                if (exception.get_status() == UPS_KEY_NOT_FOUND || exception.get_status() == UPS_INV_PARAMETER) {
-                    break;
-                }
-                UPS_SAFE_CALL(ups_cursor_close,
-                    ups_cursor
-                );
-                throw exception;
+            status = UPS_STATUS_CALL(ups_cursor_move,
+                cursor.get(),
+                &ups_key,
+                &ups_record,
+                UPS_CURSOR_NEXT
+            );
+            if (upscaledb_is_not_found(status)) {
+                break;
+            } else if (status != UPS_SUCCESS) {
+                throw UpscaleDBException("ups_cursor_move", status);
             }
         } while (true);
-        UPS_SAFE_CALL(ups_cursor_close,
-            ups_cursor
-        );
         return count;
     }
 
-    inline const key_t get_extremum_key(const bool is_lowest) {
-        key_t key;
-        record_t record;
-        ups_key_t ups_key = {.size=sizeof(key_t), .data=&key, .flags=UPS_RECORD_USER_ALLOC};
-        ups_record_t ups_record = {.size=sizeof(record_t), .data=&record, .flags=UPS_RECORD_USER_ALLOC};
-        ups_cursor_t* ups_cursor;
-        UPS_SAFE_CALL(ups_cursor_create,
-            &ups_cursor,
-            _ups_db,
-            _ups_read_txn, // transaction
-            0 // flags (unused)
-        );
-        UPS_SAFE_CALL(ups_cursor_move,
-            ups_cursor,
-            &ups_key,
-            &ups_record,
-            is_lowest ? UPS_CURSOR_FIRST : UPS_CURSOR_LAST
-        );
-        UPS_SAFE_CALL(ups_cursor_close,
-            ups_cursor
-        );
-        return key;
-    }
-    inline const key_t get_lowest_key() {
-        return get_extremum_key(true);
-    }
-    inline const key_t get_highest_key() {
-        return get_extremum_key(false);
-    }
-
-protected:
-
     // parameters
     std::string _path;
     bool _allow_duplicates;
     bool _autocommit;
     size_t _cache_size;
+    size_t _prefetch_size;
+    double _snapshot_lifetime;
     // internals
     ups_env_t* _ups_env;
     ups_db_t* _ups_db;
-    ups_txn_t* _ups_read_txn;
+    // snapshot for readers, replaced after writes
+    std::mutex _snapshot_mutex;
+    std::shared_ptr<UpscaleBTreeSnapshot> _snapshot;
+    std::chrono::steady_clock::time_point _snapshot_time;
+    std::atomic<bool> _is_snapshot_stale;
 };
 
 #ifndef typeof
@@ -0,0 +1,356 @@
+#ifndef CTRADING__HISTORY__BINARYLOGHISTORY__HPP
+#define CTRADING__HISTORY__BINARYLOGHISTORY__HPP
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+
+#include "./History.hpp"
+#include "exceptions/Exception.hpp"
+
+
+// a log made of length-prefixed, type-tagged records, holding the models as
+// they are in memory:
+// - path: a file header, then every record in the order it was fed
+// - path.index: for every record, its type and where its payload is; it lets
+//   a range only read the records of its type, and is rebuilt from the log
+//   when missing or behind
+// - optionally, a human-readable sidecar with one operator<< line per record
+
+
+enum BinaryLogHistoryRecordType : uint8_t {
+    BINARY_LOG_HISTORY_BALANCE_CHANGE = 1,
+    BINARY_LOG_HISTORY_TRADE = 2,
+    BINARY_LOG_HISTORY_ORDER = 3,
+    BINARY_LOG_HISTORY_DECISION = 4,
+};
+
+// a zero-filled tail, e.g. after a crash, does not pass for records
+inline const bool is_binary_log_history_record_type(const uint8_t type) {
+    return type >= BINARY_LOG_HISTORY_BALANCE_CHANGE && type <= BINARY_LOG_HISTORY_DECISION;
+}
+
+template <typename T> struct BinaryLogHistoryRecordTypeOf;
+template <> struct BinaryLogHistoryRecordTypeOf<BalanceChange> { static const BinaryLogHistoryRecordType value = BINARY_LOG_HISTORY_BALANCE_CHANGE; };
+template <> struct BinaryLogHistoryRecordTypeOf<Trade> { static const BinaryLogHistoryRecordType value = BINARY_LOG_HISTORY_TRADE; };
+template <> struct BinaryLogHistoryRecordTypeOf<Order> { static const BinaryLogHistoryRecordType value = BINARY_LOG_HISTORY_ORDER; };
+template <> struct BinaryLogHistoryRecordTypeOf<Decision> { static const BinaryLogHistoryRecordType value = BINARY_LOG_HISTORY_DECISION; };
+
+
+#pragma pack(push, 1)
+
+struct BinaryLogHistoryFileHeader {
+    char magic[4];
+    uint32_t version;
+};
+
+struct BinaryLogHistoryRecordHeader {
+    uint32_t size;
+    BinaryLogHistoryRecordType type;
+};
+
+struct BinaryLogHistoryIndexEntry {
+    BinaryLogHistoryRecordType type;
+    uint64_t offset;
+    uint32_t size;
+};
+
+#pragma pack(pop)
+
+
+// reads the records of one type, from a copy of their offsets; as offsets
+// are increasing, they are read through a window of the file
+template <typename T>
+class BinaryLogHistoryRangeData : public RangeData<T> {
+public:
+
+    inline BinaryLogHistoryRangeData(const std::string& path, std::vector<BinaryLogHistoryIndexEntry>&& entries) :
+        _path(path),
+        _entries(entries),
+        _index(0),
+        _window_offset(0),
+        _window_size(0)
+    {
+        _fd = open(path.c_str(), O_RDONLY);
+        if (_fd < 0) {
+            throw FileException("BinaryLogHistory could not open file for reading", path, strerror(errno));
+        }
+    }
+    virtual ~BinaryLogHistoryRangeData() {
+        close(_fd);
+    }
+
+    virtual const bool init(T*& value) {
+        _index = 0;
+        return read(value);
+    }
+    virtual const bool next(T*& value) {
+        ++_index;
+        return read(value);
+    }
+
+private:
+
+    inline const bool read(T*& value) {
+        if (_index >= _entries.size()) {
+            return false;
+        }
+        const BinaryLogHistoryIndexEntry& entry = _entries[_index];
+        // records written by a newer version may be longer
+        const size_t size = std::min((size_t) entry.size, sizeof(T));
+        if (entry.offset < _window_offset || entry.offset + size > _window_offset + _window_size) {
+            _window.resize(std::max((size_t) 65536, size));
+            const ssize_t result = pread(_fd, &_window[0], _window.size(), entry.offset);
+            if (result < (ssize_t) size) {
+                throw FileException("BinaryLogHistory could not read record", _path, entry.offset);
+            }
+            _window_offset = entry.offset;
+            _window_size = result;
+        }
+        memcpy((void*) &_value, &_window[entry.offset - _window_offset], size);
+        memset((char*) &_value + size, 0, sizeof(T) - size);
+        value = &_value;
+        return true;
+    }
+
+    const std::string _path;
+    const std::vector<BinaryLogHistoryIndexEntry> _entries;
+    size_t _index;
+    int _fd;
+    std::string _window;
+    uint64_t _window_offset;
+    size_t _window_size;
+    T _value;
+};
+
+
+class BinaryLogHistory : public History {
+public:
+
+    // records are flushed every flush_interval records, and before reading
+    inline BinaryLogHistory(const std::string& path, const std::string& sidecar_path="", const size_t flush_interval=1024) :
+        _path(path),
+        _flush_interval(flush_interval),
+        _unflushed_count(0),
+        _size(0)
+    {
+        load_index();
+        _file = open_append(_path);
+        _index_file = open_append(_path + ".index");
+        if (_size == 0) {
+            const BinaryLogHistoryFileHeader header = {{'C', 'T', 'L', 'H'}, 2};
+            write(_file, &header, sizeof(header));
+            _size = sizeof(header);
+        }
+        if (!sidecar_path.empty()) {
+            _sidecar.open(sidecar_path, std::ofstream::app);
+        }
+    }
+
+    inline ~BinaryLogHistory() {
+        try {
+            flush();
+        } catch (...) {}
+        fclose(_file);
+        fclose(_index_file);
+    }
+
+    virtual void feed(BalanceChange& balance_change) {
+        _feed(balance_change);
+    }
+    virtual void feed(Trade& trade) {
+        _feed(trade);
+    }
+    virtual void feed(Order& order) {
+        _feed(order);
+    }
+    virtual void feed(Decision& decision) {
+        _feed(decision);
+    }
+
+    virtual Range<BalanceChange> get_balance_changes() {
+        return get_range<BalanceChange>();
+    }
+    virtual Range<Trade> get_trades() {
+        return get_range<Trade>();
+    }
+    virtual Range<Order> get_orders() {
+        return get_range<Order>();
+    }
+    virtual Range<Decision> get_decisions() {
+        return get_range<Decision>();
+    }
+
+    template <typename T>
+    inline const size_t get_count() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _entries[BinaryLogHistoryRecordTypeOf<T>::value].size();
+    }
+
+    inline void flush() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _flush();
+    }
+
+private:
+
+    template <typename T>
+    inline void _feed(const T& instance) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        const BinaryLogHistoryRecordHeader header = {sizeof(T), BinaryLogHistoryRecordTypeOf<T>::value};
+        write(_file, &header, sizeof(header));
+        write(_file, &instance, sizeof(T));
+        const BinaryLogHistoryIndexEntry entry = {header.type, _size + sizeof(header), header.size};
+        write(_index_file, &entry, sizeof(entry));
+        _entries[header.type].push_back(entry);
+        _size += sizeof(header) + sizeof(T);
+        if (_sidecar.is_open()) {
+            _sidecar << instance << '\n';
+        }
+        if (++_unflushed_count >= _flush_interval) {
+            _flush();
+        }
+    }
+
+    template <typename T>
+    inline Range<T> get_range() {
+        std::vector<BinaryLogHistoryIndexEntry> entries;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _flush();
+            entries = _entries[BinaryLogHistoryRecordTypeOf<T>::value];
+        }
+        if (entries.empty()) {
+            return Range<T>();
+        }
+        return Range<T>(new BinaryLogHistoryRangeData<T>(_path, std::move(entries)));
+    }
+
+    // the log is flushed before its index, so that the index never points
+    // past what was written
+    inline void _flush() {
+        if (fflush(_file) != 0 || fflush(_index_file) != 0) {
+            throw FileException("BinaryLogHistory could not flush", _path, strerror(errno));
+        }
+        if (_sidecar.is_open()) {
+            _sidecar.flush();
+        }
+        _unflushed_count = 0;
+    }
+
+    inline void write(FILE* file, const void* data, const size_t size) {
+        if (fwrite(data, size, 1, file) != 1) {
+            throw FileException("BinaryLogHistory could not write", _path, strerror(errno));
+        }
+    }
+
+    inline FILE* open_append(const std::string& path) {
+        FILE* file = fopen(path.c_str(), "ab");
+        if (file == NULL) {
+            throw FileException("BinaryLogHistory could not open file for writing", path, strerror(errno));
+        }
+        setvbuf(file, NULL, _IOFBF, 1 << 16);
+        return file;
+    }
+
+    // missing files are fine
+    inline void resize(const std::string& path, const uint64_t size) {
+        if (truncate(path.c_str(), size) != 0 && errno != ENOENT) {
+            throw FileException("BinaryLogHistory could not truncate file", path, strerror(errno));
+        }
+    }
+
+    // read the index, then complete it from the records that are not in it;
+    // whatever follows the last complete record is dropped
+    inline void load_index() {
+        FILE* file = fopen(_path.c_str(), "rb");
+        if (file == NULL) {
+            resize(_path + ".index", 0);
+            return;
+        }
+        fseek(file, 0, SEEK_END);
+        const uint64_t file_size = ftell(file);
+        BinaryLogHistoryFileHeader header;
+        fseek(file, 0, SEEK_SET);
+        if (file_size < sizeof(header)) {
+            fclose(file);
+            resize(_path, 0);
+            resize(_path + ".index", 0);
+            return;
+        }
+        if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "CTLH", 4) != 0) {
+            fclose(file);
+            throw FileException("BinaryLogHistory found an unknown file format", _path);
+        }
+        _size = sizeof(header);
+        size_t index_count = 0;
+        FILE* index_file = fopen((_path + ".index").c_str(), "rb");
+        if (index_file) {
+            BinaryLogHistoryIndexEntry entry;
+            while (fread(&entry, sizeof(entry), 1, index_file) == 1 && entry.offset == _size + sizeof(BinaryLogHistoryRecordHeader) && entry.offset + entry.size <= file_size && is_binary_log_history_record_type(entry.type)) {
+                _entries[entry.type].push_back(entry);
+                _size = entry.offset + entry.size;
+                ++index_count;
+            }
+            fclose(index_file);
+        }
+        resize(_path + ".index", index_count * sizeof(BinaryLogHistoryIndexEntry));
+        // records missing from the index, read by chunks
+        std::vector<BinaryLogHistoryIndexEntry> missing;
+        std::string buffer(1 << 20, 0);
+        uint64_t buffer_offset = _size;
+        size_t buffer_size = 0;
+        while (true) {
+            if (_size + sizeof(BinaryLogHistoryRecordHeader) > buffer_offset + buffer_size) {
+                buffer_offset = _size;
+                fseek(file, buffer_offset, SEEK_SET);
+                buffer_size = fread(&buffer[0], 1, buffer.size(), file);
+                if (buffer_size < sizeof(BinaryLogHistoryRecordHeader)) {
+                    break;
+                }
+            }
+            BinaryLogHistoryRecordHeader record_header;
+            memcpy(&record_header, &buffer[_size - buffer_offset], sizeof(record_header));
+            const uint64_t offset = _size + sizeof(record_header);
+            if (offset + record_header.size > file_size || !is_binary_log_history_record_type(record_header.type)) {
+                break;
+            }
+            missing.push_back({record_header.type, offset, record_header.size});
+            _size = offset + record_header.size;
+        }
+        fclose(file);
+        resize(_path, _size);
+        if (!missing.empty()) {
+            FILE* index_file = open_append(_path + ".index");
+            for (const BinaryLogHistoryIndexEntry& entry : missing) {
+                write(index_file, &entry, sizeof(entry));
+                _entries[entry.type].push_back(entry);
+            }
+            fclose(index_file);
+        }
+    }
+
+    const std::string _path;
+    const size_t _flush_interval;
+    size_t _unflushed_count;
+    std::mutex _mutex;
+    FILE* _file;
+    FILE* _index_file;
+    std::ofstream _sidecar;
+    uint64_t _size;
+    // by record type
+    std::vector<BinaryLogHistoryIndexEntry> _entries[5];
+};
+
+
+#endif // CTRADING__HISTORY__BINARYLOGHISTORY__HPP
@@ -8,29 +8,51 @@
 #include <chrono>
 #include <thread>
 #include <cmath>
+#include <memory>
 
 #include "db/PlainLog.hpp"
 #include "db/UpscaleBTree.hpp"
+#include "db/LSMTree.hpp"
 
 #include "IO/directories.hpp"
 
 #include "./History.hpp"
 
 
-class DBHistory : public History{
+// trades are either appended to a plain log and indexed by timestamp and by
+// id in B-trees, or written once to an LSM tree by timestamp, whose runs
+// filter ids; a history is reopened with the storage it was created with
+enum DBHistoryTradesStorage {
+    DB_HISTORY_TRADES_IN_UPSCALEDB,
+    DB_HISTORY_TRADES_IN_LSM_TREE,
+};
+
+
+class DBHistory : public History, public HistoryPlainLogs {
 public:
 
-    inline DBHistory(const std::string& basepath) :
+    inline DBHistory(const std::string& basepath, const DBHistoryTradesStorage trades_storage=DB_HISTORY_TRADES_IN_UPSCALEDB) :
         _basepath(basepath),
         _basepath_is_initialized(init_directory(_basepath)),
         _balance_changes(basepath + "/balance_changes"),
         _balance_changes_by_timestamp(basepath + "/balance_changes_by_timestamp"),
-        _trades(basepath + "/trades"),
-        _trades_by_timestamp(basepath + "/trades_by_timestamp"),
         _orders(basepath + "/orders"),
+        _orders_by_id(basepath + "/orders_by_id"),
         _decisions(basepath + "/decisions"),
         _decisions_by_timestamp(basepath + "/decisions_by_timestamp")
-    {}
+    {
+        if (trades_storage == DB_HISTORY_TRADES_IN_LSM_TREE) {
+            _trades_tree.reset(new LSMTree<double, Trade>(basepath + "/trades_tree"));
+        } else {
+            _trades.reset(new PlainLogWriter(basepath + "/trades"));
+            _trades_by_timestamp.reset(new UpscaleBTree<Timestamp, Trade>(basepath + "/trades_by_timestamp"));
+            _trades_by_id.reset(new UpscaleBTree<uint64_t, Trade>(basepath + "/trades_by_id"));
+            // histories created before ids were indexed, or closed between
+            // a log and its index
+            backfill(basepath + "/trades", *_trades_by_id, Trade());
+        }
+        backfill(basepath + "/orders", _orders_by_id, Order());
+    }
 
     inline bool init_directory(const std::string& path) {
         try {
@@ -46,11 +68,17 @@ public:
         _balance_changes_by_timestamp.insert(balance_change.timestamp, balance_change);
     }
     virtual void feed(Trade& trade) {
-        _trades.append(trade);
-        _trades_by_timestamp.insert(trade.timestamp, trade);
+        if (_trades_tree) {
+            _trades_tree->insert(trade.timestamp, trade);
+            return;
+        }
+        _trades->append(trade);
+        _trades_by_timestamp->insert(trade.timestamp, trade);
+        _trades_by_id->insert(trade.id, trade);
     }
     virtual void feed(Order& order) {
         _orders.append(order);
+        _orders_by_id.insert(order.id, order);
     }
     virtual void feed(Decision& decision) {
         _decisions.append(decision);
@@ -58,7 +86,24 @@ public:
     }
 
     virtual Range<Trade> get_trades_by_timestamp(Timestamp timestamp_begin, Timestamp timestamp_end) {
-        return _trades_by_timestamp.get(timestamp_begin, timestamp_end);
+        if (_trades_tree) {
+            return _trades_tree->get(timestamp_begin, timestamp_end);
+        }
+        return _trades_by_timestamp->get(timestamp_begin, timestamp_end);
+    }
+    virtual std::vector<TradeBucket> get_bucketed(const double& timestamp_from, const double& timestamp_to, const size_t& n_buckets) {
+        if (n_buckets == 0) {
+            return {};
+        }
+        std::vector<TradeBucket> buckets = make_trade_buckets(timestamp_from, timestamp_to, n_buckets);
+        auto bucket = buckets.begin();
+        for (const Trade& trade : get_trades_by_timestamp(timestamp_from, timestamp_to)) {
+            while (trade.timestamp > bucket->timestamp_span.to && bucket + 1 != buckets.end()) {
+                ++bucket;
+            }
+            *bucket += trade;
+        }
+        return buckets;
     }
     virtual const Balance get_balance_at_timestamp(Timestamp& timestamp) {
         Balance result;
@@ -70,8 +115,12 @@ public:
     virtual Range<BalanceChange> get_balance_changes() {
         return _balance_changes.get<BalanceChange>();
     }
+    // by timestamp, rather than in insertion order, from the LSM tree
     virtual Range<Trade> get_trades() {
-        return _trades.get<Trade>();
+        if (_trades_tree) {
+            return _trades_tree->get();
+        }
+        return _trades->get<Trade>();
     }
     virtual Range<Order> get_orders() {
         return _orders.get<Order>();
@@ -79,16 +128,53 @@ public:
     virtual Range<Decision> get_decisions() {
         return _decisions.get<Decision>();
     }
+    virtual const bool get_trade_by_id(const uint64_t& id, Trade& trade) {
+        if (_trades_tree) {
+            const std::vector<Trade> found = _trades_tree->get_by_id(id);
+            if (found.empty()) {
+                return false;
+            }
+            trade = found.front();
+            return true;
+        }
+        for (const Trade& found : _trades_by_id->get(id)) {
+            trade = found;
+            return true;
+        }
+        return false;
+    }
+    virtual std::vector<Order> get_orders_by_id(const uint64_t& id) {
+        std::vector<Order> orders;
+        for (const Order& order : _orders_by_id.get(id)) {
+            orders.push_back(order);
+        }
+        return orders;
+    }
+    virtual const std::string get_plain_log_path(const std::string& name) {
+        if (name == "balance_changes" || (name == "trades" && _trades) || name == "orders" || name == "decisions") {
+            return _basepath + "/" + name;
+        }
+        return "";
+    }
 
     virtual TimestampSpan get_time_span() {
         TimestampSpan span;
+        if (_trades_tree) {
+            try {
+                span.from = _trades_tree->get_lowest_key();
+                span.to = _trades_tree->get_highest_key();
+            } catch (const DBKeyException& exception) {
+                span.from = span.to = NAN;
+            }
+            return span;
+        }
         try {
-            span.from = _trades_by_timestamp.get_lowest_key();
+            span.from = _trades_by_timestamp->get_lowest_key();
         } catch (const UpscaleDBException& exception) {
             span.from = NAN;
         }
         try {
-            span.to = _trades_by_timestamp.get_highest_key();
+            span.to = _trades_by_timestamp->get_highest_key();
         } catch (const UpscaleDBException& exception) {
             span.to = NAN;
         }
@@ -101,15 +187,30 @@ protected:
 
 private:
 
+    // a log and its index are appended in the same order, so the records
+    // missing from the index are the last ones of the log
+    template <typename record_t>
+    static inline void backfill(const std::string& log_path, UpscaleBTree<uint64_t, record_t>& index, record_t record) {
+        PlainLogReader reader(log_path);
+        reader.skip<record_t>(index.get_count());
+        while (reader.next(record)) {
+            index.insert(record.id, record);
+        }
+    }
+
     bool _basepath_is_initialized;
 
     PlainLogWriter _balance_changes;
     UpscaleBTree<Timestamp, BalanceChange> _balance_changes_by_timestamp;
 
-    PlainLogWriter _trades;
-    UpscaleBTree<Timestamp, Trade> _trades_by_timestamp;
+    // only one of the storages is open
+    std::unique_ptr<PlainLogWriter> _trades;
+    std::unique_ptr<UpscaleBTree<Timestamp, Trade>> _trades_by_timestamp;
+    std::unique_ptr<UpscaleBTree<uint64_t, Trade>> _trades_by_id;
+    std::unique_ptr<LSMTree<double, Trade>> _trades_tree;
 
     PlainLogWriter _orders;
+    UpscaleBTree<uint64_t, Order> _orders_by_id;
 
     PlainLogWriter _decisions;
     UpscaleBTree<Timestamp, Decision> _decisions_by_timestamp;
@@ -6,13 +6,19 @@
 #include "models/Timestamp.hpp"
 #include "models/Trade.hpp"
 #include "models/TradeSummary.hpp"
+#include "models/TradeBucket.hpp"
 #include "models/Order.hpp"
 #include "models/Decision.hpp"
 
 #include "range/Range.hpp"
 #include "math/Plotter.hpp"
+#include "math/PlotterImage.hpp"
 
 #include <set>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <string>
 #include <ostream>
 
 
@@ -73,6 +79,23 @@ public:
         return summary;
     }
 
+    // split ]timestamp_from, timestamp_to] into n_buckets and summarize each
+    // of them, in a single scan of the trades
+    virtual std::vector<TradeBucket> get_bucketed(const double& timestamp_from, const double& timestamp_to, const size_t& n_buckets) {
+        if (n_buckets == 0) {
+            return {};
+        }
+        std::vector<TradeBucket> buckets = make_trade_buckets(timestamp_from, timestamp_to, n_buckets);
+        const double bucket_width = (timestamp_to - timestamp_from) / n_buckets;
+        for (const Trade& trade : get_trades_by_timestamp(timestamp_from, timestamp_to)) {
+            const ssize_t index = get_bucket_index(trade.timestamp, timestamp_from, bucket_width, n_buckets);
+            if (index >= 0) {
+                buckets[index] += trade;
+            }
+        }
+        return buckets;
+    }
+
     virtual Range<Decision> get_decisions() = 0;
     virtual Range<Decision> get_decisions_by_timestamp(Timestamp timestamp_begin, Timestamp timestamp_end) {
         return get_decisions().filter([timestamp_begin, timestamp_end] (const Decision& decision) -> bool {
@@ -82,8 +105,42 @@ public:
 
     virtual Range<Order> get_orders() = 0;
 
-    virtual void plot() {
+    // lookups by id; storages without an index on ids scan their records
+    virtual const bool get_trade_by_id(const uint64_t& id, Trade& trade) {
+        for (const Trade& candidate : get_trades()) {
+            if (candidate.id == id) {
+                trade = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+    // successive states of an order, in the order they were fed
+    virtual std::vector<Order> get_orders_by_id(const uint64_t& id) {
+        std::vector<Order> orders;
+        for (const Order& order : get_orders()) {
+            if (order.id == id) {
+                orders.push_back(order);
+            }
+        }
+        return orders;
+    }
+
+    virtual void plot(const size_t threads_count=0) {
         Plotter plotter;
+        plotter.set_threads_count(threads_count);
+        plot_curves(plotter);
+        plotter.start();
+    }
+    // same curves as plot(), rendered to a PNG or SVG file (chosen by extension)
+    virtual void save_plot(const std::string& path, const uint32_t width=1600, const uint32_t height=900) {
+        PlotterImage plotter(width, height);
+        plot_curves(plotter);
+        plotter.save(path);
+    }
+
+    template <typename plotter_t>
+    inline void plot_curves(plotter_t& plotter) {
         TimestampSpan span = get_time_span();
         plotter.axes.x.type = PlotterAxisParameters::TEMPORAL;
         plotter.axes.x.min = span.from;
@@ -98,47 +155,53 @@ public:
         plotter.axes.y.grid = 10.;
         //
         History* history = this;
-        plotter.plot([history](double t1, double t2) mutable {
-            return history->get_trade_summary(t1, t2).average_price;
+        // curves may be evaluated from several threads, while storages are not
+        // thread-safe: every curve goes through the memo's mutex; the trades
+        // curves also share one bucketed scan per run of columns
+        struct BucketsMemo {
+            std::mutex mutex;
+            double from, to;
+            size_t n;
+            std::vector<TradeBucket> buckets;
+        };
+        std::shared_ptr<BucketsMemo> memo = std::make_shared<BucketsMemo>();
+        auto get_buckets = [history, memo](double t1, double t2, size_t n) -> std::vector<TradeBucket> {
+            std::lock_guard<std::mutex> lock(memo->mutex);
+            if (memo->from != t1 || memo->to != t2 || memo->n != n) {
+                memo->buckets = history->get_bucketed(t1, t2, n);
+                memo->from = t1;
+                memo->to = t2;
+                memo->n = n;
+            }
+            return memo->buckets;
+        };
+        plotter.plot([get_buckets](double t1, double t2, size_t n) {
+            std::vector<std::pair<double, double>> y;
+            for (const TradeBucket& bucket : get_buckets(t1, t2, n)) {
+                y.push_back({bucket.vwap, bucket.vwap});
+            }
+            return y;
         }, GREEN);
-        plotter.plot([history](double t) mutable {
+        plotter.plot([history, memo](double t) mutable {
+            std::lock_guard<std::mutex> lock(memo->mutex);
             Balance balance = history->get_balance_at_timestamp(t);
             return balance.liquidity - balance.commission;
         }, YELLOW);
         //
-        plotter.plot([history](double t1, double t2) mutable -> std::pair<double, double> {
-            double price_min = NAN;
-            double price_max = NAN;
-            for (const Trade& trade : history->get_trades_by_timestamp(t1, t2)) {
-                if (trade.decision_id == 0 || trade.type != BUY) {
-                    continue;
-                }
-                if (std::isnan(price_min) || trade.price < price_min) {
-                    price_min = trade.price;
-                }
-                if (std::isnan(price_max) || trade.price > price_max) {
-                    price_max = trade.price;
-                }
+        plotter.plot([get_buckets](double t1, double t2, size_t n) {
+            std::vector<std::pair<double, double>> y;
+            for (const TradeBucket& bucket : get_buckets(t1, t2, n)) {
+                y.push_back(bucket.decision_buy_prices);
             }
-            return {price_min, price_max};
+            return y;
         }, RED);
-        plotter.plot([history](double t1, double t2) mutable -> std::pair<double, double> {
-            double price_min = NAN;
-            double price_max = NAN;
-            for (const Trade& trade : history->get_trades_by_timestamp(t1, t2)) {
-                if (trade.decision_id == 0 || trade.type != SELL) {
-                    continue;
-                }
-                if (std::isnan(price_min) || trade.price < price_min) {
-                    price_min = trade.price;
-                }
-                if (std::isnan(price_max) || trade.price > price_max) {
-                    price_max = trade.price;
-                }
+        plotter.plot([get_buckets](double t1, double t2, size_t n) {
+            std::vector<std::pair<double, double>> y;
+            for (const TradeBucket& bucket : get_buckets(t1, t2, n)) {
+                y.push_back(bucket.decision_sell_prices);
             }
-            return {price_min, price_max};
+            return y;
         }, BLUE);
-        plotter.start();
     }
 
     virtual TimestampSpan get_time_span() {
@@ -193,6 +256,17 @@ public:
 
 
 
+// optional capability of storages keeping their records in plain logs, which
+// lets servers stream them without decoding them
+class HistoryPlainLogs {
+public:
+    // file holding the packed records of the given kind ("balance_changes",
+    // "trades", "orders" or "decisions") in insertion order, or "" if there
+    // is none; the file may also be a block log (see BlockLog.hpp)
+    virtual const std::string get_plain_log_path(const std::string& name) = 0;
+};
+
+
 template <>
 Range<BalanceChange> History::get() {
     return get_balance_changes();
@@ -0,0 +1,517 @@
+#ifndef CTRADING__HISTORY__HISTORYSERVER__HPP
+#define CTRADING__HISTORY__HISTORYSERVER__HPP
+
+
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <set>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <shared_mutex>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "network/TCPServer.hpp"
+#include "db/BlockLog.hpp"
+
+#include "./History.hpp"
+#include "./RemoteHistoryProtocol.hpp"
+
+
+// exposes a local History to RemoteHistory clients; feeds made through the
+// server (locally or by clients) are forwarded to the trade subscribers
+class HistoryServer : public TCPHandler {
+public:
+
+    inline HistoryServer(History& history, const std::string& host, const int port, const size_t threads_count=4) :
+        _history(history),
+        _is_running(true)
+    {
+        for (size_t t=0; t<threads_count; ++t) {
+            _workers.push_back(std::thread(_work, this));
+        }
+        _server.reset(new TCPServer(*this, host, port));
+    }
+
+    inline ~HistoryServer() {
+        // pending requests are dropped, running ones get cancelled
+        {
+            std::lock_guard<std::mutex> lock(_jobs_mutex);
+            _is_running = false;
+            _jobs.clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(_sessions_mutex);
+            for (auto& it : _sessions) {
+                std::lock_guard<std::mutex> session_lock(it.second->mutex);
+                it.second->is_closed = true;
+            }
+        }
+        _jobs_condition.notify_all();
+        for (std::thread& worker : _workers) {
+            worker.join();
+        }
+        _server.reset();
+    }
+
+    inline void feed(BalanceChange& balance_change) {
+        std::unique_lock<std::shared_mutex> lock(_history_mutex);
+        _history.feed(balance_change);
+    }
+    inline void feed(Trade& trade) {
+        {
+            std::unique_lock<std::shared_mutex> lock(_history_mutex);
+            _history.feed(trade);
+        }
+        // only buffered here, and sent by the I/O threads; subscribers lagging
+        // too far behind get their subscription ended
+        std::lock_guard<std::mutex> lock(_subscribers_mutex);
+        for (auto it=_subscribers.begin(); it!=_subscribers.end(); ) {
+            TCPConnection& connection = *it->second;
+            const uint32_t request_id = it->first.second;
+            if (connection.get_pending_size() > REMOTE_HISTORY_MAX_SUBSCRIBER_PENDING_SIZE) {
+                buffer_chunk(connection, request_id, NULL, 0, 0, true);
+                it = _subscribers.erase(it);
+                continue;
+            }
+            buffer_chunk(connection, request_id, (const char*) &trade, sizeof(trade), 1, false);
+            ++it;
+        }
+    }
+    inline void feed(Order& order) {
+        std::unique_lock<std::shared_mutex> lock(_history_mutex);
+        _history.feed(order);
+    }
+    inline void feed(Decision& decision) {
+        std::unique_lock<std::shared_mutex> lock(_history_mutex);
+        _history.feed(decision);
+    }
+
+    virtual bool callback(TCPConnection& connection) {
+        RemoteHistoryRequest request;
+        connection.read(request);
+        if (request.payload_size > REMOTE_HISTORY_MAX_PAYLOAD_SIZE) {
+            return false;
+        }
+        // only allocated once the whole payload came in
+        if (connection.get_readable_size() < request.payload_size) {
+            throw TCPConnectionIncompleteException();
+        }
+        std::string payload(request.payload_size, '\0');
+        connection.read(&payload[0], request.payload_size);
+        switch (request.type) {
+            case REMOTE_FEED_BALANCE_CHANGE:
+                return feed_payload<BalanceChange>(payload);
+            case REMOTE_FEED_TRADE:
+                return feed_payload<Trade>(payload);
+            case REMOTE_FEED_ORDER:
+                return feed_payload<Order>(payload);
+            case REMOTE_FEED_DECISION:
+                return feed_payload<Decision>(payload);
+            case REMOTE_SUBSCRIBE_TRADES: {
+                std::lock_guard<std::mutex> lock(_subscribers_mutex);
+                _subscribers[{&connection, request.id}] = connection.shared_from_this();
+                return true;
+            }
+            case REMOTE_CANCEL: {
+                if (payload.size() != sizeof(RemoteHistoryCancelParameters)) {
+                    return false;
+                }
+                const uint32_t request_id = ((const RemoteHistoryCancelParameters*) payload.data())->request_id;
+                {
+                    std::lock_guard<std::mutex> lock(_subscribers_mutex);
+                    _subscribers.erase({&connection, request_id});
+                }
+                // only requests that are still queued or running get cancelled,
+                // as others would never be removed from the set
+                std::shared_ptr<HistoryServerSession> session = get_session(connection);
+                std::lock_guard<std::mutex> lock(session->mutex);
+                if (session->pending_requests.count(request_id)) {
+                    session->cancelled_requests.insert(request_id);
+                }
+                return true;
+            }
+            case REMOTE_GET_BALANCE_CHANGES:
+            case REMOTE_GET_TRADES:
+            case REMOTE_GET_ORDERS:
+            case REMOTE_GET_DECISIONS:
+            case REMOTE_GET_TRADES_BY_TIMESTAMP:
+            case REMOTE_GET_DECISIONS_BY_TIMESTAMP:
+            case REMOTE_GET_BALANCE_AT_TIMESTAMP:
+            case REMOTE_GET_TRADE_SUMMARY:
+            case REMOTE_GET_BUCKETED:
+            case REMOTE_GET_TIME_SPAN: {
+                // queries run on the workers, so that a long stream does not
+                // hold the I/O thread
+                std::shared_ptr<HistoryServerSession> session = get_session(connection);
+                {
+                    std::lock_guard<std::mutex> lock(session->mutex);
+                    session->pending_requests.insert(request.id);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(_jobs_mutex);
+                    _jobs.push_back({session, request, payload});
+                }
+                _jobs_condition.notify_one();
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    virtual void on_open(TCPConnection& connection) {
+        std::lock_guard<std::mutex> lock(_sessions_mutex);
+        _sessions[&connection] = std::make_shared<HistoryServerSession>(connection.shared_from_this());
+    }
+    // running requests notice the session got closed, and the last one to
+    // finish releases it, with its connection
+    virtual void on_close(TCPConnection& connection) {
+        {
+            std::lock_guard<std::mutex> lock(_subscribers_mutex);
+            for (auto it=_subscribers.begin(); it!=_subscribers.end(); ) {
+                if (it->first.first == &connection) {
+                    it = _subscribers.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        std::shared_ptr<HistoryServerSession> session;
+        {
+            std::lock_guard<std::mutex> lock(_sessions_mutex);
+            auto it = _sessions.find(&connection);
+            if (it == _sessions.end()) {
+                return;
+            }
+            session = it->second;
+            _sessions.erase(it);
+        }
+        std::lock_guard<std::mutex> lock(session->mutex);
+        session->is_closed = true;
+    }
+
+private:
+
+    struct HistoryServerSession {
+        inline HistoryServerSession(const std::shared_ptr<TCPConnection>& connection) :
+            connection(connection),
+            is_closed(false) {}
+        std::shared_ptr<TCPConnection> connection;
+        std::mutex mutex;
+        bool is_closed;
+        // queued or running requests, and those of them that got cancelled
+        std::multiset<uint32_t> pending_requests;
+        std::set<uint32_t> cancelled_requests;
+    };
+
+    struct HistoryServerJob {
+        std::shared_ptr<HistoryServerSession> session;
+        RemoteHistoryRequest request;
+        std::string payload;
+    };
+
+    inline std::shared_ptr<HistoryServerSession> get_session(TCPConnection& connection) {
+        std::lock_guard<std::mutex> lock(_sessions_mutex);
+        return _sessions.at(&connection);
+    }
+
+    template <typename T>
+    inline const bool feed_payload(std::string& payload) {
+        if (payload.size() != sizeof(T)) {
+            return false;
+        }
+        feed(* (T*) &payload[0]);
+        return true;
+    }
+
+    static void _work(HistoryServer* server) {
+        server->work();
+    }
+    inline void work() {
+        while (true) {
+            HistoryServerJob job;
+            {
+                std::unique_lock<std::mutex> lock(_jobs_mutex);
+                _jobs_condition.wait(lock, [this] {
+                    return !_is_running || !_jobs.empty();
+                });
+                if (_jobs.empty()) {
+                    return;
+                }
+                job = _jobs.front();
+                _jobs.pop_front();
+            }
+            respond(job);
+            std::lock_guard<std::mutex> lock(job.session->mutex);
+            job.session->pending_requests.erase(job.session->pending_requests.find(job.request.id));
+            if (!job.session->pending_requests.count(job.request.id)) {
+                job.session->cancelled_requests.erase(job.request.id);
+            }
+        }
+    }
+
+    // records of a response, the part of a plain log file to send as is, or
+    // a range to read chunk by chunk; read() returns whether it is finished
+    struct HistoryServerSnapshot {
+        inline HistoryServerSnapshot() : is_valid(true), record_size(0), fd(-1), count(0) {}
+        bool is_valid;
+        std::string records;
+        std::function<const bool(std::string&, const size_t)> read;
+        size_t record_size;
+        int fd;
+        size_t count;
+    };
+
+    // answer a query; the history is shared with the other readers while a
+    // chunk of the response gets read, but it is not locked while sending
+    // it, so that slow clients do not hold the feeds
+    inline void respond(HistoryServerJob& job) {
+        if (is_cancelled(job)) {
+            return;
+        }
+        HistoryServerSnapshot snapshot;
+        {
+            std::shared_lock<std::shared_mutex> lock(_history_mutex);
+            take_snapshot(job, snapshot);
+        }
+        if (!snapshot.is_valid) {
+            // malformed request: answer with an empty response
+            send_chunk(*job.session->connection, job.request.id, NULL, 0, 0, true);
+        } else if (snapshot.fd != -1) {
+            send_file(job, snapshot);
+            close(snapshot.fd);
+        } else if (snapshot.read) {
+            send_range(job, snapshot);
+        } else {
+            send_records(job, snapshot);
+        }
+    }
+
+    inline void take_snapshot(HistoryServerJob& job, HistoryServerSnapshot& snapshot) {
+        const RemoteHistoryTimestampsParameters* timestamps = (const RemoteHistoryTimestampsParameters*) job.payload.data();
+        switch (job.request.type) {
+            case REMOTE_GET_BALANCE_CHANGES:
+                if (!open_file<BalanceChange>("balance_changes", snapshot)) {
+                    stream(_history.get_balance_changes(), snapshot);
+                }
+                return;
+            case REMOTE_GET_TRADES:
+                if (!open_file<Trade>("trades", snapshot)) {
+                    stream(_history.get_trades(), snapshot);
+                }
+                return;
+            case REMOTE_GET_ORDERS:
+                if (!open_file<Order>("orders", snapshot)) {
+                    stream(_history.get_orders(), snapshot);
+                }
+                return;
+            case REMOTE_GET_DECISIONS:
+                if (!open_file<Decision>("decisions", snapshot)) {
+                    stream(_history.get_decisions(), snapshot);
+                }
+                return;
+            case REMOTE_GET_TRADES_BY_TIMESTAMP:
+                if (job.payload.size() == sizeof(RemoteHistoryTimestampsParameters)) {
+                    return stream(_history.get_trades_by_timestamp(timestamps->timestamp_begin, timestamps->timestamp_end), snapshot);
+                }
+                break;
+            case REMOTE_GET_DECISIONS_BY_TIMESTAMP:
+                if (job.payload.size() == sizeof(RemoteHistoryTimestampsParameters)) {
+                    return stream(_history.get_decisions_by_timestamp(timestamps->timestamp_begin, timestamps->timestamp_end), snapshot);
+                }
+                break;
+            case REMOTE_GET_BALANCE_AT_TIMESTAMP:
+                if (job.payload.size() == sizeof(Timestamp)) {
+                    const Balance balance = _history.get_balance_at_timestamp(* (const Timestamp*) job.payload.data());
+                    return copy(&balance, 1, snapshot);
+                }
+                break;
+            case REMOTE_GET_TRADE_SUMMARY:
+                if (job.payload.size() == sizeof(RemoteHistoryTimestampsParameters)) {
+                    const TradeSummary summary = _history.get_trade_summary(timestamps->timestamp_begin, timestamps->timestamp_end);
+                    return copy(&summary, 1, snapshot);
+                }
+                break;
+            case REMOTE_GET_BUCKETED:
+                if (job.payload.size() == sizeof(RemoteHistoryBucketsParameters)) {
+                    const RemoteHistoryBucketsParameters* parameters = (const RemoteHistoryBucketsParameters*) job.payload.data();
+                    if (parameters->n_buckets > REMOTE_HISTORY_MAX_BUCKETS) {
+                        break;
+                    }
+                    const std::vector<TradeBucket> buckets = _history.get_bucketed(parameters->timestamp_from, parameters->timestamp_to, parameters->n_buckets);
+                    return copy(buckets.data(), buckets.size(), snapshot);
+                }
+                break;
+            case REMOTE_GET_TIME_SPAN: {
+                const TimestampSpan span = _history.get_time_span();
+                return copy(&span, 1, snapshot);
+            }
+            default:
+                break;
+        }
+        snapshot.is_valid = false;
+    }
+
+    // the range only gets iterated from read(), under the shared lock; the
+    // iterator is advanced when reading the next chunk, so that it does not
+    // hold on to a record while the history gets fed
+    template <typename T>
+    inline void stream(Range<T> range, HistoryServerSnapshot& snapshot) {
+        snapshot.record_size = sizeof(T);
+        Iterator<T> iterator;
+        bool is_started = false;
+        snapshot.read = [range, iterator, is_started](std::string& records, const size_t count) mutable {
+            records.clear();
+            if (!is_started) {
+                iterator = range.begin();
+                is_started = true;
+            } else if (iterator != range.end()) {
+                ++iterator;
+            }
+            for (size_t n=0; iterator!=range.end(); ++iterator) {
+                records.append((const char*) &*iterator, sizeof(T));
+                if (++n == count) {
+                    break;
+                }
+            }
+            return iterator == range.end();
+        };
+    }
+    template <typename T>
+    inline void copy(const T* records, const size_t count, HistoryServerSnapshot& snapshot) {
+        snapshot.record_size = sizeof(T);
+        snapshot.records.assign((const char*) records, count * sizeof(T));
+    }
+
+    // when the history keeps its records in an uncompressed plain log, it
+    // gets sent from the kernel with sendfile() instead of decoding and
+    // copying every record
+    template <typename T>
+    inline const bool open_file(const std::string& name, HistoryServerSnapshot& snapshot) {
+        HistoryPlainLogs* plain_logs = dynamic_cast<HistoryPlainLogs*>(&_history);
+        if (plain_logs == NULL) {
+            return false;
+        }
+        const std::string path = plain_logs->get_plain_log_path(name);
+        if (path.empty()) {
+            return false;
+        }
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat file_stat;
+        uint32_t magic = 0;
+        if (fstat(fd, &file_stat) == -1 || (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) && magic == block_log_magic)) {
+            close(fd);
+            return false;
+        }
+        // records appended afterwards are left out
+        snapshot.fd = fd;
+        snapshot.record_size = sizeof(T);
+        snapshot.count = file_stat.st_size / sizeof(T);
+        return true;
+    }
+
+    // the last chunk is left for the I/O thread to send
+    inline void send_records(HistoryServerJob& job, const HistoryServerSnapshot& snapshot) {
+        TCPConnection& connection = *job.session->connection;
+        const size_t count = snapshot.records.size() / snapshot.record_size;
+        size_t offset = 0;
+        while (true) {
+            const uint32_t chunk_count = std::min<size_t>(count - offset, REMOTE_HISTORY_CHUNK_SIZE);
+            const bool is_last = (offset + chunk_count == count);
+            send_chunk(connection, job.request.id, snapshot.records.data() + offset * snapshot.record_size, chunk_count * snapshot.record_size, chunk_count, is_last);
+            offset += chunk_count;
+            if (is_last || !connection.wait_writable() || is_cancelled(job)) {
+                return;
+            }
+        }
+    }
+    // the last chunk may come out empty, when the range ended with the
+    // previous one
+    inline void send_range(HistoryServerJob& job, HistoryServerSnapshot& snapshot) {
+        TCPConnection& connection = *job.session->connection;
+        std::string records;
+        while (true) {
+            bool is_last;
+            {
+                std::shared_lock<std::shared_mutex> lock(_history_mutex);
+                is_last = snapshot.read(records, REMOTE_HISTORY_CHUNK_SIZE);
+            }
+            send_chunk(connection, job.request.id, records.data(), records.size(), records.size() / snapshot.record_size, is_last);
+            if (is_last || !connection.wait_writable() || is_cancelled(job)) {
+                return;
+            }
+        }
+    }
+    inline void send_file(HistoryServerJob& job, const HistoryServerSnapshot& snapshot) {
+        TCPConnection& connection = *job.session->connection;
+        const size_t chunk_count = REMOTE_HISTORY_CHUNK_SIZE * 64;
+        size_t offset = 0;
+        while (true) {
+            const uint32_t n = std::min(snapshot.count - offset, chunk_count);
+            const bool is_last = (offset + n == snapshot.count);
+            const RemoteHistoryResponse response = {job.request.id, n, (uint32_t) (n * snapshot.record_size), is_last};
+            connection.write_file(snapshot.fd, offset * snapshot.record_size, n * snapshot.record_size, &response, sizeof(response));
+            offset += n;
+            if (is_last || !connection.wait_writable() || is_cancelled(job)) {
+                return;
+            }
+        }
+    }
+
+    inline void send_chunk(TCPConnection& connection, const uint32_t request_id, const char* records, const size_t size, const uint32_t count, const bool is_last) {
+        // one vectored write per chunk, so that concurrent responses do not
+        // interleave
+        const RemoteHistoryResponse response = {request_id, count, (uint32_t) size, is_last};
+        const struct iovec vectors[2] = {
+            {(void*) &response, sizeof(response)},
+            {(void*) records, size},
+        };
+        connection.write(vectors, 2);
+    }
+    // same as send_chunk(), without trying to send from the calling thread
+    inline void buffer_chunk(TCPConnection& connection, const uint32_t request_id, const char* records, const size_t size, const uint32_t count, const bool is_last) {
+        const RemoteHistoryResponse response = {request_id, count, (uint32_t) size, is_last};
+        std::string chunk((const char*) &response, sizeof(response));
+        if (size) {
+            chunk.append(records, size);
+        }
+        connection.write(chunk);
+    }
+
+    inline const bool is_cancelled(HistoryServerJob& job) {
+        std::lock_guard<std::mutex> lock(job.session->mutex);
+        return job.session->is_closed || job.session->cancelled_requests.count(job.request.id);
+    }
+
+    History& _history;
+    std::shared_mutex _history_mutex;
+    // sessions of the open connections
+    std::mutex _sessions_mutex;
+    std::unordered_map<TCPConnection*, std::shared_ptr<HistoryServerSession>> _sessions;
+    // subscribed connections, by connection and id of their subscription request
+    std::mutex _subscribers_mutex;
+    std::map<std::pair<TCPConnection*, uint32_t>, std::shared_ptr<TCPConnection>> _subscribers;
+    // queries, answered by the workers
+    bool _is_running;
+    std::mutex _jobs_mutex;
+    std::condition_variable _jobs_condition;
+    std::deque<HistoryServerJob> _jobs;
+    std::vector<std::thread> _workers;
+    std::unique_ptr<TCPServer> _server;
+};
+
+
+#endif // CTRADING__HISTORY__HISTORYSERVER__HPP
@@ -4,20 +4,103 @@
 
 #include "./History.hpp"
 
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <cmath>
 #include <string>
+#include <vector>
+#include <utility>
+#include <mutex>
 #include <iostream>
 #include <fstream>
 
+#include "exceptions/Exception.hpp"
+
+
+// a text log may come with a sparse index (path.index): every index_interval
+// records of a given type make a block, whose byte range in the log and
+// timestamps (as the text has them, to the second) are stored; as records of
+// other types are interleaved, blocks of different types overlap
+
+
+enum LogHistoryModelType : uint8_t {
+    LOG_HISTORY_BALANCE_CHANGE = 0,
+    LOG_HISTORY_TRADE = 1,
+    LOG_HISTORY_ORDER = 2,
+    LOG_HISTORY_DECISION = 3,
+    LOG_HISTORY_UNKNOWN = 4,
+};
+
+template <typename T> struct LogHistoryModel;
+template <> struct LogHistoryModel<BalanceChange> { static const LogHistoryModelType type = LOG_HISTORY_BALANCE_CHANGE; };
+template <> struct LogHistoryModel<Trade> { static const LogHistoryModelType type = LOG_HISTORY_TRADE; };
+template <> struct LogHistoryModel<Order> { static const LogHistoryModelType type = LOG_HISTORY_ORDER; };
+template <> struct LogHistoryModel<Decision> { static const LogHistoryModelType type = LOG_HISTORY_DECISION; };
+
+static const char* const log_history_model_prefixes[] = {"<BalanceChange ", "<Trade ", "<Order ", "<Decision "};
+
+// type and timestamp of a line, without parsing the whole of it
+inline const LogHistoryModelType log_history_identify(const std::string& line, double& timestamp) {
+    for (uint8_t type=0; type<LOG_HISTORY_UNKNOWN; ++type) {
+        if (line.compare(0, strlen(log_history_model_prefixes[type]), log_history_model_prefixes[type]) == 0) {
+            const size_t position = line.find(" timestamp=");
+            struct tm t = {};
+            if (position == std::string::npos || sscanf(line.c_str() + position, " timestamp=%d-%d-%dT%d:%d:%d",
+                &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) != 6) {
+                timestamp = NAN;
+            } else {
+                t.tm_year -= 1900;
+                t.tm_mon -= 1;
+                t.tm_isdst = -1;
+                timestamp = mktime(&t);
+            }
+            return (LogHistoryModelType) type;
+        }
+    }
+    return LOG_HISTORY_UNKNOWN;
+}
+
+
+#pragma pack(push, 1)
+
+struct LogHistoryIndexEntry {
+    LogHistoryModelType type;
+    uint64_t offset_begin;
+    uint64_t offset_end;
+    double timestamp_min;
+    double timestamp_max;
+};
+
+#pragma pack(pop)
+
+
+// byte ranges of the log, sorted and disjoint
+typedef std::vector<std::pair<uint64_t, uint64_t>> LogHistorySegments;
+
 
 template <typename T>
 class LogHistoryRangeData : public RangeData<T> {
 public:
 
-    inline LogHistoryRangeData(const std::string& path) :
-        _file(path) {}
+    // the whole file, or only the given segments of it
+    inline LogHistoryRangeData(const std::string& path, const LogHistorySegments& segments={{0, -1}}) :
+        _file(path),
+        _segments(segments),
+        _segment_index(0),
+        _prefix(log_history_model_prefixes[LogHistoryModel<T>::type]) {}
 
 
     virtual const bool init(T*& value) {
+        _segment_index = 0;
+        if (_segments.empty()) {
+            return false;
+        }
+        _file.seekg(_segments[0].first);
+        value = &_value;
         return iterate(*value);
     }
     virtual const bool next(T*& value) {
@@ -28,31 +111,38 @@ private:
 
     inline const bool iterate(T& value) {
         std::string line;
-        bool must_continue;
-        do {
-            must_continue = (bool) std::getline(_file, line);
-        } while (must_continue && !value.parse(line));
-        return must_continue;
+        while (_segment_index < _segments.size()) {
+            if ((uint64_t) _file.tellg() >= _segments[_segment_index].second || !std::getline(_file, line)) {
+                if (++_segment_index == _segments.size()) {
+                    return false;
+                }
+                _file.clear();
+                _file.seekg(_segments[_segment_index].first);
+                continue;
+            }
+            // other models are skipped without trying to parse them
+            if (line.compare(0, _prefix.size(), _prefix) == 0 && value.parse(line)) {
+                return true;
+            }
+        }
+        return false;
     }
 
-    static const std::string _model_name;
-    const std::string _path;
     std::ifstream _file;
+    const LogHistorySegments _segments;
+    size_t _segment_index;
+    const std::string _prefix;
+    T _value;
 
 };
 
-template <> const std::string LogHistoryRangeData<BalanceChange>::_model_name = "BalanceChange";
-template <> const std::string LogHistoryRangeData<Trade>::_model_name = "Trade";
-template <> const std::string LogHistoryRangeData<Order>::_model_name = "Order";
-template <> const std::string LogHistoryRangeData<Decision>::_model_name = "Decision";
-
 
 template <typename T>
 class LogHistoryRange : public Range<T> {
 public:
 
-    inline LogHistoryRange(const std::string& path) :
-        Range<T>(new LogHistoryRangeData<T>(path)) {}
+    inline LogHistoryRange(const std::string& path, const LogHistorySegments& segments={{0, -1}}) :
+        Range<T>(new LogHistoryRangeData<T>(path, segments)) {}
 
 };
 
@@ -61,12 +151,17 @@ class LogHistory : public History {
 public:
 
     LogHistory() :
-        _is_stdout(true) {}
-    LogHistory(const std::string& path) :
+        _is_stdout(true),
+        _index_interval(0) {}
+    LogHistory(const std::string& path, const size_t index_interval=1024) :
         _path(path),
         _is_stdout(false),
-        _file(_path.c_str(), std::ofstream::app)
-    {}
+        _index_interval(index_interval)
+    {
+        load_index();
+        _file.open(_path.c_str(), std::ofstream::app);
+        _file.seekp(0, std::ios::end);
+    }
 
     inline std::ostream& get_output() {
         return _is_stdout ? std::cout : _file;
@@ -100,16 +195,160 @@ public:
         return _is_stdout ? Range<Decision>() : LogHistoryRange<Decision>(_path);
     }
 
+    // only the blocks that may hold trades of the period are read
+    virtual Range<Trade> get_trades_by_timestamp(Timestamp timestamp_begin, Timestamp timestamp_end) {
+        if (_is_stdout) {
+            return Range<Trade>();
+        }
+        Range<Trade> range = LogHistoryRange<Trade>(_path, get_segments<Trade>(timestamp_begin, timestamp_end));
+        return range.filter([timestamp_begin, timestamp_end] (const Trade& trade) -> bool {
+            return trade.timestamp > timestamp_begin && trade.timestamp <= timestamp_end;
+        });
+    }
+    virtual Range<Decision> get_decisions_by_timestamp(Timestamp timestamp_begin, Timestamp timestamp_end) {
+        if (_is_stdout) {
+            return Range<Decision>();
+        }
+        Range<Decision> range = LogHistoryRange<Decision>(_path, get_segments<Decision>(timestamp_begin, timestamp_end));
+        return range.filter([timestamp_begin, timestamp_end] (const Decision& decision) -> bool {
+            return decision.timestamp > timestamp_begin && decision.timestamp <= timestamp_end;
+        });
+    }
+
+    // parts of the log holding records of the given type in [begin, end]
+    template <typename T>
+    inline const LogHistorySegments get_segments(const double timestamp_begin, const double timestamp_end) {
+        // text timestamps are truncated to the second
+        const double begin = std::floor(timestamp_begin);
+        const LogHistoryModelType type = LogHistoryModel<T>::type;
+        std::unique_lock<std::mutex> lock(_mutex);
+        LogHistorySegments segments;
+        auto add = [&segments](const uint64_t offset_begin, const uint64_t offset_end) {
+            if (!segments.empty() && offset_begin <= segments.back().second) {
+                segments.back().second = std::max(segments.back().second, offset_end);
+            } else {
+                segments.push_back({offset_begin, offset_end});
+            }
+        };
+        for (const LogHistoryIndexEntry& entry : _index[type]) {
+            if (entry.timestamp_max >= begin && entry.timestamp_min <= timestamp_end) {
+                add(entry.offset_begin, entry.offset_end);
+            }
+        }
+        // the block being filled
+        const LogHistoryIndexEntry& pending = _pending[type];
+        if (_pending_counts[type]) {
+            add(pending.offset_begin, -1);
+        }
+        return segments;
+    }
+
 private:
 
     template <typename T>
     inline void _feed(T& instance) {
-        (get_output() << instance << '\n').flush();
+        if (_is_stdout) {
+            (std::cout << instance << '\n').flush();
+            return;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        const uint64_t offset = _file.tellp();
+        (_file << instance << '\n').flush();
+        index(LogHistoryModel<T>::type, offset, _file.tellp(), std::floor(instance.timestamp));
+    }
+
+    inline void index(const LogHistoryModelType type, const uint64_t offset_begin, const uint64_t offset_end, const double timestamp) {
+        LogHistoryIndexEntry& pending = _pending[type];
+        if (_pending_counts[type]++ == 0) {
+            pending = {type, offset_begin, offset_end, timestamp, timestamp};
+        } else {
+            pending.offset_end = offset_end;
+            if (!std::isnan(timestamp)) {
+                pending.timestamp_min = std::isnan(pending.timestamp_min) ? timestamp : std::min(pending.timestamp_min, timestamp);
+                pending.timestamp_max = std::isnan(pending.timestamp_max) ? timestamp : std::max(pending.timestamp_max, timestamp);
+            }
+        }
+        if (_pending_counts[type] >= _index_interval) {
+            write_pending(pending);
+        }
+    }
+
+    inline void write_pending(LogHistoryIndexEntry& pending) {
+        if (_pending_counts[pending.type] < _index_interval) {
+            return;
+        }
+        // blocks with unreadable timestamps are always read
+        if (std::isnan(pending.timestamp_min)) {
+            pending.timestamp_min = -INFINITY;
+            pending.timestamp_max = INFINITY;
+        }
+        if (_index_file.is_open()) {
+            _index_file.write((const char*) &pending, sizeof(pending)).flush();
+        }
+        _index[pending.type].push_back(pending);
+        _pending_counts[pending.type] = 0;
+    }
+
+    // read the index, then complete it from the lines of the log after the
+    // last complete block of each type
+    inline void load_index() {
+        FILE* file = fopen(_path.c_str(), "rb");
+        const uint64_t file_size = file ? (fseek(file, 0, SEEK_END), ftell(file)) : 0;
+        if (file) {
+            fclose(file);
+        }
+        size_t index_count = 0;
+        uint64_t scan_begin = -1;
+        for (uint8_t type=0; type<LOG_HISTORY_UNKNOWN; ++type) {
+            _pending[type].type = (LogHistoryModelType) type;
+            _pending_counts[type] = 0;
+        }
+        FILE* index_file = fopen((_path + ".index").c_str(), "rb");
+        if (index_file) {
+            LogHistoryIndexEntry entry;
+            while (fread(&entry, sizeof(entry), 1, index_file) == 1 && entry.type < LOG_HISTORY_UNKNOWN && entry.offset_end <= file_size) {
+                _index[entry.type].push_back(entry);
+                ++index_count;
+            }
+            fclose(index_file);
+        }
+        if (truncate((_path + ".index").c_str(), index_count * sizeof(LogHistoryIndexEntry)) != 0 && errno != ENOENT) {
+            throw FileException("LogHistory could not truncate index", _path + ".index", strerror(errno));
+        }
+        _index_file.open((_path + ".index").c_str(), std::ofstream::app | std::ofstream::binary);
+        uint64_t indexed_end[LOG_HISTORY_UNKNOWN];
+        for (uint8_t type=0; type<LOG_HISTORY_UNKNOWN; ++type) {
+            indexed_end[type] = _index[type].empty() ? 0 : _index[type].back().offset_end;
+            scan_begin = std::min(scan_begin, indexed_end[type]);
+        }
+        if (scan_begin >= file_size) {
+            return;
+        }
+        std::ifstream log(_path);
+        log.seekg(scan_begin);
+        std::string line;
+        uint64_t offset = scan_begin;
+        while (std::getline(log, line) && !log.eof()) {
+            const uint64_t next_offset = offset + line.size() + 1;
+            double timestamp;
+            const LogHistoryModelType type = log_history_identify(line, timestamp);
+            if (type != LOG_HISTORY_UNKNOWN && offset >= indexed_end[type]) {
+                index(type, offset, next_offset, timestamp);
+            }
+            offset = next_offset;
+        }
     }
 
     const std::string _path;
     const bool _is_stdout;
+    const size_t _index_interval;
+    std::mutex _mutex;
     std::ofstream _file;
+    std::ofstream _index_file;
+    // complete blocks, and the one being filled, by type
+    std::vector<LogHistoryIndexEntry> _index[LOG_HISTORY_UNKNOWN];
+    LogHistoryIndexEntry _pending[LOG_HISTORY_UNKNOWN];
+    size_t _pending_counts[LOG_HISTORY_UNKNOWN];
 };
 
 
@@ -61,6 +61,36 @@ public:
     virtual Range<Trade> get_trades_by_timestamp(Timestamp timestamp_begin, Timestamp timestamp_end) {
         return SortedRangeFactory(_trades_by_timestamp, timestamp_begin, timestamp_end);
     }
+    virtual std::vector<TradeBucket> get_bucketed(const double& timestamp_from, const double& timestamp_to, const size_t& n_buckets) {
+        if (n_buckets == 0) {
+            return {};
+        }
+        std::vector<TradeBucket> buckets = make_trade_buckets(timestamp_from, timestamp_to, n_buckets);
+        auto bucket = buckets.begin();
+        for (auto it=_trades_by_timestamp.upper_bound(timestamp_from); it!=_trades_by_timestamp.end() && it->first<=Timestamp(timestamp_to); ++it) {
+            while (it->first > bucket->timestamp_span.to && bucket + 1 != buckets.end()) {
+                ++bucket;
+            }
+            *bucket += it->second;
+        }
+        return buckets;
+    }
+    virtual const bool get_trade_by_id(const uint64_t& id, Trade& trade) {
+        auto it = _trades_by_id.find(id);
+        if (it == _trades_by_id.end()) {
+            return false;
+        }
+        trade = it->second;
+        return true;
+    }
+    virtual std::vector<Order> get_orders_by_id(const uint64_t& id) {
+        std::vector<Order> orders;
+        auto range = _orders_by_id.equal_range(id);
+        for (auto it=range.first; it!=range.second; ++it) {
+            orders.push_back(it->second);
+        }
+        return orders;
+    }
     virtual Range<Decision> get_decisions_by_timestamp(Timestamp timestamp_begin, Timestamp timestamp_end) {
         return SortedRangeFactory(_decisions_by_timestamp, timestamp_begin, timestamp_end);
     }
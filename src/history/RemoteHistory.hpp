@@ -0,0 +1,333 @@
+#ifndef CTRADING__HISTORY__REMOTEHISTORY__HPP
+#define CTRADING__HISTORY__REMOTEHISTORY__HPP
+
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "network/TCPClient.hpp"
+
+#include "./History.hpp"
+#include "./RemoteHistoryProtocol.hpp"
+
+
+// chunks received for one request
+struct RemoteHistoryStream {
+    inline RemoteHistoryStream(const uint32_t request_id) :
+        request_id(request_id),
+        is_finished(false) {}
+    const uint32_t request_id;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::string> chunks;
+    bool is_finished;
+    // for subscriptions, called by the receiving thread instead of queueing
+    std::function<void(const std::string&)> callback;
+    // wait for the next chunk; false once the response is complete
+    inline const bool pop(std::string& chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] {
+            return is_finished || !chunks.empty();
+        });
+        if (chunks.empty()) {
+            return false;
+        }
+        chunk.swap(chunks.front());
+        chunks.pop_front();
+        return true;
+    }
+};
+
+
+class RemoteHistory;
+
+// records are pulled chunk by chunk, as the server streams them
+template <typename T>
+class RemoteRangeData : public RangeData<T> {
+public:
+
+    inline RemoteRangeData(RemoteHistory& history, const RemoteHistoryRequestType type, const std::string& payload=std::string());
+    virtual ~RemoteRangeData();
+
+    virtual const bool init(T*& value);
+    virtual const bool next(T*& value) {
+        if (++_index < _chunk.size() / sizeof(T)) {
+            value = (T*) &_chunk[_index * sizeof(T)];
+            return true;
+        }
+        while (_stream->pop(_chunk)) {
+            if (_chunk.size() >= sizeof(T)) {
+                _index = 0;
+                value = (T*) &_chunk[0];
+                return true;
+            }
+        }
+        _chunk.clear();
+        return false;
+    }
+
+private:
+    RemoteHistory& _history;
+    const RemoteHistoryRequestType _type;
+    const std::string _payload;
+    std::shared_ptr<RemoteHistoryStream> _stream;
+    bool _is_started;
+    std::string _chunk;
+    size_t _index;
+};
+
+
+// History backed by a HistoryServer; requests are pipelined (ranges are
+// requested as soon as they are built), and responses are demultiplexed by a
+// receiving thread
+class RemoteHistory : public History {
+public:
+
+    inline RemoteHistory(const std::string& host, const int port) :
+        _client(host, port),
+        _next_request_id(1),
+        _is_running(true),
+        _receiver(_receive, this) {}
+
+    inline ~RemoteHistory() {
+        try {
+            flush();
+        } catch (const TCPClientError&) {}
+        _is_running = false;
+        _receiver.join();
+    }
+
+    // feeds are coalesced, and sent along with the next query or on flush()
+    inline void flush() {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        _client.flush();
+    }
+
+    virtual void feed(BalanceChange& balance_change) {
+        send(REMOTE_FEED_BALANCE_CHANGE, &balance_change, sizeof(balance_change));
+    }
+    virtual void feed(Trade& trade) {
+        send(REMOTE_FEED_TRADE, &trade, sizeof(trade));
+    }
+    virtual void feed(Order& order) {
+        send(REMOTE_FEED_ORDER, &order, sizeof(order));
+    }
+    virtual void feed(Decision& decision) {
+        send(REMOTE_FEED_DECISION, &decision, sizeof(decision));
+    }
+
+    virtual Range<BalanceChange> get_balance_changes() {
+        return Range<BalanceChange>(new RemoteRangeData<BalanceChange>(*this, REMOTE_GET_BALANCE_CHANGES));
+    }
+    virtual Range<Trade> get_trades() {
+        return Range<Trade>(new RemoteRangeData<Trade>(*this, REMOTE_GET_TRADES));
+    }
+    virtual Range<Order> get_orders() {
+        return Range<Order>(new RemoteRangeData<Order>(*this, REMOTE_GET_ORDERS));
+    }
+    virtual Range<Decision> get_decisions() {
+        return Range<Decision>(new RemoteRangeData<Decision>(*this, REMOTE_GET_DECISIONS));
+    }
+    virtual Range<Trade> get_trades_by_timestamp(Timestamp timestamp_begin, Timestamp timestamp_end) {
+        const RemoteHistoryTimestampsParameters parameters = {timestamp_begin, timestamp_end};
+        return Range<Trade>(new RemoteRangeData<Trade>(*this, REMOTE_GET_TRADES_BY_TIMESTAMP, make_payload(parameters)));
+    }
+    virtual Range<Decision> get_decisions_by_timestamp(Timestamp timestamp_begin, Timestamp timestamp_end) {
+        const RemoteHistoryTimestampsParameters parameters = {timestamp_begin, timestamp_end};
+        return Range<Decision>(new RemoteRangeData<Decision>(*this, REMOTE_GET_DECISIONS_BY_TIMESTAMP, make_payload(parameters)));
+    }
+
+    virtual const Balance get_balance_at_timestamp(const Timestamp& timestamp) {
+        const std::vector<Balance> result = request_all<Balance>(REMOTE_GET_BALANCE_AT_TIMESTAMP, make_payload(timestamp));
+        return result.empty() ? Balance() : result.front();
+    }
+    virtual TradeSummary get_trade_summary(const double& timestamp_begin, const double timestamp_end) {
+        const RemoteHistoryTimestampsParameters parameters = {timestamp_begin, timestamp_end};
+        const std::vector<TradeSummary> result = request_all<TradeSummary>(REMOTE_GET_TRADE_SUMMARY, make_payload(parameters));
+        return result.empty() ? TradeSummary() : result.front();
+    }
+    virtual std::vector<TradeBucket> get_bucketed(const double& timestamp_from, const double& timestamp_to, const size_t& n_buckets) {
+        const RemoteHistoryBucketsParameters parameters = {timestamp_from, timestamp_to, n_buckets};
+        return request_all<TradeBucket>(REMOTE_GET_BUCKETED, make_payload(parameters));
+    }
+    virtual TimestampSpan get_time_span() {
+        const std::vector<TimestampSpan> result = request_all<TimestampSpan>(REMOTE_GET_TIME_SPAN);
+        return result.empty() ? TimestampSpan() : result.front();
+    }
+
+    // live feed of the trades fed to the server; the callback runs on the
+    // receiving thread; returns the id to pass to unsubscribe()
+    inline const uint32_t subscribe(std::function<void(const Trade&)> callback) {
+        std::shared_ptr<RemoteHistoryStream> stream = request(REMOTE_SUBSCRIBE_TRADES, std::string(), [callback](const std::string& chunk) {
+            for (size_t offset=0; offset+sizeof(Trade)<=chunk.size(); offset+=sizeof(Trade)) {
+                callback(* (const Trade*) &chunk[offset]);
+            }
+        });
+        return stream->request_id;
+    }
+    inline void unsubscribe(const uint32_t request_id) {
+        cancel(request_id);
+    }
+
+    // send a request, and register the stream receiving its response
+    inline std::shared_ptr<RemoteHistoryStream> request(const RemoteHistoryRequestType type, const std::string& payload=std::string(), std::function<void(const std::string&)> callback=NULL) {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        const uint32_t request_id = _next_request_id++;
+        std::shared_ptr<RemoteHistoryStream> stream = std::make_shared<RemoteHistoryStream>(request_id);
+        stream->callback = callback;
+        {
+            std::lock_guard<std::mutex> lock(_streams_mutex);
+            if (_is_running) {
+                _streams[request_id] = stream;
+            } else {
+                stream->is_finished = true;
+            }
+        }
+        write_request(request_id, type, payload.data(), payload.size());
+        _client.flush();
+        return stream;
+    }
+    // stop receiving the response of a request
+    inline void cancel(const uint32_t request_id) {
+        {
+            std::lock_guard<std::mutex> lock(_streams_mutex);
+            auto it = _streams.find(request_id);
+            if (it == _streams.end()) {
+                return;
+            }
+            finish(*it->second);
+            _streams.erase(it);
+        }
+        const RemoteHistoryCancelParameters parameters = {request_id};
+        send(REMOTE_CANCEL, &parameters, sizeof(parameters));
+        flush();
+    }
+
+private:
+
+    template <typename T>
+    static inline const std::string make_payload(const T& parameters) {
+        return std::string((const char*) &parameters, sizeof(parameters));
+    }
+
+    template <typename T>
+    inline std::vector<T> request_all(const RemoteHistoryRequestType type, const std::string& payload=std::string()) {
+        std::vector<T> result;
+        std::shared_ptr<RemoteHistoryStream> stream = request(type, payload);
+        std::string chunk;
+        while (stream->pop(chunk)) {
+            result.insert(result.end(), (const T*) chunk.data(), (const T*) (chunk.data() + chunk.size()));
+        }
+        return result;
+    }
+
+    // request without a response
+    inline void send(const RemoteHistoryRequestType type, const void* payload, const uint32_t size) {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        write_request(_next_request_id++, type, payload, size);
+    }
+    // must be called with _write_mutex held
+    inline void write_request(const uint32_t request_id, const RemoteHistoryRequestType type, const void* payload, const uint32_t size) {
+        const RemoteHistoryRequest request = {request_id, type, size};
+        _client.write(&request, sizeof(request));
+        _client.write(payload, size);
+    }
+
+    static inline void finish(RemoteHistoryStream& stream) {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        stream.is_finished = true;
+        stream.condition.notify_all();
+    }
+
+    static void _receive(RemoteHistory* history) {
+        history->receive();
+    }
+    inline void receive() {
+        try {
+            while (_is_running) {
+                if (!_client.wait_readable(.1)) {
+                    continue;
+                }
+                RemoteHistoryResponse response;
+                _client.read(response);
+                std::string chunk(response.size, '\0');
+                if (response.size) {
+                    _client.read(&chunk[0], response.size);
+                }
+                std::shared_ptr<RemoteHistoryStream> stream;
+                {
+                    std::lock_guard<std::mutex> lock(_streams_mutex);
+                    auto it = _streams.find(response.request_id);
+                    if (it == _streams.end()) {
+                        // cancelled
+                        continue;
+                    }
+                    stream = it->second;
+                    if (response.is_last) {
+                        _streams.erase(it);
+                    }
+                }
+                if (stream->callback) {
+                    stream->callback(chunk);
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(stream->mutex);
+                stream->chunks.push_back(std::move(chunk));
+                stream->is_finished = response.is_last;
+                stream->condition.notify_all();
+            }
+        } catch (const TCPClientError&) {}
+        // wake up whoever still waits for a response
+        std::lock_guard<std::mutex> lock(_streams_mutex);
+        _is_running = false;
+        for (auto& it : _streams) {
+            finish(*it.second);
+        }
+        _streams.clear();
+    }
+
+    TCPClient _client;
+    std::mutex _write_mutex;
+    uint32_t _next_request_id;
+    std::mutex _streams_mutex;
+    std::unordered_map<uint32_t, std::shared_ptr<RemoteHistoryStream>> _streams;
+    std::atomic<bool> _is_running;
+    std::thread _receiver;
+};
+
+
+template <typename T>
+inline RemoteRangeData<T>::RemoteRangeData(RemoteHistory& history, const RemoteHistoryRequestType type, const std::string& payload) :
+    _history(history),
+    _type(type),
+    _payload(payload),
+    _stream(history.request(type, payload)),
+    _is_started(false),
+    _index(0) {}
+
+template <typename T>
+RemoteRangeData<T>::~RemoteRangeData() {
+    _history.cancel(_stream->request_id);
+}
+
+template <typename T>
+const bool RemoteRangeData<T>::init(T*& value) {
+    // the first iteration consumes the pipelined request, later ones ask again
+    if (_is_started) {
+        _history.cancel(_stream->request_id);
+        _stream = _history.request(_type, _payload);
+    }
+    _is_started = true;
+    _chunk.clear();
+    _index = 0;
+    return next(value);
+}
+
+
+#endif // CTRADING__HISTORY__REMOTEHISTORY__HPP
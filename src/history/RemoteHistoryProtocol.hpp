@@ -0,0 +1,91 @@
+#ifndef CTRADING__HISTORY__REMOTEHISTORYPROTOCOL__HPP
+#define CTRADING__HISTORY__REMOTEHISTORYPROTOCOL__HPP
+
+
+#include <stdint.h>
+
+#include "models/Timestamp.hpp"
+
+
+// binary protocol between RemoteHistory and HistoryServer
+//
+// every request starts with a RemoteHistoryRequest header, followed by
+// payload_size bytes; requests can be pipelined, and responses are tagged with
+// the request id, as a stream of chunks, each one being a
+// RemoteHistoryResponse header followed by count packed records (size bytes);
+// the last chunk of a response has is_last set (subscriptions only end when
+// the subscriber falls too far behind)
+
+
+enum RemoteHistoryRequestType : uint8_t {
+    // payload: one record, no response
+    REMOTE_FEED_BALANCE_CHANGE = 1,
+    REMOTE_FEED_TRADE = 2,
+    REMOTE_FEED_ORDER = 3,
+    REMOTE_FEED_DECISION = 4,
+    // no payload, responds with a stream of records
+    REMOTE_GET_BALANCE_CHANGES = 16,
+    REMOTE_GET_TRADES = 17,
+    REMOTE_GET_ORDERS = 18,
+    REMOTE_GET_DECISIONS = 19,
+    // payload: RemoteHistoryTimestampsParameters, responds with a stream of records
+    REMOTE_GET_TRADES_BY_TIMESTAMP = 32,
+    REMOTE_GET_DECISIONS_BY_TIMESTAMP = 33,
+    // summaries, each responds with a single chunk
+    REMOTE_GET_BALANCE_AT_TIMESTAMP = 48, // payload: Timestamp, responds with one Balance
+    REMOTE_GET_TRADE_SUMMARY = 49, // payload: RemoteHistoryTimestampsParameters, responds with one TradeSummary
+    REMOTE_GET_BUCKETED = 50, // payload: RemoteHistoryBucketsParameters, responds with TradeBucket records
+    REMOTE_GET_TIME_SPAN = 51, // no payload, responds with one TimestampSpan
+    // live feed of the trades fed to the server, as Trade records
+    REMOTE_SUBSCRIBE_TRADES = 64,
+    // payload: RemoteHistoryCancelParameters, no response
+    REMOTE_CANCEL = 80,
+};
+
+
+#pragma pack(push, 1)
+
+
+struct RemoteHistoryRequest {
+    uint32_t id;
+    RemoteHistoryRequestType type;
+    uint32_t payload_size;
+};
+
+struct RemoteHistoryResponse {
+    uint32_t request_id;
+    uint32_t count;
+    uint32_t size;
+    uint8_t is_last;
+};
+
+struct RemoteHistoryTimestampsParameters {
+    double timestamp_begin;
+    double timestamp_end;
+};
+
+struct RemoteHistoryBucketsParameters {
+    double timestamp_from;
+    double timestamp_to;
+    uint64_t n_buckets;
+};
+
+struct RemoteHistoryCancelParameters {
+    uint32_t request_id;
+};
+
+
+#pragma pack(pop)
+
+
+// records per streamed chunk
+static const uint32_t REMOTE_HISTORY_CHUNK_SIZE = 1024;
+// larger bucketed requests are rejected by the server
+static const uint64_t REMOTE_HISTORY_MAX_BUCKETS = 1 << 16;
+// requests with a larger payload get their connection dropped
+static const uint32_t REMOTE_HISTORY_MAX_PAYLOAD_SIZE = 1 << 12;
+// subscribers with more bytes waiting to be sent get unsubscribed
+static const size_t REMOTE_HISTORY_MAX_SUBSCRIBER_PENDING_SIZE = 1 << 22;
+
+
+#endif // CTRADING__HISTORY__REMOTEHISTORYPROTOCOL__HPP
@@ -9,6 +9,9 @@
 #include <stdint.h>
 #include <cmath>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 // #include <ncurses.h>
 #include <ncursesw/ncurses.h>
@@ -18,184 +21,58 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <deque>
 
 #include "models/Timestamp.hpp"
+#include "math/PlotterCurve.hpp"
 
 
-enum PlotterColor {
-    RED = 1,
-    GREEN = 2,
-    YELLOW = 3,
-    BLUE = 4,
-    MAGENTA = 5,
-    CYAN = 6,
-    WHITE = 7,
-};
-
-
-struct PlotterCurve {
-    PlotterCurve(std::function<double(double)> f, PlotterColor color) :
-        type(FUNCTION_1),
-        f1(f),
-        color(color) {}
-    PlotterCurve(std::function<double(double, double)> f, PlotterColor color) :
-        type(FUNCTION_2),
-        f2(f),
-        color(color) {}
-    PlotterCurve(std::function<std::pair<double, double>(double, double)> f, PlotterColor color) :
-        type(FUNCTION_3),
-        f3(f),
-        color(color) {}
-    PlotterCurve(std::vector<std::pair<double, double>> values, PlotterColor color) :
-        type(VALUES),
-        values(values),
-        color(color) {}
-    enum {
-        FUNCTION_1,
-        FUNCTION_2,
-        FUNCTION_3,
-        VALUES,
-    } type;
-
-    const std::pair<double, double> compute(std::pair<double, double> x) {
-        switch (type) {
-            case FUNCTION_1: {
-                return {f1(x.first), f1(x.second)};
-            }
-            case FUNCTION_2: {
-                double y = f2(x.first, x.second);
-                return {y, y};
-            }
-            case FUNCTION_3: {
-                return f3(x.first, x.second);
-            }
-            case VALUES: {
-                double y_min, y_max;
-                for (const auto& value : values) {
-                    if (value.first > x.first && value.first <= x.second) {
-                        if (std::isnan(y_min) || value.second < y_min) {
-                            y_min = value.second;
-                        }
-                        if (std::isnan(y_max) || value.second < y_max) {
-                            y_max = value.second;
-                        }
-                    }
-                }
-                return {y_min, y_max};
-            }
-            default: {
-                return {NAN, NAN};
-            }
-        }
+struct PlotterCell {
+    inline PlotterCell(const wchar_t* _character=NULL, const attr_t _attributes=0) :
+        character(_character),
+        attributes(_attributes) {}
+    inline const bool operator != (const PlotterCell& other) const {
+        return character != other.character || attributes != other.attributes;
     }
-
-    std::function<double(double)> f1;
-    std::function<double(double, double)> f2;
-    std::function<std::pair<double, double>(double, double)> f3;
-    std::vector<std::pair<double, double>> values;
-    PlotterColor color;
-};
-
-struct PlotterAxisParameters {
-    PlotterAxisParameters() :
-        min(NAN),
-        max(NAN),
-        step(NAN),
-        origin(NAN),
-        grid(NAN) {}
-    enum {TEMPORAL, LINEAR, LOGARITHMIC} type;
-    double min;
-    double max;
-    double step;
-    double origin;
-    double grid;
-};
-
-
-struct PlotterAxesParameters {
-    PlotterAxisParameters x;
-    PlotterAxisParameters y;
-
-    inline const double i_to_x(const int16_t value) const {
-        switch (x.type) {
-            case PlotterAxisParameters::TEMPORAL:
-            case PlotterAxisParameters::LINEAR:
-                return value * x.step + x.min;
-            case PlotterAxisParameters::LOGARITHMIC:
-                return NAN;
-        }
-    }
-    inline const int16_t x_to_i(const double value) const {
-        switch (x.type) {
-            case PlotterAxisParameters::TEMPORAL:
-            case PlotterAxisParameters::LINEAR:
-                return std::round((value - x.min + .5 * x.step) / x.step);
-            case PlotterAxisParameters::LOGARITHMIC:
-                if (value < 0) {
-                    return -1;
-                }
-                return std::round(std::log(value / x.min) / x.step);
-        }
-    }
-    inline const int16_t y_to_j(double value) const {
-        switch (y.type) {
-            case PlotterAxisParameters::TEMPORAL:
-            case PlotterAxisParameters::LINEAR:
-                return std::round((y.max - value) / y.step);
-            case PlotterAxisParameters::LOGARITHMIC:
-                if (value <= 0) {
-                    return -1;
-                }
-                return std::round(std::log(y.max / value) / y.step);
-        }
-    }
-
+    const wchar_t* character;
+    attr_t attributes;
 };
 
 
 class PlotterBuffer {
 public:
 
-    PlotterBuffer(int16_t plot_width, int16_t plot_height, PlotterAxesParameters& axes) :
-        _plot_width(plot_width + 1),
-        _plot_height(2 * plot_height + 2),
-        _axes(axes)
-    {
-        // allocate pixels buffer
-        _plot = (uint8_t**) malloc(_plot_width * sizeof(uint8_t*));
-        _plot_pixels = (uint8_t*) calloc(_plot_width * _plot_height, sizeof(uint8_t));
-        for (int16_t j=0; j<_plot_height; ++j) {
-            _plot[j] = _plot_pixels + (j * _plot_width);
-        }
+    inline PlotterBuffer() :
+        _axes(NULL),
+        _plot_width(0),
+        _plot_height(0) {}
+
+    inline void resize(const int16_t plot_width, const int16_t plot_height) {
+        _plot_width = plot_width + 1;
+        _plot_height = 2 * plot_height + 2;
+        _plot_pixels.assign(_plot_width * _plot_height, 0);
+    }
+    inline void reset(PlotterAxesParameters& axes) {
+        _axes = &axes;
+        std::fill(_plot_pixels.begin(), _plot_pixels.end(), 0);
         // adjust axes
-        adjust_axis(_axes.x, _plot_width);
-        adjust_axis(_axes.y, _plot_height);
+        _axes->x.adjust(_plot_width);
+        _axes->y.adjust(_plot_height);
         // draw grids
         plot_grid_vertical();
         plot_grid_horizontal();
     }
 
-    inline void adjust_axis(PlotterAxisParameters& axis, const int16_t size) {
-        if (std::isnan(axis.min)) {
-            axis.min = axis.max - (size - 1) * axis.step;
-        }
-        if (std::isnan(axis.max)) {
-            axis.max = axis.min + (size - 1) * axis.step;
-        }
-        if (std::isnan(axis.step)) {
-            switch (axis.type) {
-                case PlotterAxisParameters::TEMPORAL:
-                case PlotterAxisParameters::LINEAR:
-                    axis.step = (axis.max - axis.min) / (double) (size - 1);
-                    break;
-                case PlotterAxisParameters::LOGARITHMIC:
-                    axis.step = std::log(axis.max / axis.min) / (double) (size - 1);
-                    break;
-            }
-        }
+    inline const int16_t get_width() const {
+        return _plot_width;
+    }
+    inline const int16_t get_height() const {
+        return _plot_height / 2;
     }
 
-    inline const bool check_ij(const int16_t i, const int16_t j) const {
+    inline const bool check_ij(const int32_t i, const int32_t j) const {
         if (i < 0 || i >= _plot_width) {
             return false;
         }
@@ -204,90 +81,43 @@ public:
         }
         return true;
     }
+    inline uint8_t& pixel(const int16_t i, const int16_t j) {
+        return _plot_pixels[j * _plot_width + i];
+    }
 
     inline void plot_line_vertical(const double& x, const int value) {
-        if (x >= _axes.x.min && x <= _axes.x.max) {
-            int16_t i = _axes.x_to_i(x);
+        if (x >= _axes->x.min && x <= _axes->x.max) {
+            int32_t i = _axes->x_to_i(x);
             if (i >= 0 && i < _plot_width) {
                 for (int16_t j=0; j<_plot_height; ++j) {
-                    _plot[j][i] |= value;
+                    pixel(i, j) |= value;
                 }
             }
         }
     }
     inline void plot_grid_vertical() {
-        switch (_axes.x.type) {
-            case PlotterAxisParameters::TEMPORAL:
-            case PlotterAxisParameters::LINEAR: {
-                double x_min = _axes.x.origin;
-                while (x_min > _axes.x.min) {
-                    x_min -= _axes.x.grid;
-                }
-                // normal grid
-                for (double x=x_min; x<=_axes.x.max; x+=_axes.x.grid) {
-                    plot_line_vertical(x, 8);
-                }
-                // origin
-                plot_line_vertical(_axes.x.origin, 32);
-            } break;
-            case PlotterAxisParameters::LOGARITHMIC: {
-                // normal grid
-                if (_axes.x.grid > 1.) {
-                    double x_min = _axes.x.origin;
-                    while (x_min > _axes.x.min) {
-                        x_min /= _axes.x.grid;
-                    }
-                    for (double x=x_min; x<=_axes.x.max; x*=_axes.x.grid) {
-                        plot_line_vertical(x, 16);
-                    }
-                }
-                // origin
-                plot_line_vertical(_axes.x.origin, 32);
-            } break;
+        const std::vector<double> lines = _axes->x.get_grid_lines();
+        for (size_t l=0; l<lines.size(); ++l) {
+            plot_line_vertical(lines[l], (l + 1 == lines.size()) ? 32 : 8);
         }
     }
 
     inline void plot_line_horizontal(const double& y, const int value) {
-        if (y >= _axes.y.min && y <= _axes.y.max) {
-            int16_t j = _axes.y_to_j(y);
-            if (j >= 0 && j < _plot_width) {
+        if (y >= _axes->y.min && y <= _axes->y.max) {
+            int32_t j = _axes->y_to_j(y);
+            if (j >= 0 && j < _plot_height) {
                 j -= j % 2;
                 for (int16_t i=0; i<_plot_width; ++i) {
-                    _plot[j][i] |= value;
-                    _plot[j+1][i] |= value;
+                    pixel(i, j) |= value;
+                    pixel(i, j+1) |= value;
                 }
             }
         }
     }
     inline void plot_grid_horizontal() {
-        switch (_axes.y.type) {
-            case PlotterAxisParameters::TEMPORAL:
-            case PlotterAxisParameters::LINEAR: {
-                double y_min = _axes.y.origin;
-                while (y_min > _axes.y.min) {
-                    y_min -= _axes.y.grid;
-                }
-                // normal grid
-                for (double y=y_min; y<=_axes.y.max; y+=_axes.y.grid) {
-                    plot_line_horizontal(y, 16);
-                }
-                // origin
-                plot_line_horizontal(_axes.y.origin, 32);
-            } break;
-            case PlotterAxisParameters::LOGARITHMIC: {
-                // normal grid
-                if (_axes.y.grid > 1.) {
-                    double y_min = _axes.y.origin;
-                    while (y_min > _axes.y.min) {
-                        y_min /= _axes.y.grid;
-                    }
-                    for (double y=y_min; y<=_axes.y.max; y*=_axes.y.grid) {
-                        plot_line_horizontal(y, 16);
-                    }
-                }
-                // origin
-                plot_line_horizontal(_axes.y.origin, 32);
-            } break;
+        const std::vector<double> lines = _axes->y.get_grid_lines();
+        for (size_t l=0; l<lines.size(); ++l) {
+            plot_line_horizontal(lines[l], (l + 1 == lines.size()) ? 32 : 16);
         }
     }
 
@@ -295,51 +125,63 @@ public:
         if (std::isnan(y)) {
             return;
         }
-        const int16_t i = _axes.x_to_i(x);
-        const int16_t j = _axes.y_to_j(y);
+        const int32_t i = _axes->x_to_i(x);
+        const int32_t j = _axes->y_to_j(y);
         if (!check_ij(i, j)) {
             return;
         }
-        _plot[j][i] = color;
+        pixel(i, j) = color;
     }
-    inline void plot(double x, std::pair<double, double> y_range, PlotterColor color=WHITE) {
-        for (double y=y_range.first; y<=y_range.second; y+=_axes.y.step) {
-            plot(x, y, color);
-        }
-        plot(x, y_range.second, color);
-    }
-
-    inline void plot(std::function<double(double)> f, PlotterColor color) {
-        for (double x=_axes.x.min; x<_axes.x.max+_axes.x.step; x+=_axes.x.step) {
-            plot(x, f(x), color);
-        }
-    }
-    inline void plot(std::function<double(double, double)> f, PlotterColor color) {
-        for (double x=_axes.x.min-.5*_axes.x.step; x<_axes.x.max+_axes.x.step; x+=_axes.x.step) {
-            plot(x, f(x, x + _axes.x.step), color);
+    inline void plot_column(const int16_t i, std::pair<double, double> y_range, PlotterColor color=WHITE) {
+        if (i < 0 || i >= _plot_width || std::isnan(y_range.second)) {
+            return;
         }
-    }
-    inline void plot(std::function<std::pair<double, double>(double, double)> f, PlotterColor color) {
-        for (double x=_axes.x.min-.5*_axes.x.step; x<_axes.x.max+_axes.x.step; x+=_axes.x.step) {
-            plot(x, f(x, x + _axes.x.step), color);
+        const int32_t j_max = _axes->y_to_j(y_range.second);
+        const int32_t j_min = std::isnan(y_range.first) ? j_max : _axes->y_to_j(y_range.first);
+        for (int32_t j=std::max<int32_t>(0, std::min(j_min, j_max)), j_end=std::min<int32_t>(_plot_height - 1, std::max(j_min, j_max)); j<=j_end; ++j) {
+            pixel(i, j) = color;
         }
     }
+
     inline void plot(const std::vector<std::pair<double, double>> values, PlotterColor color) {
         for (const auto& value : values) {
             plot(value.first, value.second, color);
         }
     }
 
-    inline void plot(const PlotterCurve& curve) {
+    // when missing_columns is given, columns absent from the cache are not
+    // computed but listed instead, and drawn from a nearby sample meanwhile
+    // when must_invalidate is set, trailing samples get recomputed (see
+    // PlotterSamplesCache::invalidate_trailing)
+    inline void plot(PlotterCurve& curve, std::vector<int16_t>* missing_columns=NULL, const bool must_invalidate=false) {
         switch (curve.type) {
             case PlotterCurve::FUNCTION_1:
-                plot(curve.f1, curve.color);
-                break;
             case PlotterCurve::FUNCTION_2:
-                plot(curve.f2, curve.color);
-                break;
             case PlotterCurve::FUNCTION_3:
-                plot(curve.f3, curve.color);
+            case PlotterCurve::FUNCTION_N:
+                curve.cache.align(_axes->x);
+                if (must_invalidate) {
+                    curve.cache.invalidate_trailing(_plot_width);
+                }
+                if (missing_columns == NULL) {
+                    curve.sample_runs(*_axes, _plot_width);
+                }
+                for (int16_t i=0; i<_plot_width; ++i) {
+                    if (missing_columns == NULL) {
+                        plot_column(i, curve.sample(*_axes, i), curve.color);
+                        continue;
+                    }
+                    std::pair<double, double> y;
+                    if (curve.cache.find(i, y)) {
+                        plot_column(i, y, curve.color);
+                        continue;
+                    }
+                    missing_columns->push_back(i);
+                    if (curve.cache.find_nearest(i, y, 16)) {
+                        plot_column(i, y, curve.color);
+                    }
+                }
+                curve.cache.trim(_plot_width);
                 break;
             case PlotterCurve::VALUES:
                 plot(curve.values, curve.color);
@@ -347,11 +189,10 @@ public:
         }
     }
 
-    inline wchar_t* get_character(uint8_t pixel_top, uint8_t pixel_bottom) {
+    inline const wchar_t* get_character(uint8_t pixel_top, uint8_t pixel_bottom) const {
         if (!(pixel_top | pixel_bottom)) {
             return L" ";
         } else if (pixel_top < 8 || pixel_bottom < 8) {
-            // printf("\e[3%hhu;4%hhum▀", pixel_top & 7, pixel_bottom & 7);
             return L"▀";
         } else {
             switch (pixel_top & 24) {
@@ -366,59 +207,224 @@ public:
             }
         }
     }
-    inline void show() {
-        for (int16_t j=0; j<_plot_height; j+=2) {
+    inline const PlotterCell get_cell(const int16_t i, const int16_t row) {
+        const uint8_t pixel_top = pixel(i, 2 * row);
+        const uint8_t pixel_bottom = pixel(i, 2 * row + 1);
+        PlotterCell cell(get_character(pixel_top, pixel_bottom));
+        if (pixel_top < 8 || pixel_bottom < 8) {
+            cell.attributes = COLOR_PAIR((pixel_top & 7) | ((pixel_bottom & 7) << 3));
+        } else if (pixel_top | pixel_bottom) {
+            cell.attributes = COLOR_PAIR(64) | (((pixel_bottom | pixel_top) & 32) ? A_BOLD : A_DIM);
+        } else {
+            cell.attributes = COLOR_PAIR(1);
+        }
+        return cell;
+    }
+
+    // cells that changed since the previous frame, which gets updated
+    inline void diff(std::vector<PlotterCell>& screen, std::function<void(const int16_t, const int16_t, const PlotterCell&)> callback) {
+        const int16_t height = get_height();
+        if (screen.size() != _plot_width * height) {
+            screen.assign(_plot_width * height, PlotterCell());
+        }
+        for (int16_t row=0; row<height; ++row) {
             for (int16_t i=0; i<_plot_width; ++i) {
-                const uint8_t pixel_top = _plot[j][i];
-                const uint8_t pixel_bottom = _plot[j + 1][i];
-                wchar_t* character = get_character(pixel_top, pixel_bottom);
-                if (pixel_top < 8 || pixel_bottom < 8) {
-                    attron(A_INVIS);
-                    // attrset(COLOR_PAIR(2));
-                    attrset(COLOR_PAIR((pixel_top & 7) | ((pixel_bottom & 7) << 3)));
-                    // attron(COLOR_PAIR((pixel_top & 7) | ((pixel_bottom & 7) << 3)));
-                } else if (pixel_top | pixel_bottom) {
-                    attrset(COLOR_PAIR(64));
-                    if ((pixel_bottom | pixel_top) & 32) {
-                        attron(A_BOLD);
-                    } else {
-                        attron(A_DIM);
-                    }
-                } else {
-                    attrset(COLOR_PAIR(1));
+                const PlotterCell cell = get_cell(i, row);
+                PlotterCell& previous_cell = screen[row * _plot_width + i];
+                if (cell != previous_cell) {
+                    callback(row, i, cell);
+                    previous_cell = cell;
                 }
-                mvaddwstr(j/2, i, character);
-                // attron(COLOR_PAIR(0));
-                attroff(A_BOLD);
-                attroff(A_DIM);
             }
         }
-        switch (_axes.x.type) {
+    }
+    // only emit the cells that changed since the previous frame
+    inline void show(std::vector<PlotterCell>& screen) {
+        diff(screen, [](const int16_t row, const int16_t i, const PlotterCell& cell) {
+            attrset(cell.attributes);
+            mvaddwstr(row, i, cell.character);
+        });
+        attrset(A_NORMAL);
+        switch (_axes->x.type) {
             case PlotterAxisParameters::LINEAR:
             case PlotterAxisParameters::LOGARITHMIC:
-                mvprintw(0, 0, " [ %lf , %lf ]  ->  [ %lf , %lf ] ", _axes.x.min, _axes.x.max, _axes.y.min, _axes.y.max);
+                mvprintw(0, 0, " [ %lf , %lf ]  ->  [ %lf , %lf ] ", _axes->x.min, _axes->x.max, _axes->y.min, _axes->y.max);
                 break;
             case PlotterAxisParameters::TEMPORAL: {
-                const std::string min = Timestamp(_axes.x.min);
-                const std::string max = Timestamp(_axes.x.max);
-                mvprintw(0, 0, " [ %s , %s ]  ->  [ %lf , %lf ] ", min.c_str(), max.c_str(), _axes.y.min, _axes.y.max);
+                const std::string min = Timestamp(_axes->x.min);
+                const std::string max = Timestamp(_axes->x.max);
+                mvprintw(0, 0, " [ %s , %s ]  ->  [ %lf , %lf ] ", min.c_str(), max.c_str(), _axes->y.min, _axes->y.max);
                 }
                 break;
         }
+        // the header overwrote some cells
+        invalidate_row(screen, 0);
         refresh();
     }
+    inline void invalidate_row(std::vector<PlotterCell>& screen, const int16_t row) const {
+        if (row >= 0 && row < get_height()) {
+            std::fill(screen.begin() + row * _plot_width, screen.begin() + (row + 1) * _plot_width, PlotterCell());
+        }
+    }
 
 private:
-    PlotterAxesParameters& _axes;
+    PlotterAxesParameters* _axes;
     int16_t _plot_width, _plot_height;
-    uint8_t** _plot;
-    uint8_t* _plot_pixels;
+    std::vector<uint8_t> _plot_pixels;
+};
+
+
+// either a single column, or columns_count consecutive columns from key
+// for batch curves
+struct PlotterTask {
+    size_t curve_index;
+    int64_t key;
+    uint64_t epoch;
+    double x;
+    std::pair<double, double> x_interval;
+    int level;
+    size_t columns_count;
+};
+
+
+// evaluates curves in the background, storing samples into their caches
+class PlotterEvaluator {
+public:
+    inline PlotterEvaluator(std::deque<PlotterCurve>& curves, std::mutex& samples_mutex) :
+        _curves(curves),
+        _samples_mutex(samples_mutex),
+        _running_tasks_count(0),
+        _is_evaluating(false),
+        _has_new_samples(false) {}
+    inline ~PlotterEvaluator() {
+        set_threads_count(0);
+    }
+
+    inline void set_threads_count(const size_t threads_count) {
+        {
+            std::lock_guard<std::mutex> lock(_tasks_mutex);
+            _is_evaluating = false;
+            _tasks.clear();
+        }
+        _tasks_condition.notify_all();
+        for (std::thread& worker : _workers) {
+            worker.join();
+        }
+        _workers.clear();
+        {
+            std::lock_guard<std::mutex> lock(_tasks_mutex);
+            _is_evaluating = (threads_count != 0);
+        }
+        for (size_t t=0; t<threads_count; ++t) {
+            _workers.push_back(std::thread(_evaluate, this));
+        }
+    }
+    inline const bool is_evaluating() const {
+        return !_workers.empty();
+    }
+    inline const bool has_new_samples() {
+        return _has_new_samples.exchange(false);
+    }
+
+    // columns on a coarse grid are computed first, then the grid gets refined
+    static inline const int get_refinement_level(const int16_t i) {
+        int level = 0;
+        for (int16_t stride=16; stride>1; stride/=2, ++level) {
+            if (i % stride == 0) {
+                break;
+            }
+        }
+        return level;
+    }
+    // replace pending tasks, thus cancelling work for a previous view
+    inline void schedule(std::vector<PlotterTask>& tasks) {
+        std::stable_sort(tasks.begin(), tasks.end(), [](const PlotterTask& a, const PlotterTask& b) {
+            return a.level < b.level;
+        });
+        {
+            std::lock_guard<std::mutex> lock(_tasks_mutex);
+            _tasks.assign(tasks.begin(), tasks.end());
+        }
+        _tasks_condition.notify_all();
+    }
+    // pending tasks are dropped, and running ones are waited for, as they
+    // point to the curves
+    inline void cancel() {
+        std::unique_lock<std::mutex> lock(_tasks_mutex);
+        _tasks.clear();
+        _idle_condition.wait(lock, [this] {
+            return _running_tasks_count == 0;
+        });
+    }
+    // wait until every scheduled task got evaluated
+    inline void wait() {
+        std::unique_lock<std::mutex> lock(_tasks_mutex);
+        _idle_condition.wait(lock, [this] {
+            return _tasks.empty() && _running_tasks_count == 0;
+        });
+    }
+
+private:
+    static void _evaluate(PlotterEvaluator* evaluator) {
+        evaluator->evaluate();
+    }
+    void evaluate() {
+        while (true) {
+            PlotterTask task;
+            {
+                std::unique_lock<std::mutex> lock(_tasks_mutex);
+                _tasks_condition.wait(lock, [this] {
+                    return !_is_evaluating || !_tasks.empty();
+                });
+                if (!_is_evaluating) {
+                    return;
+                }
+                task = _tasks.front();
+                _tasks.pop_front();
+                ++_running_tasks_count;
+            }
+            PlotterCurve* curve;
+            {
+                std::lock_guard<std::mutex> lock(_samples_mutex);
+                curve = &_curves[task.curve_index];
+            }
+            std::vector<std::pair<double, double>> y;
+            if (task.columns_count == 1) {
+                y.push_back(curve->evaluate(task.x, task.x_interval));
+            } else {
+                y = curve->evaluate(task.x_interval, task.columns_count);
+            }
+            {
+                std::lock_guard<std::mutex> lock(_samples_mutex);
+                for (size_t k=0; k<y.size(); ++k) {
+                    curve->cache.insert(task.key + k, task.epoch, y[k]);
+                }
+                _has_new_samples = true;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_tasks_mutex);
+                --_running_tasks_count;
+            }
+            _idle_condition.notify_all();
+        }
+    }
+
+    std::deque<PlotterCurve>& _curves;
+    std::mutex& _samples_mutex;
+    std::vector<std::thread> _workers;
+    std::deque<PlotterTask> _tasks;
+    std::mutex _tasks_mutex;
+    std::condition_variable _tasks_condition;
+    std::condition_variable _idle_condition;
+    size_t _running_tasks_count;
+    bool _is_evaluating;
+    std::atomic<bool> _has_new_samples;
 };
 
 
 class Plotter {
 public:
-    inline Plotter() : _last_window_size({0}), _is_looping(false) {
+    inline Plotter() : _last_window_size({0}), _is_looping(false), _evaluator(_curves, _samples_mutex), _refresh_delay(40) {
     	setlocale(LC_ALL, "");
         initscr();
         start_color();
@@ -434,57 +440,119 @@ public:
         init_pair(64, 7, 0);
     }
     inline ~Plotter() {
+        set_threads_count(0);
         clrtoeol();
     	refresh();
     	endwin();
     }
 
+    // pending tasks are dropped, and running ones are waited for, as they
+    // point to the curves
     inline void clear() {
+        _evaluator.cancel();
+        std::lock_guard<std::mutex> lock(_samples_mutex);
         _curves.clear();
     }
 
     inline void plot(std::function<double(double)> f, PlotterColor color=WHITE) {
+        std::lock_guard<std::mutex> lock(_samples_mutex);
         _curves.push_back(PlotterCurve(f, color));
     }
     inline void plot(std::function<double(double, double)> f, PlotterColor color=WHITE) {
+        std::lock_guard<std::mutex> lock(_samples_mutex);
         _curves.push_back(PlotterCurve(f, color));
     }
     inline void plot(std::function<std::pair<double, double>(double, double)> f, PlotterColor color=WHITE) {
+        std::lock_guard<std::mutex> lock(_samples_mutex);
+        _curves.push_back(PlotterCurve(f, color));
+    }
+    inline void plot(std::function<std::vector<std::pair<double, double>>(double, double, size_t)> f, PlotterColor color=WHITE) {
+        std::lock_guard<std::mutex> lock(_samples_mutex);
         _curves.push_back(PlotterCurve(f, color));
     }
     inline void plot(std::vector<std::pair<double, double>> values, PlotterColor color=WHITE) {
+        std::lock_guard<std::mutex> lock(_samples_mutex);
         _curves.push_back(PlotterCurve(values, color));
     }
 
+    // when threads_count is not zero, curves are evaluated in the background
+    // and the plot gets refined as samples come in
+    inline void set_threads_count(const size_t threads_count) {
+        _evaluator.set_threads_count(threads_count);
+    }
+    inline void set_refresh_delay(const int milliseconds) {
+        _refresh_delay = milliseconds;
+    }
+
     inline void show() {
+        render(true);
+    }
+    inline void render(const bool must_schedule) {
         // get window size
         struct winsize window_size;
         ioctl(STDOUT_FILENO, TIOCGWINSZ, &window_size);
-        // initialize buffer
-        PlotterBuffer buffer(window_size.ws_col, window_size.ws_row - 1, axes);
+        // reallocate buffer only when the terminal got resized
         if (_last_window_size.ws_col != window_size.ws_col || _last_window_size.ws_row != window_size.ws_row) {
-            // buffer.clear();
+            _buffer.resize(window_size.ws_col, window_size.ws_row - 1);
+            _screen.clear();
         }
         _last_window_size = window_size;
         // draw stuff
-        for (const PlotterCurve& curve : _curves) {
-            buffer.plot(curve);
+        std::vector<PlotterTask> tasks;
+        {
+            std::lock_guard<std::mutex> lock(_samples_mutex);
+            _buffer.reset(axes);
+            for (size_t c=0; c<_curves.size(); ++c) {
+                PlotterCurve& curve = _curves[c];
+                if (!_evaluator.is_evaluating()) {
+                    _buffer.plot(curve, NULL, must_schedule);
+                    continue;
+                }
+                std::vector<int16_t> missing_columns;
+                _buffer.plot(curve, &missing_columns, must_schedule);
+                if (!must_schedule || missing_columns.empty()) {
+                    continue;
+                }
+                // batch curves compute the whole span of missing columns at once
+                if (curve.type == PlotterCurve::FUNCTION_N && axes.x.type != PlotterAxisParameters::LOGARITHMIC) {
+                    const int16_t i_begin = missing_columns.front();
+                    const int16_t i_end = missing_columns.back() + 1;
+                    tasks.push_back({c, curve.cache.get_key(i_begin), curve.cache.get_epoch(), NAN,
+                        {axes.i_to_x_interval(i_begin).first, axes.i_to_x_interval(i_end - 1).second}, 0, (size_t) (i_end - i_begin)});
+                    continue;
+                }
+                for (const int16_t i : missing_columns) {
+                    tasks.push_back({c, curve.cache.get_key(i), curve.cache.get_epoch(), axes.i_to_column_x(i), axes.i_to_x_interval(i), PlotterEvaluator::get_refinement_level(i), 1});
+                }
+            }
+        }
+        if (must_schedule && _evaluator.is_evaluating()) {
+            _evaluator.schedule(tasks);
         }
         // go!
-        buffer.show();
+        _buffer.show(_screen);
     }
 
+    // panning moves by whole columns, so that cached samples remain valid
+    inline const double get_panning_columns(const PlotterAxisParameters& axis) const {
+        if (std::isnan(axis.step)) {
+            return NAN;
+        }
+        const int16_t size = (&axis == &axes.x) ? _buffer.get_width() : 2 * _buffer.get_height();
+        return std::max(1., std::round(.1 * size));
+    }
     void increase(PlotterAxisParameters& axis) {
+        const double columns = get_panning_columns(axis);
         switch (axis.type) {
             case PlotterAxisParameters::TEMPORAL:
             case PlotterAxisParameters::LINEAR: {
-                const double delta = (axis.max - axis.min) / 10.;
+                const double delta = std::isnan(columns) ? (axis.max - axis.min) / 10. : columns * axis.step;
                 axis.min += delta;
                 axis.max += delta;
                 break;
             }
             case PlotterAxisParameters::LOGARITHMIC: {
-                const double factor = pow(axis.max / axis.min, .1);
+                const double factor = std::isnan(columns) ? pow(axis.max / axis.min, .1) : exp(columns * axis.step);
                 axis.min *= factor;
                 axis.max *= factor;
                 break;
@@ -492,16 +560,17 @@ public:
         }
     }
     void decrease(PlotterAxisParameters& axis) {
+        const double columns = get_panning_columns(axis);
         switch (axis.type) {
             case PlotterAxisParameters::TEMPORAL:
             case PlotterAxisParameters::LINEAR: {
-                const double delta = (axis.max - axis.min) / 10.;
+                const double delta = std::isnan(columns) ? (axis.max - axis.min) / 10. : columns * axis.step;
                 axis.min -= delta;
                 axis.max -= delta;
                 break;
             }
             case PlotterAxisParameters::LOGARITHMIC: {
-                const double factor = pow(axis.max / axis.min, .1);
+                const double factor = std::isnan(columns) ? pow(axis.max / axis.min, .1) : exp(columns * axis.step);
                 axis.min /= factor;
                 axis.max /= factor;
                 break;
@@ -613,18 +682,28 @@ public:
         refresh();
     }
     virtual void on_mouse_move(const int i, const int j) {
-        std::pair<double, double> x = {axes.i_to_x(i), axes.i_to_x(i + 1)};
+        std::pair<double, double> x = axes.i_to_x_interval(i);
         attrset(COLOR_PAIR(0));
         if (axes.x.type == PlotterAxisParameters::TEMPORAL) {
             mvprintw(3, 1, "x ∈ [%s ; %s]", ((std::string) Timestamp(x.first)).c_str(), ((std::string) Timestamp(x.second)).c_str());
         } else {
             mvprintw(3, 1, "x ∈ [%lf ; %lf]", x.first, x.second);
         }
+        _buffer.invalidate_row(_screen, 3);
+        std::lock_guard<std::mutex> lock(_samples_mutex);
         int n = 0;
         for (auto& curve : _curves) {
-            const auto y = curve.compute(x);
+            std::pair<double, double> y = {NAN, NAN};
+            if (curve.type == PlotterCurve::VALUES) {
+                y = curve.compute(x);
+            } else if (!_evaluator.is_evaluating()) {
+                y = curve.sample(axes, i);
+            } else {
+                curve.cache.find(i, y);
+            }
             attrset(COLOR_PAIR(curve.color));
             mvprintw(n + 4, 1, "y%d ∈ [%lf ; %lf]", n, y.first, y.second);
+            _buffer.invalidate_row(_screen, n + 4);
             ++n;
         }
     }
@@ -634,6 +713,7 @@ public:
         show();
         keypad(stdscr, TRUE);
         mousemask(ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION, NULL);
+        timeout(_evaluator.is_evaluating() ? _refresh_delay : -1);
         while (_is_looping) {
             const int c = getch();
             MEVENT mouse_event;
@@ -644,6 +724,9 @@ public:
                     }
                     break;
                 case ERR:
+                    if (_evaluator.has_new_samples()) {
+                        render(false);
+                    }
                     break;
                 default:
                     on_key_press(c);
@@ -661,8 +744,14 @@ public:
 protected:
     bool _is_looping;
 private:
-    std::vector<PlotterCurve> _curves;
+
     struct winsize _last_window_size;
+    PlotterBuffer _buffer;
+    std::vector<PlotterCell> _screen;
+    std::deque<PlotterCurve> _curves;
+    std::mutex _samples_mutex;
+    PlotterEvaluator _evaluator;
+    int _refresh_delay;
 };
 
 
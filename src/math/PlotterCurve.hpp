@@ -0,0 +1,403 @@
+#ifndef CPPTRAING__MATH__PLOTTERCURVE_HPP
+#define CPPTRAING__MATH__PLOTTERCURVE_HPP
+
+
+#include <stdint.h>
+#include <cmath>
+
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+
+enum PlotterColor {
+    RED = 1,
+    GREEN = 2,
+    YELLOW = 3,
+    BLUE = 4,
+    MAGENTA = 5,
+    CYAN = 6,
+    WHITE = 7,
+};
+
+
+struct PlotterAxisParameters {
+    PlotterAxisParameters() :
+        min(NAN),
+        max(NAN),
+        step(NAN),
+        origin(NAN),
+        grid(NAN) {}
+    enum {TEMPORAL, LINEAR, LOGARITHMIC} type;
+    double min;
+    double max;
+    double step;
+    double origin;
+    double grid;
+
+    // fill missing bounds or step, for an axis spanning size pixels
+    inline void adjust(const int size) {
+        if (std::isnan(min)) {
+            min = max - (size - 1) * step;
+        }
+        if (std::isnan(max)) {
+            max = min + (size - 1) * step;
+        }
+        if (std::isnan(step)) {
+            switch (type) {
+                case TEMPORAL:
+                case LINEAR:
+                    step = (max - min) / (double) (size - 1);
+                    break;
+                case LOGARITHMIC:
+                    step = std::log(max / min) / (double) (size - 1);
+                    break;
+            }
+        }
+    }
+
+    // visible grid lines, the origin coming last
+    inline const std::vector<double> get_grid_lines() const {
+        std::vector<double> lines;
+        switch (type) {
+            case TEMPORAL:
+            case LINEAR: {
+                if (grid > 0.) {
+                    double value_min = origin;
+                    while (value_min > min) {
+                        value_min -= grid;
+                    }
+                    for (double value=value_min; value<=max; value+=grid) {
+                        lines.push_back(value);
+                    }
+                }
+            } break;
+            case LOGARITHMIC: {
+                if (grid > 1.) {
+                    double value_min = origin;
+                    while (value_min > min) {
+                        value_min /= grid;
+                    }
+                    for (double value=value_min; value<=max; value*=grid) {
+                        lines.push_back(value);
+                    }
+                }
+            } break;
+        }
+        lines.push_back(origin);
+        return lines;
+    }
+};
+
+
+struct PlotterAxesParameters {
+    PlotterAxisParameters x;
+    PlotterAxisParameters y;
+
+    inline const double i_to_x(const double value) const {
+        switch (x.type) {
+            case PlotterAxisParameters::TEMPORAL:
+            case PlotterAxisParameters::LINEAR:
+                return value * x.step + x.min;
+            case PlotterAxisParameters::LOGARITHMIC:
+                return x.min * std::exp(value * x.step);
+        }
+        return NAN;
+    }
+    // on linear axes, column i spans [i_to_x(i - 1), i_to_x(i)], as in x_to_i()
+    inline const double get_column_shift() const {
+        return (x.type == PlotterAxisParameters::LOGARITHMIC) ? 0. : .5;
+    }
+    inline const double i_to_column_x(const int32_t value) const {
+        return i_to_x(value - get_column_shift());
+    }
+    inline const std::pair<double, double> i_to_x_interval(const int32_t value) const {
+        const double shift = get_column_shift();
+        return {i_to_x(value - shift - .5), i_to_x(value - shift + .5)};
+    }
+    inline const int32_t x_to_i(const double value) const {
+        switch (x.type) {
+            case PlotterAxisParameters::TEMPORAL:
+            case PlotterAxisParameters::LINEAR:
+                return std::round((value - x.min + .5 * x.step) / x.step);
+            case PlotterAxisParameters::LOGARITHMIC:
+                if (value < 0) {
+                    return -1;
+                }
+                return std::round(std::log(value / x.min) / x.step);
+        }
+    }
+    inline const int32_t y_to_j(double value) const {
+        switch (y.type) {
+            case PlotterAxisParameters::TEMPORAL:
+            case PlotterAxisParameters::LINEAR:
+                return std::round((y.max - value) / y.step);
+            case PlotterAxisParameters::LOGARITHMIC:
+                if (value <= 0) {
+                    return -1;
+                }
+                return std::round(std::log(y.max / value) / y.step);
+        }
+    }
+
+};
+
+
+class PlotterSamplesCache {
+public:
+
+    inline PlotterSamplesCache() :
+        _anchor(NAN),
+        _step(NAN),
+        _offset(0),
+        _epoch(0) {}
+
+    // keys are column indices relative to the axis minimum when the cache was
+    // last reset, so that panning by whole columns keeps previous samples
+    inline void align(const PlotterAxisParameters& axis) {
+        if (std::isnan(_anchor) || axis.step != _step || axis.type != _type) {
+            reset(axis);
+            return;
+        }
+        double position;
+        switch (axis.type) {
+            case PlotterAxisParameters::TEMPORAL:
+            case PlotterAxisParameters::LINEAR:
+                position = (axis.min - _anchor) / axis.step;
+                break;
+            case PlotterAxisParameters::LOGARITHMIC:
+                position = std::log(axis.min / _anchor) / axis.step;
+                break;
+        }
+        const double rounded_position = std::round(position);
+        if (std::isnan(position) || std::abs(position - rounded_position) > 1e-6) {
+            reset(axis);
+            return;
+        }
+        _offset = rounded_position;
+    }
+    inline void reset(const PlotterAxisParameters& axis) {
+        _samples.clear();
+        _anchor = axis.min;
+        _step = axis.step;
+        _type = axis.type;
+        _offset = 0;
+        ++_epoch;
+    }
+    inline void clear() {
+        _samples.clear();
+        _anchor = NAN;
+        ++_epoch;
+    }
+
+    // keys and epoch allow samples computed in the background to be stored
+    // later on, as long as the cache has not been reset in the meantime
+    inline const int64_t get_key(const int32_t i) const {
+        return _offset + i;
+    }
+    inline const uint64_t get_epoch() const {
+        return _epoch;
+    }
+
+    inline const bool find(const int32_t i, std::pair<double, double>& y) const {
+        auto it = _samples.find(_offset + i);
+        if (it == _samples.end()) {
+            return false;
+        }
+        y = it->second;
+        return true;
+    }
+    // nearest known sample within the given distance, used as a placeholder
+    inline const bool find_nearest(const int32_t i, std::pair<double, double>& y, const int32_t distance) const {
+        for (int32_t d=1; d<distance; ++d) {
+            if (find(i - d, y) || find(i + d, y)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // samples from the last defined one up to the right edge may depend on
+    // data that came in since they were computed, so they get recomputed
+    inline void invalidate_trailing(const int32_t width) {
+        int64_t key_begin = _offset;
+        for (int32_t i=width-1; i>=0; --i) {
+            auto it = _samples.find(_offset + i);
+            if (it != _samples.end() && !std::isnan(it->second.second)) {
+                key_begin = it->first;
+                break;
+            }
+        }
+        for (auto it=_samples.begin(); it!=_samples.end(); ) {
+            if (it->first >= key_begin) {
+                it = _samples.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    inline void insert(const int32_t i, const std::pair<double, double>& y) {
+        _samples[_offset + i] = y;
+    }
+    inline void insert(const int64_t key, const uint64_t epoch, const std::pair<double, double>& y) {
+        if (epoch == _epoch) {
+            _samples[key] = y;
+        }
+    }
+
+    // forget samples that are too far from the visible columns
+    inline void trim(const int32_t width, const int32_t margin=4) {
+        const int64_t key_min = _offset - margin * width;
+        const int64_t key_max = _offset + (margin + 1) * width;
+        for (auto it=_samples.begin(); it!=_samples.end(); ) {
+            if (it->first < key_min || it->first > key_max) {
+                it = _samples.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+private:
+    double _anchor;
+    double _step;
+    decltype(PlotterAxisParameters::type) _type;
+    int64_t _offset;
+    uint64_t _epoch;
+    std::unordered_map<int64_t, std::pair<double, double>> _samples;
+};
+
+
+struct PlotterCurve {
+    PlotterCurve(std::function<double(double)> f, PlotterColor color) :
+        type(FUNCTION_1),
+        f1(f),
+        color(color) {}
+    PlotterCurve(std::function<double(double, double)> f, PlotterColor color) :
+        type(FUNCTION_2),
+        f2(f),
+        color(color) {}
+    PlotterCurve(std::function<std::pair<double, double>(double, double)> f, PlotterColor color) :
+        type(FUNCTION_3),
+        f3(f),
+        color(color) {}
+    PlotterCurve(std::function<std::vector<std::pair<double, double>>(double, double, size_t)> f, PlotterColor color) :
+        type(FUNCTION_N),
+        fn(f),
+        color(color) {}
+    PlotterCurve(std::vector<std::pair<double, double>> values, PlotterColor color) :
+        type(VALUES),
+        values(values),
+        color(color) {}
+    enum {
+        FUNCTION_1,
+        FUNCTION_2,
+        FUNCTION_3,
+        FUNCTION_N,
+        VALUES,
+    } type;
+
+    const std::pair<double, double> compute(std::pair<double, double> x) {
+        switch (type) {
+            case FUNCTION_1: {
+                return {f1(x.first), f1(x.second)};
+            }
+            case FUNCTION_2: {
+                double y = f2(x.first, x.second);
+                return {y, y};
+            }
+            case FUNCTION_3: {
+                return f3(x.first, x.second);
+            }
+            case FUNCTION_N: {
+                const auto y = fn(x.first, x.second, 1);
+                return y.empty() ? std::pair<double, double>(NAN, NAN) : y[0];
+            }
+            case VALUES: {
+                double y_min, y_max;
+                for (const auto& value : values) {
+                    if (value.first > x.first && value.first <= x.second) {
+                        if (std::isnan(y_min) || value.second < y_min) {
+                            y_min = value.second;
+                        }
+                        if (std::isnan(y_max) || value.second < y_max) {
+                            y_max = value.second;
+                        }
+                    }
+                }
+                return {y_min, y_max};
+            }
+            default: {
+                return {NAN, NAN};
+            }
+        }
+    }
+
+    // value range of the curve over a column centered on x
+    inline const std::pair<double, double> evaluate(const double x, const std::pair<double, double>& x_interval) {
+        switch (type) {
+            case FUNCTION_1: {
+                const double y = f1(x);
+                return {y, y};
+            }
+            case FUNCTION_2:
+            case FUNCTION_3:
+            case FUNCTION_N:
+                return compute(x_interval);
+            default:
+                return {NAN, NAN};
+        }
+    }
+    // n consecutive columns of equal width over x_interval, in a single call
+    // for batch curves
+    inline const std::vector<std::pair<double, double>> evaluate(const std::pair<double, double>& x_interval, const size_t n) {
+        std::vector<std::pair<double, double>> y;
+        if (type == FUNCTION_N) {
+            y = fn(x_interval.first, x_interval.second, n);
+        }
+        y.resize(n, {NAN, NAN});
+        return y;
+    }
+    // batch curves get every run of consecutive missing columns in one call,
+    // which requires columns of equal width
+    inline void sample_runs(const PlotterAxesParameters& axes, const int32_t width) {
+        if (type != FUNCTION_N || axes.x.type == PlotterAxisParameters::LOGARITHMIC) {
+            return;
+        }
+        std::pair<double, double> y;
+        for (int32_t i=0; i<width; ) {
+            if (cache.find(i, y)) {
+                ++i;
+                continue;
+            }
+            int32_t i_end = i + 1;
+            while (i_end < width && !cache.find(i_end, y)) {
+                ++i_end;
+            }
+            const std::vector<std::pair<double, double>> run = evaluate({axes.i_to_x_interval(i).first, axes.i_to_x_interval(i_end - 1).second}, i_end - i);
+            for (int32_t k=0; k<i_end-i && k<run.size(); ++k) {
+                cache.insert(i + k, run[k]);
+            }
+            i = i_end;
+        }
+    }
+    inline const std::pair<double, double> sample(const PlotterAxesParameters& axes, const int32_t i) {
+        std::pair<double, double> y;
+        if (cache.find(i, y)) {
+            return y;
+        }
+        y = evaluate(axes.i_to_column_x(i), axes.i_to_x_interval(i));
+        cache.insert(i, y);
+        return y;
+    }
+
+    std::function<double(double)> f1;
+    std::function<double(double, double)> f2;
+    std::function<std::pair<double, double>(double, double)> f3;
+    std::function<std::vector<std::pair<double, double>>(double, double, size_t)> fn;
+    std::vector<std::pair<double, double>> values;
+    PlotterColor color;
+    PlotterSamplesCache cache;
+};
+
+
+#endif // CPPTRAING__MATH__PLOTTERCURVE_HPP
@@ -0,0 +1,352 @@
+#ifndef CPPTRAING__MATH__PLOTTERIMAGE_HPP
+#define CPPTRAING__MATH__PLOTTERIMAGE_HPP
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <cmath>
+
+#include <png.h>
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <fstream>
+#include <functional>
+
+#include "exceptions/Exception.hpp"
+#include "models/Timestamp.hpp"
+#include "math/PlotterCurve.hpp"
+
+
+struct PlotterPixel {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
+
+// same model as Plotter, rendered without a terminal into PNG or SVG files
+class PlotterImage {
+public:
+
+    inline PlotterImage(const uint32_t width=1600, const uint32_t height=900) :
+        _width(width),
+        _height(height) {}
+
+    inline void plot(std::function<double(double)> f, PlotterColor color=WHITE) {
+        _curves.push_back(PlotterCurve(f, color));
+    }
+    inline void plot(std::function<double(double, double)> f, PlotterColor color=WHITE) {
+        _curves.push_back(PlotterCurve(f, color));
+    }
+    inline void plot(std::function<std::pair<double, double>(double, double)> f, PlotterColor color=WHITE) {
+        _curves.push_back(PlotterCurve(f, color));
+    }
+    inline void plot(std::function<std::vector<std::pair<double, double>>(double, double, size_t)> f, PlotterColor color=WHITE) {
+        _curves.push_back(PlotterCurve(f, color));
+    }
+    inline void plot(std::vector<std::pair<double, double>> values, PlotterColor color=WHITE) {
+        _curves.push_back(PlotterCurve(values, color));
+    }
+
+    // evaluate every curve on every pixel column, one thread per curve
+    inline void compute() {
+        readjust(axes.x, _requested_axes.x, _computed_axes.x);
+        readjust(axes.y, _requested_axes.y, _computed_axes.y);
+        _requested_axes = axes;
+        axes.x.adjust(_width);
+        axes.y.adjust(_height);
+        _computed_axes = axes;
+        _samples.assign(_curves.size(), std::vector<std::pair<double, double>>());
+        std::vector<std::thread> threads;
+        for (size_t c=0; c<_curves.size(); ++c) {
+            threads.push_back(std::thread(_compute_curve, this, c));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // samples are computed again when curves or axes changed since
+    inline const bool is_computed() const {
+        return _samples.size() == _curves.size() && is_same(axes.x, _computed_axes.x) && is_same(axes.y, _computed_axes.y);
+    }
+
+    inline void save(const std::string& path) {
+        if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".svg") == 0) {
+            save_svg(path);
+        } else {
+            save_png(path);
+        }
+    }
+
+    inline void save_png(const std::string& path) {
+        if (!is_computed()) {
+            compute();
+        }
+        const std::vector<PlotterPixel> pixels = rasterize();
+        FILE* file = fopen(path.c_str(), "wb");
+        if (file == NULL) {
+            throw FileException("PlotterImage could not open file for writing", path, strerror(errno));
+        }
+        png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        png_infop info = (png == NULL) ? NULL : png_create_info_struct(png);
+        if (info == NULL) {
+            png_destroy_write_struct(&png, NULL);
+            fclose(file);
+            throw FileException("PlotterImage could not initialize PNG writer", path);
+        }
+        if (setjmp(png_jmpbuf(png))) {
+            png_destroy_write_struct(&png, &info);
+            fclose(file);
+            throw FileException("PlotterImage could not write PNG", path);
+        }
+        png_init_io(png, file);
+        png_set_IHDR(png, info, _width, _height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png, info);
+        for (int32_t j=0; j<_height; ++j) {
+            png_write_row(png, (png_const_bytep) &pixels[(size_t) j * _width]);
+        }
+        png_write_end(png, NULL);
+        png_destroy_write_struct(&png, &info);
+        fclose(file);
+    }
+
+    inline void save_svg(const std::string& path) {
+        if (!is_computed()) {
+            compute();
+        }
+        std::ofstream file(path);
+        if (!file) {
+            throw FileException("PlotterImage could not open file for writing", path, strerror(errno));
+        }
+        file << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << _width << "\" height=\"" << _height << "\""
+             << " viewBox=\"0 0 " << _width << ' ' << _height << "\">\n";
+        file << "<rect width=\"100%\" height=\"100%\" fill=\"" << get_svg_color(_background) << "\"/>\n";
+        // grids
+        const std::vector<double> x_lines = axes.x.get_grid_lines();
+        for (size_t l=0; l<x_lines.size(); ++l) {
+            const int32_t i = axes.x_to_i(x_lines[l]);
+            if (x_lines[l] >= axes.x.min && x_lines[l] <= axes.x.max && i >= 0 && i < _width) {
+                file << "<line x1=\"" << i << "\" y1=\"0\" x2=\"" << i << "\" y2=\"" << _height << "\""
+                     << " stroke=\"" << get_svg_color((l + 1 == x_lines.size()) ? _origin : _grid) << "\"/>\n";
+            }
+        }
+        const std::vector<double> y_lines = axes.y.get_grid_lines();
+        for (size_t l=0; l<y_lines.size(); ++l) {
+            const int32_t j = axes.y_to_j(y_lines[l]);
+            if (y_lines[l] >= axes.y.min && y_lines[l] <= axes.y.max && j >= 0 && j < _height) {
+                file << "<line x1=\"0\" y1=\"" << j << "\" x2=\"" << _width << "\" y2=\"" << j << "\""
+                     << " stroke=\"" << get_svg_color((l + 1 == y_lines.size()) ? _origin : _grid) << "\"/>\n";
+            }
+        }
+        // curves
+        for (size_t c=0; c<_curves.size(); ++c) {
+            const PlotterCurve& curve = _curves[c];
+            const std::string color = get_svg_color(get_pixel(curve.color));
+            if (curve.type == PlotterCurve::VALUES) {
+                for (const auto& value : curve.values) {
+                    const int32_t i = axes.x_to_i(value.first);
+                    const int32_t j = axes.y_to_j(value.second);
+                    if (i >= 0 && i < _width && j >= 0 && j < _height) {
+                        file << "<circle cx=\"" << i << "\" cy=\"" << j << "\" r=\"1.5\" fill=\"" << color << "\"/>\n";
+                    }
+                }
+                continue;
+            }
+            file << "<path fill=\"none\" stroke=\"" << color << "\" d=\"";
+            bool is_drawing = false;
+            for (int32_t i=0; i<_width; ++i) {
+                std::pair<int32_t, int32_t> j_range;
+                if (!get_j_range(_samples[c][i], j_range)) {
+                    is_drawing = false;
+                    continue;
+                }
+                file << (is_drawing ? 'L' : 'M') << i << ' ' << j_range.first << 'V' << j_range.second;
+                is_drawing = true;
+            }
+            file << "\"/>\n";
+        }
+        // caption
+        file << "<text x=\"4\" y=\"14\" font-family=\"monospace\" font-size=\"12\" fill=\"" << get_svg_color(_origin) << "\">"
+             << escape_svg(get_caption()) << "</text>\n";
+        file << "</svg>\n";
+    }
+
+    PlotterAxesParameters axes;
+
+private:
+
+    static inline const bool is_same(const PlotterAxisParameters& axis, const PlotterAxisParameters& other) {
+        return axis.type == other.type && axis.min == other.min && axis.max == other.max && axis.step == other.step;
+    }
+    // bounds or step that adjust() derived from the others no longer match
+    // once those changed, so they get derived again
+    static inline void readjust(PlotterAxisParameters& axis, const PlotterAxisParameters& requested, const PlotterAxisParameters& computed) {
+        if (is_same(axis, computed)) {
+            return;
+        }
+        if (std::isnan(requested.min) && axis.min == computed.min) {
+            axis.min = NAN;
+        }
+        if (std::isnan(requested.max) && axis.max == computed.max) {
+            axis.max = NAN;
+        }
+        if (std::isnan(requested.step) && axis.step == computed.step) {
+            axis.step = NAN;
+        }
+    }
+
+    static void _compute_curve(PlotterImage* plotter, const size_t c) {
+        plotter->compute_curve(c);
+    }
+    inline void compute_curve(const size_t c) {
+        PlotterCurve& curve = _curves[c];
+        std::vector<std::pair<double, double>>& samples = _samples[c];
+        if (curve.type == PlotterCurve::VALUES) {
+            return;
+        }
+        curve.cache.align(axes.x);
+        curve.sample_runs(axes, _width);
+        samples.resize(_width);
+        for (int32_t i=0; i<_width; ++i) {
+            samples[i] = curve.sample(axes, i);
+        }
+    }
+
+    // pixel rows covered by a column sample, clipped to the image
+    inline const bool get_j_range(const std::pair<double, double>& y, std::pair<int32_t, int32_t>& j_range) const {
+        if (std::isnan(y.second)) {
+            return false;
+        }
+        const int32_t j_max = axes.y_to_j(y.second);
+        const int32_t j_min = std::isnan(y.first) ? j_max : axes.y_to_j(y.first);
+        j_range.first = std::max<int32_t>(0, std::min(j_min, j_max));
+        j_range.second = std::min<int32_t>(_height - 1, std::max(j_min, j_max));
+        return j_range.first <= j_range.second;
+    }
+
+    inline const std::vector<PlotterPixel> rasterize() const {
+        std::vector<PlotterPixel> pixels((size_t) _width * _height, _background);
+        // grids
+        const std::vector<double> x_lines = axes.x.get_grid_lines();
+        for (size_t l=0; l<x_lines.size(); ++l) {
+            const int32_t i = axes.x_to_i(x_lines[l]);
+            if (x_lines[l] >= axes.x.min && x_lines[l] <= axes.x.max && i >= 0 && i < _width) {
+                for (int32_t j=0; j<_height; ++j) {
+                    pixels[(size_t) j * _width + i] = (l + 1 == x_lines.size()) ? _origin : _grid;
+                }
+            }
+        }
+        const std::vector<double> y_lines = axes.y.get_grid_lines();
+        for (size_t l=0; l<y_lines.size(); ++l) {
+            const int32_t j = axes.y_to_j(y_lines[l]);
+            if (y_lines[l] >= axes.y.min && y_lines[l] <= axes.y.max && j >= 0 && j < _height) {
+                for (int32_t i=0; i<_width; ++i) {
+                    pixels[(size_t) j * _width + i] = (l + 1 == y_lines.size()) ? _origin : _grid;
+                }
+            }
+        }
+        // curves, joining consecutive columns
+        for (size_t c=0; c<_curves.size(); ++c) {
+            const PlotterCurve& curve = _curves[c];
+            const PlotterPixel color = get_pixel(curve.color);
+            if (curve.type == PlotterCurve::VALUES) {
+                for (const auto& value : curve.values) {
+                    const int32_t i = axes.x_to_i(value.first);
+                    const int32_t j = axes.y_to_j(value.second);
+                    for (int32_t di=-1; di<=1; ++di) {
+                        for (int32_t dj=-1; dj<=1; ++dj) {
+                            if (i + di >= 0 && i + di < _width && j + dj >= 0 && j + dj < _height) {
+                                pixels[(size_t) (j + dj) * _width + i + di] = color;
+                            }
+                        }
+                    }
+                }
+                continue;
+            }
+            bool has_previous = false;
+            std::pair<int32_t, int32_t> previous_j_range;
+            for (int32_t i=0; i<_width; ++i) {
+                std::pair<int32_t, int32_t> j_range;
+                if (!get_j_range(_samples[c][i], j_range)) {
+                    has_previous = false;
+                    continue;
+                }
+                int32_t j_begin = j_range.first;
+                int32_t j_end = j_range.second;
+                if (has_previous) {
+                    j_begin = std::min(j_begin, previous_j_range.second);
+                    j_end = std::max(j_end, previous_j_range.first);
+                }
+                for (int32_t j=j_begin; j<=j_end; ++j) {
+                    pixels[(size_t) j * _width + i] = color;
+                }
+                previous_j_range = j_range;
+                has_previous = true;
+            }
+        }
+        return pixels;
+    }
+
+    inline const std::string get_caption() const {
+        char buffer[256];
+        if (axes.x.type == PlotterAxisParameters::TEMPORAL) {
+            const std::string min = Timestamp(axes.x.min);
+            const std::string max = Timestamp(axes.x.max);
+            snprintf(buffer, sizeof(buffer), "[ %s , %s ]  ->  [ %lf , %lf ]", min.c_str(), max.c_str(), axes.y.min, axes.y.max);
+        } else {
+            snprintf(buffer, sizeof(buffer), "[ %lf , %lf ]  ->  [ %lf , %lf ]", axes.x.min, axes.x.max, axes.y.min, axes.y.max);
+        }
+        return buffer;
+    }
+
+    static inline const std::string escape_svg(const std::string& text) {
+        std::string result;
+        for (const char c : text) {
+            switch (c) {
+                case '&': result += "&amp;"; break;
+                case '<': result += "&lt;"; break;
+                case '>': result += "&gt;"; break;
+                case '"': result += "&quot;"; break;
+                default: result += c; break;
+            }
+        }
+        return result;
+    }
+
+    static inline const PlotterPixel get_pixel(const PlotterColor color) {
+        switch (color) {
+            case RED: return {205, 49, 49};
+            case GREEN: return {13, 188, 121};
+            case YELLOW: return {229, 229, 16};
+            case BLUE: return {36, 114, 200};
+            case MAGENTA: return {188, 63, 188};
+            case CYAN: return {17, 168, 205};
+            case WHITE: return {229, 229, 229};
+        }
+        return {229, 229, 229};
+    }
+    static inline const std::string get_svg_color(const PlotterPixel& pixel) {
+        char buffer[8];
+        snprintf(buffer, sizeof(buffer), "#%02x%02x%02x", pixel.r, pixel.g, pixel.b);
+        return buffer;
+    }
+
+    const uint32_t _width;
+    const uint32_t _height;
+    std::vector<PlotterCurve> _curves;
+    std::vector<std::vector<std::pair<double, double>>> _samples;
+    PlotterAxesParameters _requested_axes;
+    PlotterAxesParameters _computed_axes;
+    static constexpr PlotterPixel _background = {0, 0, 0};
+    static constexpr PlotterPixel _grid = {64, 64, 64};
+    static constexpr PlotterPixel _origin = {160, 160, 160};
+};
+
+
+#endif // CPPTRAING__MATH__PLOTTERIMAGE_HPP
@@ -4,10 +4,12 @@
 
 #include <string>
 #include <cmath>
+#include <mutex>
 
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 
 
 #pragma pack(push, 1)
@@ -30,13 +32,11 @@ public:
     }
     inline Timestamp(const struct timeval& tv)
         : _value(tv.tv_sec + tv.tv_usec * 1e-6) {}
+    // the current UTC time, read as local time
     inline Timestamp() {
         struct timeval tv;
         gettimeofday(&tv, NULL);
-        time_t original = tv.tv_sec;
-        double microseconds = tv.tv_usec * 1e-6;
-        struct tm* converted = gmtime(&original);
-        _value = mktime(converted) + microseconds;
+        _value = tv.tv_sec + get_utc_offset(tv.tv_sec) + tv.tv_usec * 1e-6;
     }
     inline Timestamp(const double value)
         : _value(value) {}
@@ -105,6 +105,23 @@ public:
 
 private:
 
+    // computed with mktime() once per hour and thread, as it takes a lock
+    // and reads the time zone every time; the mutex lets tools see the time
+    // zone state of libc as guarded
+    static inline const double get_utc_offset(const time_t t) {
+        thread_local time_t cached_hour = -1;
+        thread_local double cached_offset = 0.;
+        if (t / 3600 != cached_hour) {
+            static std::mutex mutex;
+            std::lock_guard<std::mutex> lock(mutex);
+            struct tm converted;
+            gmtime_r(&t, &converted);
+            cached_offset = mktime(&converted) - t;
+            cached_hour = t / 3600;
+        }
+        return cached_offset;
+    }
+
     double _value;
 
 };
@@ -32,7 +32,7 @@ struct Trade {
     }
 
     inline const bool parse(const std::string& source) {
-        struct tm t;
+        struct tm t = {};
         char tmp_type[8];
         int year;
         int result = sscanf(source.c_str(), "<Trade id=%" PRIu64 " decision_id=%" PRIu64 " buy_order_id=%" PRIu64 " sell_order_id=%" PRIu64 " timestamp=%d-%d-%dT%d:%d:%d type=%c%c%c%c price=%lf volume=%lf>",
@@ -45,11 +45,12 @@ struct Trade {
             &price,
             &volume
         );
-        if (result != 15) {
+        if (result != 16) {
             return false;
         }
         t.tm_year = year - 1900;
         t.tm_mon -= 1;
+        t.tm_isdst = -1;
         timestamp = t;
         switch (tmp_type[0]) {
             case 'W':
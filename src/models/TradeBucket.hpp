@@ -0,0 +1,130 @@
+#ifndef CTRADING__MODELS__TRADEBUCKET__HPP
+#define CTRADING__MODELS__TRADEBUCKET__HPP
+
+
+#include <stdint.h>
+#include <ostream>
+
+#include "./Trade.hpp"
+#include "./Timestamp.hpp"
+
+
+#pragma pack(push, 1)
+
+
+struct PriceExtrema {
+    double min;
+    double max;
+    inline PriceExtrema() : min(NAN), max(NAN) {}
+    inline void operator += (const double& price) {
+        if (std::isnan(min) || price < min) {
+            min = price;
+        }
+        if (std::isnan(max) || price > max) {
+            max = price;
+        }
+    }
+    inline operator std::pair<double, double> () const {
+        return {min, max};
+    }
+};
+
+
+// summary of the trades within ]timestamp_span.from, timestamp_span.to]
+struct TradeBucket {
+    inline TradeBucket(const Timestamp& from=NAN, const Timestamp& to=NAN) :
+        timestamp_span(from, to),
+        count(0),
+        volume(0.),
+        price_volume(0.),
+        vwap(NAN) {}
+    TimestampSpan timestamp_span;
+    size_t count;
+    double volume;
+    double price_volume;
+    double vwap;
+    PriceExtrema buy_prices;
+    PriceExtrema sell_prices;
+    // only trades that were triggered by a decision
+    PriceExtrema decision_buy_prices;
+    PriceExtrema decision_sell_prices;
+    inline void operator += (const Trade& trade) {
+        ++count;
+        volume += trade.volume;
+        price_volume += trade.volume * trade.price;
+        vwap = price_volume / volume;
+        switch (trade.type) {
+            case BUY:
+                buy_prices += trade.price;
+                if (trade.decision_id) {
+                    decision_buy_prices += trade.price;
+                }
+                break;
+            case SELL:
+                sell_prices += trade.price;
+                if (trade.decision_id) {
+                    decision_sell_prices += trade.price;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+
+#pragma pack(pop)
+
+
+#include <vector>
+
+// n_buckets contiguous, empty buckets covering ]timestamp_from, timestamp_to]
+inline std::vector<TradeBucket> make_trade_buckets(const double& timestamp_from, const double& timestamp_to, const size_t& n_buckets) {
+    std::vector<TradeBucket> buckets;
+    buckets.reserve(n_buckets);
+    const double bucket_width = (timestamp_to - timestamp_from) / n_buckets;
+    for (size_t b=0; b<n_buckets; ++b) {
+        buckets.push_back(TradeBucket(
+            timestamp_from + b * bucket_width,
+            (b + 1 == n_buckets) ? timestamp_to : timestamp_from + (b + 1) * bucket_width
+        ));
+    }
+    return buckets;
+}
+
+// index of the bucket containing timestamp, as used by History::get_bucketed
+inline const ssize_t get_bucket_index(const double& timestamp, const double& timestamp_from, const double& bucket_width, const size_t& n_buckets) {
+    const ssize_t index = std::ceil((timestamp - timestamp_from) / bucket_width) - 1;
+    if (index < 0) {
+        return (timestamp > timestamp_from) ? 0 : -1;
+    }
+    if (index >= (ssize_t) n_buckets) {
+        return n_buckets - 1;
+    }
+    return index;
+}
+
+
+inline std::ostream& operator << (std::ostream& os, const PriceExtrema price_extrema) {
+    return (os
+        << "[" << price_extrema.min
+        << ", " << price_extrema.max
+        << "]"
+    );
+}
+inline std::ostream& operator << (std::ostream& os, const TradeBucket trade_bucket) {
+    return (os
+        << "<TradeBucket"
+        << " from=" << trade_bucket.timestamp_span.from
+        << " to=" << trade_bucket.timestamp_span.to
+        << " count=" << trade_bucket.count
+        << " volume=" << trade_bucket.volume
+        << " vwap=" << trade_bucket.vwap
+        << " buy_prices=" << trade_bucket.buy_prices
+        << " sell_prices=" << trade_bucket.sell_prices
+        << ">"
+    );
+}
+
+
+#endif // CTRADING__MODELS__TRADEBUCKET__HPP
@@ -21,6 +21,13 @@ struct TradeSummaryPart {
         price += trade.volume * trade.price;
         average_price = price / volume;
     }
+    // parts of distinct trades
+    inline void operator += (const TradeSummaryPart& other) {
+        count += other.count;
+        volume += other.volume;
+        price += other.price;
+        average_price = price / volume;
+    }
     inline const double compute_spread_with(const TradeSummaryPart& other) const {
         return std::abs(price - other.price) / (volume + other.volume);
     }
@@ -59,6 +66,19 @@ struct TradeSummary {
         spread = buys.compute_spread_with(sells);
         average_price = (buys.price + sells.price) / (buys.volume + sells.volume);
     }
+    // summaries of distinct trades, e.g. computed in parallel
+    inline void operator += (const TradeSummary& other) {
+        if (!std::isnan((const double&) other.timestamp_span.from) && (std::isnan((const double&) timestamp_span.from) || other.timestamp_span.from < timestamp_span.from)) {
+            timestamp_span.from = other.timestamp_span.from;
+        }
+        if (!std::isnan((const double&) other.timestamp_span.to) && (std::isnan((const double&) timestamp_span.to) || other.timestamp_span.to > timestamp_span.to)) {
+            timestamp_span.to = other.timestamp_span.to;
+        }
+        buys += other.buys;
+        sells += other.sells;
+        spread = buys.compute_spread_with(sells);
+        average_price = (buys.price + sells.price) / (buys.volume + sells.volume);
+    }
 };
 
 #pragma pack(pop)
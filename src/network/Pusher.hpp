@@ -12,9 +12,12 @@
 using JSON = nlohmann::json;
 
 #include "./WebSocketClient.hpp"
+#include "./PusherMessage.hpp"
 
 
 typedef void (*pusher_callback_t) (const std::string&, const JSON&, void*);
+// receives the message as views over the received payload
+typedef void (*pusher_message_callback_t) (const PusherMessage&, void*);
 
 
 struct PusherChannelSubscription {
@@ -27,6 +30,18 @@ struct PusherChannelSubscription {
     void* user_data;
 };
 
+struct PusherMessageSubscription {
+    inline PusherMessageSubscription(const std::string& _event, const std::string& _channel_name, const pusher_message_callback_t _callback, void* _user_data) :
+        event(_event),
+        channel_name(_channel_name),
+        callback(_callback),
+        user_data(_user_data) {}
+    const std::string event;
+    const std::string channel_name;
+    const pusher_message_callback_t callback;
+    void* user_data;
+};
+
 
 class PusherClient : public WebSocketClient {
 public:
@@ -52,8 +67,16 @@ public:
             _subscriptions.insert({event, {channel_name, callable, user_data}});
         }
     }
+    // messages are parsed in place, without allocating: preferable for
+    // frequent events
+    inline void subscribe(const std::string& channel_name, std::vector<std::string> events, pusher_message_callback_t callable, void* user_data=NULL) {
+        for (const std::string& event : events) {
+            _message_subscriptions.push_back({event, channel_name, callable, user_data});
+        }
+    }
     inline void unsubscribe() {
         _subscriptions.clear();
+        _message_subscriptions.clear();
     }
 
     inline void start() {
@@ -62,12 +85,30 @@ public:
         for (const auto& it : _subscriptions) {
             channel_names.insert(it.second.channel_name);
         }
+        for (const PusherMessageSubscription& subscription : _message_subscriptions) {
+            channel_names.insert(subscription.channel_name);
+        }
         WebSocketClient::start();
         for (const std::string& channel_name : channel_names) {
             send("pusher:subscribe", {{"channel", channel_name}});
         }
     }
 
+    virtual void callback(const char* payload, const size_t size) {
+        if (!_message_subscriptions.empty()) {
+            PusherMessage message;
+            if (message.parse(payload, size)) {
+                for (const PusherMessageSubscription& subscription : _message_subscriptions) {
+                    if (message.is_event(subscription.event) && (message.channel == NULL || message.is_channel(subscription.channel_name))) {
+                        subscription.callback(message, subscription.user_data);
+                    }
+                }
+            }
+        }
+        if (!_subscriptions.empty()) {
+            callback(std::string(payload, size));
+        }
+    }
     virtual void callback(const std::string& payload) {
         const auto message = JSON::parse(payload);
         try {
@@ -89,6 +130,7 @@ private:
     const std::string _host;
     const std::string _path;
     std::multimap<std::string, PusherChannelSubscription> _subscriptions;
+    std::vector<PusherMessageSubscription> _message_subscriptions;
 };
 
 
@@ -0,0 +1,322 @@
+#ifndef CTRADING__NETWORK__PUSHERMESSAGE__HPP
+#define CTRADING__NETWORK__PUSHERMESSAGE__HPP
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+
+// reads a JSON object in place, without allocating; when the object is
+// itself the content of a JSON string (as Pusher's "data" is), it is read
+// through its escape sequences, without being unescaped first
+class PusherDataReader {
+public:
+
+    inline PusherDataReader(const char* begin, const char* end, const bool is_escaped=false) :
+        _position(begin),
+        _end(end),
+        _is_escaped(is_escaped),
+        _is_started(false) {}
+
+    // move to the next member of the object; false at its end
+    inline const bool next_key(const char*& key, size_t& key_size) {
+        skip_whitespace();
+        if (_position >= _end) {
+            return false;
+        }
+        if (!_is_started) {
+            if (*_position != '{') {
+                return false;
+            }
+            _is_started = true;
+        } else if (*_position != ',') {
+            return false;
+        }
+        ++_position;
+        skip_whitespace();
+        if (!read_string(key, key_size)) {
+            return false;
+        }
+        skip_whitespace();
+        if (_position >= _end || *_position != ':') {
+            return false;
+        }
+        ++_position;
+        skip_whitespace();
+        return true;
+    }
+
+    // numbers are accepted either bare or quoted
+    inline const bool read(uint64_t& value) {
+        const bool is_quoted = read_quote();
+        if (_position >= _end || *_position < '0' || *_position > '9') {
+            return false;
+        }
+        value = 0;
+        while (_position < _end && *_position >= '0' && *_position <= '9') {
+            value = 10 * value + (*_position++ - '0');
+        }
+        return !is_quoted || read_quote();
+    }
+    inline const bool read(double& value) {
+        const bool is_quoted = read_quote();
+        if (!read_number(value)) {
+            return false;
+        }
+        return !is_quoted || read_quote();
+    }
+    // points to the raw string, escape sequences included
+    inline const bool read(const char*& value, size_t& size) {
+        return read_string(value, size);
+    }
+
+    // skip any value
+    inline const bool skip() {
+        skip_whitespace();
+        if (_position >= _end) {
+            return false;
+        }
+        if (is_quote()) {
+            const char* value;
+            size_t size;
+            return read_string(value, size);
+        }
+        if (*_position != '{' && *_position != '[') {
+            while (_position < _end && *_position != ',' && *_position != '}' && *_position != ']' && !is_quote()) {
+                ++_position;
+            }
+            return true;
+        }
+        // nested containers: only strings need care
+        size_t depth = 0;
+        while (_position < _end) {
+            if (is_quote()) {
+                const char* value;
+                size_t size;
+                if (!read_string(value, size)) {
+                    return false;
+                }
+                continue;
+            }
+            const char c = *_position++;
+            if (c == '{' || c == '[') {
+                ++depth;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline const char* get_position() const {
+        return _position;
+    }
+
+private:
+
+    inline void skip_whitespace() {
+        while (_position < _end && (*_position == ' ' || *_position == '\t' || *_position == '\n' || *_position == '\r')) {
+            ++_position;
+        }
+        // escaped whitespaces
+        if (_is_escaped && _position + 1 < _end && _position[0] == '\\' && (_position[1] == 'n' || _position[1] == 't' || _position[1] == 'r')) {
+            _position += 2;
+            skip_whitespace();
+        }
+    }
+
+    // a quote is '"' in a plain object, '\"' in an escaped one
+    inline const bool is_quote() const {
+        if (_is_escaped) {
+            return _position + 1 < _end && _position[0] == '\\' && _position[1] == '"';
+        }
+        return _position < _end && _position[0] == '"';
+    }
+    inline const bool read_quote() {
+        if (!is_quote()) {
+            return false;
+        }
+        _position += _is_escaped ? 2 : 1;
+        return true;
+    }
+
+    inline const bool read_string(const char*& value, size_t& size) {
+        if (!read_quote()) {
+            return false;
+        }
+        value = _position;
+        while (_position < _end) {
+            if (is_quote()) {
+                size = _position - value;
+                return read_quote();
+            }
+            // inside the string, a backslash escapes the next character; when
+            // escaped, that backslash is itself written '\\', and so may be
+            // the next character
+            if (*_position == '\\') {
+                if (_is_escaped && _position + 1 < _end && _position[1] == '\\') {
+                    _position += 2;
+                    _position += (_position < _end && *_position == '\\') ? 2 : 1;
+                } else {
+                    _position += 2;
+                }
+            } else {
+                ++_position;
+            }
+        }
+        return false;
+    }
+
+    // decimal numbers that fit in 53 bits, with no more than 22 decimals, are
+    // computed exactly without strtod()
+    inline const bool read_number(double& value) {
+        static const double powers_of_ten[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+        };
+        const char* begin = _position;
+        const bool is_negative = (_position < _end && *_position == '-');
+        if (is_negative) {
+            ++_position;
+        }
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        const char* digits_begin = _position;
+        while (_position < _end && *_position >= '0' && *_position <= '9') {
+            if (digits < 19) {
+                mantissa = 10 * mantissa + (*_position - '0');
+                digits += (mantissa != 0);
+            } else {
+                ++exponent;
+            }
+            ++_position;
+        }
+        if (_position < _end && *_position == '.') {
+            ++_position;
+            while (_position < _end && *_position >= '0' && *_position <= '9') {
+                if (digits < 19) {
+                    mantissa = 10 * mantissa + (*_position - '0');
+                    digits += (mantissa != 0);
+                    --exponent;
+                }
+                ++_position;
+            }
+        }
+        if (_position == digits_begin) {
+            return false;
+        }
+        bool has_exponent = false;
+        if (_position < _end && (*_position == 'e' || *_position == 'E')) {
+            has_exponent = true;
+            ++_position;
+            while (_position < _end && ((*_position >= '0' && *_position <= '9') || *_position == '-' || *_position == '+')) {
+                ++_position;
+            }
+        }
+        if (!has_exponent && digits < 19 && mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+            value = (exponent < 0) ? mantissa / powers_of_ten[-exponent] : mantissa * powers_of_ten[exponent];
+        } else {
+            // rare path: copied on the stack, as strtod() needs a terminator
+            char buffer[64];
+            const size_t size = _position - begin;
+            if (size >= sizeof(buffer)) {
+                return false;
+            }
+            memcpy(buffer, begin, size);
+            buffer[size] = '\0';
+            value = strtod(buffer, NULL);
+            return true;
+        }
+        if (is_negative) {
+            value = -value;
+        }
+        return true;
+    }
+
+    const char* _position;
+    const char* _end;
+    const bool _is_escaped;
+    bool _is_started;
+};
+
+
+// Pusher message, as views over the received payload
+struct PusherMessage {
+
+    inline PusherMessage() :
+        event(NULL),
+        event_size(0),
+        channel(NULL),
+        channel_size(0),
+        data(NULL),
+        data_end(NULL),
+        is_data_escaped(false) {}
+
+    // the envelope is read once; "data" is only located, for
+    // get_data_reader() to read it through its escape sequences
+    inline const bool parse(const char* payload, const size_t size) {
+        PusherDataReader reader(payload, payload + size);
+        const char* key;
+        size_t key_size;
+        while (reader.next_key(key, key_size)) {
+            if (key_size == 5 && memcmp(key, "event", 5) == 0) {
+                if (!reader.read(event, event_size)) {
+                    return false;
+                }
+            } else if (key_size == 7 && memcmp(key, "channel", 7) == 0) {
+                if (!reader.read(channel, channel_size)) {
+                    return false;
+                }
+            } else if (key_size == 4 && memcmp(key, "data", 4) == 0) {
+                const char* value = reader.get_position();
+                if (value < payload + size && *value == '"') {
+                    size_t value_size;
+                    if (!reader.read(data, value_size)) {
+                        return false;
+                    }
+                    data_end = data + value_size;
+                    is_data_escaped = true;
+                } else {
+                    data = value;
+                    if (!reader.skip()) {
+                        return false;
+                    }
+                    data_end = reader.get_position();
+                    is_data_escaped = false;
+                }
+            } else if (!reader.skip()) {
+                return false;
+            }
+        }
+        return event != NULL;
+    }
+
+    inline const bool is_event(const std::string& name) const {
+        return name.size() == event_size && memcmp(name.data(), event, event_size) == 0;
+    }
+    inline const bool is_event(const char* name) const {
+        return strncmp(name, event, event_size) == 0 && name[event_size] == '\0';
+    }
+    inline const bool is_channel(const std::string& name) const {
+        return name.size() == channel_size && memcmp(name.data(), channel, channel_size) == 0;
+    }
+
+    inline PusherDataReader get_data_reader() const {
+        return PusherDataReader(data, data_end, is_data_escaped);
+    }
+
+    const char* event;
+    size_t event_size;
+    const char* channel;
+    size_t channel_size;
+    const char* data;
+    const char* data_end;
+    bool is_data_escaped;
+};
+
+
+#endif // CTRADING__NETWORK__PUSHERMESSAGE__HPP
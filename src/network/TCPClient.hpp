@@ -3,16 +3,20 @@
 
 
 #include <string>
+#include <mutex>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -34,7 +38,8 @@ public:
         _port(port),
         _timeout(timeout),
         _host_entry(gethostbyname(_host.c_str())),
-        _sock(socket(AF_INET, SOCK_STREAM, 0))
+        _sock(socket(AF_INET, SOCK_STREAM, 0)),
+        _read_offset(0)
     {
         if (_host_entry == NULL) {
             throw TCPClientError("TCPClient could not resolve host", hstrerror(h_errno), _host, _port);
@@ -77,6 +82,9 @@ public:
     }
 
     inline ~TCPClient() {
+        try {
+            flush();
+        } catch (const TCPClientError&) {}
         close(_sock);
     }
 
@@ -104,30 +112,45 @@ public:
             throw TCPClientError("TCPConnection got closed by client", _sock);
         }
     }
+    // wait for incoming data, at most timeout seconds
+    inline const bool wait_readable(const double timeout) {
+        if (_read_offset < _read_buffer.size()) {
+            return true;
+        }
+        pollfd descriptor = {_sock, POLLIN, 0};
+        return poll(&descriptor, 1, (int) (timeout * 1e3)) > 0;
+    }
 
+    // reads are served from a buffer, refilled by bulk recv() calls; pending
+    // writes are flushed first, as the answer may depend on them
     inline int read(void* data, const size_t size) {
-        int offset = 0;
+        flush();
+        size_t offset = std::min(size, _read_buffer.size() - _read_offset);
+        memcpy(data, _read_buffer.data() + _read_offset, offset);
+        _read_offset += offset;
         while (offset < size) {
-            const int missing = size - offset;
-            const int result = recv(_sock, (char*)data + offset, size, 0);
-            if (result == -1) {
-                throw TCPClientError("TCPConnection could not read", _sock, strerror(errno));
+            const size_t missing = size - offset;
+            if (missing >= _read_buffer_size) {
+                // large enough to skip the buffer
+                offset += receive((char*)data + offset, missing, MSG_WAITALL);
+                continue;
             }
-            offset += result;
-            ensure_is_not_closed();
+            fill_read_buffer();
+            const size_t available = std::min(missing, _read_buffer.size());
+            memcpy((char*)data + offset, _read_buffer.data(), available);
+            _read_offset = available;
+            offset += available;
         }
         return offset;
     }
+    // whatever was received, waiting only if nothing is available yet
     inline void read(std::string& str) {
-        str.clear();
-        int offset;
-        do {
-            offset = recv(_sock, _buffer, sizeof(_buffer), 0);
-            if (offset == -1) {
-                throw TCPClientError("TCPConnection could not read", _sock, strerror(errno));
-            }
-            str.append(_buffer, offset);
-        } while (offset == sizeof(_buffer));
+        flush();
+        if (_read_offset == _read_buffer.size()) {
+            fill_read_buffer();
+        }
+        str.assign(_read_buffer, _read_offset, std::string::npos);
+        _read_offset = _read_buffer.size();
     }
     template <typename T>
     inline int read(T& object) {
@@ -135,19 +158,52 @@ public:
         return result;
     }
 
+    // writes are coalesced, until flush() or a read; the buffer is flushed by
+    // itself when it grows past its size
     inline void write(const std::string& str) {
         write(str.data(), str.size());
     }
     inline void write(const void* data, const size_t size) {
-        int result = send(_sock, data, size, 0);
-        if (result == -1) {
-            throw TCPClientError("TCPClient could not write data", strerror(errno), size, _host, _port);
-		}
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        _write_buffer.append((const char*) data, size);
+        if (_write_buffer.size() >= _write_buffer_size) {
+            send_buffered();
+        }
     }
     template <typename T>
     inline void write(T& object) {
         return write(&object, sizeof(object));
     }
+    // records sent along with the buffered data, in a single writev()
+    template <typename T>
+    inline void write_batch(const T* records, const size_t count) {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        struct iovec vectors[2] = {
+            {(void*) _write_buffer.data(), _write_buffer.size()},
+            {(void*) records, count * sizeof(T)},
+        };
+        send_vectors(vectors, 2);
+        _write_buffer.clear();
+    }
+    // size bytes of a file, with sendfile()
+    inline void write_file(const int fd, off_t offset, const size_t size) {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        send_buffered();
+        const off_t end = offset + size;
+        while (offset < end) {
+            const ssize_t result = sendfile(_sock, fd, &offset, end - offset);
+            if (result == -1 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                throw TCPClientError("TCPClient could not send file", strerror(errno), size, _host, _port);
+            }
+        }
+    }
+    inline void flush() {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        send_buffered();
+    }
 
 private:
     const std::string _host;
@@ -156,8 +212,66 @@ private:
     struct hostent* _host_entry;
     int _sock;
     struct sockaddr_in _address;
-    char _buffer[4096];
+    // input
+    static const size_t _read_buffer_size = 1 << 16;
     std::string _read_buffer;
+    size_t _read_offset;
+    // output
+    static const size_t _write_buffer_size = 1 << 16;
+    std::mutex _write_mutex;
+    std::string _write_buffer;
+
+    inline const size_t receive(char* data, const size_t size, const int flags=0) {
+        while (true) {
+            const ssize_t result = recv(_sock, data, size, flags);
+            if (result > 0) {
+                return result;
+            } else if (result == 0) {
+                throw TCPClientError("TCPClient got closed by server", _host, _port);
+            } else if (errno != EINTR) {
+                throw TCPClientError("TCPClient could not read", strerror(errno), _host, _port);
+            }
+        }
+    }
+    // must only be called once the buffer was consumed
+    inline void fill_read_buffer() {
+        _read_buffer.resize(_read_buffer_size);
+        _read_buffer.resize(receive(&_read_buffer[0], _read_buffer_size));
+        _read_offset = 0;
+    }
+
+    // the following must be called with _write_mutex held
+    inline void send_buffered() {
+        struct iovec vector = {(void*) _write_buffer.data(), _write_buffer.size()};
+        send_vectors(&vector, 1);
+        _write_buffer.clear();
+    }
+    inline void send_vectors(struct iovec* vectors, int count) {
+        while (count) {
+            if (vectors->iov_len == 0) {
+                ++vectors;
+                --count;
+                continue;
+            }
+            ssize_t result = writev(_sock, vectors, count);
+            if (result == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw TCPClientError("TCPClient could not write data", strerror(errno), _host, _port);
+            }
+            // skip what was sent
+            while (count && (size_t) result >= vectors->iov_len) {
+                result -= vectors->iov_len;
+                ++vectors;
+                --count;
+            }
+            if (count) {
+                vectors->iov_base = (char*) vectors->iov_base + result;
+                vectors->iov_len -= result;
+            }
+        }
+    }
 };
 
 
@@ -6,17 +6,27 @@
 #include <stdint.h>
 #include <string.h>
 #include <signal.h>
-#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <poll.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 
 #include <string>
 #include <thread>
 #include <vector>
-#include <list>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 
 #include "exceptions/Exception.hpp"
 
@@ -26,54 +36,56 @@ public:
     using NetworkException::NetworkException;
 };
 
+// thrown by TCPConnection::read when the buffered input is too short; the
+// reactor rewinds the connection and calls the handler again once more data
+// arrived (not an Exception, so that it does not get logged)
+class TCPConnectionIncompleteException {};
+
 
 class TCPConnection;
+class TCPServerLoop;
 
+// callbacks are run by the server's I/O threads, so handlers shared between
+// connections must be thread-safe; callback() is only called when input is
+// available, and should read a whole request before producing side effects;
+// other threads writing to a connection must keep it with shared_from_this(),
+// as it gets released once closed
 class TCPHandler {
 public:
     virtual bool callback(TCPConnection& connection) = 0;
+    virtual void on_open(TCPConnection&) {}
+    virtual void on_close(TCPConnection&) {}
 };
 
 
-class TCPConnection {
+class TCPConnection : public std::enable_shared_from_this<TCPConnection> {
 public:
 
     inline TCPConnection(TCPHandler& handler, const int sock, const time_t timeout=3) :
         _handler(handler),
+        _loop(NULL),
+        _is_flush_requested(false),
         _sock(sock),
-        _is_running(true),
-        _thread(loop, this),
+        _is_closed(false),
         _timeout(timeout),
-        _endtime(timeout + time(NULL))
-    {
-        std::cout << "START CONNECTION " << _sock << '\n';
-    }
+        _endtime(0),
+        _read_offset(0),
+        _pending_size(0),
+        _callback_thread(std::thread::id()) {}
 
     inline ~TCPConnection() {
-        _is_running = false;
-        _thread.join();
+        clear_segments();
+        close(_sock);
     }
 
-    const bool is_closed() {
-        fd_set rfd;
-        FD_ZERO(&rfd);
-        FD_SET(_sock, &rfd);
-        timeval tv = { 0 };
-        select(_sock+1, &rfd, 0, 0, &tv);
-        if (!FD_ISSET(_sock, &rfd)) {
-            return false;
-        }
-        int n = 0;
-        ioctl(_sock, FIONREAD, &n);
-        return n == 0;
+    inline const int get_socket() const {
+        return _sock;
     }
-    void ensure_is_not_closed() {
-        if (time(NULL) > _endtime) {
-            _is_running = false;
-            throw TCPConnectionClosedException("TCPConnection timed out", _sock);
-        }
-        if (is_closed()) {
-            _is_running = false;
+    inline const bool is_closed() const {
+        return _is_closed;
+    }
+    inline void ensure_is_not_closed() {
+        if (_is_closed) {
             throw TCPConnectionClosedException("TCPConnection got closed by client", _sock);
         }
     }
@@ -82,92 +94,539 @@ public:
         _endtime = _timeout + time(NULL);
     }
 
+    // writes are buffered, and sent when the handler returns or on flush();
+    // they may be called from any thread, in which case the I/O thread gets
+    // woken up to send them
     inline void write(const std::string& str) {
         write(str.data(), str.size());
     }
     inline void write(const void* data, const int size) {
-        int offset = 0;
-        start_timeout();
-        while (offset < size) {
-            const int result = send(_sock, (const char*)data + offset, size, 0);
-            if (result == -1) {
-                _is_running = false;
-                throw TCPConnectionClosedException("TCPConnection could not write", _sock, strerror(errno));
-            }
-            offset += result;
-            ensure_is_not_closed();
+        if (std::this_thread::get_id() == _callback_thread) {
+            // kept aside until the callback completes, in case it gets rewound
+            _callback_buffer.append((const char*) data, size);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_write_mutex);
+            append((const char*) data, size);
         }
+        request_flush();
     }
     template <typename T>
     inline void write(const T& object) {
         return write((void*) &object, sizeof(object));
     }
+    // batch of buffers: when nothing is pending, they are handed to a single
+    // writev without being copied, and only what the socket did not take
+    // gets buffered
+    inline void write(const struct iovec* vectors, const int count) {
+        if (std::this_thread::get_id() == _callback_thread) {
+            for (int v=0; v<count; ++v) {
+                _callback_buffer.append((const char*) vectors[v].iov_base, vectors[v].iov_len);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_write_mutex);
+            size_t offset = 0;
+            if (_pending_size == 0 && !_is_closed) {
+                offset = send_vectors(vectors, std::min(count, IOV_MAX));
+            }
+            for (int v=0; v<count; ++v) {
+                const size_t size = vectors[v].iov_len;
+                if (offset < size) {
+                    append((const char*) vectors[v].iov_base + offset, size - offset);
+                }
+                offset = (offset > size) ? (offset - size) : 0;
+            }
+            if (_pending_size == 0) {
+                return;
+            }
+        }
+        request_flush();
+    }
+    // send size bytes of a file with sendfile(), in order with the other
+    // writes, right after the given header; the file descriptor is
+    // duplicated, so it can be closed afterwards
+    inline void write_file(const int fd, const off_t offset, const size_t size, const void* header=NULL, const size_t header_size=0) {
+        {
+            std::lock_guard<std::mutex> lock(_write_mutex);
+            write_file_segment(fd, offset, size, header, header_size);
+        }
+        if (std::this_thread::get_id() != _callback_thread) {
+            request_flush();
+        }
+    }
+    inline void flush() {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        send_buffered();
+    }
+    inline const size_t get_pending_size() {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        return _pending_size;
+    }
+    // for writers outside of the I/O threads: flush, then block until at most
+    // max_pending bytes remain buffered; returns false if the connection
+    // closed, or if the buffer did not drain before the timeout
+    inline const bool wait_writable(const size_t max_pending=1<<20) {
+        time_t endtime = _timeout + time(NULL);
+        size_t pending_size = -1;
+        while (!_is_closed && time(NULL) <= endtime) {
+            {
+                std::lock_guard<std::mutex> lock(_write_mutex);
+                send_buffered();
+                if (_pending_size <= max_pending) {
+                    return true;
+                }
+                if (_pending_size < pending_size) {
+                    // the peer is reading, restart the timeout
+                    pending_size = _pending_size;
+                    endtime = _timeout + time(NULL);
+                }
+            }
+            pollfd descriptor = {_sock, POLLOUT, 0};
+            poll(&descriptor, 1, 100);
+        }
+        return false;
+    }
 
+    // reads are served from the input buffer filled by the reactor
     inline void read(void* data, const int size) {
-        int offset = 0;
-        start_timeout();
-        while (offset < size) {
-            const int result = recv(_sock, (char*)data + offset, size, 0);
-            if (result == -1) {
-                _is_running = false;
-                throw TCPConnectionClosedException("TCPConnection could not read", _sock, strerror(errno));
+        if (_read_buffer.size() - _read_offset < (size_t) size) {
+            if (_is_closed) {
+                throw TCPConnectionClosedException("TCPConnection got closed by client", _sock);
             }
-            offset += result;
-            ensure_is_not_closed();
+            throw TCPConnectionIncompleteException();
         }
+        memcpy(data, _read_buffer.data() + _read_offset, size);
+        _read_offset += size;
     }
     template <typename T>
     inline void read(const T& object) {
         return read((void*) &object, sizeof(object));
     }
+    inline const size_t get_readable_size() const {
+        return _read_buffer.size() - _read_offset;
+    }
+
+private:
 
-    static void loop(TCPConnection* replier) {
-        ssize_t r;
-        std::string recieved_data;
-        try {
-            while (replier->_is_running && replier->_handler.callback(*replier)) {
-                replier->ensure_is_not_closed();
-                usleep(1);
+    friend class TCPServerLoop;
+
+    // drain the socket, as required by edge triggering
+    inline void receive() {
+        while (true) {
+            // receive straight into the input buffer
+            const size_t size = _read_buffer.size();
+            _read_buffer.resize(size + (1 << 16));
+            const ssize_t result = recv(_sock, &_read_buffer[size], 1 << 16, 0);
+            _read_buffer.resize(size + std::max<ssize_t>(result, 0));
+            if (result > 0) {
+                continue;
+            } else if (result == 0) {
+                _is_closed = true;
+                return;
+            } else if (errno == EINTR) {
+                continue;
+            } else {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    _is_closed = true;
+                }
+                return;
             }
-        } catch (TCPConnectionClosedException) {
-            replier->_is_running = false;
         }
-        close(replier->_sock);
-        std::cout << "END CONNECTION " << replier->_sock << '\n';
     }
 
-private:
+    // call the handler for as long as it consumes complete requests;
+    // returns false when the connection should be dropped
+    inline const bool process() {
+        bool is_running = true;
+        _callback_thread = std::this_thread::get_id();
+        while (is_running && _read_offset < _read_buffer.size()) {
+            const size_t read_offset = _read_offset;
+            _callback_buffer.clear();
+            try {
+                is_running = _handler.callback(*this);
+            } catch (TCPConnectionIncompleteException) {
+                // rewind, and wait for the rest of the request
+                _read_offset = read_offset;
+                _callback_buffer.clear();
+                if (_endtime == 0) {
+                    start_timeout();
+                }
+                break;
+            } catch (const TCPConnectionClosedException&) {
+                is_running = false;
+            }
+            _endtime = 0;
+            {
+                std::lock_guard<std::mutex> lock(_write_mutex);
+                append(_callback_buffer.data(), _callback_buffer.size());
+            }
+            if (_read_offset == read_offset) {
+                break;
+            }
+        }
+        _callback_thread = std::thread::id();
+        _read_buffer.erase(0, _read_offset);
+        _read_offset = 0;
+        return is_running && !_is_closed;
+    }
+
+    inline const bool has_timed_out(const time_t now) const {
+        return _endtime && now > _endtime;
+    }
+
+    // ask the I/O thread to send what other threads buffered
+    inline void request_flush();
+
+    // buffered output, as a queue of byte buffers and file ranges
+    struct TCPConnectionSegment {
+        inline TCPConnectionSegment() : fd(-1), offset(0), size(0) {}
+        std::string data;
+        int fd;
+        off_t offset;
+        size_t size;
+    };
+
+    // the following must be called with _write_mutex held
+
+    inline void append(const char* data, const size_t size) {
+        if (_is_closed) {
+            return;
+        }
+        if (_segments.empty() || _segments.back().fd != -1 || _segments.back().data.size() >= (1 << 16)) {
+            _segments.push_back(TCPConnectionSegment());
+        }
+        TCPConnectionSegment& segment = _segments.back();
+        segment.data.append(data, size);
+        segment.size += size;
+        _pending_size += size;
+    }
+
+    inline void write_file_segment(const int fd, const off_t offset, const size_t size, const void* header, const size_t header_size) {
+        if (std::this_thread::get_id() == _callback_thread) {
+            // cannot be rewound: what the callback wrote so far goes first
+            append(_callback_buffer.data(), _callback_buffer.size());
+            _callback_buffer.clear();
+        }
+        if (header_size) {
+            append((const char*) header, header_size);
+        }
+        if (size == 0) {
+            return;
+        }
+        TCPConnectionSegment segment;
+        segment.fd = dup(fd);
+        if (segment.fd == -1) {
+            throw NetworkException("TCPConnection could not duplicate file descriptor", fd, strerror(errno));
+        }
+        segment.offset = offset;
+        segment.size = size;
+        _segments.push_back(std::move(segment));
+        _pending_size += size;
+    }
+
+    // returns the number of bytes sent
+    inline const size_t send_vectors(const struct iovec* vectors, const int count) {
+        while (true) {
+            const ssize_t result = writev(_sock, vectors, count);
+            if (result >= 0) {
+                return result;
+            } else if (errno == EINTR) {
+                continue;
+            } else {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    _is_closed = true;
+                }
+                return 0;
+            }
+        }
+    }
+
+    inline void send_buffered() {
+        while (!_segments.empty() && !_is_closed) {
+            TCPConnectionSegment& front = _segments.front();
+            if (front.fd != -1) {
+                // file range
+                const ssize_t result = sendfile(_sock, front.fd, &front.offset, front.size);
+                if (result > 0) {
+                    front.size -= result;
+                    _pending_size -= result;
+                    if (front.size == 0) {
+                        close(front.fd);
+                        _segments.pop_front();
+                    }
+                    continue;
+                } else if (result == -1 && errno == EINTR) {
+                    continue;
+                } else if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    return;
+                }
+                // error, or file shorter than expected
+                _is_closed = true;
+                break;
+            }
+            // consecutive byte buffers go through one writev
+            struct iovec vectors[64];
+            int count = 0;
+            for (auto it=_segments.begin(); it!=_segments.end() && it->fd==-1 && count<64; ++it, ++count) {
+                vectors[count].iov_base = (void*) (it->data.data() + it->data.size() - it->size);
+                vectors[count].iov_len = it->size;
+            }
+            size_t sent = send_vectors(vectors, count);
+            if (sent == 0) {
+                return;
+            }
+            _pending_size -= sent;
+            while (sent) {
+                TCPConnectionSegment& segment = _segments.front();
+                if (sent < segment.size) {
+                    segment.size -= sent;
+                    break;
+                }
+                sent -= segment.size;
+                _segments.pop_front();
+            }
+        }
+        if (_is_closed) {
+            clear_segments();
+        }
+    }
+
+    inline void clear_segments() {
+        for (TCPConnectionSegment& segment : _segments) {
+            if (segment.fd != -1) {
+                close(segment.fd);
+            }
+        }
+        _segments.clear();
+        _pending_size = 0;
+    }
+
     TCPHandler& _handler;
+    TCPServerLoop* _loop;
+    std::atomic<bool> _is_flush_requested;
     const int _sock;
-    bool _is_running;
-    int _timeout;
+    std::atomic<bool> _is_closed;
+    const time_t _timeout;
     time_t _endtime;
+    std::string _read_buffer;
+    size_t _read_offset;
+    std::mutex _write_mutex;
+    std::deque<TCPConnectionSegment> _segments;
+    size_t _pending_size;
+    std::atomic<std::thread::id> _callback_thread;
+    std::string _callback_buffer;
+};
+
+
+// one I/O thread, with its own epoll instance and the connections it owns
+class TCPServerLoop {
+public:
+
+    inline TCPServerLoop() :
+        _epoll(epoll_create1(0)),
+        _wakeup(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+        _is_running(true)
+    {
+        if (_epoll == -1 || _wakeup == -1) {
+            throw NetworkException("TCPServerLoop could not create epoll instance", strerror(errno));
+        }
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = _wakeup;
+        epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup, &event);
+        _thread = std::thread(_run, this);
+    }
+
+    inline ~TCPServerLoop() {
+        _is_running = false;
+        _thread.join();
+        for (auto& it : _connections) {
+            it.second->_is_closed = true;
+            it.second->_handler.on_close(*it.second);
+        }
+        _connections.clear();
+        close(_wakeup);
+        close(_epoll);
+    }
+
+    inline void add(TCPConnection* connection) {
+        const std::shared_ptr<TCPConnection> shared_connection(connection);
+        connection->_loop = this;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _connections[connection->_sock] = shared_connection;
+        }
+        connection->_handler.on_open(*connection);
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = connection->_sock;
+        if (epoll_ctl(_epoll, EPOLL_CTL_ADD, connection->_sock, &event) == -1) {
+            remove(shared_connection);
+        }
+    }
+
+    inline const size_t get_connections_count() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _connections.size();
+    }
+
+private:
+
+    friend class TCPConnection;
+
+    // called from other threads, which buffered output on a connection
+    inline void request_flush(TCPConnection* connection) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _flush_requests.push_back(connection->_sock);
+        }
+        const uint64_t one = 1;
+        ::write(_wakeup, &one, sizeof(one));
+    }
+
+    static void _run(TCPServerLoop* loop) {
+        loop->run();
+    }
+    inline void run() {
+        epoll_event events[256];
+        time_t last_sweep = time(NULL);
+        while (_is_running) {
+            const int n = epoll_wait(_epoll, events, sizeof(events) / sizeof(events[0]), 100);
+            for (int e=0; e<n; ++e) {
+                if (events[e].data.fd == _wakeup) {
+                    flush_requested();
+                    continue;
+                }
+                const std::shared_ptr<TCPConnection> connection = find(events[e].data.fd);
+                if (connection) {
+                    handle(connection, events[e].events);
+                }
+            }
+            // drop connections stuck on an incomplete request
+            const time_t now = time(NULL);
+            if (now != last_sweep) {
+                last_sweep = now;
+                std::vector<std::shared_ptr<TCPConnection>> expired;
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    for (auto& it : _connections) {
+                        if (it.second->has_timed_out(now)) {
+                            expired.push_back(it.second);
+                        }
+                    }
+                }
+                for (const std::shared_ptr<TCPConnection>& connection : expired) {
+                    remove(connection);
+                }
+            }
+        }
+    }
+
+    inline const std::shared_ptr<TCPConnection> find(const int sock) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _connections.find(sock);
+        return (it == _connections.end()) ? std::shared_ptr<TCPConnection>() : it->second;
+    }
+
+    inline void flush_requested() {
+        uint64_t count;
+        while (read(_wakeup, &count, sizeof(count)) > 0);
+        std::vector<int> socks;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            socks.swap(_flush_requests);
+        }
+        for (const int sock : socks) {
+            const std::shared_ptr<TCPConnection> connection = find(sock);
+            if (connection) {
+                handle(connection, 0);
+            }
+        }
+    }
+
+    inline void handle(const std::shared_ptr<TCPConnection>& connection, const uint32_t events) {
+        connection->_is_flush_requested = false;
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            connection->receive();
+            if (!connection->process()) {
+                connection->flush();
+                remove(connection);
+                return;
+            }
+        }
+        connection->flush();
+        if (connection->_is_closed) {
+            remove(connection);
+        }
+    }
+
+    // the connection gets released once other threads are done with it
+    inline void remove(const std::shared_ptr<TCPConnection>& connection) {
+        epoll_ctl(_epoll, EPOLL_CTL_DEL, connection->_sock, NULL);
+        connection->_is_closed = true;
+        connection->_handler.on_close(*connection);
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _connections.find(connection->_sock);
+        if (it != _connections.end() && it->second == connection) {
+            _connections.erase(it);
+        }
+    }
+
+    const int _epoll;
+    const int _wakeup;
+    std::atomic<bool> _is_running;
+    std::mutex _mutex;
+    std::unordered_map<int, std::shared_ptr<TCPConnection>> _connections;
+    std::vector<int> _flush_requests;
     std::thread _thread;
 };
 
 
+inline void TCPConnection::request_flush() {
+    if (_loop != NULL && !_is_closed && !_is_flush_requested.exchange(true)) {
+        _loop->request_flush(this);
+    }
+}
+
+
 class TCPServer {
 public:
 
-    inline TCPServer(TCPHandler& handler, const std::string& host, const int port, const int timeout=10) :
+    inline TCPServer(TCPHandler& handler, const std::string& host, const int port, const int timeout=10, size_t threads_count=0) :
         _handler(handler),
-        _is_running(true),
         _host(host),
         _port(port),
+        _is_running(true),
         _timeout(timeout),
-        _thread(_start, this)
-    {}
+        _sock(make_accept_sock())
+    {
+        if (threads_count == 0) {
+            threads_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        for (size_t t=0; t<threads_count; ++t) {
+            _loops.push_back(new TCPServerLoop());
+        }
+        _thread = std::thread(_start, this);
+    }
 
     inline ~TCPServer() {
-        std::cout << "CLOSE SERVER #1" << '\n';
         _is_running = false;
-        std::cout << "CLOSE SERVER #2" << '\n';
         _thread.join();
-        std::cout << "CLOSE SERVER #3" << '\n';
-        for (TCPConnection* connection : _connections) {
-            delete connection;
+        close(_sock);
+        for (TCPServerLoop* loop : _loops) {
+            delete loop;
+        }
+    }
+
+    inline const size_t get_connections_count() {
+        size_t count = 0;
+        for (TCPServerLoop* loop : _loops) {
+            count += loop->get_connections_count();
         }
-        std::cout << "CLOSE SERVER #4" << '\n';
+        return count;
     }
 
     static void _start(TCPServer* server) {
@@ -175,20 +634,27 @@ public:
     }
     void start() {
         signal(SIGPIPE, SIG_IGN);
-        int sock = make_accept_sock();
+        const int epoll = epoll_create1(0);
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = _sock;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, _sock, &event);
+        // connections are dealt round-robin to the I/O threads
+        size_t next_loop = 0;
         while (_is_running) {
-            struct timeval tv;
-            tv.tv_sec = (long)_timeout;
-            tv.tv_usec = 0;
-            fd_set rfds;
-            FD_ZERO(&rfds);
-            FD_SET(sock, &rfds);
-            if (select(sock + 1, &rfds, 0, 0, &tv)) {
-                int new_sock = accept(sock, 0, 0);
-                _connections.push_back(new TCPConnection(_handler, new_sock, _timeout));
+            if (epoll_wait(epoll, &event, 1, 100) <= 0) {
+                continue;
+            }
+            while (true) {
+                const int new_sock = accept4(_sock, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (new_sock == -1) {
+                    break;
+                }
+                _loops[next_loop]->add(new TCPConnection(_handler, new_sock, _timeout));
+                next_loop = (next_loop + 1) % _loops.size();
             }
-            usleep(1);
         }
+        close(epoll);
     }
 
     int make_accept_sock() {
@@ -201,7 +667,9 @@ public:
         hints.ai_socktype = SOCK_STREAM;
         hints.ai_flags = AI_PASSIVE;
 
-        getaddrinfo(_host.c_str(), std::to_string(_port).c_str(), &hints, &res);
+        if (getaddrinfo(_host.c_str(), std::to_string(_port).c_str(), &hints, &res) != 0) {
+            throw NetworkException("TCPServer could not resolve host", _host, _port);
+        }
 
         for (ai = res; ai; ai = ai->ai_next) {
             if (ai->ai_family == PF_INET6) break;
@@ -209,10 +677,13 @@ public:
         }
         ai = ai ? ai : ai4;
 
-        sock = socket(ai->ai_family, SOCK_STREAM, 0);
+        sock = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
-        bind(sock, ai->ai_addr, ai->ai_addrlen);
-        listen(sock, 256);
+        if (bind(sock, ai->ai_addr, ai->ai_addrlen) == -1 || listen(sock, SOMAXCONN) == -1) {
+            freeaddrinfo(res);
+            close(sock);
+            throw NetworkException("TCPServer could not listen", _host, _port, strerror(errno));
+        }
         freeaddrinfo(res);
         return sock;
     }
@@ -221,10 +692,11 @@ private:
     TCPHandler& _handler;
     const std::string _host;
     const int _port;
-    std::thread _thread;
-    bool _is_running;
+    std::atomic<bool> _is_running;
     int _timeout;
-    std::list<TCPConnection*> _connections;
+    const int _sock;
+    std::vector<TCPServerLoop*> _loops;
+    std::thread _thread;
 };
 
 
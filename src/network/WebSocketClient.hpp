@@ -2,8 +2,19 @@
 #define CTRADING__NETWORK__WEBSOCKETCLIENT__HPP
 
 
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
 #include <string>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
 
 #include "./easywsclient.hpp"
 #include "./easywsclient.cpp"
@@ -16,6 +27,74 @@ public:
 };
 
 
+// frames (and fragmented messages) above this size end the connection,
+// instead of having their announced length allocated
+static const size_t WEBSOCKET_MAX_FRAME_SIZE = 1 << 24;
+
+
+// received bytes, appended at the write end and consumed at the read end;
+// consumed space is reclaimed by moving the unread tail (at most one
+// incomplete frame) back to the beginning, so that frames are always
+// contiguous and can be parsed in place
+class WebSocketReceiveBuffer {
+public:
+
+    inline WebSocketReceiveBuffer(const size_t capacity=1<<20) :
+        _data(capacity, '\0'),
+        _read_offset(0),
+        _write_offset(0) {}
+
+    inline char* get_write_pointer() {
+        return &_data[_write_offset];
+    }
+    inline const size_t get_write_space() {
+        if (_write_offset == _data.size()) {
+            reclaim();
+        }
+        return _data.size() - _write_offset;
+    }
+    inline void commit(const size_t size) {
+        _write_offset += size;
+    }
+
+    inline char* get_read_pointer() {
+        return &_data[_read_offset];
+    }
+    inline const size_t get_readable_size() const {
+        return _write_offset - _read_offset;
+    }
+    inline void consume(const size_t size) {
+        _read_offset += size;
+        if (_read_offset == _write_offset) {
+            _read_offset = _write_offset = 0;
+        }
+    }
+
+    // make room for a frame of the given size
+    inline void reserve(const size_t size) {
+        if (_data.size() - _read_offset < size) {
+            reclaim();
+            if (_data.size() < size) {
+                _data.resize(size);
+            }
+        }
+    }
+
+private:
+
+    inline void reclaim() {
+        const size_t readable_size = get_readable_size();
+        memmove(&_data[0], &_data[_read_offset], readable_size);
+        _read_offset = 0;
+        _write_offset = readable_size;
+    }
+
+    std::string _data;
+    size_t _read_offset;
+    size_t _write_offset;
+};
+
+
 class WebSocketClient {
 public:
 
@@ -24,8 +103,12 @@ public:
         _url(url),
         _origin(origin),
         _ws(NULL),
+        _sock(-1),
         _thread(NULL),
-        _is_running(false) {}
+        _is_running(false),
+        _busy_poll(0),
+        _cpu(-1),
+        _random(std::random_device()()) {}
     inline ~WebSocketClient() {
         stop();
     }
@@ -33,26 +116,42 @@ public:
     inline void set_debug(const bool debug) {
         _debug = debug;
     }
+    // spin on the socket instead of sleeping in poll(), and ask the kernel to
+    // busy-poll the device queue for the given number of microseconds
+    // (SO_BUSY_POLL); 0 disables it
+    inline void set_busy_poll(const int microseconds) {
+        _busy_poll = microseconds;
+    }
+    // pin the receiving thread to a CPU; -1 lets the scheduler decide
+    inline void set_cpu(const int cpu) {
+        _cpu = cpu;
+    }
 
     static void _start(WebSocketClient* client) {
-        while (client->_is_running) {
-            client->_ws->poll(1);
-            client->_ws->dispatch(client->_callback, client);
-        }
+        client->receive();
     }
     inline void start() {
         stop();
-        _is_running = true;
-        // initialize websocket
+        // initialize websocket (easywsclient only takes care of the handshake)
         _ws = easywsclient::WebSocket::from_url(_url, _origin);
         if (_ws == NULL) {
             throw WebSocketClientException("Could not connect to websocket", _url);
         }
+        _sock = _ws->getSocket();
+        const int buffer_size = 1 << 22;
+        setsockopt(_sock, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        if (_busy_poll && setsockopt(_sock, SOL_SOCKET, SO_BUSY_POLL, &_busy_poll, sizeof(_busy_poll)) == -1 && _debug) {
+            std::cout << "WEBSOCKETCLIENT COULD NOT SET SO_BUSY_POLL: " << strerror(errno) << '\n';
+        }
         // initialize thread
+        _is_running = true;
         _thread = new std::thread(_start, this);
     }
 
     inline void stop() {
+        if (_sock != -1 && _is_running) {
+            send_frame(CLOSE, "", 0);
+        }
         _is_running = false;
         // stop thread
         if (_thread) {
@@ -62,7 +161,8 @@ public:
         }
         // stop websocket
         if (_ws) {
-            _ws->close();
+            ::close(_sock);
+            _sock = -1;
             delete _ws;
             _ws = NULL;
         }
@@ -72,26 +172,233 @@ public:
         if (_debug) {
             std::cout << "WEBSOCKETCLIENT CLIENT SAYS: " << payload << '\n';
         }
-        _ws->send(payload);
+        send_frame(TEXT_FRAME, payload.data(), payload.size());
     }
 
-    virtual void callback(const std::string& payload) = 0;
-    static void _callback(const std::string& payload, void* _client) {
-        WebSocketClient* client = (WebSocketClient*) _client;
-        if (client->_debug) {
-            std::cout << "WEBSOCKETCLIENT SERVER SAYS: " << payload << '\n';
-        }
-        client->callback(payload);
+    // messages are handed over in place, straight from the receive buffer;
+    // the default implementation copies them for callback(const std::string&)
+    virtual void callback(const char* data, const size_t size) {
+        callback(std::string(data, size));
+    }
+    virtual void callback(const std::string& payload) {}
+
+    // false once the server closed the connection, or broke the protocol
+    inline const bool is_running() const {
+        return _is_running;
+    }
+
+    // when the bytes of the message being handed over were received
+    inline const std::chrono::steady_clock::time_point& get_receive_time() const {
+        return _receive_time;
     }
 
 private:
 
+    enum Opcode {
+        CONTINUATION = 0x0,
+        TEXT_FRAME = 0x1,
+        BINARY_FRAME = 0x2,
+        CLOSE = 0x8,
+        PING = 0x9,
+        PONG = 0xa,
+    };
+
+    inline void receive() {
+        if (_cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(_cpu, &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+        while (_is_running) {
+            if (!_busy_poll) {
+                pollfd descriptor = {_sock, POLLIN, 0};
+                if (::poll(&descriptor, 1, 100) <= 0) {
+                    continue;
+                }
+            }
+            // drain the socket in as few recv() as possible
+            bool has_received = false;
+            while (true) {
+                const size_t space = _buffer.get_write_space();
+                const ssize_t result = recv(_sock, _buffer.get_write_pointer(), space, MSG_DONTWAIT);
+                if (result > 0) {
+                    _buffer.commit(result);
+                    has_received = true;
+                    if ((size_t) result < space) {
+                        break;
+                    }
+                } else if (result == 0) {
+                    _is_running = false;
+                    break;
+                } else if (errno == EINTR) {
+                    continue;
+                } else {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        _is_running = false;
+                    }
+                    break;
+                }
+            }
+            if (has_received) {
+                _receive_time = std::chrono::steady_clock::now();
+                dispatch();
+            }
+        }
+    }
+
+    // parse every complete frame of the buffer, in place
+    inline void dispatch() {
+        while (_buffer.get_readable_size() >= 2) {
+            uint8_t* data = (uint8_t*) _buffer.get_read_pointer();
+            const size_t readable_size = _buffer.get_readable_size();
+            const bool fin = data[0] & 0x80;
+            const Opcode opcode = (Opcode) (data[0] & 0x0f);
+            const bool mask = data[1] & 0x80;
+            const uint8_t n0 = data[1] & 0x7f;
+            const size_t header_size = 2 + (n0 == 126 ? 2 : 0) + (n0 == 127 ? 8 : 0) + (mask ? 4 : 0);
+            if (readable_size < header_size) {
+                return;
+            }
+            uint64_t n = n0;
+            if (n0 == 126) {
+                n = ((uint64_t) data[2] << 8) | data[3];
+            } else if (n0 == 127) {
+                n = 0;
+                for (int i=2; i<10; ++i) {
+                    n = (n << 8) | data[i];
+                }
+            }
+            if (n > WEBSOCKET_MAX_FRAME_SIZE) {
+                std::cerr << "WEBSOCKETCLIENT GOT OVERSIZED FRAME: " << n << " bytes\n";
+                fail();
+                return;
+            }
+            if (readable_size < header_size + n) {
+                _buffer.reserve(header_size + n);
+                return;
+            }
+            char* payload = (char*) data + header_size;
+            if (mask) {
+                const uint8_t* masking_key = data + header_size - 4;
+                for (size_t i=0; i<n; ++i) {
+                    payload[i] ^= masking_key[i & 3];
+                }
+            }
+            switch (opcode) {
+                case TEXT_FRAME:
+                case BINARY_FRAME:
+                case CONTINUATION:
+                    if (fin && _fragments.empty()) {
+                        handle(payload, n);
+                    } else {
+                        // fragmented messages are the only ones to be copied
+                        if (_fragments.size() + n > WEBSOCKET_MAX_FRAME_SIZE) {
+                            std::cerr << "WEBSOCKETCLIENT GOT OVERSIZED MESSAGE\n";
+                            fail();
+                            return;
+                        }
+                        _fragments.append(payload, n);
+                        if (fin) {
+                            handle(_fragments.data(), _fragments.size());
+                            _fragments.clear();
+                        }
+                    }
+                    break;
+                case PING:
+                    send_frame(PONG, payload, n);
+                    break;
+                case PONG:
+                    break;
+                case CLOSE:
+                    _is_running = false;
+                    break;
+                default:
+                    std::cerr << "WEBSOCKETCLIENT GOT UNEXPECTED OPCODE: " << opcode << '\n';
+                    _is_running = false;
+                    break;
+            }
+            _buffer.consume(header_size + n);
+        }
+    }
+
+    // close with 1009 (message too big), and stop reading
+    inline void fail() {
+        const char status[2] = {(char) (1009 >> 8), (char) (1009 & 0xff)};
+        try {
+            send_frame(CLOSE, status, 2);
+        } catch (...) {}
+        ::shutdown(_sock, SHUT_RDWR);
+        _is_running = false;
+    }
+
+    inline void handle(const char* data, const size_t size) {
+        if (_debug) {
+            std::cout << "WEBSOCKETCLIENT SERVER SAYS: " << std::string(data, size) << '\n';
+        }
+        callback(data, size);
+    }
+
+    // frames sent by a client must be masked
+    inline void send_frame(const Opcode opcode, const char* payload, const size_t size) {
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        if (_sock == -1) {
+            throw WebSocketClientException("WebSocketClient is not connected", _url);
+        }
+        std::string frame;
+        frame.reserve(14 + size);
+        frame += (char) (0x80 | opcode);
+        if (size < 126) {
+            frame += (char) (0x80 | size);
+        } else if (size < 65536) {
+            frame += (char) (0x80 | 126);
+            frame += (char) (size >> 8);
+            frame += (char) size;
+        } else {
+            frame += (char) (0x80 | 127);
+            for (int shift=56; shift>=0; shift-=8) {
+                frame += (char) (size >> shift);
+            }
+        }
+        const uint32_t masking_key = _random();
+        frame.append((const char*) &masking_key, 4);
+        const size_t offset = frame.size();
+        frame.append(payload, size);
+        for (size_t i=0; i<size; ++i) {
+            frame[offset + i] ^= ((const char*) &masking_key)[i & 3];
+        }
+        // the socket is non-blocking
+        size_t sent = 0;
+        while (sent < frame.size()) {
+            const ssize_t result = ::send(_sock, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+            if (result >= 0) {
+                sent += result;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd descriptor = {_sock, POLLOUT, 0};
+                ::poll(&descriptor, 1, 100);
+            } else if (errno != EINTR) {
+                throw WebSocketClientException("WebSocketClient could not send frame", _url, strerror(errno));
+            }
+        }
+    }
+
     bool _debug;
     const std::string _url;
     const std::string _origin;
     easywsclient::WebSocket::pointer _ws;
+    int _sock;
     std::thread* _thread;
-    bool _is_running;
+    std::atomic<bool> _is_running;
+    int _busy_poll;
+    int _cpu;
+    // receiving
+    WebSocketReceiveBuffer _buffer;
+    std::string _fragments;
+    std::chrono::steady_clock::time_point _receive_time;
+    // sending
+    std::mutex _send_mutex;
+    // masking keys must not be predictable (RFC 6455, section 5.3)
+    std::mt19937 _random;
 };
 
 
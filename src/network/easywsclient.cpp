@@ -180,6 +180,10 @@ class _RealWebSocket : public easywsclient::WebSocket
       return readyState;
     }
 
+    int getSocket() const {
+      return sockfd;
+    }
+
     void poll(int timeout) { // timeout in milliseconds
         if (readyState == CLOSED) {
             if (timeout > 0) {
@@ -35,6 +35,7 @@ class WebSocket {
     virtual void sendPing() = 0;
     virtual void close() = 0;
     virtual readyStateValues getReadyState() const = 0;
+    virtual int getSocket() const { return -1; } // added for cpptrading's own receive loop
 
     template<class Callable>
     void dispatch(Callable callable, void* user_data=NULL)
@@ -4,6 +4,9 @@
 
 #include <string.h>
 
+#include <iterator>
+#include <type_traits>
+
 #include "./Range.hpp"
 
 
@@ -12,10 +15,12 @@ class ForwardRangeData : public RangeData<T> {
 public:
 
     ForwardRangeData(Container& container) :
-        _container(container) {}
+        _container(container),
+        _position(0) {}
 
     virtual const bool init(T*& value) {
         _container_iterator = _container.begin();
+        _position = 0;
         if (_container_iterator != _container.end()) {
             value = &*_container_iterator;
             return true;
@@ -23,7 +28,17 @@ public:
         return false;
     }
 
+    // containers with random access are addressed by position, so that
+    // appending to a vector between two steps does not invalidate the range
     virtual const bool next(T*& value) {
+        ++_position;
+        if constexpr (is_random_access) {
+            if (_position < _container.size()) {
+                value = &_container[_position];
+                return true;
+            }
+            return false;
+        }
         ++_container_iterator;
         if (_container_iterator != _container.end()) {
             value = &*_container_iterator;
@@ -34,8 +49,11 @@ public:
 
 private:
 
+    static constexpr bool is_random_access = std::is_same<typename std::iterator_traits<typename Container::iterator>::iterator_category, std::random_access_iterator_tag>::value;
+
     Container& _container;
     typename Container::iterator _container_iterator;
+    size_t _position;
 
 };
 
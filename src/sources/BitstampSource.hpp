@@ -2,9 +2,6 @@
 #define CPPTRAING__SOURCES__BITSTAMPSOURCE_HPP
 
 
-#include "json.hpp"
-using JSON = nlohmann::json;
-
 #include "./Source.hpp"
 #include "models/Trade.hpp"
 #include "models/Order.hpp"
@@ -27,57 +24,87 @@ public:
         _pusher_client.start();
     }
 
-    static const Trade make_trade(const JSON& data) {
-        return {
-            .id = data["id"],
-            .volume = data["amount"],
-            .price = data["price"],
-            .type = (data["type"] == 0) ? BUY : SELL,
-            .timestamp = std::stod(data["timestamp"].get<std::string>()),
-            .buy_order_id = data["buy_order_id"],
-            .sell_order_id = data["sell_order_id"],
-        };
+    // decoded straight from the escaped "data" of the Pusher message
+    static const bool parse_trade(const PusherMessage& message, Trade& trade) {
+        PusherDataReader reader = message.get_data_reader();
+        const char* key;
+        size_t key_size;
+        uint64_t type = 0;
+        int fields = 0;
+        while (reader.next_key(key, key_size)) {
+            bool is_read;
+            if (key_size == 2 && memcmp(key, "id", 2) == 0) {
+                is_read = reader.read(trade.id) && ++fields;
+            } else if (key_size == 6 && memcmp(key, "amount", 6) == 0) {
+                is_read = reader.read(trade.volume) && ++fields;
+            } else if (key_size == 5 && memcmp(key, "price", 5) == 0) {
+                is_read = reader.read(trade.price) && ++fields;
+            } else if (key_size == 4 && memcmp(key, "type", 4) == 0) {
+                is_read = reader.read(type) && ++fields;
+            } else if (key_size == 9 && memcmp(key, "timestamp", 9) == 0) {
+                is_read = reader.read(*trade.timestamp) && ++fields;
+            } else if (key_size == 12 && memcmp(key, "buy_order_id", 12) == 0) {
+                is_read = reader.read(trade.buy_order_id) && ++fields;
+            } else if (key_size == 13 && memcmp(key, "sell_order_id", 13) == 0) {
+                is_read = reader.read(trade.sell_order_id) && ++fields;
+            } else {
+                is_read = reader.skip();
+            }
+            if (!is_read) {
+                return false;
+            }
+        }
+        trade.type = (type == 0) ? BUY : SELL;
+        return fields == 7;
     }
-    static const Order make_order(const JSON& data) {
-        return {
-            .id = data["id"],
-            .amount = data["amount"],
-            .price = data["price"],
-            .type = (data["order_type"] == 0) ? BUY : SELL,
-            .timestamp = std::stod(data["datetime"].get<std::string>()),
-        };
+    static const bool parse_order(const PusherMessage& message, Order& order) {
+        PusherDataReader reader = message.get_data_reader();
+        const char* key;
+        size_t key_size;
+        uint64_t type = 0;
+        int fields = 0;
+        while (reader.next_key(key, key_size)) {
+            bool is_read;
+            if (key_size == 2 && memcmp(key, "id", 2) == 0) {
+                is_read = reader.read(order.id) && ++fields;
+            } else if (key_size == 6 && memcmp(key, "amount", 6) == 0) {
+                is_read = reader.read(order.amount) && ++fields;
+            } else if (key_size == 5 && memcmp(key, "price", 5) == 0) {
+                is_read = reader.read(order.price) && ++fields;
+            } else if (key_size == 10 && memcmp(key, "order_type", 10) == 0) {
+                is_read = reader.read(type) && ++fields;
+            } else if (key_size == 8 && memcmp(key, "datetime", 8) == 0) {
+                is_read = reader.read(order.timestamp) && ++fields;
+            } else {
+                is_read = reader.skip();
+            }
+            if (!is_read) {
+                return false;
+            }
+        }
+        order.type = (type == 0) ? BUY : SELL;
+        return fields == 5;
     }
 
-    static void orders_callback(const std::string& event, const JSON& data, void* user_data) {
+    static void orders_callback(const PusherMessage& message, void* user_data) {
         Order order;
-        try {
-            order = make_order(data);
-        } catch (const KeyException&) {
-            std::cerr << "ERROR WHILE PARSING ORDER FROM BITSTAMP PUSHER: " << data << std::endl;
-            return;
-        } catch (const nlohmann::detail::type_error&) {
-            std::cerr << "ERROR WHILE PARSING ORDER FROM BITSTAMP PUSHER: " << data << std::endl;
+        if (!parse_order(message, order)) {
+            std::cerr << "ERROR WHILE PARSING ORDER FROM BITSTAMP PUSHER: " << std::string(message.data, message.data_end) << std::endl;
             return;
         }
         BitstampSource& source = * (BitstampSource*) user_data;
-        // std::cout << "[" << event << "] " << order << std::endl;
-        if (event == "order_created") {
+        if (message.is_event("order_created")) {
             source.feed(order);
-        } else if (event == "order_changed") {
+        } else if (message.is_event("order_changed")) {
             source.feed(order);
-        } else if (event == "order_deleted") {
+        } else if (message.is_event("order_deleted")) {
             source.puke(order);
         }
     }
-    static void trades_callback(const std::string& event, const JSON& data, void* user_data) {
+    static void trades_callback(const PusherMessage& message, void* user_data) {
         Trade trade;
-        try {
-            trade = make_trade(data);
-        } catch (const KeyException&) {
-            std::cerr << "ERROR WHILE PARSING TRADE FROM BITSTAMP PUSHER: " << data << std::endl;
-            return;
-        } catch (const nlohmann::detail::type_error&) {
-            std::cerr << "ERROR WHILE PARSING TRADE FROM BITSTAMP PUSHER: " << data << std::endl;
+        if (!parse_trade(message, trade)) {
+            std::cerr << "ERROR WHILE PARSING TRADE FROM BITSTAMP PUSHER: " << std::string(message.data, message.data_end) << std::endl;
             return;
         }
         BitstampSource& source = * (BitstampSource*) user_data;
@@ -31,6 +31,8 @@ public:
             }
             feed(trade);
         }
+        fclose(file);
+        wait();
     }
 
 private:
@@ -0,0 +1,295 @@
+#ifndef CPPTRAING__SOURCES__HISTORYSINK_HPP
+#define CPPTRAING__SOURCES__HISTORYSINK_HPP
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "history/History.hpp"
+#include "./SPSCRing.hpp"
+
+
+// what happens to an event when the ring of a sink is full
+enum HistorySinkPolicy {
+    // the source waits for the sink to catch up
+    HISTORY_SINK_BLOCK,
+    // the event is lost (and counted)
+    HISTORY_SINK_DROP,
+    // the event is kept in an unbounded overflow queue, drained in order
+    HISTORY_SINK_SPILL,
+};
+
+
+struct HistorySinkMetrics {
+    size_t enqueued;
+    size_t consumed;
+    size_t dropped;
+    size_t spilled;
+    size_t errors;
+    // what the history threw last, if anything
+    std::string last_error;
+    // events waiting, in the ring and the overflow queue
+    size_t pending;
+    // time between enqueuing and feeding the history, in seconds
+    double last_lag;
+    double max_lag;
+    double mean_lag;
+};
+
+
+// feeds one history from its own thread, so that a slow history does not
+// slow down the source (nor the other histories)
+class HistorySink {
+public:
+
+    inline HistorySink(History& history, const HistorySinkPolicy policy=HISTORY_SINK_BLOCK, const size_t capacity=65536) :
+        _history(history),
+        _policy(policy),
+        _ring(capacity),
+        _is_running(true),
+        _is_spilling(false),
+        _is_sleeping(false),
+        _enqueued(0),
+        _consumed(0),
+        _dropped(0),
+        _spilled(0),
+        _errors(0),
+        _last_lag(0),
+        _max_lag(0),
+        _total_lag(0)
+    {
+        _thread = std::thread(&HistorySink::consume, this);
+    }
+
+    // remaining events are fed before the thread stops
+    inline ~HistorySink() {
+        _is_running.store(false);
+        wake();
+        _thread.join();
+    }
+
+    // producer side, from the source thread only
+    inline void feed(const Trade& trade) {
+        Event event;
+        event.type = TRADE;
+        memcpy(event.payload, &trade, sizeof(Trade));
+        enqueue(event);
+    }
+    inline void feed(const Order& order) {
+        Event event;
+        event.type = ORDER;
+        memcpy(event.payload, &order, sizeof(Order));
+        enqueue(event);
+    }
+
+    // until every event enqueued so far was fed to the history
+    inline void wait() {
+        while (_consumed.load() + _dropped.load() < _enqueued.load()) {
+            wake();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    inline const HistorySinkMetrics get_metrics() const {
+        HistorySinkMetrics metrics;
+        metrics.enqueued = _enqueued.load();
+        metrics.consumed = _consumed.load();
+        metrics.dropped = _dropped.load();
+        metrics.spilled = _spilled.load();
+        metrics.errors = _errors.load();
+        {
+            std::lock_guard<std::mutex> lock(_error_mutex);
+            metrics.last_error = _last_error;
+        }
+        metrics.pending = metrics.enqueued - metrics.consumed - metrics.dropped;
+        metrics.last_lag = 1e-9 * _last_lag.load();
+        metrics.max_lag = 1e-9 * _max_lag.load();
+        metrics.mean_lag = metrics.consumed ? 1e-9 * _total_lag.load() / metrics.consumed : 0.;
+        return metrics;
+    }
+
+    inline History& get_history() {
+        return _history;
+    }
+    inline const HistorySinkPolicy get_policy() const {
+        return _policy;
+    }
+
+private:
+
+    enum EventType : uint8_t {
+        TRADE,
+        ORDER,
+    };
+
+    // either model, kept as bytes in the slots of the ring
+    struct Event {
+        EventType type;
+        int64_t enqueue_time;
+        char payload[sizeof(Trade) > sizeof(Order) ? sizeof(Trade) : sizeof(Order)];
+    };
+
+    static inline const int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline void enqueue(Event& event) {
+        event.enqueue_time = now();
+        _enqueued.fetch_add(1, std::memory_order_relaxed);
+        // once spilling, everything goes to the overflow queue until it is
+        // taken by the consumer, to keep events in order
+        if (_is_spilling.load(std::memory_order_acquire) || !_ring.push(event)) {
+            switch (_policy) {
+                case HISTORY_SINK_BLOCK:
+                    while (!_ring.push(event)) {
+                        wake();
+                        std::this_thread::yield();
+                    }
+                    break;
+                case HISTORY_SINK_DROP:
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                case HISTORY_SINK_SPILL: {
+                    std::unique_lock<std::mutex> lock(_spill_mutex);
+                    _spill.push_back(event);
+                    _is_spilling.store(true, std::memory_order_release);
+                    _spilled.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_is_sleeping.load(std::memory_order_relaxed)) {
+            wake();
+        }
+    }
+
+    inline void wake() {
+        std::unique_lock<std::mutex> lock(_wake_mutex);
+        _wake_condition.notify_one();
+    }
+
+    inline void process(const Event& event) {
+        try {
+            if (event.type == TRADE) {
+                Trade trade;
+                memcpy((void*) &trade, event.payload, sizeof(Trade));
+                _history.feed(trade);
+            } else {
+                Order order;
+                memcpy((void*) &order, event.payload, sizeof(Order));
+                _history.feed(order);
+            }
+        } catch (const Exception& exception) {
+            // Exception does not derive publicly from std::exception
+            fail(exception.what());
+        } catch (const std::exception& exception) {
+            fail(exception.what());
+        } catch (...) {
+            fail("unknown error");
+        }
+        const int64_t lag = now() - event.enqueue_time;
+        _last_lag.store(lag, std::memory_order_relaxed);
+        if (lag > _max_lag.load(std::memory_order_relaxed)) {
+            _max_lag.store(lag, std::memory_order_relaxed);
+        }
+        _total_lag.fetch_add(lag, std::memory_order_relaxed);
+        _consumed.fetch_add(1, std::memory_order_release);
+    }
+
+    inline void fail(const std::string& error) {
+        {
+            std::lock_guard<std::mutex> lock(_error_mutex);
+            _last_error = error;
+        }
+        _errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the overflow queue only holds events newer than those of the ring, and
+    // is only taken once the ring is empty
+    inline const size_t drain_spill() {
+        std::deque<Event> spill;
+        {
+            std::unique_lock<std::mutex> lock(_spill_mutex);
+            if (_spill.empty() || !_ring.is_empty()) {
+                return 0;
+            }
+            spill.swap(_spill);
+            _is_spilling.store(false, std::memory_order_release);
+        }
+        for (const Event& event : spill) {
+            process(event);
+        }
+        return spill.size();
+    }
+
+    inline void consume() {
+        int idle = 0;
+        while (true) {
+            size_t count = _ring.pop(256, [this](const Event& event) {
+                process(event);
+            });
+            if (count == 0 && _policy == HISTORY_SINK_SPILL) {
+                count = drain_spill();
+            }
+            if (count) {
+                idle = 0;
+                continue;
+            }
+            if (!_is_running.load()) {
+                if (_ring.is_empty() && (_policy != HISTORY_SINK_SPILL || !_is_spilling.load())) {
+                    break;
+                }
+                continue;
+            }
+            // spin a little, then sleep until woken up
+            if (++idle < 64) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_wake_mutex);
+            _is_sleeping.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_ring.is_empty() && !_is_spilling.load() && _is_running.load()) {
+                _wake_condition.wait_for(lock, std::chrono::milliseconds(1));
+            }
+            _is_sleeping.store(false);
+        }
+    }
+
+    History& _history;
+    const HistorySinkPolicy _policy;
+    SPSCRing<Event> _ring;
+    std::thread _thread;
+    std::atomic<bool> _is_running;
+    // overflow queue
+    std::mutex _spill_mutex;
+    std::deque<Event> _spill;
+    std::atomic<bool> _is_spilling;
+    // consumer wake-up
+    std::mutex _wake_mutex;
+    std::condition_variable _wake_condition;
+    std::atomic<bool> _is_sleeping;
+    // metrics
+    std::atomic<size_t> _enqueued;
+    std::atomic<size_t> _consumed;
+    std::atomic<size_t> _dropped;
+    std::atomic<size_t> _spilled;
+    std::atomic<size_t> _errors;
+    mutable std::mutex _error_mutex;
+    std::string _last_error;
+    std::atomic<int64_t> _last_lag;
+    std::atomic<int64_t> _max_lag;
+    std::atomic<int64_t> _total_lag;
+};
+
+
+#endif // CPPTRAING__SOURCES__HISTORYSINK_HPP
@@ -0,0 +1,174 @@
+#ifndef CPPTRAING__SOURCES__ORDERBOOK_HPP
+#define CPPTRAING__SOURCES__ORDERBOOK_HPP
+
+
+#include <stdint.h>
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "models/Order.hpp"
+
+
+// orders aggregated at one price
+struct OrderBookLevel {
+    double price;
+    double amount;
+    uint32_t count;
+};
+
+
+// limit order book rebuilt from order events: orders are tracked by id (for
+// changes and deletions to be applied), and aggregated in price levels; each
+// side is a sorted array whose best level comes last, as most updates happen
+// near the top of the book
+class OrderBook {
+public:
+
+    inline OrderBook() :
+        _timestamp(0) {}
+
+    // created or changed order
+    inline void feed(const Order& order) {
+        if (order.type != BUY && order.type != SELL) {
+            return;
+        }
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _timestamp = std::max(_timestamp, order.timestamp);
+        auto it = _orders.find(order.id);
+        if (it == _orders.end()) {
+            _orders.insert({order.id, {order.price, order.amount, order.type}});
+            add(order.type, order.price, order.amount, 1);
+            return;
+        }
+        BookOrder& book_order = it->second;
+        if (book_order.price == order.price && book_order.type == order.type) {
+            add(order.type, order.price, order.amount - book_order.amount, 0);
+        } else {
+            add(book_order.type, book_order.price, -book_order.amount, -1);
+            add(order.type, order.price, order.amount, 1);
+        }
+        book_order = {order.price, order.amount, order.type};
+    }
+    // deleted order
+    inline void puke(const Order& order) {
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _timestamp = std::max(_timestamp, order.timestamp);
+        auto it = _orders.find(order.id);
+        if (it == _orders.end()) {
+            return;
+        }
+        add(it->second.type, it->second.price, -it->second.amount, -1);
+        _orders.erase(it);
+    }
+    inline void clear() {
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _timestamp = 0;
+        _orders.clear();
+        _bids.clear();
+        _asks.clear();
+    }
+
+    // price is NAN when the side is empty
+    inline const OrderBookLevel get_best_bid() const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return _bids.empty() ? OrderBookLevel{NAN, 0., 0} : _bids.back();
+    }
+    inline const OrderBookLevel get_best_ask() const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return _asks.empty() ? OrderBookLevel{NAN, 0., 0} : _asks.back();
+    }
+    inline const double get_spread() const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return (_bids.empty() || _asks.empty()) ? NAN : _asks.back().price - _bids.back().price;
+    }
+    inline const double get_mid_price() const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return (_bids.empty() || _asks.empty()) ? NAN : .5 * (_asks.back().price + _bids.back().price);
+    }
+
+    // best levels first; the vectors are reused, to avoid allocating
+    inline void get_depth(std::vector<OrderBookLevel>& bids, std::vector<OrderBookLevel>& asks, const size_t levels=-1) const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        bids.assign(_bids.rbegin(), _bids.rbegin() + std::min(levels, _bids.size()));
+        asks.assign(_asks.rbegin(), _asks.rbegin() + std::min(levels, _asks.size()));
+    }
+    // amount offered at prices up to the given distance from the best one
+    inline const double get_depth_amount(const ActionType type, const double distance) const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        const std::vector<OrderBookLevel>& levels = (type == BUY) ? _bids : _asks;
+        double amount = 0.;
+        for (auto it=levels.rbegin(); it!=levels.rend() && std::abs(it->price - levels.back().price) <= distance; ++it) {
+            amount += it->amount;
+        }
+        return amount;
+    }
+
+    // every live order, for persistence
+    inline void get_orders(std::vector<Order>& orders) const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        orders.clear();
+        orders.reserve(_orders.size());
+        for (const auto& it : _orders) {
+            orders.push_back({it.first, it.second.amount, it.second.price, it.second.type, _timestamp});
+        }
+    }
+
+    inline const size_t get_orders_count() const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return _orders.size();
+    }
+    inline const size_t get_levels_count(const ActionType type) const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return (type == BUY) ? _bids.size() : _asks.size();
+    }
+    inline const double get_timestamp() const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return _timestamp;
+    }
+
+private:
+
+    struct BookOrder {
+        double price;
+        double amount;
+        ActionType type;
+    };
+
+    // must be called with the lock held
+    inline void add(const ActionType type, const double price, const double amount, const int count) {
+        std::vector<OrderBookLevel>& levels = (type == BUY) ? _bids : _asks;
+        // bids are sorted by increasing price, asks by decreasing price
+        auto it = (type == BUY)
+            ? std::lower_bound(levels.begin(), levels.end(), price, [](const OrderBookLevel& level, const double price) {
+                return level.price < price;
+            })
+            : std::lower_bound(levels.begin(), levels.end(), price, [](const OrderBookLevel& level, const double price) {
+                return level.price > price;
+            });
+        if (it == levels.end() || it->price != price) {
+            if (count > 0) {
+                levels.insert(it, {price, amount, (uint32_t) count});
+            }
+            return;
+        }
+        it->amount += amount;
+        it->count += count;
+        if (it->count == 0) {
+            levels.erase(it);
+        }
+    }
+
+    mutable std::shared_mutex _mutex;
+    double _timestamp;
+    std::unordered_map<uint64_t, BookOrder> _orders;
+    std::vector<OrderBookLevel> _bids;
+    std::vector<OrderBookLevel> _asks;
+};
+
+
+#endif // CPPTRAING__SOURCES__ORDERBOOK_HPP
@@ -0,0 +1,484 @@
+#ifndef CPPTRAING__SOURCES__ORDERSTATES_HPP
+#define CPPTRAING__SOURCES__ORDERSTATES_HPP
+
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+#include "models/Order.hpp"
+#include "exceptions/Exception.hpp"
+
+
+// epoch-based reclamation: readers announce the epoch they entered in; what a
+// writer retired at a given epoch may be reused once every reader announces
+// a later one; threads release their slots when they exit
+class OrderStatesEpochs {
+public:
+
+    static const uint64_t quiescent = UINT64_MAX;
+
+    inline OrderStatesEpochs() :
+        _serial(make_serial()),
+        _epoch(0) {
+        for (Slot& slot : _slots) {
+            slot.owner = 0;
+            slot.epoch = quiescent;
+        }
+        std::lock_guard<std::mutex> lock(get_instances_mutex());
+        get_instances()[_serial] = this;
+    }
+    inline ~OrderStatesEpochs() {
+        std::lock_guard<std::mutex> lock(get_instances_mutex());
+        get_instances().erase(_serial);
+    }
+
+    inline void enter() {
+        Slot& slot = get_slot();
+        slot.epoch.store(_epoch.load());
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    inline void exit() {
+        get_slot().epoch.store(quiescent, std::memory_order_release);
+    }
+
+    inline const uint64_t get_epoch() const {
+        return _epoch.load();
+    }
+    inline void advance() {
+        _epoch.fetch_add(1);
+    }
+    // what was retired before that epoch can be reused
+    inline const uint64_t get_safe_epoch() const {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t result = _epoch.load();
+        for (const Slot& slot : _slots) {
+            const uint64_t epoch = slot.epoch.load();
+            if (epoch < result) {
+                result = epoch;
+            }
+        }
+        return result;
+    }
+
+    inline const size_t get_threads_count() const {
+        size_t count = 0;
+        for (const Slot& slot : _slots) {
+            count += (slot.owner != 0);
+        }
+        return count;
+    }
+
+private:
+
+    static const size_t _max_threads = 128;
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> owner;
+        std::atomic<uint64_t> epoch;
+    };
+
+    // slots claimed by a thread, by instance serial; those of the instances
+    // still alive get released when the thread exits
+    struct ThreadSlots {
+        inline ~ThreadSlots() {
+            std::lock_guard<std::mutex> lock(get_instances_mutex());
+            for (const auto& claimed_slot : claimed_slots) {
+                auto it = get_instances().find(claimed_slot.first);
+                if (it != get_instances().end()) {
+                    Slot& slot = it->second->_slots[claimed_slot.second];
+                    slot.epoch.store(quiescent, std::memory_order_release);
+                    slot.owner.store(0, std::memory_order_release);
+                }
+            }
+        }
+        std::vector<std::pair<uint64_t, size_t>> claimed_slots;
+    };
+
+    // threads keep the slot they claimed, cached for the last instance used
+    inline Slot& get_slot() {
+        thread_local uint64_t cached_serial = 0;
+        thread_local size_t cached_index = 0;
+        thread_local ThreadSlots thread_slots;
+        if (cached_serial == _serial) {
+            return _slots[cached_index];
+        }
+        const uint64_t owner = (uint64_t) pthread_self();
+        for (size_t index=0; index<_max_threads; ++index) {
+            if (_slots[index].owner == owner) {
+                cached_serial = _serial;
+                cached_index = index;
+                return _slots[index];
+            }
+        }
+        for (size_t index=0; index<_max_threads; ++index) {
+            uint64_t expected = 0;
+            if (_slots[index].owner.compare_exchange_strong(expected, owner)) {
+                thread_slots.claimed_slots.push_back({_serial, index});
+                cached_serial = _serial;
+                cached_index = index;
+                return _slots[index];
+            }
+        }
+        throw Exception("OrderStates cannot be used by more threads", (size_t) _max_threads);
+    }
+
+    static inline std::mutex& get_instances_mutex() {
+        static std::mutex instances_mutex;
+        return instances_mutex;
+    }
+    static inline std::unordered_map<uint64_t, OrderStatesEpochs*>& get_instances() {
+        static std::unordered_map<uint64_t, OrderStatesEpochs*> instances;
+        return instances;
+    }
+    static inline const uint64_t make_serial() {
+        static std::atomic<uint64_t> serials(0);
+        return ++serials;
+    }
+
+    const uint64_t _serial;
+    std::atomic<uint64_t> _epoch;
+    Slot _slots[_max_threads];
+};
+
+// successive versions of the live orders; readers (retrieve()) never lock and
+// touch the table entry and the version slots; writers (feed(), puke()) lock
+// the shard of the order id, and reclaim deleted orders and outdated versions
+// based on the time of the market, instead of a sweeping thread
+class OrderStates {
+public:
+
+    inline OrderStates(const double retention=60.0) :
+        _retention(retention),
+        _last_timestamp(0) {}
+
+    inline ~OrderStates() {
+        for (Shard& shard : _shards) {
+            delete shard.table.load();
+            for (auto& retired : shard.retired_tables) {
+                delete retired.second;
+            }
+            for (std::atomic<Version*>& block : shard.blocks) {
+                delete [] block.load();
+            }
+        }
+    }
+
+    // latest version of the order that is not newer than the timestamp; id is
+    // 0 when there is none
+    inline const Order retrieve(const uint64_t id, const double timestamp) {
+        Order result = {};
+        const Shard& shard = get_shard(id);
+        _epochs.enter();
+        const Table* table = shard.table.load(std::memory_order_acquire);
+        if (table) {
+            for (size_t index=table->get_index(id); ; index=(index+1)&table->mask) {
+                const uint64_t entry_id = table->entries[index].id.load(std::memory_order_acquire);
+                if (entry_id == id) {
+                    uint32_t slot = table->entries[index].head.load(std::memory_order_acquire);
+                    while (slot != none) {
+                        const Version& version = shard.get_version(slot);
+                        if (version.order.timestamp <= timestamp) {
+                            result = version.order;
+                            break;
+                        }
+                        slot = version.next.load(std::memory_order_acquire);
+                    }
+                    break;
+                }
+                if (entry_id == empty) {
+                    break;
+                }
+            }
+        }
+        _epochs.exit();
+        return result;
+    }
+
+    inline void feed(const Order& order) {
+        Shard& shard = get_shard(order.id);
+        ShardLock lock(shard);
+        update_timestamp(order.timestamp);
+        Entry& entry = shard.find_or_insert(order.id, *this);
+        const uint32_t slot = shard.allocate(*this);
+        Version& version = shard.get_version(slot);
+        version.order = order;
+        // versions are chained from the newest; the chain is cut after the
+        // first one old enough to answer any query past the retention
+        std::atomic<uint32_t>* link = &entry.head;
+        uint32_t next = link->load(std::memory_order_relaxed);
+        while (next != none && shard.get_version(next).order.timestamp > order.timestamp) {
+            link = &shard.get_version(next).next;
+            next = link->load(std::memory_order_relaxed);
+        }
+        version.next.store(next, std::memory_order_relaxed);
+        link->store(slot, std::memory_order_release);
+        trim(shard, entry);
+        collect(shard);
+    }
+
+    // the order gets reclaimed once its deletion is older than the retention
+    inline void puke(const Order& order) {
+        Shard& shard = get_shard(order.id);
+        {
+            ShardLock lock(shard);
+            Entry* entry = shard.find(order.id);
+            if (entry && entry->head.load(std::memory_order_relaxed) != none) {
+                update_timestamp(order.timestamp);
+                shard.deleted.push_back({_last_timestamp.load(), order.id});
+                collect(shard);
+                return;
+            }
+        }
+        feed(order);
+        ShardLock lock(shard);
+        shard.deleted.push_back({_last_timestamp.load(), order.id});
+    }
+
+    inline const size_t get_size() const {
+        size_t size = 0;
+        for (const Shard& shard : _shards) {
+            size += shard.size;
+        }
+        return size;
+    }
+
+private:
+
+    static const uint64_t empty = 0;
+    static const uint64_t tombstone = UINT64_MAX;
+    static const uint32_t none = UINT32_MAX;
+    static const size_t _shards_count = 16;
+    static const size_t _block_size = 4096;
+    static const size_t _max_blocks = 4096;
+
+    struct Version {
+        Order order;
+        std::atomic<uint32_t> next;
+    };
+    struct Entry {
+        std::atomic<uint64_t> id;
+        std::atomic<uint32_t> head;
+    };
+    struct Table {
+        inline Table(const size_t capacity) :
+            mask(capacity - 1),
+            used(0),
+            entries(new Entry[capacity]()) {}
+        inline ~Table() {
+            delete [] entries;
+        }
+        inline const size_t get_index(const uint64_t id) const {
+            return (id * 0x9E3779B97F4A7C15ULL) >> 20 & mask;
+        }
+        const size_t mask;
+        size_t used;
+        Entry* entries;
+    };
+    struct Deletion {
+        double timestamp;
+        uint64_t id;
+    };
+
+    struct alignas(64) Shard {
+        inline Shard() :
+            lock(false),
+            table(NULL),
+            blocks_count(0),
+            size(0) {
+            for (std::atomic<Version*>& block : blocks) {
+                block = NULL;
+            }
+        }
+
+        inline Version& get_version(const uint32_t slot) const {
+            return blocks[slot / _block_size].load(std::memory_order_acquire)[slot % _block_size];
+        }
+        // pooled slots, recycled through the retired list
+        inline const uint32_t allocate(OrderStates& states) {
+            if (free_slots.empty()) {
+                states.reclaim(*this);
+            }
+            if (free_slots.empty()) {
+                if (blocks_count == _max_blocks) {
+                    throw Exception("OrderStates ran out of slots", _max_blocks * _block_size);
+                }
+                blocks[blocks_count].store(new Version[_block_size], std::memory_order_release);
+                for (size_t i=_block_size; i--; ) {
+                    free_slots.push_back(blocks_count * _block_size + i);
+                }
+                ++blocks_count;
+            }
+            const uint32_t slot = free_slots.back();
+            free_slots.pop_back();
+            return slot;
+        }
+
+        inline Entry* find(const uint64_t id) {
+            Table* current = table.load(std::memory_order_relaxed);
+            if (current == NULL) {
+                return NULL;
+            }
+            for (size_t index=current->get_index(id); ; index=(index+1)&current->mask) {
+                Entry& entry = current->entries[index];
+                const uint64_t entry_id = entry.id.load(std::memory_order_relaxed);
+                if (entry_id == id) {
+                    return &entry;
+                }
+                if (entry_id == empty) {
+                    return NULL;
+                }
+            }
+        }
+        inline Entry& find_or_insert(const uint64_t id, OrderStates& states) {
+            Entry* entry = find(id);
+            if (entry) {
+                return *entry;
+            }
+            Table* current = table.load(std::memory_order_relaxed);
+            if (current == NULL || 2 * (current->used + 1) > current->mask + 1) {
+                current = states.rebuild(*this);
+            }
+            for (size_t index=current->get_index(id); ; index=(index+1)&current->mask) {
+                Entry& entry = current->entries[index];
+                if (entry.id.load(std::memory_order_relaxed) == empty) {
+                    entry.head.store(none, std::memory_order_relaxed);
+                    entry.id.store(id, std::memory_order_release);
+                    ++current->used;
+                    ++size;
+                    return entry;
+                }
+            }
+        }
+
+        std::atomic<bool> lock;
+        std::atomic<Table*> table;
+        std::atomic<Version*> blocks[_max_blocks];
+        size_t blocks_count;
+        std::atomic<size_t> size;
+        std::vector<uint32_t> free_slots;
+        std::deque<Deletion> deleted;
+        // retired at the given epoch
+        std::deque<std::pair<uint64_t, uint32_t>> retired_slots;
+        std::deque<std::pair<uint64_t, Table*>> retired_tables;
+    };
+
+    struct ShardLock {
+        inline ShardLock(Shard& shard) : _shard(shard) {
+            while (_shard.lock.exchange(true, std::memory_order_acquire)) {
+                while (_shard.lock.load(std::memory_order_relaxed));
+            }
+        }
+        inline ~ShardLock() {
+            _shard.lock.store(false, std::memory_order_release);
+        }
+        Shard& _shard;
+    };
+
+    inline Shard& get_shard(const uint64_t id) {
+        return _shards[(id * 0x9E3779B97F4A7C15ULL) >> 60 & (_shards_count - 1)];
+    }
+
+    inline void update_timestamp(const double timestamp) {
+        double last_timestamp = _last_timestamp.load(std::memory_order_relaxed);
+        while (timestamp > last_timestamp && !_last_timestamp.compare_exchange_weak(last_timestamp, timestamp));
+    }
+
+    // the following must be called with the shard locked
+
+    inline void retire(Shard& shard, uint32_t slot) {
+        const uint64_t epoch = _epochs.get_epoch();
+        while (slot != none) {
+            shard.retired_slots.push_back({epoch, slot});
+            slot = shard.get_version(slot).next.load(std::memory_order_relaxed);
+        }
+    }
+    inline void reclaim(Shard& shard) {
+        _epochs.advance();
+        const uint64_t safe_epoch = _epochs.get_safe_epoch();
+        while (!shard.retired_slots.empty() && shard.retired_slots.front().first < safe_epoch) {
+            shard.free_slots.push_back(shard.retired_slots.front().second);
+            shard.retired_slots.pop_front();
+        }
+        while (!shard.retired_tables.empty() && shard.retired_tables.front().first < safe_epoch) {
+            delete shard.retired_tables.front().second;
+            shard.retired_tables.pop_front();
+        }
+    }
+
+    // drop the versions no query within the retention can reach
+    inline void trim(Shard& shard, Entry& entry) {
+        const double horizon = _last_timestamp.load(std::memory_order_relaxed) - _retention;
+        uint32_t slot = entry.head.load(std::memory_order_relaxed);
+        while (slot != none) {
+            Version& version = shard.get_version(slot);
+            if (version.order.timestamp <= horizon) {
+                const uint32_t next = version.next.exchange(none, std::memory_order_release);
+                retire(shard, next);
+                return;
+            }
+            slot = version.next.load(std::memory_order_relaxed);
+        }
+    }
+
+    // erase orders deleted before the retention
+    inline void collect(Shard& shard) {
+        const double horizon = _last_timestamp.load(std::memory_order_relaxed) - _retention;
+        while (!shard.deleted.empty() && shard.deleted.front().timestamp <= horizon) {
+            Entry* entry = shard.find(shard.deleted.front().id);
+            shard.deleted.pop_front();
+            if (entry == NULL) {
+                continue;
+            }
+            const uint32_t head = entry->head.exchange(none, std::memory_order_release);
+            if (head == none) {
+                continue;
+            }
+            entry->id.store(tombstone, std::memory_order_release);
+            retire(shard, head);
+            --shard.size;
+        }
+    }
+
+    // grow, or get rid of the tombstones
+    inline Table* rebuild(Shard& shard) {
+        Table* previous = shard.table.load(std::memory_order_relaxed);
+        size_t capacity = 16;
+        while (capacity < 4 * (shard.size + 1)) {
+            capacity *= 2;
+        }
+        Table* table = new Table(capacity);
+        if (previous) {
+            for (size_t i=0; i<=previous->mask; ++i) {
+                const Entry& entry = previous->entries[i];
+                const uint64_t id = entry.id.load(std::memory_order_relaxed);
+                const uint32_t head = entry.head.load(std::memory_order_relaxed);
+                if (id == empty || id == tombstone || head == none) {
+                    continue;
+                }
+                size_t index = table->get_index(id);
+                while (table->entries[index].id.load(std::memory_order_relaxed) != empty) {
+                    index = (index + 1) & table->mask;
+                }
+                table->entries[index].head.store(head, std::memory_order_relaxed);
+                table->entries[index].id.store(id, std::memory_order_relaxed);
+                ++table->used;
+            }
+            shard.retired_tables.push_back({_epochs.get_epoch(), previous});
+        }
+        shard.table.store(table, std::memory_order_release);
+        return table;
+    }
+
+    const double _retention;
+    std::atomic<double> _last_timestamp;
+    OrderStatesEpochs _epochs;
+    Shard _shards[_shards_count];
+};
+
+
+#endif // CPPTRAING__SOURCES__ORDERSTATES_HPP
@@ -0,0 +1,92 @@
+#ifndef CPPTRAING__SOURCES__SPSCRING_HPP
+#define CPPTRAING__SOURCES__SPSCRING_HPP
+
+
+#include <stddef.h>
+
+#include <atomic>
+#include <vector>
+
+
+// bounded queue for exactly one producer thread and one consumer thread; each
+// side keeps a cached copy of the other's index, so that the shared cache
+// lines are only touched when the cached value says the ring is full (or
+// empty)
+template <typename T>
+class SPSCRing {
+public:
+
+    // the capacity is rounded up to a power of two
+    inline SPSCRing(const size_t capacity) :
+        _mask(round_up(capacity) - 1),
+        _items(_mask + 1),
+        _head(0),
+        _cached_tail(0),
+        _tail(0),
+        _cached_head(0) {}
+
+    // producer side
+    inline const bool push(const T& item) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _cached_tail > _mask) {
+            _cached_tail = _tail.load(std::memory_order_acquire);
+            if (head - _cached_tail > _mask) {
+                return false;
+            }
+        }
+        _items[head & _mask] = item;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side: up to count items, handed to the callback in place
+    template <typename Callback>
+    inline const size_t pop(const size_t count, Callback callback) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _cached_head) {
+            _cached_head = _head.load(std::memory_order_acquire);
+            if (tail == _cached_head) {
+                return 0;
+            }
+        }
+        const size_t available = std::min(count, _cached_head - tail);
+        for (size_t i=0; i<available; ++i) {
+            callback(_items[(tail + i) & _mask]);
+        }
+        _tail.store(tail + available, std::memory_order_release);
+        return available;
+    }
+
+    // approximate, from either side
+    inline const size_t get_size() const {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+    inline const bool is_empty() const {
+        return get_size() == 0;
+    }
+    inline const size_t get_capacity() const {
+        return _mask + 1;
+    }
+
+private:
+
+    static inline const size_t round_up(const size_t capacity) {
+        size_t result = 2;
+        while (result < capacity) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    const size_t _mask;
+    std::vector<T> _items;
+    // written by the producer
+    alignas(64) std::atomic<size_t> _head;
+    size_t _cached_tail;
+    // written by the consumer
+    alignas(64) std::atomic<size_t> _tail;
+    size_t _cached_head;
+};
+
+
+#endif // CPPTRAING__SOURCES__SPSCRING_HPP
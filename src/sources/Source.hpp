@@ -5,44 +5,56 @@
 #include <stdint.h>
 
 #include <set>
-#include <thread>
-#include <tbb/concurrent_hash_map.h>
+#include <vector>
+#include <memory>
 
 #include "history/History.hpp"
+#include "db/OrderBookLog.hpp"
+#include "./OrderStates.hpp"
+#include "./OrderBook.hpp"
+#include "./HistorySink.hpp"
 
 
 class Source {
 public:
 
     inline Source(const std::string& currency_pair) :
-        _is_running(true),
         _last_timestamp(0),
         _currency_pair(currency_pair),
-        _cleanup_period(0.5),
-        _cleanup_threshold(60.0),
-        _cleanup_thread(std::thread(_cleanup, this))
+        _orders(60.0)
     {}
 
-    inline ~Source() {
-        _is_running = false;
-        _cleanup_thread.join();
+    // each history is fed from its own thread, through a ring of the given
+    // capacity; the policy tells what to do when it is full
+    inline void historize(History& history, const HistorySinkPolicy policy=HISTORY_SINK_BLOCK, const size_t capacity=65536) {
+        for (auto& sink : _sinks) {
+            if (&sink->get_history() == &history) {
+                return;
+            }
+        }
+        _sinks.emplace_back(new HistorySink(history, policy, capacity));
     }
-
-    inline void historize(History& history) {
-        _histories.insert(&history);
+    // until every history has been fed what was received so far
+    inline void wait() {
+        for (auto& sink : _sinks) {
+            sink->wait();
+        }
+    }
+    // one per history, in the order they were added
+    inline const std::vector<HistorySinkMetrics> get_history_metrics() const {
+        std::vector<HistorySinkMetrics> metrics;
+        for (auto& sink : _sinks) {
+            metrics.push_back(sink->get_metrics());
+        }
+        return metrics;
+    }
+    // persist the order events, to rebuild past books
+    inline void record_order_book(OrderBookLogWriter& order_book_log) {
+        _order_book_logs.insert(&order_book_log);
     }
 
     inline Order retrieve_order(const uint64_t& id, const double& timestamp) {
-        Order result_order = {0};
-        tbb::concurrent_hash_map<uint64_t, std::vector<Order>>::accessor it;
-        if (_current_orders.find(it, id)) {
-            for (const Order& order : it->second) {
-                if (order.timestamp > result_order.timestamp && order.timestamp <= timestamp) {
-                    result_order = order;
-                }
-            }
-        }
-        return result_order;
+        return _orders.retrieve(id, timestamp);
     }
 
     inline void feed(Trade& trade) {
@@ -51,13 +63,13 @@ public:
         }
         Order buy_order = retrieve_order(trade.buy_order_id, trade.timestamp);
         Order sell_order = retrieve_order(trade.sell_order_id, trade.timestamp);
-        for (auto history : _histories) {
-            history->feed(trade);
-            if (sell_order.type != WAIT) {
-                history->feed(buy_order);
+        for (auto& sink : _sinks) {
+            sink->feed(trade);
+            if (buy_order.type != WAIT) {
+                sink->feed(buy_order);
             }
             if (sell_order.type != WAIT) {
-                history->feed(sell_order);
+                sink->feed(sell_order);
             }
         }
     }
@@ -65,19 +77,23 @@ public:
         if (order.timestamp > _last_timestamp) {
             _last_timestamp = order.timestamp;
         }
-        tbb::concurrent_hash_map<uint64_t, std::vector<Order>>::accessor it;
-        if (_current_orders.find(it, order.id)) {
-            it->second.push_back(order);
-        } else {
-            _current_orders.insert({order.id, {order}});
+        _orders.feed(order);
+        _order_book.feed(order);
+        for (auto order_book_log : _order_book_logs) {
+            order_book_log->feed(order);
         }
     }
     inline void puke(Order& order) {
-        tbb::concurrent_hash_map<uint64_t, std::vector<Order>>::accessor it;
-        if (!_current_orders.find(it, order.id)) {
-            feed(order);
+        _orders.puke(order);
+        _order_book.puke(order);
+        for (auto order_book_log : _order_book_logs) {
+            order_book_log->puke(order);
         }
-        _deleted_orders_ids.insert(order.id);
+    }
+
+    // live book, rebuilt from the order events
+    inline const OrderBook& get_order_book() const {
+        return _order_book;
     }
 
     inline double get_last_timestamp() const {
@@ -91,45 +107,11 @@ protected:
 
 private:
 
-    std::set<History*> _histories;
-    tbb::concurrent_hash_map<uint64_t, std::vector<Order>> _current_orders;
-    std::set<uint64_t> _deleted_orders_ids;
-
-    void cleanup() {
-        size_t ignored_count = 0;
-        size_t total_count = 0;
-        const size_t old_current_orders_size = _current_orders.size();
-        for (const uint64_t deleted_order_id : _deleted_orders_ids) {
-            tbb::concurrent_hash_map<uint64_t, std::vector<Order>>::accessor it;
-            if (_current_orders.find(it, deleted_order_id)) {
-                std::vector<Order> orders;
-                for (const Order& order : it->second) {
-                    ++total_count;
-                    if (order.timestamp > _last_timestamp - _cleanup_threshold) {
-                        ++ignored_count;
-                        orders.push_back(order);
-                    }
-                }
-                if (orders.size() == 0) {
-                    _current_orders.erase(it);
-                } else {
-                    it->second = orders;
-                }
-            }
-        }
-        std::cout << "CLEANUP: " << (total_count - ignored_count) << " / " << total_count << "   [" << old_current_orders_size << "->" << _current_orders.size() <<"]" << std::endl;
-    }
-    static void _cleanup(Source* source) {
-        while (source->_is_running) {
-            std::this_thread::sleep_for(std::chrono::duration<double>(source->_cleanup_period));
-            source->cleanup();
-        }
-    }
-
-    bool _is_running;
-    double _cleanup_period;
-    double _cleanup_threshold;
-    std::thread _cleanup_thread;
+    std::vector<std::unique_ptr<HistorySink>> _sinks;
+    std::set<OrderBookLogWriter*> _order_book_logs;
+    // deleted orders are kept 60 seconds, for the trades referring to them
+    OrderStates _orders;
+    OrderBook _order_book;
 };
 
 
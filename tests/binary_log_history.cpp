@@ -0,0 +1,142 @@
+#include <iostream>
+#include <chrono>
+#include <sys/stat.h>
+
+#include "history/BinaryLogHistory.hpp"
+#include "history/LogHistory.hpp"
+#include "./measure.hpp"
+
+
+static Trade make_trade(const size_t i) {
+    Trade trade;
+    trade.id = i + 1;
+    trade.timestamp = 1500000000. + i;
+    trade.price = 7000. + (i % 100);
+    trade.volume = 0.01 * (1 + i % 7);
+    trade.buy_order_id = 2 * i;
+    trade.sell_order_id = 2 * i + 1;
+    return trade;
+}
+static Order make_order(const size_t i) {
+    Order order;
+    order.id = 2 * i;
+    order.timestamp = 1500000000. + i;
+    order.price = 7000. + (i % 100);
+    order.amount = 0.01 * (1 + i % 7);
+    order.type = BUY;
+    return order;
+}
+
+// two orders per trade, as a source feeds them
+static void feed(History& history, const size_t begin, const size_t end) {
+    for (size_t i=begin; i<end; ++i) {
+        Trade trade = make_trade(i);
+        Order buy_order = make_order(i);
+        Order sell_order = make_order(i);
+        sell_order.id += 1;
+        sell_order.type = SELL;
+        history.feed(trade);
+        history.feed(buy_order);
+        history.feed(sell_order);
+    }
+}
+
+static const size_t check_trades(History& history, const size_t count) {
+    size_t errors = 0;
+    size_t i = 0;
+    for (const Trade& trade : history.get_trades()) {
+        errors += !(trade == make_trade(i++));
+    }
+    return errors + (i != count);
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::string path = "/tmp/cpptrading-binary_log_history";
+    remove(path.c_str());
+    remove((path + ".index").c_str());
+    remove((path + ".txt").c_str());
+    const size_t n = 200000;
+
+    // write in two sessions, the first one with a sidecar
+    const double write_duration = measure([&] {
+        {
+            BinaryLogHistory history(path, path + ".txt");
+            feed(history, 0, n/2);
+        }
+        BinaryLogHistory history(path);
+        feed(history, n/2, n);
+    });
+    size_t trades_count;
+    size_t errors;
+    const double read_duration = measure([&] {
+        BinaryLogHistory history(path);
+        trades_count = history.get_count<Trade>();
+        errors = check_trades(history, n);
+    });
+    std::cout << "binary: " << 3 * n << " records written in " << write_duration << "s, "
+        << trades_count << " trades read in " << read_duration << "s, " << errors << " errors\n";
+
+    // an interrupted write, and a lost index
+    {
+        FILE* file = fopen(path.c_str(), "ab");
+        fwrite("\x20\x00\x00", 3, 1, file);
+        fclose(file);
+        remove((path + ".index").c_str());
+        size_t recovery_errors;
+        const double recovery_duration = measure([&] {
+            BinaryLogHistory history(path);
+            feed(history, n, n + 10);
+            recovery_errors = check_trades(history, n + 10);
+        });
+        std::cout << "recovery: " << recovery_errors << " errors, index rebuilt in " << recovery_duration << "s\n";
+    }
+    // a zero-filled tail, and a lost index
+    {
+        struct stat file_stat;
+        stat(path.c_str(), &file_stat);
+        const off_t size = file_stat.st_size;
+        FILE* file = fopen(path.c_str(), "ab");
+        const std::string zeros(4096, '\0');
+        fwrite(zeros.data(), zeros.size(), 1, file);
+        fclose(file);
+        remove((path + ".index").c_str());
+        size_t tail_errors;
+        {
+            BinaryLogHistory history(path);
+            tail_errors = check_trades(history, n + 10);
+        }
+        stat(path.c_str(), &file_stat);
+        std::cout << "zero-filled tail: " << tail_errors << " errors, " << (file_stat.st_size - size) << " bytes left after truncation\n";
+    }
+
+    // the text log, as before
+    const std::string text_path = "/tmp/cpptrading-log_history";
+    remove(text_path.c_str());
+    const size_t text_n = n / 10;
+    const double text_write_duration = measure([&] {
+        LogHistory history(text_path);
+        feed(history, 0, text_n);
+    });
+    // every line is tried as a trade, as LogHistoryRangeData does
+    size_t text_count = 0;
+    const double text_read_duration = measure([&] {
+        std::ifstream file(text_path);
+        std::string line;
+        Trade trade;
+        while (std::getline(file, line)) {
+            trade.parse(line);
+            ++text_count;
+        }
+    });
+    std::cout << "text: " << 3 * text_n << " records written in " << text_write_duration << "s, "
+        << text_count << " lines parsed in " << text_read_duration << "s\n";
+    std::cout << "per trade: binary write " << 1e9 * write_duration / n << "ns vs text " << 1e9 * text_write_duration / text_n
+        << "ns, binary read " << 1e9 * read_duration / n << "ns vs text " << 1e9 * text_read_duration / text_n << "ns\n";
+
+    remove(path.c_str());
+    remove((path + ".index").c_str());
+    remove((path + ".txt").c_str());
+    remove(text_path.c_str());
+    return 0;
+}
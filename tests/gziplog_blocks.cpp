@@ -0,0 +1,194 @@
+#include <iostream>
+#include <chrono>
+
+#include "db/GzipLog.hpp"
+#include "models/Trade.hpp"
+#include "./measure.hpp"
+
+
+static Trade make_trade(const size_t i) {
+    Trade trade;
+    trade.id = i + 1;
+    trade.timestamp = 1500000000. + 0.1 * i;
+    trade.price = 7000. + 0.01 * ((i * 7) % 1000);
+    trade.volume = 0.001 * (1 + i % 50);
+    trade.type = (i % 3) ? BUY : SELL;
+    return trade;
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::string path = "/tmp/cpptrading-gziplog_blocks";
+    remove(path.c_str());
+    remove((path + ".index").c_str());
+    const size_t n = 2000000;
+
+    // written in two sessions
+    const double write_duration = measure([&] {
+        {
+            GzipLogWriter writer(path);
+            for (size_t i=0; i<n/2; ++i) {
+                writer.append(make_trade(i));
+            }
+        }
+        GzipLogWriter writer(path);
+        for (size_t i=n/2; i<n; ++i) {
+            writer.append(make_trade(i));
+        }
+    });
+    FILE* file = fopen(path.c_str(), "rb");
+    fseek(file, 0, SEEK_END);
+    const size_t size = ftell(file);
+    fclose(file);
+    std::cout << "blocks: " << n << " trades written in " << write_duration << "s, ratio " << (double) (n * sizeof(Trade)) / size << '\n';
+
+    // the former format, on a sample
+    const std::string legacy_path = path + ".gz";
+    remove(legacy_path.c_str());
+    const size_t legacy_n = n / 20;
+    const double legacy_write_duration = measure([&] {
+        gzFile legacy_file = gzopen(legacy_path.c_str(), "ab");
+        for (size_t i=0; i<legacy_n; ++i) {
+            const Trade trade = make_trade(i);
+            gzwrite(legacy_file, &trade, sizeof(trade));
+            gzflush(legacy_file, Z_FINISH);
+        }
+        gzclose(legacy_file);
+    });
+    file = fopen(legacy_path.c_str(), "rb");
+    fseek(file, 0, SEEK_END);
+    const size_t legacy_size = ftell(file);
+    fclose(file);
+    std::cout << "one gzip member per record: " << legacy_n << " trades written in " << legacy_write_duration << "s, ratio "
+        << (double) (legacy_n * sizeof(Trade)) / legacy_size << '\n';
+    {
+        GzipLogReader legacy_reader(legacy_path);
+        size_t legacy_errors = 0;
+        Trade trade;
+        for (size_t i=0; i<legacy_n; ++i) {
+            legacy_errors += legacy_reader.next(trade) != sizeof(Trade) || !(trade == make_trade(i));
+        }
+        std::cout << "legacy read: " << legacy_errors << " errors\n";
+    }
+    remove(legacy_path.c_str());
+
+    // sequential read
+    size_t errors = 0;
+    const double sequential_duration = measure([&] {
+        GzipLogReader reader(path);
+        Trade trade;
+        for (size_t i=0; i<n; ++i) {
+            errors += reader.next(trade) != sizeof(Trade) || !(trade == make_trade(i));
+        }
+        errors += reader.next(trade) != 0;
+    });
+    std::cout << "sequential read: " << errors << " errors in " << sequential_duration << "s\n";
+
+    // seek, then read a window
+    GzipLogReader reader(path);
+    errors = 0;
+    const double seek_duration = measure([&] {
+        for (size_t k=0; k<100; ++k) {
+            const size_t i = (k * 7919) % n;
+            reader.seek<Trade>(1500000000. + 0.1 * i - 0.01);
+            Trade trade;
+            errors += reader.next(trade) != sizeof(Trade) || trade.id != i + 1;
+        }
+    });
+    std::cout << "seek: " << errors << " errors, " << 1e3 * seek_duration / 100 << "ms per seek, " << reader.get_blocks().size() << " blocks\n";
+
+    // windows, with one or more threads
+    for (const size_t threads_count : {1, 4}) {
+        size_t count = 0;
+        uint64_t last_id = 0;
+        errors = 0;
+        const double window_duration = measure([&] {
+            reader.read<Trade>(1500000000. + 20000., 1500000000. + 120000., [&](const Trade& trade) {
+                errors += trade.id <= last_id;
+                last_id = trade.id;
+                ++count;
+            }, threads_count);
+        });
+        std::cout << "window read with " << threads_count << " threads: " << count << " trades, " << errors << " errors in " << window_duration << "s\n";
+    }
+
+    // a corrupted block fails the read on the calling thread, whichever
+    // thread decompressed it
+    {
+        const std::string corrupted_path = path + ".corrupted";
+        remove(corrupted_path.c_str());
+        remove((corrupted_path + ".index").c_str());
+        {
+            GzipLogWriter writer(corrupted_path);
+            for (size_t i=0; i<n/10; ++i) {
+                writer.append(make_trade(i));
+            }
+        }
+        file = fopen(corrupted_path.c_str(), "r+b");
+        fseek(file, reader.get_blocks()[20].offset + sizeof(BlockLogBlockHeader), SEEK_SET);
+        fwrite("corrupted", 9, 1, file);
+        fclose(file);
+        GzipLogReader corrupted_reader(corrupted_path);
+        for (const size_t threads_count : {1, 4}) {
+            bool is_thrown = false;
+            try {
+                corrupted_reader.read<Trade>(0., INFINITY, [](const Trade& trade) {}, threads_count);
+            } catch (const Exception& exception) {
+                is_thrown = true;
+            }
+            std::cout << "corrupted block with " << threads_count << " threads: " << (is_thrown ? "thrown" : "KO") << '\n';
+        }
+        remove(corrupted_path.c_str());
+        remove((corrupted_path + ".index").c_str());
+    }
+
+    // the trade codecs
+    for (const CodecType codec : {CODEC_TRADES, CODEC_TRADES_ZLIB}) {
+        const std::string codec_path = path + ".codec";
+        remove(codec_path.c_str());
+        remove((codec_path + ".index").c_str());
+        {
+            GzipLogWriter writer(codec_path, 65536, Z_DEFAULT_COMPRESSION, codec);
+            for (size_t i=0; i<n; ++i) {
+                writer.append(make_trade(i));
+            }
+        }
+        file = fopen(codec_path.c_str(), "rb");
+        fseek(file, 0, SEEK_END);
+        const size_t codec_size = ftell(file);
+        fclose(file);
+        errors = 0;
+        const double codec_duration = measure([&] {
+            GzipLogReader codec_reader(codec_path);
+            Trade trade;
+            for (size_t i=0; i<n; ++i) {
+                errors += codec_reader.next(trade) != sizeof(Trade) || !(trade == make_trade(i));
+            }
+        });
+        std::cout << "codec " << (int) codec << ": ratio " << (double) (n * sizeof(Trade)) / codec_size << ", "
+            << errors << " errors, sequential read in " << codec_duration << "s\n";
+        remove(codec_path.c_str());
+        remove((codec_path + ".index").c_str());
+    }
+
+    // a lost index, and an interrupted write
+    remove((path + ".index").c_str());
+    file = fopen(path.c_str(), "ab");
+    fwrite("GZLB", 4, 1, file);
+    fclose(file);
+    {
+        GzipLogWriter writer(path);
+        writer.append(make_trade(n));
+    }
+    errors = 0;
+    GzipLogReader repaired_reader(path);
+    Trade trade;
+    for (size_t i=0; i<=n; ++i) {
+        errors += repaired_reader.next(trade) != sizeof(Trade) || !(trade == make_trade(i));
+    }
+    std::cout << "repair: " << errors << " errors\n";
+
+    remove(path.c_str());
+    remove((path + ".index").c_str());
+    return 0;
+}
@@ -2,17 +2,80 @@
 #include "history/MemoryHistory.hpp"
 #include "sources/CSVSource.hpp"
 
+#include <experimental/filesystem>
+
 
 void analyze(History& history, const std::string& name) {
     std::cout << '\n';
     std::cout << history.get_trade_summary(Timestamp(2018, 1, 1), Timestamp(2018, 1, 2)) << '\n';
     std::cout << history.get_time_span() << '\n';
+    for (const TradeBucket& bucket : history.get_bucketed(Timestamp(2018, 1, 1), Timestamp(2018, 1, 2), 24)) {
+        std::cout << bucket << '\n';
+    }
+    for (const Trade& trade : history.get_trades()) {
+        Trade found;
+        std::cout << "trade " << trade.id << (history.get_trade_by_id(trade.id, found) && found == trade ? " found" : " not found") << " by id" << '\n';
+        std::cout << "orders " << trade.buy_order_id << ", " << trade.sell_order_id << ": " << history.get_orders_by_id(trade.buy_order_id).size()
+            << ", " << history.get_orders_by_id(trade.sell_order_id).size() << " states" << '\n';
+        break;
+    }
     std::cout << "Analyzed " << name << '\n';
 }
 
+// both storages of trades answer alike, before and after being reopened
+void compare_trades_storages() {
+    const std::string basepath = "/tmp/cpptrading-tests/history_analysis_storages";
+    std::experimental::filesystem::remove_all(basepath);
+    const size_t n = 100000;
+    size_t errors = 0;
+    for (const bool is_reopened : {false, true}) {
+        DBHistory btree_history(basepath + "/btree", DB_HISTORY_TRADES_IN_UPSCALEDB);
+        DBHistory lsm_tree_history(basepath + "/lsm_tree", DB_HISTORY_TRADES_IN_LSM_TREE);
+        if (!is_reopened) {
+            for (size_t i=0; i<n; ++i) {
+                Trade trade;
+                trade.id = i + 1;
+                trade.timestamp = 1500000000. + i - ((i % 100 == 7) ? 3. : 0.);
+                trade.price = 7000. + 0.01 * ((i * 7) % 1000);
+                trade.volume = 0.001 * (1 + i % 50);
+                trade.type = (i % 3) ? BUY : SELL;
+                btree_history.feed(trade);
+                lsm_tree_history.feed(trade);
+            }
+        }
+        std::vector<Trade> btree_trades;
+        for (const Trade& trade : btree_history.get_trades_by_timestamp(1500000000. + n / 3, 1500000000. + n / 2)) {
+            btree_trades.push_back(trade);
+        }
+        std::vector<Trade> lsm_tree_trades;
+        for (const Trade& trade : lsm_tree_history.get_trades_by_timestamp(1500000000. + n / 3, 1500000000. + n / 2)) {
+            lsm_tree_trades.push_back(trade);
+        }
+        errors += btree_trades.empty() || btree_trades != lsm_tree_trades;
+        for (const uint64_t id : {(uint64_t) 1, (uint64_t) n / 2, (uint64_t) n, (uint64_t) n + 1}) {
+            Trade btree_trade, lsm_tree_trade;
+            const bool is_found = btree_history.get_trade_by_id(id, btree_trade);
+            errors += lsm_tree_history.get_trade_by_id(id, lsm_tree_trade) != is_found || (is_found && !(lsm_tree_trade == btree_trade));
+        }
+        const TimestampSpan btree_span = btree_history.get_time_span();
+        const TimestampSpan lsm_tree_span = lsm_tree_history.get_time_span();
+        errors += !(btree_span.from == lsm_tree_span.from) || !(btree_span.to == lsm_tree_span.to);
+        size_t count = 0;
+        for (const Trade& trade : lsm_tree_history.get_trades()) {
+            ++count;
+        }
+        errors += count != n;
+        errors += !lsm_tree_history.get_plain_log_path("trades").empty();
+    }
+    std::cout << "trades in B-trees or in an LSM tree: " << errors << " errors" << '\n';
+    std::experimental::filesystem::remove_all(basepath);
+}
+
 
 int main(int argc, char const *argv[]) {
 
+    compare_trades_storages();
+
     DBHistory db_history("/tmp/cpptrading-tests/history_analysis");
     MemoryHistory mem_history;
     // CSVSource source("btceur", "data/localbtcEUR.csv");
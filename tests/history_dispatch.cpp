@@ -0,0 +1,131 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+#include "sources/Source.hpp"
+#include "history/MemoryHistory.hpp"
+#include "./measure.hpp"
+
+
+// stands for a history writing to a slow disk
+class SlowHistory : public MemoryHistory {
+public:
+    virtual void feed(Trade& trade) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        MemoryHistory::feed(trade);
+    }
+    using MemoryHistory::feed;
+};
+
+// stands for a history whose disk is full, from time to time
+class FailingHistory : public MemoryHistory {
+public:
+    virtual void feed(Trade& trade) {
+        if (trade.id % 10 == 0) {
+            throw FileException("FailingHistory could not write trade", trade.id);
+        }
+        MemoryHistory::feed(trade);
+    }
+    using MemoryHistory::feed;
+};
+
+
+static Trade make_trade(const size_t i) {
+    Trade trade;
+    trade.id = i + 1;
+    trade.timestamp = 1500000000. + i * 0.001;
+    trade.price = 7000. + (i % 100);
+    trade.volume = 0.01;
+    return trade;
+}
+
+static const bool is_ordered(MemoryHistory& history, const size_t count) {
+    size_t n = 0;
+    uint64_t last_id = 0;
+    for (const Trade& trade : history.get_trades()) {
+        if (trade.id <= last_id) {
+            return false;
+        }
+        last_id = trade.id;
+        ++n;
+    }
+    return n == count;
+}
+
+
+int main(int argc, char const *argv[]) {
+    const size_t n = 5000;
+
+    // as before: every history fed in turn, on the source thread
+    {
+        MemoryHistory fast_history;
+        SlowHistory slow_history;
+        const double duration = measure([&] {
+            for (size_t i=0; i<n; ++i) {
+                Trade trade = make_trade(i);
+                fast_history.feed(trade);
+                slow_history.feed(trade);
+            }
+        });
+        std::cout << "serial: " << 1e6 * duration / n << "us per trade on the source thread\n";
+    }
+
+    // each history on its own thread
+    {
+        MemoryHistory fast_history;
+        SlowHistory slow_history;
+        Source source("btceur");
+        source.historize(fast_history);
+        source.historize(slow_history);
+        const double duration = measure([&] {
+            for (size_t i=0; i<n; ++i) {
+                Trade trade = make_trade(i);
+                source.feed(trade);
+            }
+        });
+        const std::vector<HistorySinkMetrics> before_wait = source.get_history_metrics();
+        source.wait();
+        const std::vector<HistorySinkMetrics> metrics = source.get_history_metrics();
+        std::cout << "dispatched: " << 1e6 * duration / n << "us per trade on the source thread\n";
+        std::cout << "  fast history: mean lag " << 1e6 * metrics[0].mean_lag << "us, max lag " << 1e6 * metrics[0].max_lag << "us, "
+            << before_wait[0].pending << " pending after feeding, " << (is_ordered(fast_history, n) ? "OK" : "KO") << '\n';
+        std::cout << "  slow history: mean lag " << 1e3 * metrics[1].mean_lag << "ms, max lag " << 1e3 * metrics[1].max_lag << "ms, "
+            << before_wait[1].pending << " pending after feeding, " << (is_ordered(slow_history, n) ? "OK" : "KO") << '\n';
+    }
+
+    // overflow policies, with a small ring
+    {
+        SlowHistory dropping_history;
+        SlowHistory spilling_history;
+        Source source("btceur");
+        source.historize(dropping_history, HISTORY_SINK_DROP, 64);
+        source.historize(spilling_history, HISTORY_SINK_SPILL, 64);
+        for (size_t i=0; i<n; ++i) {
+            Trade trade = make_trade(i);
+            source.feed(trade);
+        }
+        source.wait();
+        const std::vector<HistorySinkMetrics> metrics = source.get_history_metrics();
+        std::cout << "drop: " << metrics[0].consumed << " fed, " << metrics[0].dropped << " dropped, "
+            << (metrics[0].consumed + metrics[0].dropped == n && is_ordered(dropping_history, metrics[0].consumed) ? "OK" : "KO") << '\n';
+        std::cout << "spill: " << metrics[1].consumed << " fed, " << metrics[1].spilled << " spilled, "
+            << (metrics[1].consumed == n && is_ordered(spilling_history, n) ? "OK" : "KO") << '\n';
+    }
+
+    // failures are counted, and the last one is kept
+    {
+        FailingHistory failing_history;
+        Source source("btceur");
+        source.historize(failing_history);
+        for (size_t i=0; i<100; ++i) {
+            Trade trade = make_trade(i);
+            source.feed(trade);
+        }
+        source.wait();
+        const std::vector<HistorySinkMetrics> metrics = source.get_history_metrics();
+        std::cout << "failures: " << metrics[0].errors << " errors, last one: " << metrics[0].last_error << ", "
+            << (metrics[0].errors == 10 && metrics[0].last_error == "FailingHistory could not write trade, 100" && is_ordered(failing_history, 90) ? "OK" : "KO") << '\n';
+    }
+
+    return 0;
+}
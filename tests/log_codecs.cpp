@@ -0,0 +1,201 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+
+#include <signal.h>
+#include <sys/resource.h>
+
+#include "db/PlainLog.hpp"
+#include "db/RotatingLog.hpp"
+#include "models/Trade.hpp"
+#include "./measure.hpp"
+
+
+// LZ4 and zstd are only measured when compiled in, e.g. with
+// -DCPPTRADING_LZ4 -DCPPTRADING_ZSTD -llz4 -lzstd
+
+
+// as received from an exchange: ids with gaps, timestamps to the
+// millisecond, prices moving by a few cents, volumes to the satoshi
+static std::vector<Trade> make_trades(const size_t count) {
+    const Trade prototype;
+    std::mt19937 random(42);
+    std::vector<Trade> trades(count, prototype);
+    uint64_t id = 80000000;
+    int64_t milliseconds = 1500000000000;
+    int64_t cents = 700000;
+    uint64_t order_id = 2000000000;
+    for (Trade& trade : trades) {
+        id += 1 + random() % 3;
+        milliseconds += random() % 2000;
+        cents += (int) (random() % 11) - 5;
+        order_id += random() % 50;
+        trade.id = id;
+        trade.timestamp = milliseconds / 1e3;
+        trade.price = cents / 1e2;
+        trade.volume = (1 + random() % 100000000) / 1e8;
+        trade.type = (random() % 2) ? BUY : SELL;
+        trade.decision_id = 0;
+        trade.buy_order_id = order_id + random() % 100;
+        trade.sell_order_id = order_id + random() % 100;
+    }
+    return trades;
+}
+
+static const size_t get_size(const std::string& path) {
+    size_t size = 0;
+    for (const std::string suffix : {"", ".index", ".dictionary"}) {
+        FILE* file = fopen((path + suffix).c_str(), "rb");
+        if (file) {
+            fseek(file, 0, SEEK_END);
+            size += ftell(file);
+            fclose(file);
+        }
+    }
+    return size;
+}
+
+static void remove_log(const std::string& path) {
+    for (const std::string suffix : {"", ".index", ".dictionary"}) {
+        remove((path + suffix).c_str());
+    }
+}
+
+
+static const std::vector<Trade> trades = make_trades(1000000);
+static const double megabytes = trades.size() * sizeof(Trade) / 1e6;
+
+static void benchmark(const std::string& name, const Codec& codec, const size_t block_size=65536) {
+    const std::string path = "/tmp/cpptrading-log_codecs";
+    remove_log(path);
+    const double write_duration = measure([&] {
+        PlainLogWriter writer(path, codec, block_size);
+        for (const Trade& trade : trades) {
+            writer.append(trade);
+        }
+    });
+    size_t errors = 0;
+    const double read_duration = measure([&] {
+        PlainLogReader reader(path);
+        Trade trade;
+        for (const Trade& expected : trades) {
+            errors += !reader.next(trade) || !(trade == expected);
+        }
+        errors += reader.next(trade);
+    });
+    std::cout << name << ": ratio " << (double) (trades.size() * sizeof(Trade)) / get_size(path)
+        << ", write " << megabytes / write_duration << "MB/s, read " << megabytes / read_duration << "MB/s, "
+        << errors << " errors\n";
+    remove_log(path);
+}
+
+// writers that fail (here, past the maximum file size) throw from append() or
+// flush(), and are still destroyed without terminating
+static void test_write_errors(const std::string& basepath) {
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    const rlim_t previous_limit = limit.rlim_cur;
+    limit.rlim_cur = 100000;
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, SIG_IGN);
+    size_t errors = 0;
+    for (const bool background : {false, true}) {
+        const std::string path = basepath + "-full";
+        remove_log(path);
+        bool is_thrown = false;
+        try {
+            BlockLogWriter writer(path, Codec(CODEC_ZLIB), 65536, background);
+            for (const Trade& trade : trades) {
+                writer.append(trade);
+            }
+            writer.flush();
+        } catch (const FileException&) {
+            is_thrown = true;
+        }
+        errors += !is_thrown;
+        remove_log(path);
+    }
+    {
+        bool is_thrown = false;
+        RotatingLogWriter writer(basepath + "-full", Codec(CODEC_TRADES_ZLIB));
+        try {
+            for (const Trade& trade : trades) {
+                writer.append(trade);
+            }
+            writer.stop();
+        } catch (const FileException&) {
+            is_thrown = true;
+        }
+        errors += !is_thrown;
+    }
+    limit.rlim_cur = previous_limit;
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, SIG_DFL);
+    std::cout << "write errors: " << errors << " errors\n";
+}
+
+
+int main(int argc, char const *argv[]) {
+    std::cout << trades.size() << " trades, " << megabytes << "MB\n";
+    benchmark("none", Codec(CODEC_NONE));
+    benchmark("zlib", Codec(CODEC_ZLIB));
+    benchmark("trades", Codec(CODEC_TRADES));
+    benchmark("trades+zlib", Codec(CODEC_TRADES_ZLIB));
+#ifdef CPPTRADING_LZ4
+    benchmark("lz4", Codec(CODEC_LZ4));
+#endif
+#ifdef CPPTRADING_ZSTD
+    benchmark("zstd", Codec(CODEC_ZSTD));
+    // a dictionary mostly helps small blocks
+    std::vector<std::string> samples;
+    for (size_t i=0; i+64<=trades.size() && samples.size()<1000; i+=1000) {
+        samples.emplace_back((const char*) &trades[i], 64 * sizeof(Trade));
+    }
+    const std::string dictionary = Codec::train_dictionary(samples, 16384);
+    benchmark("zstd, 4KiB blocks", Codec(CODEC_ZSTD), 4096);
+    benchmark("zstd, 4KiB blocks, dictionary", Codec(CODEC_ZSTD, 0, dictionary), 4096);
+#endif
+
+    // time spent appending, when blocks are compressed in the background or not
+    for (const bool background : {false, true}) {
+        const std::string path = "/tmp/cpptrading-log_codecs";
+        remove_log(path);
+        double append_duration = 0.;
+        {
+            BlockLogWriter writer(path, Codec(CODEC_ZLIB), 65536, background);
+            append_duration = measure([&] {
+                for (const Trade& trade : trades) {
+                    writer.append(trade);
+                }
+            });
+        }
+        std::cout << "zlib, " << (background ? "background" : "foreground") << " compression: "
+            << 1e9 * append_duration / trades.size() << "ns per append\n";
+        remove_log(path);
+    }
+
+    // rotating logs alike
+    const std::string basepath = "/tmp/cpptrading-log_codecs-rotating";
+    size_t errors = 0;
+    {
+        RotatingLogWriter writer(basepath, Codec(CODEC_TRADES_ZLIB));
+        for (size_t i=0; i<100000; ++i) {
+            writer.append(trades[i]);
+        }
+        size_t i = 0;
+        for (const Trade& trade : writer.get<Trade>()) {
+            errors += !(trade == trades[i++]);
+        }
+        errors += i != 100000;
+    }
+    std::cout << "rotating log: " << errors << " errors\n";
+    test_write_errors(basepath);
+    std::experimental::filesystem::path directory = std::experimental::filesystem::path(basepath).parent_path();
+    for (auto& p : std::experimental::filesystem::directory_iterator(directory)) {
+        if (p.path().string().rfind(basepath, 0) == 0) {
+            remove(p.path().c_str());
+        }
+    }
+
+    return 0;
+}
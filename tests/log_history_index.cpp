@@ -0,0 +1,78 @@
+#include <iostream>
+#include <chrono>
+
+#include "history/LogHistory.hpp"
+#include "./measure.hpp"
+
+
+static void feed(LogHistory& history, const size_t begin, const size_t end) {
+    for (size_t i=begin; i<end; ++i) {
+        Trade trade;
+        trade.id = i + 1;
+        trade.timestamp = 1500000000. + i;
+        trade.price = 7000. + (i % 100);
+        trade.volume = 0.01;
+        trade.type = BUY;
+        history.feed(trade);
+        Order order;
+        order.id = i + 1;
+        order.timestamp = 1500000000. + i;
+        order.type = SELL;
+        history.feed(order);
+    }
+}
+
+static const size_t count(Range<Trade> range) {
+    size_t result = 0;
+    for (const Trade& trade : range) {
+        ++result;
+    }
+    return result;
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::string path = "/tmp/cpptrading-log_history_index";
+    remove(path.c_str());
+    remove((path + ".index").c_str());
+    const size_t n = 200000;
+    {
+        LogHistory history(path);
+        feed(history, 0, n/2);
+    }
+    // the block being filled when closed is rebuilt from the log
+    LogHistory history(path);
+    feed(history, n/2, n);
+
+    size_t errors = 0;
+    double indexed_duration = 0.;
+    double full_duration = 0.;
+    const double t0 = 1500000000.;
+    for (const double begin : {t0 - 10., t0 + 1000.5, t0 + n/2 - 500., t0 + n - 3000., t0 + n - 10.}) {
+        const double end = begin + 2000.;
+        const size_t expected = std::max(0., std::min(end, t0 + n - 1.) - std::max(begin, t0 - 1.));
+        size_t indexed_count;
+        size_t full_count;
+        indexed_duration += measure([&] {
+            indexed_count = count(history.get_trades_by_timestamp(begin, end));
+        });
+        full_duration += measure([&] {
+            full_count = count(history.History::get_trades_by_timestamp(begin, end));
+        });
+        errors += (indexed_count != full_count) + (std::abs((double) indexed_count - (double) expected) > 1.);
+    }
+    std::cout << "windows of 2000 trades out of " << n << ": " << errors << " errors, indexed "
+        << 1e3 * indexed_duration / 5 << "ms vs full scan " << 1e3 * full_duration / 5 << "ms\n";
+
+    // a lost index is rebuilt
+    remove((path + ".index").c_str());
+    const double rebuild_duration = measure([&] {
+        LogHistory rebuilt_history(path);
+        errors += count(rebuilt_history.get_trades_by_timestamp(t0 + 5000., t0 + 6000.)) != 1000;
+    });
+    std::cout << "index rebuilt in " << rebuild_duration << "s, " << errors << " errors\n";
+
+    remove(path.c_str());
+    remove((path + ".index").c_str());
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <iostream>
+#include <chrono>
+#include <ctime>
+
+#include "db/LSMTree.hpp"
+#include "db/PlainLog.hpp"
+#include "models/Trade.hpp"
+#include "./measure.hpp"
+
+
+// a trade every second, some of them arriving a bit late
+static Trade make_trade(const size_t i) {
+    Trade trade;
+    trade.id = i + 1;
+    trade.timestamp = 1500000000. + i - ((i % 100 == 7) ? 3. : 0.);
+    trade.price = 7000. + 0.01 * ((i * 7) % 1000);
+    trade.volume = 0.001 * (1 + i % 50);
+    trade.type = (i % 3) ? BUY : SELL;
+    return trade;
+}
+
+// trades within ]begin, end], in the order of their timestamps then of their insertion
+static std::vector<Trade> expect(const size_t n, const double begin, const double end) {
+    std::vector<Trade> trades;
+    for (size_t i=0; i<n; ++i) {
+        const Trade trade = make_trade(i);
+        if ((double) trade.timestamp > begin && (double) trade.timestamp <= end) {
+            trades.push_back(trade);
+        }
+    }
+    std::stable_sort(trades.begin(), trades.end(), [](const Trade& a, const Trade& b) {
+        return (double) a.timestamp < (double) b.timestamp;
+    });
+    return trades;
+}
+
+static const size_t check(LSMTree<double, Trade>& tree, const size_t n, const double begin, const double end) {
+    const std::vector<Trade> expected = expect(n, begin, end);
+    size_t errors = 0;
+    size_t count = 0;
+    for (const Trade& trade : tree.get(begin, end)) {
+        errors += count >= expected.size() || !(trade == expected[count]);
+        ++count;
+    }
+    return errors + (count != expected.size());
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::string directory = "/tmp/cpptrading-lsm_tree";
+    std::experimental::filesystem::remove_all(directory);
+    std::experimental::filesystem::create_directory(directory);
+    const size_t n = 1000000;
+    const double first = 1500000000.;
+    std::vector<Trade> trades;
+    trades.reserve(n);
+    for (size_t i=0; i<n; ++i) {
+        trades.push_back(make_trade(i));
+    }
+
+    // writes, compared with appending to a plain log; UpscaleBTree is not
+    // compared, as UpscaleDB is not required to build the tests
+    std::unique_ptr<LSMTree<double, Trade>> tree(new LSMTree<double, Trade>(directory + "/trades", 1 << 16, 4, 64));
+    const double write_duration = measure([&] {
+        for (const Trade& trade : trades) {
+            tree->insert(trade.timestamp, trade);
+        }
+        tree->flush();
+    });
+    const double log_write_duration = measure([&] {
+        PlainLogWriter writer(directory + "/trades.log");
+        for (const Trade& trade : trades) {
+            writer.append(trade);
+        }
+    });
+    std::cout << "write: " << n / write_duration << " trades/s, " << tree->get_runs_count() << " runs, vs "
+        << n / log_write_duration << " trades/s for a plain log\n";
+
+    // ranges of an hour, compared with a scan of the plain log; only the
+    // reads are timed, and checked afterwards
+    size_t errors = 0;
+    const size_t queries = 100;
+    std::vector<std::vector<Trade>> expected(queries);
+    std::vector<std::vector<Trade>> found(queries);
+    for (size_t q=0; q<queries; ++q) {
+        const double begin = first + (q * 7919) % (n - 3600);
+        expected[q] = expect(n, begin, begin + 3600.);
+        found[q].reserve(expected[q].size());
+    }
+    const double range_duration = measure([&] {
+        for (size_t q=0; q<queries; ++q) {
+            const double begin = first + (q * 7919) % (n - 3600);
+            for (const Trade& trade : tree->get(begin, begin + 3600.)) {
+                found[q].push_back(trade);
+            }
+        }
+    });
+    for (size_t q=0; q<queries; ++q) {
+        errors += found[q].size() != expected[q].size();
+        for (size_t i=0; i<std::min(found[q].size(), expected[q].size()); ++i) {
+            errors += !(found[q][i] == expected[q][i]);
+        }
+    }
+    size_t log_count = 0;
+    const double log_range_duration = measure([&] {
+        PlainLogReader reader(directory + "/trades.log");
+        Trade trade;
+        while (reader.next(trade)) {
+            log_count += (double) trade.timestamp > first && (double) trade.timestamp <= first + 3600.;
+        }
+    });
+    std::cout << "ranges of an hour: " << 1e6 * range_duration / queries << "us each, " << errors
+        << " errors, vs " << 1e6 * log_range_duration << "us for a plain log scan\n";
+
+    // after merges, and while inserting
+    tree->compact();
+    errors = check(*tree, n, first - 10., first + n);
+    std::thread reader([&] {
+        for (size_t q=0; q<20; ++q) {
+            errors += check(*tree, n, first, first + 1000.);
+        }
+    });
+    for (size_t i=n; i<n+100000; ++i) {
+        tree->insert(make_trade(i).timestamp, make_trade(i));
+    }
+    reader.join();
+    errors += check(*tree, n + 100000, first - 10., first + n + 100000);
+    std::cout << "compaction: " << tree->get_runs_count() << " runs, " << errors << " errors\n";
+
+    // ids, skipping runs through their bloom filters, and most of a run
+    // through its id ranges
+    errors = 0;
+    const double id_duration = measure([&] {
+        for (size_t q=0; q<queries; ++q) {
+            const uint64_t id = 1 + (q * 7919) % (n + 100000);
+            const std::vector<Trade> found = tree->get_by_id(id);
+            errors += found.size() != 1 || !(found[0] == make_trade(id - 1));
+        }
+        errors += !tree->get_by_id(n + 200000).empty();
+    });
+    std::cout << "ids: " << 1e6 * id_duration / queries << "us each, " << errors << " errors\n";
+
+    // buffered trades are replayed from the write-ahead log
+    tree.reset();
+    tree.reset(new LSMTree<double, Trade>(directory + "/trades", 1 << 16, 4, 64));
+    errors = check(*tree, n + 100000, first - 10., first + n + 100000);
+    errors += tree->get_lowest_key() != first || tree->get_highest_key() != first + n + 100000 - 1;
+    errors += tree->count(first + 8.) != 1 || tree->count(first + 4.) != 2 || tree->contains(first - 1.);
+    std::cout << "reopened: " << tree->get_runs_count() << " runs, " << errors << " errors\n";
+
+    tree.reset();
+
+    // a run that cannot be written is retried, without spinning, and its
+    // failure is thrown until then
+    const std::string failing_path = directory + "/failing";
+    tree.reset(new LSMTree<double, Trade>(failing_path, 1000, 4, 64));
+    std::experimental::filesystem::create_directory(failing_path + "/run-0-0.tmp");
+    for (size_t i=0; i<1000; ++i) {
+        tree->insert(trades[i].timestamp, trades[i]);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    bool is_insert_thrown = false;
+    try {
+        tree->insert(trades[1000].timestamp, trades[1000]);
+    } catch (const FileException& exception) {
+        is_insert_thrown = true;
+    }
+    bool is_flush_thrown = false;
+    const clock_t cpu_begin = clock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    const double failing_cpu = (double) (clock() - cpu_begin) / CLOCKS_PER_SEC;
+    try {
+        tree->flush();
+    } catch (const FileException& exception) {
+        is_flush_thrown = true;
+    }
+    std::experimental::filesystem::remove(failing_path + "/run-0-0.tmp");
+    bool is_recovered = false;
+    for (size_t attempt=0; attempt<50 && !is_recovered; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        try {
+            tree->flush();
+            is_recovered = true;
+        } catch (const FileException& exception) {}
+    }
+    errors = !is_insert_thrown + !is_flush_thrown + !is_recovered + (is_recovered && tree->get_runs_count() != 1);
+    std::cout << "failing writes: " << 1e3 * failing_cpu << "ms of CPU over 200ms, " << errors << " errors\n";
+
+    tree.reset();
+    std::experimental::filesystem::remove_all(directory);
+    return 0;
+}
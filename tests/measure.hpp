@@ -0,0 +1,17 @@
+#ifndef CPPTRADING__TESTS__MEASURE
+#define CPPTRADING__TESTS__MEASURE
+
+
+#include <chrono>
+
+
+// duration of a call, in seconds
+template <typename Function>
+static const double measure(Function function) {
+    const auto begin = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+
+#endif // CPPTRADING__TESTS__MEASURE
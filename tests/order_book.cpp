@@ -0,0 +1,132 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <map>
+
+#include "sources/OrderBook.hpp"
+#include "./measure.hpp"
+
+
+// order events around a mid price, as created/changed/deleted
+struct OrderEvent {
+    Order order;
+    bool is_deletion;
+};
+
+static std::vector<OrderEvent> make_events(const size_t count) {
+    std::mt19937 random(42);
+    std::vector<OrderEvent> events;
+    std::vector<Order> live;
+    const double mid = 7000.;
+    uint64_t next_id = 1;
+    for (size_t i=0; i<count; ++i) {
+        const int action = random() % 10;
+        if (action < 4 || live.size() < 1000) {
+            Order order;
+            order.id = next_id++;
+            order.type = (random() % 2) ? BUY : SELL;
+            // mostly close to the mid price, in cents
+            const double distance = 0.01 * (1 + (random() % 100) * (random() % 100) / 10);
+            order.price = std::round(100. * (order.type == BUY ? mid - distance : mid + distance)) / 100.;
+            order.amount = (1 + random() % 1000) / 1000.;
+            order.timestamp = i;
+            live.push_back(order);
+            events.push_back({order, false});
+        } else if (action < 6) {
+            Order& order = live[random() % live.size()];
+            order.amount = (1 + random() % 1000) / 1000.;
+            order.timestamp = i;
+            events.push_back({order, false});
+        } else {
+            const size_t index = random() % live.size();
+            live[index].timestamp = i;
+            events.push_back({live[index], true});
+            live[index] = live.back();
+            live.pop_back();
+        }
+    }
+    return events;
+}
+
+
+// aggregate the live orders naively
+static void test_correctness(const std::vector<OrderEvent>& events) {
+    OrderBook book;
+    std::map<uint64_t, Order> orders;
+    size_t errors = 0;
+    std::vector<OrderBookLevel> bids, asks;
+    for (size_t i=0; i<events.size(); ++i) {
+        const OrderEvent& event = events[i];
+        if (event.is_deletion) {
+            book.puke(event.order);
+            orders.erase(event.order.id);
+        } else {
+            book.feed(event.order);
+            orders[event.order.id] = event.order;
+        }
+        if (i % 1000 || orders.size() < 1000) {
+            continue;
+        }
+        std::map<double, OrderBookLevel> expected_bids, expected_asks;
+        for (const auto& it : orders) {
+            OrderBookLevel& level = (it.second.type == BUY ? expected_bids : expected_asks)[it.second.price];
+            level.price = it.second.price;
+            level.amount += it.second.amount;
+            level.count += 1;
+        }
+        book.get_depth(bids, asks);
+        errors += (bids.size() != expected_bids.size() || asks.size() != expected_asks.size());
+        auto bid = expected_bids.rbegin();
+        for (size_t l=0; l<bids.size() && bid!=expected_bids.rend(); ++l, ++bid) {
+            errors += (bids[l].price != bid->second.price || bids[l].count != bid->second.count || std::abs(bids[l].amount - bid->second.amount) > 1e-9);
+        }
+        auto ask = expected_asks.begin();
+        for (size_t l=0; l<asks.size() && ask!=expected_asks.end(); ++l, ++ask) {
+            errors += (asks[l].price != ask->second.price || asks[l].count != ask->second.count || std::abs(asks[l].amount - ask->second.amount) > 1e-9);
+        }
+        errors += (book.get_best_bid().price != expected_bids.rbegin()->first);
+        errors += (book.get_best_ask().price != expected_asks.begin()->first);
+    }
+    std::cout << "correctness: " << errors << " errors, " << book.get_orders_count() << " orders in "
+        << book.get_levels_count(BUY) << " bid levels and " << book.get_levels_count(SELL) << " ask levels\n";
+    std::cout << "best bid " << book.get_best_bid().price << ", best ask " << book.get_best_ask().price
+        << ", spread " << book.get_spread() << ", bid depth within 1.00: " << book.get_depth_amount(BUY, 1.) << "\n";
+}
+
+
+static void test_performance(const std::vector<OrderEvent>& events) {
+    OrderBook book;
+    const double duration = measure([&] {
+        for (const OrderEvent& event : events) {
+            if (event.is_deletion) {
+                book.puke(event.order);
+            } else {
+                book.feed(event.order);
+            }
+        }
+    });
+    std::cout << "updates: " << events.size() / duration / 1e6 << "M events/s, " << 1e9 * duration / events.size() << "ns/event\n";
+    double checksum = 0.;
+    const size_t n = 10000000;
+    const double top_duration = measure([&] {
+        for (size_t i=0; i<n; ++i) {
+            checksum += book.get_spread();
+        }
+    });
+    std::vector<OrderBookLevel> bids, asks;
+    const double depth_duration = measure([&] {
+        for (size_t i=0; i<n/10; ++i) {
+            book.get_depth(bids, asks, 20);
+            checksum += bids[0].amount;
+        }
+    });
+    std::cout << "spread: " << 1e9 * top_duration / n << "ns, depth snapshot (20 levels): " << 1e9 * depth_duration / (n/10) << "ns (checksum " << checksum << ")\n";
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::vector<OrderEvent> events = make_events(2000000);
+    test_correctness(events);
+    test_performance(events);
+    return 0;
+}
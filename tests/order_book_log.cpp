@@ -0,0 +1,183 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+
+#include "db/OrderBookLog.hpp"
+#include "./measure.hpp"
+
+
+// order events around a mid price, 100 per second; events are dated as the
+// log does it, by the latest order timestamp
+static std::vector<OrderBookEvent> make_events(const size_t count) {
+    std::mt19937 random(42);
+    std::vector<OrderBookEvent> events;
+    std::vector<Order> live;
+    uint64_t next_id = 1;
+    double timestamp = 0.;
+    for (size_t i=0; i<count; ++i) {
+        const int action = random() % 10;
+        if (action < 4 || live.size() < 1000) {
+            Order order;
+            order.id = next_id++;
+            order.type = (random() % 2) ? BUY : SELL;
+            const double distance = 0.01 * (1 + (random() % 100) * (random() % 100) / 10);
+            order.price = std::round(100. * (order.type == BUY ? 7000. - distance : 7000. + distance)) / 100.;
+            order.amount = (1 + random() % 1000) / 1000.;
+            order.timestamp = timestamp = 1500000000. + i * 0.01;
+            live.push_back(order);
+            events.push_back({timestamp, order, ORDER_BOOK_UPDATE});
+        } else if (action < 6) {
+            // changed orders keep their creation date
+            Order& order = live[random() % live.size()];
+            order.amount = (1 + random() % 1000) / 1000.;
+            events.push_back({timestamp, order, ORDER_BOOK_UPDATE});
+        } else {
+            const size_t index = random() % live.size();
+            events.push_back({timestamp, live[index], ORDER_BOOK_DELETION});
+            live[index] = live.back();
+            live.pop_back();
+        }
+    }
+    return events;
+}
+
+static const bool is_same(const OrderBook& a, const OrderBook& b) {
+    std::vector<OrderBookLevel> a_bids, a_asks, b_bids, b_asks;
+    a.get_depth(a_bids, a_asks);
+    b.get_depth(b_bids, b_asks);
+    if (a_bids.size() != b_bids.size() || a_asks.size() != b_asks.size() || a.get_orders_count() != b.get_orders_count()) {
+        return false;
+    }
+    for (size_t i=0; i<a_bids.size(); ++i) {
+        if (a_bids[i].price != b_bids[i].price || a_bids[i].count != b_bids[i].count || std::abs(a_bids[i].amount - b_bids[i].amount) > 1e-9) {
+            return false;
+        }
+    }
+    for (size_t i=0; i<a_asks.size(); ++i) {
+        if (a_asks[i].price != b_asks[i].price || a_asks[i].count != b_asks[i].count || std::abs(a_asks[i].amount - b_asks[i].amount) > 1e-9) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::string path = "/tmp/cpptrading-order_book_log";
+    std::experimental::filesystem::remove_all(path);
+    const size_t n = 1000000;
+    const std::vector<OrderBookEvent> events = make_events(n);
+
+    // write, closing and reopening the log halfway
+    const double write_duration = measure([&] {
+        {
+            OrderBookLogWriter writer(path);
+            for (size_t i=0; i<n/2; ++i) {
+                writer.append(events[i].order, events[i].type);
+            }
+        }
+        OrderBookLogWriter writer(path);
+        for (size_t i=n/2; i<n; ++i) {
+            writer.append(events[i].order, events[i].type);
+        }
+        writer.flush();
+    });
+    std::cout << "written " << n << " events in " << write_duration << "s, "
+        << std::experimental::filesystem::file_size(path + "/deltas") << " bytes of deltas, "
+        << std::experimental::filesystem::file_size(path + "/snapshots") << " bytes of snapshots\n";
+
+    // snapshots are compressed and written away from the feeding thread,
+    // which only copies the book
+    for (const bool background : {false, true}) {
+        const std::string snapshot_path = path + "-snapshots";
+        std::experimental::filesystem::remove_all(snapshot_path);
+        {
+            OrderBookLogWriter writer(snapshot_path, INFINITY, n, background);
+            for (size_t i=0; i<n/10; ++i) {
+                writer.append(events[i].order, events[i].type);
+            }
+            double snapshot_duration = 0.;
+            for (int s=0; s<100; ++s) {
+                snapshot_duration += measure([&] {
+                    writer.snapshot();
+                });
+                writer.flush();
+            }
+            std::cout << "snapshot of " << writer.get_order_book().get_orders_count() << " orders on the feeding thread, "
+                << (background ? "in the background" : "inline") << ": " << 1e6 * snapshot_duration / 100 << "us\n";
+        }
+        std::experimental::filesystem::remove_all(snapshot_path);
+    }
+
+    // compare with the book replayed in memory, at random instants
+    std::mt19937 random(0);
+    std::vector<double> instants;
+    for (int i=0; i<200; ++i) {
+        instants.push_back(events[random() % n].timestamp);
+    }
+    std::sort(instants.begin(), instants.end());
+    OrderBookLogReader reader(path);
+    OrderBook expected, loaded;
+    size_t errors = 0;
+    size_t e = 0;
+    double load_duration = 0.;
+    for (const double instant : instants) {
+        while (e < n && events[e].timestamp <= instant) {
+            events[e++].apply(expected);
+        }
+        load_duration += measure([&] {
+            reader.load(instant, loaded);
+        });
+        errors += !is_same(expected, loaded);
+    }
+    std::cout << "load: " << errors << " errors out of " << instants.size() << " instants, "
+        << reader.get_snapshots_count() << " snapshots, " << 1e3 * load_duration / instants.size() << "ms per load\n";
+
+    // rebuilding from the beginning, as before
+    const double full_duration = measure([&] {
+        OrderBook book;
+        for (const OrderBookEvent& event : events) {
+            if (event.timestamp > instants.back()) {
+                break;
+            }
+            event.apply(book);
+        }
+    });
+    std::cout << "full replay up to the last instant (from memory): " << 1e3 * full_duration << "ms\n";
+
+    // step through a period
+    size_t replayed = 0;
+    bool is_replay_ok = true;
+    reader.replay(instants[100], instants[100] + 30., loaded, [&](const OrderBookEvent& event, const OrderBook& book) {
+        is_replay_ok &= (event.timestamp >= instants[100] && event.timestamp <= instants[100] + 30.);
+        ++replayed;
+    });
+    std::cout << "replay: " << replayed << " events over 30 seconds, " << (is_replay_ok ? "OK" : "KO") << '\n';
+
+    // an interrupted write leaves partial entries, or entries past the end of
+    // the snapshots; reopening drops them
+    const size_t snapshots_count = reader.get_snapshots_count();
+    const uint64_t snapshots_size = std::experimental::filesystem::file_size(path + "/snapshots");
+    {
+        FILE* index = fopen((path + "/index").c_str(), "ab");
+        const OrderBookIndexEntry entry = {instants.back() + 1., snapshots_size + 1000, n};
+        fwrite(&entry, sizeof(entry), 1, index);
+        fwrite(&entry, sizeof(entry) / 2, 1, index);
+        fclose(index);
+        FILE* snapshots = fopen((path + "/snapshots").c_str(), "ab");
+        fwrite("partial", 7, 1, snapshots);
+        fclose(snapshots);
+    }
+    OrderBookLogWriter(path).flush();
+    errors = 0;
+    OrderBookLogReader repaired_reader(path);
+    repaired_reader.load(instants.back(), loaded);
+    errors += repaired_reader.get_snapshots_count() != snapshots_count;
+    errors += std::experimental::filesystem::file_size(path + "/snapshots") != snapshots_size;
+    errors += std::experimental::filesystem::file_size(path + "/index") != snapshots_count * sizeof(OrderBookIndexEntry);
+    errors += !is_same(expected, loaded);
+    std::cout << "reopened after an interrupted write: " << errors << " errors\n";
+
+    std::experimental::filesystem::remove_all(path);
+    return 0;
+}
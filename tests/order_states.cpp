@@ -0,0 +1,233 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <tbb/concurrent_hash_map.h>
+
+#include "sources/OrderStates.hpp"
+#include "./measure.hpp"
+
+
+static const double retention = 60.0;
+
+
+static const Order make_order(std::mt19937& random, const uint64_t id, const double timestamp) {
+    Order order;
+    order.id = id;
+    order.amount = (1 + random() % 1000) / 100.;
+    order.price = 7000 + random() % 1000;
+    order.type = (random() % 2) ? BUY : SELL;
+    order.timestamp = timestamp;
+    return order;
+}
+
+
+// compare with every version ever fed
+static void test_correctness() {
+    std::mt19937 random(42);
+    OrderStates states(retention);
+    std::unordered_map<uint64_t, std::vector<Order>> versions;
+    std::unordered_map<uint64_t, double> deletions;
+    double timestamp = 1000.;
+    uint64_t next_id = 1;
+    size_t errors = 0;
+    size_t checks = 0;
+    for (size_t i=0; i<300000; ++i) {
+        timestamp += 0.01;
+        const int action = random() % 10;
+        if (action < 5 || next_id < 100) {
+            const Order order = make_order(random, next_id++, timestamp);
+            states.feed(order);
+            versions[order.id].push_back(order);
+        } else if (action < 8) {
+            // change, sometimes slightly in the past
+            const uint64_t id = next_id - 1 - random() % std::min<uint64_t>(next_id - 1, 5000);
+            if (deletions.count(id)) {
+                continue;
+            }
+            const Order order = make_order(random, id, timestamp - (random() % 2) * 0.005);
+            states.feed(order);
+            versions[id].push_back(order);
+        } else {
+            const uint64_t id = next_id - 1 - random() % std::min<uint64_t>(next_id - 1, 5000);
+            if (deletions.count(id)) {
+                continue;
+            }
+            const Order order = make_order(random, id, timestamp);
+            // known orders are only marked as deleted
+            states.puke(order);
+            deletions[id] = timestamp;
+        }
+        // query a recent order at a recent time
+        const uint64_t id = next_id - 1 - random() % std::min<uint64_t>(next_id - 1, 5000);
+        const double query_timestamp = timestamp - (random() % 1000) * 0.01;
+        const auto deletion = deletions.find(id);
+        if (deletion != deletions.end() && deletion->second <= timestamp - retention) {
+            continue;
+        }
+        Order expected = {0};
+        for (const Order& order : versions[id]) {
+            if (order.timestamp <= query_timestamp && (expected.id == 0 || order.timestamp >= expected.timestamp)) {
+                expected = order;
+            }
+        }
+        const Order result = states.retrieve(id, query_timestamp);
+        errors += !(result == expected);
+        ++checks;
+    }
+    size_t live = 0;
+    for (const auto& it : versions) {
+        const auto deletion = deletions.find(it.first);
+        live += (deletion == deletions.end() || deletion->second > timestamp - retention - 1.);
+    }
+    std::cout << "correctness: " << errors << " errors out of " << checks << " checks, "
+        << states.get_size() << " orders kept (at most " << live << " expected, " << versions.size() << " fed)\n";
+}
+
+
+// readers enriching trades while a writer feeds and deletes orders
+static void test_concurrency() {
+    OrderStates states(1.0);
+    std::atomic<bool> is_running(true);
+    std::atomic<uint64_t> last_id(0);
+    std::atomic<size_t> found(0);
+    std::atomic<size_t> inconsistencies(0);
+    std::vector<std::thread> readers;
+    for (int r=0; r<3; ++r) {
+        readers.push_back(std::thread([&, r] {
+            std::mt19937 random(r);
+            while (is_running) {
+                const uint64_t last = last_id;
+                if (last == 0) {
+                    continue;
+                }
+                const uint64_t id = last - random() % std::min<uint64_t>(last, 1000);
+                const Order order = states.retrieve(id, 1e12);
+                if (order.id) {
+                    ++found;
+                    // every version of an order has the price derived from its id
+                    inconsistencies += (order.id != id || order.price != (double) (id % 1000));
+                }
+            }
+        }));
+    }
+    std::mt19937 random(0);
+    for (uint64_t id=1; id<=200000; ++id) {
+        Order order = make_order(random, id, id * 1e-3);
+        order.price = id % 1000;
+        states.feed(order);
+        last_id = id;
+        if (id > 100) {
+            Order changed = order;
+            changed.id = id - random() % 100;
+            changed.price = changed.id % 1000;
+            if (random() % 2) {
+                states.feed(changed);
+            } else {
+                states.puke(changed);
+            }
+        }
+    }
+    is_running = false;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    std::cout << "concurrency: " << found << " orders found, " << inconsistencies << " inconsistencies, "
+        << states.get_size() << " orders kept\n";
+}
+
+// readers that exit release their slots, so that more than 128 of them can
+// come and go
+static void test_threads() {
+    OrderStates states(1.0);
+    OrderStatesEpochs epochs;
+    Order order = {};
+    order.id = 1;
+    order.timestamp = 1.;
+    states.feed(order);
+    size_t found = 0;
+    size_t errors = 0;
+    for (size_t batch=0; batch<4; ++batch) {
+        std::vector<std::thread> readers;
+        std::atomic<size_t> batch_found(0);
+        for (size_t r=0; r<100; ++r) {
+            readers.push_back(std::thread([&] {
+                batch_found += (states.retrieve(1, 1.).id == 1);
+                epochs.enter();
+                epochs.exit();
+            }));
+        }
+        for (std::thread& reader : readers) {
+            reader.join();
+        }
+        found += batch_found;
+        errors += (epochs.get_threads_count() != 0);
+    }
+    std::cout << "threads: " << found << " / 400 orders found, " << epochs.get_threads_count() << " slots left, " << errors << " errors\n";
+}
+
+// enrichment of trades by the previous implementation and the new one
+static void test_performance() {
+    static const size_t n = 1000000;
+    std::mt19937 random(0);
+    std::vector<Order> orders;
+    for (size_t i=0; i<n; ++i) {
+        orders.push_back(make_order(random, 1 + i, 1000. + i * 1e-3));
+    }
+    std::vector<uint64_t> queries;
+    for (size_t i=0; i<4*n; ++i) {
+        queries.push_back(1 + random() % n);
+    }
+    double checksum = 0.;
+    // former Source storage
+    tbb::concurrent_hash_map<uint64_t, std::vector<Order>> current_orders;
+    const double tbb_feed = measure([&] {
+        for (const Order& order : orders) {
+            tbb::concurrent_hash_map<uint64_t, std::vector<Order>>::accessor it;
+            if (current_orders.find(it, order.id)) {
+                it->second.push_back(order);
+            } else {
+                current_orders.insert({order.id, {order}});
+            }
+        }
+    });
+    const double tbb_retrieve = measure([&] {
+        for (const uint64_t id : queries) {
+            Order result_order = {0};
+            tbb::concurrent_hash_map<uint64_t, std::vector<Order>>::accessor it;
+            if (current_orders.find(it, id)) {
+                for (const Order& order : it->second) {
+                    if (order.timestamp > result_order.timestamp && order.timestamp <= 1e12) {
+                        result_order = order;
+                    }
+                }
+            }
+            checksum += result_order.price;
+        }
+    });
+    // OrderStates
+    OrderStates states(1e9);
+    const double states_feed = measure([&] {
+        for (const Order& order : orders) {
+            states.feed(order);
+        }
+    });
+    const double states_retrieve = measure([&] {
+        for (const uint64_t id : queries) {
+            checksum += states.retrieve(id, 1e12).price;
+        }
+    });
+    std::cout << "tbb::concurrent_hash_map: feed " << 1e9 * tbb_feed / n << "ns/order, retrieve " << 1e9 * tbb_retrieve / queries.size() << "ns/order\n";
+    std::cout << "OrderStates:              feed " << 1e9 * states_feed / n << "ns/order, retrieve " << 1e9 * states_retrieve / queries.size() << "ns/order\n";
+    std::cout << "(checksum " << checksum << ")\n";
+}
+
+
+int main(int argc, char const *argv[]) {
+    test_correctness();
+    test_concurrency();
+    test_threads();
+    test_performance();
+    return 0;
+}
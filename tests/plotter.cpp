@@ -1,4 +1,5 @@
 #include <iostream>
+#include <stdlib.h>
 
 #include "math/Plotter.hpp"
 
@@ -13,6 +14,9 @@ class MyPlotter : public Plotter {
 int main (int argc, char **argv)
 {
     MyPlotter plotter;
+    if (argc > 1) {
+        plotter.set_threads_count(atoi(argv[1]));
+    }
     //
     plotter.axes.x.type = PlotterAxisParameters::LINEAR;
     plotter.axes.x.min = -8.;
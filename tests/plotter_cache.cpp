@@ -0,0 +1,141 @@
+#include <iostream>
+
+#include "math/Plotter.hpp"
+
+
+static const int16_t width = 99;
+static const int16_t height = 20;
+
+
+static PlotterAxesParameters make_axes() {
+    PlotterAxesParameters axes;
+    axes.x.type = PlotterAxisParameters::LINEAR;
+    axes.x.min = 0.;
+    axes.x.max = width;
+    axes.x.origin = 0.;
+    axes.x.grid = 10.;
+    axes.y.type = PlotterAxisParameters::LINEAR;
+    axes.y.min = -1.5;
+    axes.y.max = +1.5;
+    axes.y.origin = 0.;
+    axes.y.grid = .5;
+    return axes;
+}
+
+// same moves as Plotter::increase() and Plotter::zoomin()
+static void pan(PlotterAxesParameters& axes, const int columns) {
+    axes.x.min += columns * axes.x.step;
+    axes.x.max += columns * axes.x.step;
+}
+static void zoom(PlotterAxesParameters& axes) {
+    const double center = .5 * (axes.x.min + axes.x.max);
+    const double half_span = .25 * (axes.x.max - axes.x.min);
+    axes.x.min = center - half_span;
+    axes.x.max = center + half_span;
+    axes.x.step = NAN;
+}
+
+
+// panning by k columns evaluates k columns, zooming evaluates them all
+static void test_evaluations() {
+    size_t evaluations = 0;
+    double x_defined = INFINITY;
+    PlotterCurve curve([&evaluations, &x_defined](double x) {
+        ++evaluations;
+        return (x > x_defined) ? NAN : std::sin(x);
+    }, GREEN);
+    PlotterAxesParameters axes = make_axes();
+    PlotterBuffer buffer;
+    buffer.resize(width, height);
+    buffer.reset(axes);
+    buffer.plot(curve);
+    std::cout << "first frame: " << evaluations << " evaluations for " << buffer.get_width() << " columns\n";
+    size_t errors = 0;
+    for (int columns : {1, 3, 10}) {
+        evaluations = 0;
+        pan(axes, columns);
+        buffer.reset(axes);
+        buffer.plot(curve);
+        std::cout << "pan by " << columns << " columns: " << evaluations << " evaluations\n";
+        errors += (evaluations != columns);
+    }
+    evaluations = 0;
+    pan(axes, -14);
+    buffer.reset(axes);
+    buffer.plot(curve);
+    std::cout << "pan back by 14 columns: " << evaluations << " evaluations\n";
+    errors += (evaluations != 0);
+    // when data comes in, columns from the last defined one on get recomputed
+    x_defined = axes.x.min + 80.;
+    curve.cache.clear();
+    buffer.reset(axes);
+    buffer.plot(curve);
+    int32_t i_defined = buffer.get_width() - 1;
+    std::pair<double, double> y;
+    while (i_defined >= 0 && !(curve.cache.find(i_defined, y) && !std::isnan(y.second))) {
+        --i_defined;
+    }
+    x_defined = axes.x.min + 90.;
+    evaluations = 0;
+    buffer.reset(axes);
+    buffer.plot(curve, NULL, true);
+    std::cout << "invalidate trailing: " << evaluations << " evaluations for " << (buffer.get_width() - i_defined) << " trailing columns\n";
+    errors += (evaluations != buffer.get_width() - i_defined);
+    x_defined = INFINITY;
+    //
+    const uint64_t epoch = curve.cache.get_epoch();
+    evaluations = 0;
+    zoom(axes);
+    buffer.reset(axes);
+    buffer.plot(curve);
+    std::cout << "zoom: " << evaluations << " evaluations, epoch " << epoch << " -> " << curve.cache.get_epoch() << '\n';
+    errors += (evaluations != buffer.get_width() || curve.cache.get_epoch() == epoch);
+    std::cout << "evaluations: " << errors << " errors\n";
+}
+
+// only cells that changed since the previous frame get repainted
+static void test_diff() {
+    PlotterAxesParameters axes = make_axes();
+    PlotterBuffer buffer;
+    buffer.resize(width, height);
+    std::vector<PlotterCell> screen;
+    size_t changes = 0;
+    const auto count = [&changes](const int16_t row, const int16_t i, const PlotterCell& cell) {
+        ++changes;
+    };
+    size_t errors = 0;
+    //
+    buffer.reset(axes);
+    buffer.diff(screen, count);
+    std::cout << "first frame: " << changes << " cells repainted out of " << screen.size() << '\n';
+    errors += (changes != screen.size());
+    //
+    changes = 0;
+    buffer.reset(axes);
+    buffer.diff(screen, count);
+    std::cout << "same frame: " << changes << " cells repainted\n";
+    errors += (changes != 0);
+    //
+    changes = 0;
+    buffer.reset(axes);
+    buffer.plot(3.2, .7, RED);
+    buffer.plot(51.2, -1.2, BLUE);
+    buffer.diff(screen, count);
+    std::cout << "two points: " << changes << " cells repainted\n";
+    errors += (changes != 2);
+    //
+    changes = 0;
+    buffer.reset(axes);
+    buffer.plot(51.2, -1.2, BLUE);
+    buffer.diff(screen, count);
+    std::cout << "one point removed: " << changes << " cells repainted\n";
+    errors += (changes != 1);
+    std::cout << "diff: " << errors << " errors\n";
+}
+
+
+int main(int argc, char const *argv[]) {
+    test_evaluations();
+    test_diff();
+    return 0;
+}
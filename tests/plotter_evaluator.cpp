@@ -0,0 +1,155 @@
+#include <iostream>
+#include <chrono>
+
+#include "math/Plotter.hpp"
+
+
+static std::vector<PlotterTask> make_tasks(PlotterCurve& curve, const int16_t width, const double x_offset) {
+    std::vector<PlotterTask> tasks;
+    for (int16_t i=0; i<width; ++i) {
+        const double x = x_offset + i;
+        tasks.push_back({0, curve.cache.get_key(i), curve.cache.get_epoch(), x, {x - .5, x + .5}, PlotterEvaluator::get_refinement_level(i), 1});
+    }
+    return tasks;
+}
+
+
+// a pan or zoom replaces the tasks of the previous view
+static void test_replacement() {
+    std::deque<PlotterCurve> curves;
+    std::mutex samples_mutex;
+    std::atomic<size_t> evaluations(0);
+    curves.push_back(PlotterCurve([&evaluations](double x) {
+        ++evaluations;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return x;
+    }, WHITE));
+    PlotterCurve& curve = curves.front();
+    PlotterEvaluator evaluator(curves, samples_mutex);
+    evaluator.set_threads_count(1);
+    PlotterAxisParameters axis;
+    axis.type = PlotterAxisParameters::LINEAR;
+    axis.min = 0.;
+    axis.step = 1.;
+    size_t errors = 0;
+    // pan: tasks for the columns that came into view
+    std::vector<PlotterTask> tasks;
+    {
+        std::lock_guard<std::mutex> lock(samples_mutex);
+        curve.cache.align(axis);
+        tasks = make_tasks(curve, 100, 0.);
+    }
+    evaluator.schedule(tasks);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    {
+        std::lock_guard<std::mutex> lock(samples_mutex);
+        axis.min += 100.;
+        curve.cache.align(axis);
+        tasks = make_tasks(curve, 10, 100.);
+    }
+    evaluator.schedule(tasks);
+    evaluator.wait();
+    size_t found = 0;
+    {
+        std::lock_guard<std::mutex> lock(samples_mutex);
+        std::pair<double, double> y;
+        for (int16_t i=0; i<10; ++i) {
+            found += (curve.cache.find(i, y) && y.second == 100. + i);
+        }
+    }
+    std::cout << "pan: " << evaluations << " evaluations for 100 + 10 tasks, " << found << "/10 new columns\n";
+    errors += (found != 10 || evaluations >= 100);
+    // zoom: the cache gets reset, and samples of the previous view get dropped
+    evaluations = 0;
+    {
+        std::lock_guard<std::mutex> lock(samples_mutex);
+        tasks = make_tasks(curve, 100, 0.);
+    }
+    evaluator.schedule(tasks);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    {
+        std::lock_guard<std::mutex> lock(samples_mutex);
+        axis.step = .5;
+        curve.cache.align(axis);
+        tasks = make_tasks(curve, 100, 1000.);
+    }
+    evaluator.schedule(tasks);
+    evaluator.wait();
+    found = 0;
+    {
+        std::lock_guard<std::mutex> lock(samples_mutex);
+        std::pair<double, double> y;
+        for (int16_t i=-200; i<200; ++i) {
+            found += curve.cache.find(i, y);
+            errors += (curve.cache.find(i, y) && y.second != 1000. + i);
+        }
+    }
+    std::cout << "zoom: " << evaluations << " evaluations for 100 + 100 tasks, " << found << "/100 samples\n";
+    errors += (found != 100 || evaluations >= 200);
+    std::cout << "replacement: " << errors << " errors\n";
+}
+
+// coarse columns come first
+static void test_refinement() {
+    std::deque<PlotterCurve> curves;
+    std::mutex samples_mutex;
+    std::vector<int> order;
+    curves.push_back(PlotterCurve([&order](double x) {
+        order.push_back(x);
+        return x;
+    }, WHITE));
+    PlotterEvaluator evaluator(curves, samples_mutex);
+    evaluator.set_threads_count(1);
+    std::vector<PlotterTask> tasks = make_tasks(curves.front(), 64, 0.);
+    evaluator.schedule(tasks);
+    evaluator.wait();
+    size_t errors = (order.size() != 64);
+    for (size_t k=1; k<order.size(); ++k) {
+        errors += (PlotterEvaluator::get_refinement_level(order[k]) < PlotterEvaluator::get_refinement_level(order[k - 1]));
+    }
+    std::cout << "first columns:";
+    for (size_t k=0; k<8 && k<order.size(); ++k) {
+        std::cout << ' ' << order[k];
+    }
+    std::cout << "\nrefinement: " << errors << " errors\n";
+}
+
+// cancelling waits for running tasks, so that curves can then be removed
+static void test_cancel() {
+    std::deque<PlotterCurve> curves;
+    std::mutex samples_mutex;
+    std::atomic<size_t> running(0);
+    std::atomic<size_t> evaluations(0);
+    curves.push_back(PlotterCurve([&running, &evaluations](double x) {
+        ++running;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ++evaluations;
+        --running;
+        return x;
+    }, WHITE));
+    PlotterEvaluator evaluator(curves, samples_mutex);
+    evaluator.set_threads_count(2);
+    std::vector<PlotterTask> tasks = make_tasks(curves.front(), 100, 0.);
+    evaluator.schedule(tasks);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    evaluator.cancel();
+    const size_t running_after_cancel = running;
+    {
+        std::lock_guard<std::mutex> lock(samples_mutex);
+        curves.clear();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::cout << "cancel: " << running_after_cancel << " tasks running after cancel, " << evaluations << " evaluations\n";
+    const size_t errors = (running_after_cancel != 0 || evaluations > 2);
+    //
+    evaluator.set_threads_count(0);
+    std::cout << "cancel: " << errors << " errors\n";
+}
+
+
+int main(int argc, char const *argv[]) {
+    test_replacement();
+    test_refinement();
+    test_cancel();
+    return 0;
+}
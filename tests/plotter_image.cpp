@@ -0,0 +1,107 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "math/PlotterImage.hpp"
+
+
+int main (int argc, char **argv)
+{
+    const std::string base_path = "/tmp/cpptrading-tests";
+    mkdir(base_path.c_str(), 0755);
+    //
+    PlotterImage plotter(1280, 720);
+    plotter.axes.x.type = PlotterAxisParameters::LINEAR;
+    plotter.axes.x.min = -8.;
+    plotter.axes.x.max = +8.;
+    plotter.axes.x.origin = 0.;
+    plotter.axes.x.grid = 1.;
+    //
+    plotter.axes.y.type = PlotterAxisParameters::LINEAR;
+    plotter.axes.y.min = -4.;
+    plotter.axes.y.max = +4.;
+    plotter.axes.y.origin = 0.;
+    plotter.axes.y.grid = 1.;
+    //
+    const double origin = 2.;
+    plotter.plot([origin](double x) {
+        return x * x - origin;
+    }, GREEN);
+    plotter.plot([](double x_min, double x_max) {
+        return std::pair<double, double>(x_min, x_max);
+    });
+    plotter.plot(sqrt, BLUE);
+    plotter.plot(exp, YELLOW);
+    plotter.plot(log, MAGENTA);
+    plotter.plot(sin, RED);
+    plotter.plot([](double x_min, double x_max, size_t n) {
+        std::vector<std::pair<double, double>> y;
+        for (size_t i=0; i<n; ++i) {
+            const double x = x_min + (i + .5) * (x_max - x_min) / n;
+            y.push_back({cos(x) - .1, cos(x) + .1});
+        }
+        return y;
+    }, CYAN);
+    plotter.plot({{0, 0}, {-1, 1}, {-2, 2}, {1, -1}, {-.5, .5}, {-1.5, 1.5}, {-42, 42}}, CYAN);
+    //
+    size_t errors = 0;
+    plotter.save(base_path + "/plotter.png");
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    std::vector<uint8_t> pixels;
+    if (png_image_begin_read_from_file(&image, (base_path + "/plotter.png").c_str())) {
+        image.format = PNG_FORMAT_RGB;
+        pixels.resize(PNG_IMAGE_SIZE(image));
+        png_image_finish_read(&image, NULL, pixels.data(), 0, NULL);
+    }
+    errors += image.width != 1280 || image.height != 720 || pixels.empty();
+    if (!pixels.empty()) {
+        // the parabola goes through (0, -2), nothing goes through (-7.5, 3.7)
+        const uint8_t* curve_pixel = &pixels[3 * (plotter.axes.y_to_j(-2.) * 1280 + plotter.axes.x_to_i(0.))];
+        const uint8_t* empty_pixel = &pixels[3 * (plotter.axes.y_to_j(3.7) * 1280 + plotter.axes.x_to_i(-7.5))];
+        errors += curve_pixel[0] != 13 || curve_pixel[1] != 188 || curve_pixel[2] != 121;
+        errors += empty_pixel[0] != 0 || empty_pixel[1] != 0 || empty_pixel[2] != 0;
+    }
+    std::cout << "saved " << base_path << "/plotter.png: " << image.width << "x" << image.height << '\n';
+    // panning gets the curves computed again
+    plotter.axes.x.min += 4.;
+    plotter.axes.x.max += 4.;
+    plotter.save(base_path + "/plotter-panned.png");
+    pixels.clear();
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (png_image_begin_read_from_file(&image, (base_path + "/plotter-panned.png").c_str())) {
+        image.format = PNG_FORMAT_RGB;
+        pixels.resize(PNG_IMAGE_SIZE(image));
+        png_image_finish_read(&image, NULL, pixels.data(), 0, NULL);
+    }
+    errors += pixels.empty();
+    if (!pixels.empty()) {
+        const uint8_t* curve_pixel = &pixels[3 * (plotter.axes.y_to_j(-2.) * 1280 + plotter.axes.x_to_i(0.))];
+        errors += curve_pixel[0] != 13 || curve_pixel[1] != 188 || curve_pixel[2] != 121;
+        std::cout << "saved " << base_path << "/plotter-panned.png: x in [" << plotter.axes.x.min << " ; " << plotter.axes.x.max << "], step " << plotter.axes.x.step << '\n';
+    }
+    plotter.axes.x.min -= 4.;
+    plotter.axes.x.max -= 4.;
+    //
+    plotter.save(base_path + "/plotter.svg");
+    std::ifstream file(base_path + "/plotter.svg");
+    std::stringstream svg;
+    svg << file.rdbuf();
+    const std::string text = svg.str();
+    size_t paths = 0;
+    size_t circles = 0;
+    for (size_t position=0; (position=text.find("<path ", position)) != std::string::npos; ++position) {
+        ++paths;
+    }
+    for (size_t position=0; (position=text.find("<circle ", position)) != std::string::npos; ++position) {
+        ++circles;
+    }
+    errors += text.compare(0, 4, "<svg") != 0 || text.find("width=\"1280\" height=\"720\"") == std::string::npos;
+    errors += paths != 7 || circles != 6 || text.find("->") != std::string::npos || text.find("-&gt;") == std::string::npos;
+    std::cout << "saved " << base_path << "/plotter.svg: " << paths << " paths, " << circles << " points\n";
+    std::cout << errors << " errors\n";
+    return errors != 0;
+}
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <new>
+
+#include "sources/BitstampSource.hpp"
+#include "./measure.hpp"
+
+
+// count heap allocations
+static std::atomic<size_t> allocations(0);
+void* operator new(size_t size) {
+    ++allocations;
+    void* pointer = malloc(size);
+    if (pointer == NULL) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+void operator delete(void* pointer, size_t size) noexcept {
+    free(pointer);
+}
+
+
+// former path: the envelope and its data are parsed into JSON trees
+static const Trade make_trade(const std::string& payload) {
+    const JSON message = JSON::parse(payload);
+    const JSON data = JSON::parse(message["data"].get<std::string>());
+    Trade trade;
+    trade.id = data["id"];
+    trade.volume = data["amount"];
+    trade.price = data["price"];
+    trade.type = (data["type"] == 0) ? BUY : SELL;
+    trade.timestamp = std::stod(data["timestamp"].get<std::string>());
+    trade.buy_order_id = data["buy_order_id"];
+    trade.sell_order_id = data["sell_order_id"];
+    return trade;
+}
+static const Order make_order(const std::string& payload) {
+    const JSON message = JSON::parse(payload);
+    const JSON data = JSON::parse(message["data"].get<std::string>());
+    Order order;
+    order.id = data["id"];
+    order.amount = data["amount"];
+    order.price = data["price"];
+    order.type = (data["order_type"] == 0) ? BUY : SELL;
+    order.timestamp = std::stod(data["datetime"].get<std::string>());
+    return order;
+}
+
+
+// messages as sent by Bitstamp
+static const std::string make_trade_payload(std::mt19937& random, const uint64_t id) {
+    const double price = (700000 + random() % 200000) / 100.;
+    const double amount = (1 + random() % 100000000) / 1e8;
+    char price_str[32], amount_str[32];
+    snprintf(price_str, sizeof(price_str), "%.2f", price);
+    snprintf(amount_str, sizeof(amount_str), "%.8f", amount);
+    const uint64_t timestamp = 1500000000 + id;
+    const JSON data = {
+        {"amount", JSON::parse(amount_str)},
+        {"buy_order_id", 600000000 + random() % 1000000},
+        {"sell_order_id", 600000000 + random() % 1000000},
+        {"amount_str", amount_str},
+        {"price_str", price_str},
+        {"timestamp", std::to_string(timestamp)},
+        {"microtimestamp", std::to_string(timestamp) + "123456"},
+        {"price", JSON::parse(price_str)},
+        {"type", random() % 2},
+        {"id", id},
+    };
+    return JSON({{"event", "trade"}, {"channel", "live_trades_btceur"}, {"data", data.dump()}}).dump();
+}
+static const std::string make_order_payload(std::mt19937& random, const uint64_t id) {
+    char price_str[32], amount_str[32];
+    snprintf(price_str, sizeof(price_str), "%.2f", (700000 + random() % 200000) / 100.);
+    snprintf(amount_str, sizeof(amount_str), "%.8f", (1 + random() % 100000000) / 1e8);
+    const uint64_t timestamp = 1500000000 + id;
+    const JSON data = {
+        {"microtimestamp", std::to_string(timestamp) + "123456"},
+        {"amount", JSON::parse(amount_str)},
+        {"order_type", random() % 2},
+        {"amount_str", amount_str},
+        {"price_str", price_str},
+        {"price", JSON::parse(price_str)},
+        {"id", id},
+        {"datetime", std::to_string(timestamp)},
+    };
+    return JSON({{"data", data.dump()}, {"event", "order_created"}, {"channel", "live_orders_btceur"}}).dump();
+}
+
+
+int main(int argc, char const *argv[]) {
+    static const size_t n = 200000;
+    std::mt19937 random(42);
+    std::vector<std::string> trade_payloads, order_payloads;
+    for (size_t i=0; i<n; ++i) {
+        trade_payloads.push_back(make_trade_payload(random, i));
+        order_payloads.push_back(make_order_payload(random, i));
+    }
+    std::cout << "example: " << trade_payloads.front() << "\n\n";
+
+    // both paths must agree
+    size_t mismatches = 0;
+    for (size_t i=0; i<n; ++i) {
+        PusherMessage message;
+        Trade trade;
+        Order order;
+        const Trade expected_trade = make_trade(trade_payloads[i]);
+        const Order expected_order = make_order(order_payloads[i]);
+        mismatches += !message.parse(trade_payloads[i].data(), trade_payloads[i].size());
+        mismatches += !message.is_event("trade");
+        mismatches += !BitstampSource::parse_trade(message, trade);
+        mismatches += !(trade == expected_trade);
+        mismatches += !message.parse(order_payloads[i].data(), order_payloads[i].size());
+        mismatches += !message.is_event("order_created");
+        mismatches += !BitstampSource::parse_order(message, order);
+        mismatches += !(order == expected_order);
+    }
+    std::cout << "mismatches: " << mismatches << '\n';
+
+    // nested strings with escape sequences, and malformed data
+    const std::string tricky = R"({"event":"trade","data":"{\"note\": \"a \\\"quoted\\\" \\\\ word\\n\", \"id\": 7, \"amount\": 1.5e-3, \"price\": \"-2.25\", \"type\": 1, \"timestamp\": \"12.5\", \"buy_order_id\": 1, \"sell_order_id\": 2, \"extra\": [1, {\"a\": \"}\"}]}","channel":"live_trades_btceur"})";
+    PusherMessage message;
+    Trade trade;
+    const bool is_tricky_ok = message.parse(tricky.data(), tricky.size()) && BitstampSource::parse_trade(message, trade)
+        && trade.id == 7 && trade.volume == 1.5e-3 && trade.price == -2.25 && trade.type == SELL && *trade.timestamp == 12.5;
+    std::cout << "escaped strings: " << (is_tricky_ok ? "OK" : "KO") << '\n';
+    const std::string truncated = trade_payloads.front().substr(0, trade_payloads.front().size() / 2);
+    const bool is_truncated_rejected = !message.parse(truncated.data(), truncated.size()) || !BitstampSource::parse_trade(message, trade);
+    std::cout << "truncated message: " << (is_truncated_rejected ? "rejected" : "ACCEPTED") << "\n\n";
+
+    // benchmark
+    double checksum = 0.;
+    const size_t json_allocations = allocations;
+    const double json_duration = measure([&] {
+        for (size_t i=0; i<n; ++i) {
+            checksum += make_trade(trade_payloads[i]).price;
+            checksum += make_order(order_payloads[i]).price;
+        }
+    });
+    const size_t json_allocated = allocations - json_allocations;
+    const size_t fast_allocations = allocations;
+    const double fast_duration = measure([&] {
+        for (size_t i=0; i<n; ++i) {
+            PusherMessage message;
+            Trade trade;
+            Order order;
+            message.parse(trade_payloads[i].data(), trade_payloads[i].size());
+            BitstampSource::parse_trade(message, trade);
+            message.parse(order_payloads[i].data(), order_payloads[i].size());
+            BitstampSource::parse_order(message, order);
+            checksum += trade.price + order.price;
+        }
+    });
+    const size_t fast_allocated = allocations - fast_allocations;
+    std::cout << "JSON:           " << 2*n / json_duration / 1e6 << "M messages/s, "
+        << 1e9 * json_duration / (2*n) << "ns/message, "
+        << (double) json_allocated / (2*n) << " allocations/message\n";
+    std::cout << "PusherMessage:  " << 2*n / fast_duration / 1e6 << "M messages/s, "
+        << 1e9 * fast_duration / (2*n) << "ns/message, "
+        << (double) fast_allocated / (2*n) << " allocations/message\n";
+    std::cout << "speedup: " << json_duration / fast_duration << "x (checksum " << checksum << ")\n";
+    return 0;
+}
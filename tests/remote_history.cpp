@@ -0,0 +1,267 @@
+#include <iostream>
+#include <atomic>
+
+#include "history/History.hpp"
+#include "history/MemoryHistory.hpp"
+#include "history/HistoryServer.hpp"
+#include "history/RemoteHistory.hpp"
+#include "db/PlainLog.hpp"
+#include "db/BlockLog.hpp"
+
+#include <sys/stat.h>
+#include <chrono>
+
+
+// also keeps its trades in a plain log, which the server can send with sendfile()
+class PlainLogHistory : public MemoryHistory, public HistoryPlainLogs {
+public:
+    inline PlainLogHistory(const std::string& path) :
+        _path(path),
+        _trades_log(path) {}
+    virtual void feed(Trade& trade) {
+        MemoryHistory::feed(trade);
+        _trades_log.append(trade);
+    }
+    virtual const std::string get_plain_log_path(const std::string& name) {
+        return (name == "trades") ? _path : "";
+    }
+private:
+    const std::string _path;
+    PlainLogWriter _trades_log;
+};
+
+
+// same, with a compressed log, which cannot be sent as is
+class BlockLogHistory : public MemoryHistory, public HistoryPlainLogs {
+public:
+    inline BlockLogHistory(const std::string& path) :
+        _path(path),
+        _trades_log(path) {}
+    virtual void feed(Trade& trade) {
+        MemoryHistory::feed(trade);
+        _trades_log.append(trade);
+    }
+    virtual const std::string get_plain_log_path(const std::string& name) {
+        _trades_log.flush();
+        return (name == "trades") ? _path : "";
+    }
+private:
+    const std::string _path;
+    BlockLogWriter _trades_log;
+};
+
+
+int main(int argc, char const *argv[]) {
+    MemoryHistory local_history;
+    for (size_t i=0; i<100000; ++i) {
+        Trade trade;
+        trade.id = i;
+        trade.timestamp = Timestamp(2018, 1, 1) + 10. * i;
+        trade.type = (i % 3) ? BUY : SELL;
+        trade.price = 10000. + 100. * sin(i / 1000.);
+        trade.volume = .01 * (1 + i % 7);
+        local_history.feed(trade);
+    }
+    HistoryServer server(local_history, "0.0.0.0", 7891);
+    usleep(100000);
+    RemoteHistory remote_history("127.0.0.1", 7891);
+
+    // streamed ranges, two of them pipelined
+    Range<Trade> all_trades = remote_history.get_trades();
+    Range<Trade> some_trades = remote_history.get_trades_by_timestamp(Timestamp(2018, 1, 2), Timestamp(2018, 1, 3));
+    size_t count = 0;
+    size_t mismatches = 0;
+    auto local_it = local_history.get_trades().begin();
+    for (const Trade& trade : all_trades) {
+        mismatches += !(trade == *local_it);
+        ++local_it;
+        ++count;
+    }
+    std::cout << "streamed trades = " << count << ", mismatches = " << mismatches << '\n';
+    count = 0;
+    for (const Trade& trade : some_trades) {
+        ++count;
+    }
+    size_t local_count = 0;
+    for (const Trade& trade : local_history.get_trades_by_timestamp(Timestamp(2018, 1, 2), Timestamp(2018, 1, 3))) {
+        ++local_count;
+    }
+    std::cout << "streamed trades by timestamp = " << count << " (local = " << local_count << ")\n";
+
+    // summaries
+    std::cout << "remote time span = " << remote_history.get_time_span() << '\n';
+    std::cout << "local time span = " << local_history.get_time_span() << '\n';
+    std::cout << "remote summary = " << remote_history.get_trade_summary(Timestamp(2018, 1, 1), Timestamp(2018, 1, 2)) << '\n';
+    std::cout << "local summary = " << local_history.get_trade_summary(Timestamp(2018, 1, 1), Timestamp(2018, 1, 2)) << '\n';
+    const std::vector<TradeBucket> remote_buckets = remote_history.get_bucketed(Timestamp(2018, 1, 1), Timestamp(2018, 1, 5), 4);
+    const std::vector<TradeBucket> local_buckets = local_history.get_bucketed(Timestamp(2018, 1, 1), Timestamp(2018, 1, 5), 4);
+    for (size_t b=0; b<remote_buckets.size(); ++b) {
+        std::cout << remote_buckets[b] << '\n' << local_buckets[b] << '\n';
+    }
+    std::cout << "no buckets = " << remote_history.get_bucketed(Timestamp(2018, 1, 1), Timestamp(2018, 1, 5), 0).size()
+        << ", too many buckets = " << remote_history.get_bucketed(Timestamp(2018, 1, 1), Timestamp(2018, 1, 5), 1L << 40).size() << '\n';
+
+    // partially consumed range, cancelled on destruction
+    {
+        Range<Trade> trades = remote_history.get_trades();
+        for (const Trade& trade : trades) {
+            break;
+        }
+    }
+
+    // live feed
+    std::atomic<size_t> received(0);
+    const uint32_t subscription = remote_history.subscribe([&received](const Trade& trade) {
+        ++received;
+    });
+    usleep(100000);
+    for (size_t i=0; i<10; ++i) {
+        Trade trade;
+        trade.id = 100000 + i;
+        trade.timestamp = Timestamp(2018, 2, 1) + 10. * i;
+        trade.price = 10000.;
+        trade.volume = 1.;
+        remote_history.feed(trade);
+    }
+    remote_history.flush();
+    usleep(200000);
+    remote_history.unsubscribe(subscription);
+    std::cout << "received live trades = " << received << " / 10" << '\n';
+    std::cout << "remote time span after feed = " << remote_history.get_time_span() << '\n';
+
+    // a client that does not read its response does not hold the feeds
+    {
+        TCPClient client("127.0.0.1", 7891);
+        for (uint32_t r=0; r<32; ++r) {
+            const RemoteHistoryRequest request = {r, REMOTE_GET_TRADES, 0};
+            client.write(request);
+        }
+        client.flush();
+        double duration = 0.;
+        for (size_t i=0; i<5; ++i) {
+            usleep(100000);
+            Trade trade;
+            trade.id = 200000 + i;
+            trade.timestamp = Timestamp(2018, 3, 1) + i;
+            trade.price = 10000.;
+            trade.volume = 1.;
+            const auto begin = std::chrono::steady_clock::now();
+            server.feed(trade);
+            duration = std::max(duration, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+        }
+        std::cout << "feeds during a stalled stream took at most " << 1e3 * duration << "ms\n";
+    }
+
+    // a range streamed from memory while the history gets fed
+    {
+        std::thread feeder([&server] {
+            for (size_t i=0; i<50000; ++i) {
+                Trade trade;
+                trade.id = 300000 + i;
+                trade.timestamp = Timestamp(2018, 4, 1) + i;
+                trade.price = 10000.;
+                trade.volume = 1.;
+                server.feed(trade);
+            }
+        });
+        size_t count = 0;
+        size_t disorders = 0;
+        uint64_t previous_id = 0;
+        for (const Trade& trade : remote_history.get_trades()) {
+            disorders += (count && trade.id <= previous_id);
+            previous_id = trade.id;
+            ++count;
+        }
+        feeder.join();
+        std::cout << "streamed while feeding = " << count << " trades, disorders = " << disorders << '\n';
+    }
+
+    // cancelling a request that was already answered does not affect a later
+    // one with the same id
+    {
+        TCPClient client("127.0.0.1", 7891);
+        uint32_t answers = 0;
+        for (size_t r=0; r<2; ++r) {
+            const RemoteHistoryRequest request = {7, REMOTE_GET_TIME_SPAN, 0};
+            client.write(request);
+            client.flush();
+            RemoteHistoryResponse response;
+            TimestampSpan span;
+            if (client.wait_readable(1.) && client.read(response) && response.size == sizeof(span) && client.read(span)) {
+                answers += (response.request_id == 7);
+            }
+            usleep(50000);
+            const RemoteHistoryRequest cancel_request = {8, REMOTE_CANCEL, sizeof(RemoteHistoryCancelParameters)};
+            const RemoteHistoryCancelParameters cancel_parameters = {7};
+            client.write(cancel_request);
+            client.write(cancel_parameters);
+            client.flush();
+        }
+        std::cout << "answers after cancelling answered requests = " << answers << " / 2\n";
+    }
+
+    // requests with an oversized payload get their connection dropped
+    {
+        TCPClient client("127.0.0.1", 7891);
+        const RemoteHistoryRequest request = {1, REMOTE_GET_TIME_SPAN, 1U << 31};
+        client.write(request);
+        client.flush();
+        std::cout << "oversized payload: " << (client.wait_readable(1.) && client.is_closed() ? "dropped" : "NOT DROPPED") << '\n';
+    }
+
+    // streaming a million trades from a plain log
+    {
+        mkdir("/tmp/cpptrading-tests", 0755);
+        const std::string path = "/tmp/cpptrading-tests/remote_history_trades";
+        unlink(path.c_str());
+        PlainLogHistory file_history(path);
+        for (size_t i=0; i<1000000; ++i) {
+            Trade trade;
+            trade.id = i;
+            trade.timestamp = Timestamp(2018, 1, 1) + i;
+            trade.price = 10000.;
+            trade.volume = 1.;
+            file_history.feed(trade);
+        }
+        HistoryServer file_server(file_history, "0.0.0.0", 7892);
+        usleep(100000);
+        RemoteHistory file_remote_history("127.0.0.1", 7892);
+        const auto begin = std::chrono::steady_clock::now();
+        size_t count = 0;
+        uint64_t ids = 0;
+        for (const Trade& trade : file_remote_history.get_trades()) {
+            ++count;
+            ids += trade.id;
+        }
+        const double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << "streamed " << count << " trades from plain log in " << duration << "s"
+                  << (ids == 999999ULL * 1000000ULL / 2 ? "" : " (WRONG IDS)") << '\n';
+    }
+
+    // block logs are decoded instead
+    {
+        const std::string path = "/tmp/cpptrading-tests/remote_history_block_trades";
+        unlink(path.c_str());
+        BlockLogHistory block_history(path);
+        for (size_t i=0; i<100000; ++i) {
+            Trade trade;
+            trade.id = i;
+            trade.timestamp = Timestamp(2018, 1, 1) + i;
+            trade.price = 10000.;
+            trade.volume = 1.;
+            block_history.feed(trade);
+        }
+        HistoryServer block_server(block_history, "0.0.0.0", 7893);
+        usleep(100000);
+        RemoteHistory block_remote_history("127.0.0.1", 7893);
+        size_t count = 0;
+        uint64_t ids = 0;
+        for (const Trade& trade : block_remote_history.get_trades()) {
+            ++count;
+            ids += trade.id;
+        }
+        std::cout << "streamed " << count << " trades from block log"
+                  << (ids == 99999ULL * 100000ULL / 2 ? "" : " (WRONG IDS)") << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <chrono>
+
+#include "db/RotatingLogCompactor.hpp"
+#include "models/Trade.hpp"
+#include "./measure.hpp"
+
+
+// a trade every minute
+static Trade make_trade(const size_t i) {
+    Trade trade;
+    trade.id = i + 1;
+    trade.timestamp = 1500000000. + 60. * i;
+    trade.price = 7000. + 0.01 * ((i * 7) % 1000);
+    trade.volume = 0.001 * (1 + i % 50);
+    trade.type = (i % 3) ? BUY : SELL;
+    return trade;
+}
+
+// records read in order, from the first one given
+static const size_t check(RotatingLogReader& reader, size_t i, size_t& errors) {
+    size_t count = 0;
+    Trade trade;
+    while (reader.next(trade)) {
+        errors += !(trade == make_trade(i++));
+        ++count;
+    }
+    return count;
+}
+
+static const size_t count_files(const std::string& directory) {
+    size_t count = 0;
+    for (auto& p : std::experimental::filesystem::directory_iterator(directory)) {
+        ++count;
+    }
+    return count;
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::string directory = "/tmp/cpptrading-rotatinglog_compaction";
+    std::experimental::filesystem::remove_all(directory);
+    std::experimental::filesystem::create_directory(directory);
+    const std::string basepath = directory + "/trades";
+    const size_t days = 60;
+    const size_t n = days * 24 * 60;
+    const double now = 1500000000. + 60. * n;
+
+    // uncompressed daily segments; the last one is still being written
+    std::unique_ptr<RotatingLogWriter> writer(new RotatingLogWriter(basepath, Codec(CODEC_NONE), 86400, 256, 65536, ROTATING_LOG_BY_TIMESTAMP));
+    for (size_t i=0; i<n-10; ++i) {
+        writer->append(make_trade(i));
+    }
+    writer->flush();
+    size_t before_size = 0;
+    for (const auto& it : rotating_log_load_segments(basepath)) {
+        before_size += it.second.size;
+    }
+    const size_t before_files = count_files(directory);
+
+    // merged into segments of about 1 MB of trades, while a reader listed the former ones
+    RotatingLogReader early_reader(basepath);
+    RotatingLogCompactor<Trade> compactor(basepath, Codec(CODEC_TRADES_ZLIB), 1 << 20, 1 << 19, 0., 0, 60.);
+    const double compaction_duration = measure([&] {
+        compactor.compact(now);
+    });
+    size_t errors = 0;
+    size_t count = check(early_reader, 0, errors);
+    errors += count != n - 10;
+    std::cout << "reader listing segments before compaction: " << count << " trades, " << errors << " errors\n";
+
+    // the writer goes on
+    for (size_t i=n-10; i<n; ++i) {
+        writer->append(make_trade(i));
+    }
+    writer->flush();
+    errors = 0;
+    RotatingLogReader reader(basepath);
+    count = check(reader, 0, errors);
+    errors += count != n;
+    size_t after_size = 0;
+    for (const auto& it : rotating_log_load_segments(basepath)) {
+        after_size += it.second.size;
+    }
+    RotatingLogCompactionMetrics metrics = compactor.get_metrics();
+    std::cout << "compaction: " << metrics.merged_segments << " segments merged into " << metrics.written_segments
+        << " in " << compaction_duration << "s, " << before_size << " to " << after_size << " bytes, "
+        << count << " trades, " << errors << " errors\n";
+
+    // former files are only deleted after the grace period
+    compactor.compact(now + 3600.);
+    metrics = compactor.get_metrics();
+    std::cout << "files: " << before_files << " before, " << count_files(directory) << " after, "
+        << metrics.deleted_segments << " deleted\n";
+
+    // retention: the last week only, read from the end of a merged segment
+    RotatingLogCompactor<Trade> retention(basepath, Codec(CODEC_TRADES_ZLIB), 1 << 20, 1 << 19, 7 * 86400., 0, 0.);
+    retention.compact(now);
+    errors = 0;
+    RotatingLogReader retained_reader(basepath);
+    const size_t first = retained_reader.get_segments().empty() ? 0 : (retained_reader.get_segments()[0].timestamp_min - 1500000000.) / 60.;
+    count = check(retained_reader, first, errors);
+    errors += first + count != n || 1500000000. + 60. * first > now - 7 * 86400. + 2 * 86400.;
+    std::cout << "retention: " << retention.get_metrics().dropped_segments << " segments dropped, "
+        << count << " trades left, " << errors << " errors\n";
+
+    // in the background
+    RotatingLogCompactor<Trade> background(basepath, Codec(CODEC_TRADES_ZLIB));
+    background.start(0.01);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    background.stop();
+    std::cout << "background: " << background.get_metrics().runs << " runs, " << background.get_metrics().errors << " errors\n";
+
+    writer.reset();
+    std::experimental::filesystem::remove_all(directory);
+    return 0;
+}
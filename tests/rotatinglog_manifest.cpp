@@ -0,0 +1,118 @@
+#include <iostream>
+#include <chrono>
+
+#include "db/RotatingLog.hpp"
+#include "models/Trade.hpp"
+#include "./measure.hpp"
+
+
+// a trade every minute
+static Trade make_trade(const size_t i) {
+    Trade trade;
+    trade.id = i + 1;
+    trade.timestamp = 1500000000. + 60. * i;
+    trade.price = 7000. + 0.01 * ((i * 7) % 1000);
+    trade.volume = 0.001 * (1 + i % 50);
+    trade.type = (i % 3) ? BUY : SELL;
+    return trade;
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::string directory = "/tmp/cpptrading-rotatinglog_manifest";
+    std::experimental::filesystem::remove_all(directory);
+    std::experimental::filesystem::create_directory(directory);
+    const std::string basepath = directory + "/trades";
+    // a year, in daily segments, written in two sessions
+    const size_t n = 365 * 24 * 60;
+    for (const size_t session : {0, 1}) {
+        RotatingLogWriter writer(basepath, Codec(CODEC_TRADES_ZLIB), 86400, 256, 65536, ROTATING_LOG_BY_TIMESTAMP);
+        for (size_t i=session*n/2; i<(session+1)*n/2; ++i) {
+            writer.append(make_trade(i));
+        }
+    }
+
+    // last week
+    const double end = 1500000000. + 60. * (n - 1);
+    const double begin = end - 7 * 86400.;
+    size_t errors = 0;
+    size_t count = 0;
+    size_t segments_count = 0;
+    const double pruned_duration = measure([&] {
+        RotatingLogReader reader(basepath, begin, end);
+        segments_count = reader.get_segments().size();
+        Trade trade;
+        while (reader.next(trade)) {
+            errors += (double) trade.timestamp < begin || (double) trade.timestamp > end || !(trade == make_trade(n - 7 * 24 * 60 - 1 + count));
+            ++count;
+        }
+    });
+    errors += count != 7 * 24 * 60 + 1;
+    size_t full_count = 0;
+    const double full_duration = measure([&] {
+        RotatingLogReader reader(basepath);
+        Trade trade;
+        while (reader.next(trade)) {
+            full_count += (double) trade.timestamp >= begin && (double) trade.timestamp <= end;
+        }
+    });
+    errors += full_count != count;
+    std::cout << "last week out of a year: " << count << " trades from " << segments_count << " segments, "
+        << errors << " errors, in " << 1e3 * pruned_duration << "ms vs full scan " << 1e3 * full_duration << "ms\n";
+
+    // bounds are kept by the manifest
+    const RotatingLogSegments segments = rotating_log_load_segments(basepath);
+    size_t segments_errors = segments.size() != 366;
+    size_t total = 0;
+    for (const auto& it : segments) {
+        segments_errors += std::isnan(it.second.timestamp_min) || it.second.size == 0;
+        total += it.second.count;
+    }
+    segments_errors += total != n;
+    std::cout << "manifest: " << segments.size() << " segments, " << total << " trades, " << segments_errors << " errors\n";
+
+    // nearly sorted trades do not reopen the former segment at each boundary
+    {
+        const std::string jittered_basepath = directory + "/jittered";
+        const size_t jittered_n = 10 * 24 * 360;
+        size_t jittered_count = 0;
+        const double jittered_duration = measure([&] {
+            RotatingLogWriter writer(jittered_basepath, Codec(CODEC_TRADES_ZLIB), 86400, 256, 65536, ROTATING_LOG_BY_TIMESTAMP);
+            for (size_t i=0; i<jittered_n; ++i) {
+                Trade trade = make_trade(i);
+                trade.timestamp = 1500000000. + 10. * i + 10. * ((i * 5) % 7) - 30.;
+                writer.append(trade);
+            }
+        });
+        RotatingLogReader reader(jittered_basepath);
+        Trade trade;
+        while (reader.next(trade)) {
+            ++jittered_count;
+        }
+        const size_t manifest_entries = std::experimental::filesystem::file_size(jittered_basepath + ".manifest") / sizeof(RotatingLogSegment);
+        std::cout << "jittered trades over 10 days: " << rotating_log_load_segments(jittered_basepath).size() << " segments, "
+            << manifest_entries << " manifest entries, " << (jittered_count == jittered_n ? "OK" : "KO") << ", in " << 1e3 * jittered_duration << "ms\n";
+    }
+
+    // logs without a manifest are read entirely, and listed by the next writer
+    remove((basepath + ".manifest").c_str());
+    {
+        RotatingLogReader reader(basepath, begin, end);
+        segments_count = reader.get_segments().size();
+    }
+    {
+        RotatingLogWriter writer(basepath, Codec(CODEC_TRADES_ZLIB), 86400, 256, 65536, ROTATING_LOG_BY_TIMESTAMP);
+        writer.append(make_trade(n));
+    }
+    RotatingLogReader reader(basepath, end, INFINITY);
+    count = 0;
+    Trade trade;
+    while (reader.next(trade)) {
+        ++count;
+    }
+    std::cout << "without manifest: " << segments_count << " segments to read, then " << reader.get_segments().size()
+        << " segments and " << count << " trades after the last one\n";
+
+    std::experimental::filesystem::remove_all(directory);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+
+#include "db/RotatingLog.hpp"
+#include "models/Trade.hpp"
+#include "models/TradeSummary.hpp"
+#include "./measure.hpp"
+
+
+// a trade every minute
+static Trade make_trade(const size_t i) {
+    Trade trade;
+    trade.id = i + 1;
+    trade.timestamp = 1500000000. + 60. * i;
+    trade.price = 7000. + 0.01 * ((i * 7) % 1000);
+    trade.volume = 0.001 * (1 + i % 50);
+    trade.type = (i % 3) ? BUY : SELL;
+    return trade;
+}
+
+static const bool is_close(const double a, const double b) {
+    return std::abs(a - b) <= 1e-9 * std::max(std::abs(a), std::abs(b));
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::string directory = "/tmp/cpptrading-rotatinglog_scan";
+    std::experimental::filesystem::remove_all(directory);
+    std::experimental::filesystem::create_directory(directory);
+    const std::string basepath = directory + "/trades";
+    // a year, in daily segments
+    const size_t n = 365 * 24 * 60;
+    {
+        RotatingLogWriter writer(basepath, Codec(CODEC_TRADES_ZLIB), 86400, 256, 65536, ROTATING_LOG_BY_TIMESTAMP);
+        for (size_t i=0; i<n; ++i) {
+            writer.append(make_trade(i));
+        }
+    }
+
+    // the whole archive, serially
+    TradeSummary expected;
+    const double serial_duration = measure([&] {
+        RotatingLogReader reader(basepath);
+        Trade trade;
+        while (reader.next(trade)) {
+            expected += trade;
+        }
+    });
+    std::cout << "serial: " << expected.buys.count + expected.sells.count << " trades in " << serial_duration << "s\n";
+
+    // in parallel
+    for (const size_t threads_count : {1, 2, 4}) {
+        TradeSummary summary;
+        const double duration = measure([&] {
+            RotatingLogReader reader(basepath);
+            summary = reader.scan<Trade, TradeSummary>(
+                [](TradeSummary& summary, const Trade& trade) { summary += trade; },
+                [](TradeSummary& summary, const TradeSummary& other) { summary += other; },
+                TradeSummary(), threads_count
+            );
+        });
+        const size_t errors = (summary.buys.count != expected.buys.count) + (summary.sells.count != expected.sells.count)
+            + !is_close(summary.buys.volume, expected.buys.volume) + !is_close(summary.average_price, expected.average_price)
+            + (summary.timestamp_span.from != expected.timestamp_span.from) + (summary.timestamp_span.to != expected.timestamp_span.to);
+        std::cout << "scan with " << threads_count << " threads: " << errors << " errors in " << duration << "s\n";
+    }
+
+    // filtering, over a period; results keep the order of the records
+    const double begin = 1500000000. + 60. * n / 3;
+    const double end = 1500000000. + 60. * 2 * n / 3;
+    RotatingLogReader reader(basepath, begin, end);
+    const std::vector<Trade> sells = reader.scan<Trade, std::vector<Trade>>(
+        [](std::vector<Trade>& sells, const Trade& trade) {
+            if (trade.type == SELL) {
+                sells.push_back(trade);
+            }
+        },
+        [](std::vector<Trade>& sells, const std::vector<Trade>& other) {
+            sells.insert(sells.end(), other.begin(), other.end());
+        }
+    );
+    size_t errors = 0;
+    size_t expected_count = 0;
+    for (size_t i=0; i<n; ++i) {
+        const Trade trade = make_trade(i);
+        if (trade.type == SELL && (double) trade.timestamp >= begin && (double) trade.timestamp <= end) {
+            errors += expected_count >= sells.size() || !(sells[expected_count] == trade);
+            ++expected_count;
+        }
+    }
+    errors += sells.size() != expected_count;
+    std::cout << "filter: " << sells.size() << " sells from " << reader.get_segments().size() << " segments, " << errors << " errors\n";
+
+    // what map throws is what scan throws, once the workers are done
+    errors = 0;
+    try {
+        reader.scan<Trade, size_t>(
+            [](size_t& count, const Trade& trade) {
+                if (++count == 1000) {
+                    throw std::out_of_range("too many trades");
+                }
+            },
+            [](size_t& count, const size_t& other) {
+                count += other;
+            },
+            0, 4
+        );
+        ++errors;
+    } catch (const std::out_of_range& exception) {
+        errors += std::string(exception.what()) != "too many trades";
+    } catch (...) {
+        ++errors;
+    }
+    std::cout << "failing map: " << errors << " errors\n";
+
+    std::experimental::filesystem::remove_all(directory);
+    return 0;
+}
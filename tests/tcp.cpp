@@ -1,4 +1,8 @@
 #include <iostream>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
 #include "network/TCPServer.hpp"
 #include "network/TCPClient.hpp"
@@ -22,7 +26,36 @@ public:
     }
 
 private:
-    size_t _counter;
+    std::atomic<size_t> _counter;
+};
+
+// keeps its connections, and writes to them from another thread
+class TCPPushHandler : public TCPHandler {
+public:
+
+    virtual bool callback(TCPConnection& connection) {
+        char byte;
+        connection.read(byte);
+        return true;
+    }
+    virtual void on_open(TCPConnection& connection) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _connections.push_back(connection.shared_from_this());
+    }
+    inline void push(const size_t value) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const std::shared_ptr<TCPConnection>& connection : _connections) {
+            connection->write(value);
+        }
+    }
+    inline void release() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _connections.clear();
+    }
+
+private:
+    std::mutex _mutex;
+    std::vector<std::shared_ptr<TCPConnection>> _connections;
 };
 
 
@@ -56,6 +89,69 @@ int main(int argc, char const *argv[]) {
         usleep(100000);
     }
 
+    // many concurrent clients, with requests split across packets
+    const size_t clients_count = 400;
+    std::atomic<size_t> successes(0);
+    std::vector<std::vector<TCPClient*>> clients(8);
+    for (size_t c=0; c<clients_count; ++c) {
+        clients[c % clients.size()].push_back(new TCPClient("127.0.0.1", 7890));
+    }
+    std::vector<std::thread> threads;
+    for (size_t t=0; t<clients.size(); ++t) {
+        threads.push_back(std::thread([&successes, &clients, t] {
+            for (TCPClient* client : clients[t]) {
+                size_t nonce = rand();
+                client->write(&nonce, 3);
+                client->flush();
+                usleep(100);
+                client->write((char*)&nonce + 3, sizeof(nonce) - 3);
+                size_t received_nonce;
+                size_t counter;
+                char continuation;
+                client->read(received_nonce);
+                while (client->read(continuation) && continuation) {
+                    client->read(counter);
+                }
+                if (received_nonce == nonce) {
+                    ++successes;
+                }
+            }
+            for (TCPClient* client : clients[t]) {
+                delete client;
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    usleep(100000);
+    std::cout << "successful clients = " << successes << " / " << clients_count << '\n';
+    std::cout << "remaining connections = " << server.get_connections_count() << '\n';
+
+    // writes from other threads get sent without waiting for input, and
+    // connections outlive their closing as long as they are held
+    {
+        TCPPushHandler push_handler;
+        TCPServer push_server(push_handler, "0.0.0.0", 7892, 1);
+        usleep(100000);
+        size_t received = 0;
+        size_t value;
+        {
+            TCPClient client("127.0.0.1", 7892);
+            usleep(100000);
+            const auto begin = std::chrono::steady_clock::now();
+            push_handler.push(42);
+            client.read(value);
+            const double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            received += (value == 42);
+            std::cout << "pushed value = " << value << " in " << 1e3 * latency << "ms\n";
+        }
+        usleep(100000);
+        push_handler.push(43);
+        std::cout << "connections after closing = " << push_server.get_connections_count() << '\n';
+        push_handler.release();
+    }
+
     // getchar();
     return 0;
 }
@@ -0,0 +1,112 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+
+#include <zlib.h>
+
+#include "db/TradeCodec.hpp"
+#include "./measure.hpp"
+
+
+// as received from an exchange: ids with gaps, timestamps to the
+// millisecond, prices moving by a few cents, volumes to the satoshi
+static std::vector<Trade> make_trades(const size_t count) {
+    const Trade prototype;
+    std::mt19937 random(42);
+    std::vector<Trade> trades(count, prototype);
+    uint64_t id = 80000000;
+    int64_t milliseconds = 1500000000000;
+    int64_t cents = 700000;
+    uint64_t order_id = 2000000000;
+    for (Trade& trade : trades) {
+        id += 1 + random() % 3;
+        milliseconds += random() % 2000;
+        cents += (int) (random() % 11) - 5;
+        order_id += random() % 50;
+        trade.id = id;
+        trade.timestamp = milliseconds / 1e3;
+        trade.price = cents / 1e2;
+        trade.volume = (1 + random() % 100000000) / 1e8;
+        trade.type = (random() % 2) ? BUY : SELL;
+        trade.decision_id = 0;
+        trade.buy_order_id = order_id + random() % 100;
+        trade.sell_order_id = order_id + random() % 100;
+    }
+    return trades;
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::vector<Trade> trades = make_trades(1000000);
+    // blocks of about 64 KiB, as in BlockLog
+    const size_t block_count = 65536 / sizeof(Trade) + 1;
+    const size_t n = trades.size() - trades.size() % block_count;
+    const size_t raw_size = n * sizeof(Trade);
+
+    // zlib alone
+    std::vector<std::string> zlib_blocks;
+    const double zlib_encode_duration = measure([&] {
+        for (size_t i=0; i<n; i+=block_count) {
+            uLongf size = compressBound(block_count * sizeof(Trade));
+            std::string block(size, 0);
+            compress2((Bytef*) &block[0], &size, (const Bytef*) &trades[i], block_count * sizeof(Trade), Z_DEFAULT_COMPRESSION);
+            block.resize(size);
+            zlib_blocks.push_back(block);
+        }
+    });
+    size_t zlib_size = 0;
+    for (const std::string& block : zlib_blocks) {
+        zlib_size += block.size();
+    }
+    std::string output(block_count * sizeof(Trade), 0);
+    const double zlib_decode_duration = measure([&] {
+        for (const std::string& block : zlib_blocks) {
+            uLongf size = output.size();
+            uncompress((Bytef*) &output[0], &size, (const Bytef*) block.data(), block.size());
+        }
+    });
+
+    // the trade codec
+    std::vector<std::string> codec_blocks;
+    const double codec_encode_duration = measure([&] {
+        for (size_t i=0; i<n; i+=block_count) {
+            std::string block;
+            TradeCodec::encode((const char*) &trades[i], block_count * sizeof(Trade), block);
+            codec_blocks.push_back(block);
+        }
+    });
+    size_t codec_size = 0;
+    for (const std::string& block : codec_blocks) {
+        codec_size += block.size();
+    }
+    size_t errors = 0;
+    const double codec_decode_duration = measure([&] {
+        for (const std::string& block : codec_blocks) {
+            TradeCodec::decode(block.data(), block.size(), output);
+        }
+    });
+    for (size_t b=0; b<codec_blocks.size(); ++b) {
+        TradeCodec::decode(codec_blocks[b].data(), codec_blocks[b].size(), output);
+        errors += output.size() != block_count * sizeof(Trade) || memcmp(output.data(), &trades[b * block_count], output.size()) != 0;
+    }
+
+    // values that are not decimals, and odd types
+    std::vector<Trade> odd_trades = make_trades(1000);
+    std::mt19937_64 random(0);
+    for (Trade& trade : odd_trades) {
+        trade.price = std::sqrt((double) (random() % 1000000));
+        trade.timestamp = NAN;
+        trade.type = (ActionType) (random() % 7);
+    }
+    std::string odd_block;
+    TradeCodec::encode((const char*) odd_trades.data(), odd_trades.size() * sizeof(Trade), odd_block);
+    TradeCodec::decode(odd_block.data(), odd_block.size(), output);
+    errors += memcmp(output.data(), odd_trades.data(), output.size()) != 0;
+
+    std::cout << n << " trades, " << raw_size << " bytes, " << errors << " errors\n";
+    std::cout << "zlib: ratio " << (double) raw_size / zlib_size << ", encode " << raw_size / zlib_encode_duration / 1e6
+        << "MB/s, decode " << raw_size / zlib_decode_duration / 1e6 << "MB/s\n";
+    std::cout << "trade codec: ratio " << (double) raw_size / codec_size << ", encode " << raw_size / codec_encode_duration / 1e6
+        << "MB/s, decode " << raw_size / codec_decode_duration / 1e6 << "MB/s\n";
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#include "db/UpscaleBTree.hpp"
+#include "models/Trade.hpp"
+#include "./measure.hpp"
+
+
+// a trade every second
+static Trade make_trade(const size_t i) {
+    Trade trade;
+    trade.id = i + 1;
+    trade.timestamp = 1500000000. + i;
+    trade.price = 7000. + 0.01 * ((i * 7) % 1000);
+    trade.volume = 0.001 * (1 + i % 50);
+    trade.type = (i % 3) ? BUY : SELL;
+    return trade;
+}
+
+
+int main(int argc, char const *argv[]) {
+    const std::string directory = "/tmp/cpptrading-upscalebtree_snapshots";
+    std::experimental::filesystem::remove_all(directory);
+    const size_t n = 100000;
+    const double first = 1500000000.;
+    std::unique_ptr<UpscaleBTree<double, Trade>> btree(new UpscaleBTree<double, Trade>(directory + "/trades"));
+    for (size_t i=0; i<n; ++i) {
+        Trade trade = make_trade(i);
+        btree->insert(trade.timestamp, trade);
+    }
+
+    // ranges of a minute, from several threads, with batches of records
+    size_t errors = 0;
+    const size_t queries = 10000;
+    for (const size_t threads_count : {1, 4}) {
+        std::atomic<size_t> threads_errors(0);
+        const double duration = measure([&] {
+            std::vector<std::thread> threads;
+            for (size_t t=0; t<threads_count; ++t) {
+                threads.emplace_back([&, t] {
+                    for (size_t q=t; q<queries; q+=threads_count) {
+                        const double begin = first + (q * 7919) % (n - 60);
+                        size_t count = 0;
+                        for (const Trade& trade : btree->get(begin, begin + 60.)) {
+                            threads_errors += !(trade == make_trade(begin - first + 1 + count));
+                            ++count;
+                        }
+                        threads_errors += count != 60;
+                    }
+                });
+            }
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+        });
+        std::cout << "ranges of a minute with " << threads_count << " threads: " << 1e6 * duration / queries
+            << "us each, " << threads_errors << " errors\n";
+    }
+
+    // readers see new trades, unless they hold a former snapshot
+    std::shared_ptr<UpscaleBTreeSnapshot> snapshot = btree->get_snapshot();
+    errors = 0;
+    for (size_t i=n; i<n+1000; ++i) {
+        Trade trade = make_trade(i);
+        btree->insert(trade.timestamp, trade);
+        errors += !btree->contains(trade.timestamp) || btree->get_highest_key() != trade.timestamp;
+    }
+    size_t count = 0;
+    for (const Trade& trade : btree->get(snapshot, first + n - 10., first + n + 10.)) {
+        ++count;
+    }
+    std::cout << "fresh reads: " << errors << " errors; held snapshot: " << count << " trades after its last one\n";
+
+    // concurrent writer & readers
+    std::atomic<bool> is_writing(true);
+    std::atomic<size_t> reads(0);
+    std::atomic<size_t> read_errors(0);
+    std::thread writer([&] {
+        for (size_t i=n+1000; i<n+11000; ++i) {
+            Trade trade = make_trade(i);
+            btree->insert(trade.timestamp, trade);
+        }
+        is_writing = false;
+    });
+    std::vector<std::thread> readers;
+    for (size_t t=0; t<4; ++t) {
+        readers.emplace_back([&] {
+            while (is_writing) {
+                const double highest = btree->get_highest_key();
+                size_t count = 0;
+                for (const Trade& trade : btree->get(highest - 100., highest)) {
+                    ++count;
+                }
+                read_errors += count != 100;
+                ++reads;
+            }
+        });
+    }
+    writer.join();
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    std::cout << "concurrent writes: " << reads << " reads, " << read_errors << " errors\n";
+
+    // conflicts are retried with a growing delay; the end of a range is not an error
+    size_t attempts = 0;
+    const ups_status_t status = UPS_STATUS_CALL([&attempts] {
+        return (++attempts <= 20) ? UPS_TXN_CONFLICT : UPS_SUCCESS;
+    });
+    const UpscaleDBMetrics metrics = get_upscaledb_metrics();
+    errors = (status != UPS_SUCCESS) + (attempts != 21) + (metrics.conflicted_calls != 1) + (metrics.conflicts != 20);
+    std::cout << "conflicts: " << metrics.conflicts << " retries in " << 1e3 * metrics.backoff_duration << "ms, "
+        << errors << " errors\n";
+    const double end_duration = measure([&] {
+        for (size_t q=0; q<queries; ++q) {
+            for (const Trade& trade : btree->get(first + n + 20000., first + n + 30000.)) {
+                ++errors;
+            }
+        }
+    });
+    std::cout << "ranges past the end: " << 1e6 * end_duration / queries << "us each, " << errors << " errors\n";
+
+    snapshot.reset();
+    btree.reset();
+    std::experimental::filesystem::remove_all(directory);
+    return 0;
+}
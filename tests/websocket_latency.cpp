@@ -0,0 +1,226 @@
+#include "network/WebSocketClient.hpp"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <vector>
+#include <algorithm>
+
+
+static const size_t ticks_count = 20000;
+static const size_t large_size = 200000;
+
+static inline const int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// unmasked frame, as sent by a server
+static const std::string make_frame(const uint8_t opcode, const std::string& payload, const bool fin=true) {
+    std::string frame;
+    frame += (char) ((fin ? 0x80 : 0) | opcode);
+    if (payload.size() < 126) {
+        frame += (char) payload.size();
+    } else if (payload.size() < 65536) {
+        frame += (char) 126;
+        frame += (char) (payload.size() >> 8);
+        frame += (char) payload.size();
+    } else {
+        frame += (char) 127;
+        for (int shift=56; shift>=0; shift-=8) {
+            frame += (char) (payload.size() >> shift);
+        }
+    }
+    return frame + payload;
+}
+
+static void send_all(const int sock, const std::string& data) {
+    for (size_t sent=0; sent<data.size(); ) {
+        const ssize_t result = ::send(sock, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            return;
+        }
+        sent += result;
+    }
+}
+
+
+// minimal websocket server: accepts one client, then sends timestamped ticks
+// along with a few frames exercising the parser (or just an oversized frame)
+class TickServer {
+public:
+
+    inline TickServer(const bool is_oversized=false) :
+        _is_oversized(is_oversized) {
+        _listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(_listener, (sockaddr*) &address, sizeof(address));
+        socklen_t length = sizeof(address);
+        getsockname(_listener, (sockaddr*) &address, &length);
+        _port = ntohs(address.sin_port);
+        listen(_listener, 1);
+        _thread = std::thread(&TickServer::serve, this);
+    }
+    inline ~TickServer() {
+        _thread.join();
+        close(_listener);
+    }
+    inline const std::string get_url() const {
+        return "ws://127.0.0.1:" + std::to_string(_port) + "/";
+    }
+
+private:
+
+    inline void serve() {
+        const int sock = accept(_listener, NULL, NULL);
+        const int flag = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        std::string request;
+        char c;
+        while (request.size() < 4 || request.compare(request.size() - 4, 4, "\r\n\r\n") != 0) {
+            if (recv(sock, &c, 1, 0) != 1) {
+                close(sock);
+                return;
+            }
+            request += c;
+        }
+        send_all(sock, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n");
+        if (_is_oversized) {
+            std::string header = "\x82\x7f";
+            for (int shift=56; shift>=0; shift-=8) {
+                header += (char) ((1ULL << 40) >> shift);
+            }
+            send_all(sock, header);
+            while (recv(sock, &c, 1, 0) > 0);
+            close(sock);
+            return;
+        }
+        // fragmented, large, and control frames
+        send_all(sock, make_frame(0x1, "frag", false) + make_frame(0x9, "ping") + make_frame(0x0, "mented", false) + make_frame(0x0, "!", true));
+        send_all(sock, make_frame(0x2, std::string(large_size, 'x')));
+        // ticks
+        for (size_t i=0; i<ticks_count; ++i) {
+            const int64_t timestamp = now();
+            send_all(sock, make_frame(0x2, std::string((const char*) &timestamp, sizeof(timestamp))));
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+        send_all(sock, make_frame(0x8, ""));
+        // wait for the client to close
+        while (recv(sock, &c, 1, 0) > 0);
+        close(sock);
+    }
+
+    const bool _is_oversized;
+    int _listener;
+    int _port;
+    std::thread _thread;
+};
+
+
+static void show_latencies(const std::string& label, std::vector<int64_t>& latencies) {
+    if (latencies.empty()) {
+        std::cout << label << ": no tick received\n";
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << label << ": " << latencies.size() << " ticks"
+        << ", p50=" << latencies[latencies.size() * 50 / 100] / 1e3 << "us"
+        << ", p99=" << latencies[latencies.size() * 99 / 100] / 1e3 << "us"
+        << ", p99.9=" << latencies[latencies.size() * 999 / 1000] / 1e3 << "us"
+        << ", max=" << latencies.back() / 1e3 << "us\n";
+}
+
+
+class TickClient : public WebSocketClient {
+public:
+
+    inline TickClient(const std::string& url) :
+        WebSocketClient(url),
+        is_fragmented_ok(false),
+        is_large_ok(false),
+        is_closed(false) {
+        latencies.reserve(ticks_count);
+    }
+
+    virtual void callback(const char* data, const size_t size) {
+        if (size == sizeof(int64_t)) {
+            latencies.push_back(now() - * (const int64_t*) data);
+            if (latencies.size() == ticks_count) {
+                is_closed = true;
+            }
+        } else if (size == large_size) {
+            is_large_ok = std::count(data, data + size, 'x') == large_size;
+        } else {
+            is_fragmented_ok = std::string(data, size) == "fragmented!";
+        }
+    }
+
+    std::vector<int64_t> latencies;
+    bool is_fragmented_ok;
+    bool is_large_ok;
+    std::atomic<bool> is_closed;
+};
+
+
+static void test_client(const std::string& label, const int busy_poll, const int cpu) {
+    TickServer server;
+    TickClient client(server.get_url());
+    client.set_busy_poll(busy_poll);
+    client.set_cpu(cpu);
+    client.start();
+    while (!client.is_closed) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    client.stop();
+    std::cout << label << ": fragmented message " << (client.is_fragmented_ok ? "OK" : "KO")
+        << ", large message " << (client.is_large_ok ? "OK" : "KO") << '\n';
+    show_latencies(label, client.latencies);
+}
+
+// a terabyte frame is refused instead of allocated
+static void test_oversized_frame() {
+    TickServer server(true);
+    TickClient client(server.get_url());
+    client.start();
+    for (size_t i=0; i<100 && client.is_running(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::cout << "oversized frame: " << (client.is_running() ? "KO" : "connection closed") << '\n';
+    client.stop();
+}
+
+// the former receiving loop, for comparison
+static void test_easywsclient() {
+    TickServer server;
+    easywsclient::WebSocket::pointer ws = easywsclient::WebSocket::from_url(server.get_url());
+    std::vector<int64_t> latencies;
+    latencies.reserve(ticks_count);
+    while (ws->getReadyState() != easywsclient::WebSocket::CLOSED && latencies.size() < ticks_count) {
+        ws->poll(1);
+        ws->dispatchBinary([&latencies](const std::vector<uint8_t>& message) {
+            if (message.size() == sizeof(int64_t)) {
+                latencies.push_back(now() - * (const int64_t*) message.data());
+            }
+        });
+    }
+    ws->close();
+    ws->poll();
+    delete ws;
+    show_latencies("easywsclient poll(1)", latencies);
+}
+
+
+int main(int argc, char const *argv[]) {
+    test_easywsclient();
+    test_client("WebSocketClient", 0, -1);
+    // spinning only pays off with a core to spare
+    if (std::thread::hardware_concurrency() > 1) {
+        test_client("WebSocketClient busy-poll", 50, 1);
+    } else {
+        std::cout << "WebSocketClient busy-poll: skipped on a single CPU\n";
+    }
+    test_oversized_frame();
+    return 0;
+}